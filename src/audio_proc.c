@@ -0,0 +1,361 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "audio_proc.h"
+
+#define STAGE_AGC 0
+#define STAGE_COMPRESSOR 1
+#define STAGE_PREEMPH 2
+#define STAGE_LIMITER 3
+
+// Gain computer and limiter granularity, in frames
+#define SUB_BLOCK 32
+
+// AGC: brings the long term level to the target, gated so that pauses do
+// not pump the gain up
+#define AGC_TARGET -18.0f               // dBFS RMS
+#define AGC_MIN -10.0f                  // dB
+#define AGC_MAX 12.0f
+#define AGC_GATE -50.0f                 // dBFS RMS
+#define AGC_TIME 3.0f                   // s
+
+#define CROSSOVER_LOW 250.0
+#define CROSSOVER_HIGH 4000.0
+
+// Highest pre-emphasis boost, the shelf stops rising here
+#define PREEMPH_CORNER 20000.0
+
+// Leave a little room for the resampler's overshoot
+#define LIMITER_CEILING 0.944f          // -0.5 dBFS
+#define LIMITER_RELEASE 0.05f           // s
+
+// Keeps the filter states out of denormals in silence
+#define ANTI_DENORMAL 1e-18f
+
+static const char *stage_names[PROC_STAGES] = { "agc", "compressor", "preemphasis", "limiter" };
+
+static const struct {
+	float threshold, ratio, makeup, attack, release;
+} band_settings[PROC_BANDS] = {
+	{ -24, 3.0, 4, 0.020, 0.300 },  // low
+	{ -22, 2.5, 3, 0.010, 0.200 },  // mid
+	{ -26, 2.5, 4, 0.005, 0.150 },  // high
+};
+
+static inline float db_to_lin(float db)
+{
+	return expf(db * 0.11512925f);
+}
+
+static inline float lin_to_db(float lin)
+{
+	return 8.6858896f * logf(lin + 1e-9f);
+}
+
+static double now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// First order shelf (1 + s tau) / (1 + s / wp). The bilinear transform
+// squeezes the zero towards Nyquist and overshoots by 1.5 dB at 10 kHz
+// from 44.1 kHz, so the zero is matched instead, at exp(-1 / tau rate),
+// and the pole is placed to hit the analog magnitude exactly at rate / 4,
+// where |1 - c z^-1|^2 is simply 1 + c^2. Unity gain at DC.
+static void preemph_design(struct biquad4 *bq, int lane, double tau, double rate)
+{
+	double corner = PREEMPH_CORNER < 0.45 * rate ? PREEMPH_CORNER : 0.45 * rate;
+	double w = M_PI / 2 * rate;
+	double target = (1 + w * w * tau * tau) / (1 + w * w / (4 * M_PI * M_PI * corner * corner));
+	double zero = exp(-1 / (tau * rate));
+	double x = 1 - target * (1 - zero) * (1 - zero) / (1 + zero * zero);
+	double pole;
+
+	// (1 - pole)^2 / (1 + pole^2) has to equal 1 - x
+	x = x > 1 ? 1 : x < -1 ? -1 : x;
+	pole = x / (1 + sqrt(1 - x * x));
+
+	biquad4_set(bq, lane, (1 - pole) / (1 - zero), -zero * (1 - pole) / (1 - zero), 0, 1, -pole, 0);
+}
+
+int audio_proc_init(struct audio_proc *ap, int rate, int channels, int profile, int preemph) {
+	memset(ap, 0, sizeof(struct audio_proc));
+	if (channels < 1 || channels > 2)
+		return -1;
+
+	ap->rate = rate;
+	ap->channels = channels;
+	ap->profile = profile;
+	ap->preemph = preemph;
+	if (profile == PROC_OFF && preemph == 0)
+		return 0;
+
+	ap->delay = calloc(2 * SUB_BLOCK * channels, sizeof(float));
+	for (int i = 0; i < 3; i++)
+		ap->lanes[i] = aligned_alloc(16, PROC_MAX_FRAMES * 4 * sizeof(float));
+	if (!ap->delay || !ap->lanes[0] || !ap->lanes[1] || !ap->lanes[2]) {
+		audio_proc_free(ap);
+		return -1;
+	}
+
+	ap->agc_coef = 1 - expf(-1.0f / (rate * AGC_TIME));
+
+	// Lanes are channel 0 and 1 of the lower band, then of the upper band
+	for (int l = 0; l < 4; l++) {
+		for (int s = 0; s < 2; s++) {
+			biquad4_design(&ap->split_low[s], l, l < 2 ? BQ_LOWPASS : BQ_HIGHPASS, CROSSOVER_LOW, M_SQRT1_2, rate);
+			biquad4_design(&ap->split_high[s], l, l < 2 ? BQ_LOWPASS : BQ_HIGHPASS, CROSSOVER_HIGH, M_SQRT1_2, rate);
+		}
+		// An LR4 low plus high pass adds up to this allpass
+		biquad4_design(&ap->low_allpass, l, BQ_ALLPASS, CROSSOVER_HIGH, M_SQRT1_2, rate);
+		if (preemph)
+			preemph_design(&ap->preemph_filter, l, preemph * 1e-6, rate);
+	}
+
+	for (int b = 0; b < PROC_BANDS; b++) {
+		ap->band[b].threshold = band_settings[b].threshold;
+		ap->band[b].ratio = band_settings[b].ratio;
+		ap->band[b].makeup = band_settings[b].makeup;
+		ap->band[b].attack = 1 - expf(-SUB_BLOCK / (rate * band_settings[b].attack));
+		ap->band[b].release = 1 - expf(-SUB_BLOCK / (rate * band_settings[b].release));
+		ap->band[b].env = -100;
+		ap->band[b].gain = db_to_lin(band_settings[b].makeup);
+	}
+
+	ap->ceiling = LIMITER_CEILING;
+	ap->release = 1 - expf(-SUB_BLOCK / (rate * LIMITER_RELEASE));
+	ap->gain = 1;
+	ap->gain_target = 1;
+
+	return 0;
+}
+
+// Long term gain riding on the block RMS, ramped across the block
+static void agc(struct audio_proc *ap, float *x, int len)
+{
+	int n = len * ap->channels;
+	float sum = 0;
+
+	for (int i = 0; i < n; i++)
+		sum += x[i] * x[i];
+
+	float level = lin_to_db(sqrtf(sum / n));
+	float start = db_to_lin(ap->agc_gain);
+
+	if (level > AGC_GATE) {
+		float target = AGC_TARGET - level;
+		float coef = 1 - powf(1 - ap->agc_coef, len);
+
+		if (target < AGC_MIN)
+			target = AGC_MIN;
+		if (target > AGC_MAX)
+			target = AGC_MAX;
+		ap->agc_gain += (target - ap->agc_gain) * coef;
+	}
+
+	float gain = start, step = (db_to_lin(ap->agc_gain) - start) / len;
+
+	for (int i = 0; i < len; i++) {
+		gain += step;
+		for (int c = 0; c < ap->channels; c++)
+			x[i * ap->channels + c] *= gain;
+	}
+}
+
+// Gain for one band over the next sub-block, from its peak level
+static float band_gain(struct compressor *comp, float peak)
+{
+	float level = lin_to_db(peak);
+
+	comp->env += (level - comp->env) * (level > comp->env ? comp->attack : comp->release);
+
+	float over = comp->env - comp->threshold;
+
+	return db_to_lin(comp->makeup - (over > 0 ? over * (1 - 1 / comp->ratio) : 0));
+}
+
+static void compressor(struct audio_proc *ap, float *x, int len)
+{
+	int channels = ap->channels;
+	float *in = ap->lanes[0], *lo = ap->lanes[1], *hi = ap->lanes[2];
+
+	// Split off the low band: lo holds low and the rest, per channel
+	for (int i = 0; i < len; i++) {
+		float l = x[i * channels] + ANTI_DENORMAL;
+		float r = (channels == 2) ? x[i * channels + 1] + ANTI_DENORMAL : 0;
+
+		in[4 * i] = in[4 * i + 2] = l;
+		in[4 * i + 1] = in[4 * i + 3] = r;
+	}
+	biquad4_run(&ap->split_low[0], in, lo, len);
+	biquad4_run(&ap->split_low[1], lo, lo, len);
+
+	// Split the rest into mid and high, and put the low band through the
+	// matching allpass
+	for (int i = 0; i < len; i++) {
+		hi[4 * i] = hi[4 * i + 2] = lo[4 * i + 2];
+		hi[4 * i + 1] = hi[4 * i + 3] = lo[4 * i + 3];
+		lo[4 * i + 2] = lo[4 * i + 3] = 0;
+	}
+	biquad4_run(&ap->split_high[0], hi, hi, len);
+	biquad4_run(&ap->split_high[1], hi, hi, len);
+	biquad4_run(&ap->low_allpass, lo, lo, len);
+
+	for (int start = 0; start < len; start += SUB_BLOCK) {
+		int n = (len - start < SUB_BLOCK) ? len - start : SUB_BLOCK;
+		float peak[PROC_BANDS] = { 0 }, gain[PROC_BANDS], step[PROC_BANDS];
+
+		for (int i = start; i < start + n; i++) {
+			for (int c = 0; c < channels; c++) {
+				peak[0] = fmaxf(peak[0], fabsf(lo[4 * i + c]));
+				peak[1] = fmaxf(peak[1], fabsf(hi[4 * i + c]));
+				peak[2] = fmaxf(peak[2], fabsf(hi[4 * i + 2 + c]));
+			}
+		}
+		for (int b = 0; b < PROC_BANDS; b++) {
+			float target = band_gain(&ap->band[b], peak[b]);
+
+			gain[b] = ap->band[b].gain;
+			step[b] = (target - gain[b]) / n;
+			ap->band[b].gain = target;
+		}
+
+		for (int i = start; i < start + n; i++) {
+			for (int b = 0; b < PROC_BANDS; b++)
+				gain[b] += step[b];
+			for (int c = 0; c < channels; c++)
+				x[i * channels + c] = gain[0] * lo[4 * i + c] + gain[1] * hi[4 * i + c] + gain[2] * hi[4 * i + 2 + c];
+		}
+	}
+}
+
+static void preemphasis(struct audio_proc *ap, float *x, int len)
+{
+	int channels = ap->channels;
+	float *lanes = ap->lanes[0];
+
+	for (int i = 0; i < len; i++) {
+		lanes[4 * i] = x[i * channels] + ANTI_DENORMAL;
+		lanes[4 * i + 1] = (channels == 2) ? x[i * channels + 1] + ANTI_DENORMAL : 0;
+		lanes[4 * i + 2] = lanes[4 * i + 3] = 0;
+	}
+	biquad4_run(&ap->preemph_filter, lanes, lanes, len);
+	for (int i = 0; i < len; i++) {
+		for (int c = 0; c < channels; c++)
+			x[i * channels + c] = lanes[4 * i + c];
+	}
+}
+
+// Look-ahead peak limiter. Audio is delayed by two sub-blocks, so when a
+// sub-block leaves the delay line the peaks of it and of the one after it
+// are known. The gain ramps linearly across the sub-block to a value no
+// higher than either needs, which keeps every sample under the ceiling
+// without clipping.
+static void limiter(struct audio_proc *ap, float *x, int len)
+{
+	int channels = ap->channels;
+
+	for (int i = 0; i < len; i++) {
+		float *d = ap->delay + ap->delay_pos * channels;
+
+		for (int c = 0; c < channels; c++) {
+			float in = x[i * channels + c];
+
+			ap->peak[1] = fmaxf(ap->peak[1], fabsf(in));
+			x[i * channels + c] = d[c] * ap->gain;
+			d[c] = in;
+		}
+		ap->gain += ap->gain_step;
+		if (++ap->delay_pos == 2 * SUB_BLOCK)
+			ap->delay_pos = 0;
+
+		if (++ap->fill == SUB_BLOCK) {
+			// Land exactly on the end of the ramp, without rounding drift
+			ap->gain = ap->gain_target;
+
+			float target = ap->gain + (1 - ap->gain) * ap->release;
+
+			for (int k = 0; k < 2; k++) {
+				if (ap->peak[k] * target > ap->ceiling)
+					target = ap->ceiling / ap->peak[k];
+			}
+			ap->gain_step = (target - ap->gain) / SUB_BLOCK;
+			ap->gain_target = target;
+			ap->peak[0] = ap->peak[1];
+			ap->peak[1] = 0;
+			ap->fill = 0;
+		}
+	}
+}
+
+int audio_proc_stage_enabled(struct audio_proc *ap, int stage) {
+	switch (stage) {
+	case STAGE_AGC:
+		return ap->profile != PROC_OFF;
+	case STAGE_COMPRESSOR:
+		return ap->profile == PROC_FULL;
+	case STAGE_PREEMPH:
+		return ap->preemph != 0;
+	default:
+		// Whenever anything else is on, to catch the peaks it makes
+		return ap->delay != NULL;
+	}
+}
+
+void audio_proc_run(struct audio_proc *ap, float *frames, int len) {
+	static void (*const stages[PROC_STAGES])(struct audio_proc *, float *, int) = {
+		agc, compressor, preemphasis, limiter
+	};
+
+	if (ap->delay == NULL || len <= 0)
+		return;
+
+	for (int s = 0; s < PROC_STAGES; s++) {
+		if (!audio_proc_stage_enabled(ap, s))
+			continue;
+
+		double start = now_ns();
+		stages[s](ap, frames, len);
+		ap->stage_ns[s] += now_ns() - start;
+	}
+	ap->frames += len;
+}
+
+const char *audio_proc_stage_name(int stage) {
+	return stage_names[stage];
+}
+
+void audio_proc_report(struct audio_proc *ap) {
+	if (ap->frames == 0)
+		return;
+
+	printf("Audio processing at %d Hz:", ap->rate);
+	for (int s = 0; s < PROC_STAGES; s++) {
+		double ns = (double)ap->stage_ns[s] / ap->frames;
+
+		if (audio_proc_stage_enabled(ap, s))
+			printf(" %s %.1f ns/frame (%.2f%% CPU)", stage_names[s], ns, ns * ap->rate / 1e7);
+	}
+	printf("\n");
+}
+
+void audio_proc_free(struct audio_proc *ap) {
+	free(ap->delay);
+	ap->delay = NULL;
+	for (int i = 0; i < 3; i++) {
+		free(ap->lanes[i]);
+		ap->lanes[i] = NULL;
+	}
+}
@@ -0,0 +1,82 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef AUDIO_PROC_H
+#define AUDIO_PROC_H
+
+#include <stdint.h>
+#include "biquad.h"
+
+// Processing profiles
+#define PROC_OFF 0
+#define PROC_LIGHT 1                    // AGC and limiter
+#define PROC_FULL 2                     // AGC, three band compressor and limiter
+
+#define PROC_STAGES 4
+#define PROC_BANDS 3
+
+// Longest block audio_proc_run() accepts, in frames
+#define PROC_MAX_FRAMES 4096
+
+struct compressor {
+	float threshold;                // dB
+	float ratio;
+	float makeup;                   // dB
+	float attack;                   // per sub-block smoothing coefficients
+	float release;
+	float env;                      // dB
+	float gain;                     // linear, at the end of the last sub-block
+};
+
+// Broadcast processing at the input rate, before resampling: slow AGC, a
+// three band compressor, pre-emphasis and a look-ahead peak limiter, in
+// that order. Everything is allocated by audio_proc_init(); processing
+// itself never allocates.
+struct audio_proc {
+	int channels;
+	int rate;
+	int profile;
+	int preemph;                    // time constant in us, 0 for none
+
+	// AGC
+	float agc_gain;                 // dB
+	float agc_coef;
+
+	// Compressor: two LR4 crossovers and an allpass keeping the low band
+	// in phase with the other two
+	struct biquad4 split_low[2];
+	struct biquad4 split_high[2];
+	struct biquad4 low_allpass;
+	struct compressor band[PROC_BANDS];
+
+	struct biquad4 preemph_filter;
+
+	// Limiter, with a delay line of two sub-blocks
+	float ceiling;
+	float release;
+	float *delay;
+	int delay_pos;
+	int fill;                       // frames into the sub-block being collected
+	float peak[2];                  // previous and current sub-block
+	float gain;
+	float gain_step;
+	float gain_target;              // where the ramp ends, at the next sub-block
+
+	float *lanes[3];                // scratch, PROC_MAX_FRAMES * 4 each
+
+	uint64_t stage_ns[PROC_STAGES];
+	uint64_t frames;
+};
+
+extern int audio_proc_init(struct audio_proc *ap, int rate, int channels, int profile, int preemph);
+extern void audio_proc_run(struct audio_proc *ap, float *frames, int len);
+extern void audio_proc_report(struct audio_proc *ap);
+extern void audio_proc_free(struct audio_proc *ap);
+extern int audio_proc_stage_enabled(struct audio_proc *ap, int stage);
+extern const char *audio_proc_stage_name(int stage);
+
+#endif
@@ -0,0 +1,2420 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <samplerate.h>
+
+#include "fm_mpx.h"
+#include "resampler.h"
+#include "mpx_gen.h"
+#include "rds.h"
+#include "freq.h"
+#include "audio_proc.h"
+#include "clipper.h"
+#include "net_audio.h"
+#include "playlist.h"
+#include "tune.h"
+#include "dma_ring.h"
+#include "trace.h"
+#include "drift.h"
+#include "latency.h"
+#include "cache.h"
+#include "siggen.h"
+#include "bench.h"
+
+// Offline benchmarks of the baseband pipeline stages. Everything runs on
+// synthetic signals in memory, so the numbers are free of disk and decoder
+// noise and comparable between boards.
+
+#define BENCH_SECONDS 10
+
+// PLLA_FRAC steps per kHz for the pipeline benchmark: a 1 GHz VCO divided
+// by 10 for 100 MHz, with the 19.2 MHz crystal
+#define BENCH_STEPS_PER_KHZ (10 * 1000 / (19.2e6 / (1 << 20)))
+#define BENCH_DEVIATION 75
+
+static double cpu_time()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sine(sample_t *buf, int len, int channels, double freq, double rate, float level)
+{
+	for (int i = 0; i < len; i++) {
+		for (int c = 0; c < channels; c++)
+			buf[i * channels + c] = sample_from_float(level * sin(2 * M_PI * freq * i / rate));
+	}
+}
+
+static void to_float(float *out, const sample_t *in, long len)
+{
+	for (long i = 0; i < len; i++)
+		out[i] = sample_to_float(in[i]);
+}
+
+// Fit a sine at freq to the signal and report the ratio of its power to
+// everything else, in dB
+static double purity(const float *y, int len, double freq, double rate)
+{
+	double a = 0, b = 0, residual = 0;
+
+	for (int i = 0; i < len; i++) {
+		a += y[i] * sin(2 * M_PI * freq * i / rate);
+		b += y[i] * cos(2 * M_PI * freq * i / rate);
+	}
+	a *= 2.0 / len;
+	b *= 2.0 / len;
+
+	for (int i = 0; i < len; i++) {
+		double e = y[i] - a * sin(2 * M_PI * freq * i / rate) - b * cos(2 * M_PI * freq * i / rate);
+		residual += e * e;
+	}
+
+	return 10 * log10((a * a + b * b) / 2 / (residual / len));
+}
+
+// Current clock of the first core in Hz, 0 if the kernel does not say
+static double cpu_hz()
+{
+	FILE *f = fopen("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", "r");
+	double khz = 0;
+
+	if (f) {
+		if (fscanf(f, "%lf", &khz) != 1)
+			khz = 0;
+		fclose(f);
+	}
+
+	return khz * 1e3;
+}
+
+static void report_at(char *stage, char *variant, double seconds, long samples, double quality, int rate)
+{
+	double ns = seconds * 1e9 / samples;
+
+	printf("  %-12s %-10s %8.1f ns/sample %7.2f%% CPU at %d Hz",
+		stage, variant, ns, ns * rate / 1e7, rate);
+	if (!isnan(quality))
+		printf("  %6.1f dB", quality);
+	printf("\n");
+}
+
+static void report(char *stage, char *variant, double seconds, long samples, double quality)
+{
+	report_at(stage, variant, seconds, samples, quality, MPX_SAMPLE_RATE);
+}
+
+static int bench_resampler()
+{
+	int rates[] = { 32000, 44100, 48000 };
+	char *names[] = { "poly", "zoh", "sinc" };
+	double tone = 5000;
+
+	printf("Resampler: %.0f Hz tone, %d s of input, purity is tone to residual power\n", tone, BENCH_SECONDS);
+
+	for (int r = 0; r < 3; r++) {
+		int in_len = rates[r] * BENCH_SECONDS;
+		long out_cap = (long)in_len * MPX_SAMPLE_RATE / rates[r] + DATA_SIZE * 16;
+		double ratio = (double)MPX_SAMPLE_RATE / rates[r];
+		sample_t *in = malloc(in_len * sizeof(sample_t));
+		sample_t *poly_out = malloc(out_cap * sizeof(sample_t));
+		float *src_in = malloc(in_len * sizeof(float));
+		float *out = malloc(out_cap * sizeof(float));
+		char label[16];
+
+		if (!in || !poly_out || !src_in || !out) {
+			free(in);
+			free(poly_out);
+			free(src_in);
+			free(out);
+			return -1;
+		}
+		sine(in, in_len, 1, tone, rates[r], 0.5);
+		to_float(src_in, in, in_len);
+		snprintf(label, sizeof(label), "%d Hz", rates[r]);
+
+		for (int m = 0; m < 3; m++) {
+			long produced = 0;
+			double start = cpu_time();
+
+			if (m == RESAMPLER_POLY) {
+				struct resampler *poly = resampler_new(1, rates[r], MPX_SAMPLE_RATE, ratio);
+
+				for (int i = 0; i < in_len; i += DATA_SIZE) {
+					int len = (in_len - i < DATA_SIZE) ? in_len - i : DATA_SIZE;
+					produced += resampler_process(poly, in + i, len, poly_out + produced, out_cap - produced);
+				}
+				resampler_free(poly);
+			} else {
+				int error;
+				SRC_STATE *src = src_new(m == RESAMPLER_SINC ? SRC_SINC_FASTEST : SRC_ZERO_ORDER_HOLD, 1, &error);
+				SRC_DATA data;
+
+				data.src_ratio = ratio;
+				data.end_of_input = 0;
+				for (int i = 0; i < in_len; i += DATA_SIZE) {
+					data.data_in = src_in + i;
+					data.input_frames = (in_len - i < DATA_SIZE) ? in_len - i : DATA_SIZE;
+					data.data_out = out + produced;
+					data.output_frames = out_cap - produced;
+					src_process(src, &data);
+					produced += data.output_frames_gen;
+				}
+				src_delete(src);
+			}
+
+			double elapsed = cpu_time() - start;
+
+			if (m == RESAMPLER_POLY)
+				to_float(out, poly_out, produced);
+			// Skip the filter start-up transient
+			double quality = purity(out + DATA_SIZE, produced - DATA_SIZE, tone, MPX_SAMPLE_RATE);
+
+			report(label, names[m], elapsed, produced, quality);
+		}
+
+		free(in);
+		free(poly_out);
+		free(src_in);
+		free(out);
+	}
+
+	return 0;
+}
+
+// Full per-block cost of turning 44.1 kHz audio into baseband: resampling
+// plus, for stereo, the multiplex. "mix" is the multiplex on its own.
+static int bench_mpx()
+{
+	int rate = 44100;
+	int in_len = rate * BENCH_SECONDS;
+	long out_len = (long)in_len * MPX_SAMPLE_RATE / rate + DATA_SIZE * 16;
+	double ratio = (double)MPX_SAMPLE_RATE / rate;
+	sample_t *in = malloc(in_len * 2 * sizeof(sample_t));
+	sample_t *lr = malloc(DATA_SIZE * 16 * 2 * sizeof(sample_t));
+	sample_t *out = malloc(out_len * sizeof(sample_t));
+	struct mpx_osc osc = { 0 };
+	double mix = 0;
+	int ret = -1;
+
+	if (!in || !out || !lr || mpx_osc_init(&osc, MPX_SAMPLE_RATE, 0) < 0)
+		goto exit;
+
+	printf("MPX: %d Hz input in blocks of %d frames, %d s\n", rate, DATA_SIZE, BENCH_SECONDS);
+
+	for (int channels = 1; channels <= 2; channels++) {
+		struct resampler *poly = resampler_new(channels, rate, MPX_SAMPLE_RATE, ratio);
+		int blocks = 0;
+		long produced = 0;
+		double start = cpu_time();
+
+		sine(in, in_len, channels, 1000, rate, 0.5);
+		for (int i = 0; i < in_len; i += DATA_SIZE) {
+			int len = (in_len - i < DATA_SIZE) ? in_len - i : DATA_SIZE;
+
+			if (channels == 1) {
+				produced += resampler_process(poly, in + i, len, out + produced, DATA_SIZE * 16);
+			} else {
+				int n = resampler_process(poly, in + 2 * i, len, lr, DATA_SIZE * 16);
+				double t = cpu_time();
+
+				mpx_stereo(&osc, lr, NULL, out + produced, n);
+				mix += cpu_time() - t;
+				produced += n;
+			}
+			blocks++;
+		}
+		resampler_free(poly);
+
+		double elapsed = cpu_time() - start;
+
+		report("mpx", channels == 1 ? "mono" : "stereo", elapsed, produced, NAN);
+		printf("  %-12s %-10s %8.1f us/block\n", "", "", elapsed * 1e6 / blocks);
+		if (channels == 2) {
+			report("mpx", "mix", mix, produced, NAN);
+			printf("  %-12s %-10s %8.1f us/block\n", "", "", mix * 1e6 / blocks);
+		}
+	}
+	ret = 0;
+
+exit:
+	mpx_osc_free(&osc);
+	free(in);
+	free(lr);
+	free(out);
+	return ret;
+}
+
+// Amplitude of the sine at freq in the signal, from the same fit
+static double amplitude(const float *y, int len, int stride, double freq, double rate)
+{
+	double a = 0, b = 0;
+
+	for (int i = 0; i < len; i++) {
+		a += y[i * stride] * sin(2 * M_PI * freq * i / rate);
+		b += y[i * stride] * cos(2 * M_PI * freq * i / rate);
+	}
+
+	return 2.0 / len * sqrt(a * a + b * b);
+}
+
+// Audio processing chain at 44.1 kHz stereo, on programme-like material:
+// three tones under a slow swell of 30 dB plus sharp bursts, so the AGC,
+// the compressor and the limiter all have work to do. Fails if a single
+// sample leaves the limiter above its ceiling, give or take rounding, then checks the 75 us
+// pre-emphasis curve against 10 log10(1 + (2 pi f tau)^2).
+static int bench_process()
+{
+	int rate = 44100;
+	int len = rate * BENCH_SECONDS;
+	float *in = malloc(len * 2 * sizeof(float));
+	float *buf = malloc(len * 2 * sizeof(float));
+	char *names[] = { "off", "light", "full" };
+	double freqs[] = { 1000, 5000 };
+	int ret = -1;
+
+	if (!in || !buf)
+		goto exit;
+
+	for (int i = 0; i < len; i++) {
+		double t = (double)i / rate;
+		double swell = pow(10, (-30 + 15 * (1 - cos(2 * M_PI * t / BENCH_SECONDS))) / 20);
+		double burst = fmod(t, 0.5) < 0.01 ? 4 : 1;
+		double x = swell * burst * (0.5 * sin(2 * M_PI * 110 * t) + 0.3 * sin(2 * M_PI * 1000 * t) +
+			0.2 * sin(2 * M_PI * 7000 * t));
+
+		in[2 * i] = x;
+		in[2 * i + 1] = 0.8 * x;
+	}
+
+	printf("Audio processing: %d Hz stereo in blocks of %d frames, %d s, 75 us pre-emphasis\n",
+		rate, DATA_SIZE, BENCH_SECONDS);
+
+	for (int profile = PROC_LIGHT; profile <= PROC_FULL; profile++) {
+		struct audio_proc ap;
+		float peak = 0;
+
+		if (audio_proc_init(&ap, rate, 2, profile, 75) < 0)
+			goto exit;
+
+		memcpy(buf, in, len * 2 * sizeof(float));
+		for (int i = 0; i < len; i += DATA_SIZE)
+			audio_proc_run(&ap, buf + 2 * i, (len - i < DATA_SIZE) ? len - i : DATA_SIZE);
+		for (int i = 0; i < len * 2; i++)
+			peak = fmaxf(peak, fabsf(buf[i]));
+
+		for (int s = 0; s < PROC_STAGES; s++) {
+			double ns = (double)ap.stage_ns[s] / ap.frames;
+
+			if (audio_proc_stage_enabled(&ap, s))
+				printf("  %-12s %-10s %8.1f ns/frame  %7.2f%% CPU at %d Hz\n",
+					audio_proc_stage_name(s), names[profile], ns, ns * rate / 1e7, rate);
+		}
+		printf("  %-12s %-10s %8.4f peak, ceiling %.4f\n", "output", names[profile], peak, ap.ceiling);
+
+		// To within the rounding of the gain ramp
+		if (peak > ap.ceiling + FLT_EPSILON) {
+			fprintf(stderr, "Limiter output exceeds the ceiling by %g\n", peak - ap.ceiling);
+			audio_proc_free(&ap);
+			goto exit;
+		}
+		audio_proc_free(&ap);
+	}
+
+	// Quiet enough that the limiter stays at unity
+	for (int f = 0; f < 2; f++) {
+		struct audio_proc ap;
+		double expect = 10 * log10(1 + pow(2 * M_PI * freqs[f] * 75e-6, 2));
+
+		if (audio_proc_init(&ap, rate, 1, PROC_OFF, 75) < 0)
+			goto exit;
+		for (int i = 0; i < rate; i++)
+			buf[i] = 0.01 * sin(2 * M_PI * freqs[f] * i / rate);
+		for (int i = 0; i < rate; i += DATA_SIZE)
+			audio_proc_run(&ap, buf + i, (rate - i < DATA_SIZE) ? rate - i : DATA_SIZE);
+		audio_proc_free(&ap);
+
+		// Skip the first 0.1 s of settling
+		double gain = 20 * log10(amplitude(buf + rate / 10, rate - rate / 10, 1, freqs[f], rate) / 0.01);
+
+		printf("  %-12s %-10.0f %+8.2f dB, %+.2f dB ideal\n", "preemphasis", freqs[f], gain, expect);
+		if (fabs(gain - expect) > 0.5) {
+			fprintf(stderr, "Pre-emphasis response is off\n");
+			goto exit;
+		}
+	}
+	ret = 0;
+
+exit:
+	free(in);
+	free(buf);
+	return ret;
+}
+
+// Composite clipper on stereo audio driven 1 dB past its share of the
+// deviation: tones at 1 kHz in L and 1.3 kHz in R, whose intermodulation
+// falls on every multiple of 100 Hz, 19 and 57 kHz included. The
+// composite is built here rather than by mpx_stereo_audio() so that even
+// Q15 can hold it above the limit. Next to clamping the audio at the same
+// limit, the clipper has to hold the limit as well and keep its products
+// at the pilot and RDS frequencies far lower.
+static int bench_clip()
+{
+	int len = MPX_SAMPLE_RATE * BENCH_SECONDS;
+	int block = DATA_SIZE * 4;
+	sample_t *mpx = malloc(len * sizeof(sample_t));
+	float *y = malloc(len * sizeof(float));
+	float *hard = malloc(len * sizeof(float));
+	struct mpx_osc osc = { 0 };
+	struct mpx_clipper clip;
+	double freqs[] = { 19000, 57000 };
+	char *names[] = { "pilot", "rds" };
+	int ret = -1;
+
+	if (!mpx || !y || !hard || mpx_osc_init(&osc, MPX_SAMPLE_RATE, 1) < 0)
+		goto exit;
+
+	float limit = 2 * osc.stereo_level;
+
+	printf("Clipper: stereo multiplex at %d Hz, %d s, audio limit %.3f\n", MPX_SAMPLE_RATE, BENCH_SECONDS, limit);
+
+	for (int hot = 0; hot <= 1; hot++) {
+		double level = hot ? 1.12 : 0.5;
+		double elapsed = 0;
+
+		for (int i = 0; i < len; i++) {
+			double l = level * sin(2 * M_PI * 1000.0 * i / MPX_SAMPLE_RATE);
+			double r = level * sin(2 * M_PI * 1300.0 * i / MPX_SAMPLE_RATE);
+			double sub = sin(2 * M_PI * 38000.0 * i / MPX_SAMPLE_RATE);
+
+			mpx[i] = sample_from_float(osc.stereo_level * ((l + r) + (l - r) * sub));
+		}
+		to_float(hard, mpx, len);
+
+		mpx_clipper_init(&clip, MPX_SAMPLE_RATE, limit, 1, 1, 1);
+		for (int i = 0; i < len; i += block) {
+			double start = cpu_time();
+
+			mpx_clipper_run(&clip, mpx + i, (len - i < block) ? len - i : block);
+			elapsed += cpu_time() - start;
+		}
+		to_float(y, mpx, len);
+
+		report("clip", hot ? "hot" : "clean", elapsed, len, NAN);
+		if (!hot)
+			continue;
+
+		float peak = 0;
+
+		for (int i = 0; i < len; i++) {
+			hard[i] = hard[i] > limit ? limit : hard[i] < -limit ? -limit : hard[i];
+			peak = fabsf(y[i]) > peak ? fabsf(y[i]) : peak;
+		}
+		printf("  ");
+		clip_stats_print(&clip.stats);
+
+		// Fixed point rounds the limit to the nearest Q15 step
+		if (peak > limit + 1.0f / 32768) {
+			fprintf(stderr, "Clipper output peaks at %.4f, over the limit\n", peak);
+			goto exit;
+		}
+
+		// A second in, clear of the filter settling
+		for (int f = 0; f < 2; f++) {
+			double clamped = 20 * log10(amplitude(hard + MPX_SAMPLE_RATE, MPX_SAMPLE_RATE, 1, freqs[f], MPX_SAMPLE_RATE));
+			double clipped = 20 * log10(amplitude(y + MPX_SAMPLE_RATE, MPX_SAMPLE_RATE, 1, freqs[f], MPX_SAMPLE_RATE));
+
+			printf("  %-12s %-10.0f %8.1f dBFS, %.1f dBFS clamped\n", names[f], freqs[f], clipped, clamped);
+			if (clipped > clamped - 20) {
+				fprintf(stderr, "Clipper leaves too much distortion at %.0f Hz\n", freqs[f]);
+				goto exit;
+			}
+		}
+	}
+	ret = 0;
+
+exit:
+	mpx_osc_free(&osc);
+	free(mpx);
+	free(y);
+	free(hard);
+	return ret;
+}
+
+static void put_le(uint8_t *p, uint32_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		p[i] = value >> (8 * i);
+}
+
+static int write_pcm(char *path, int rate, int channels, const int16_t *pcm, long frames)
+{
+	uint32_t data_size = frames * channels * 2;
+	uint8_t header[44];
+	FILE *f;
+
+	memcpy(header, "RIFF", 4);
+	put_le(header + 4, 36 + data_size, 4);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_le(header + 16, 16, 4);
+	put_le(header + 20, 1, 2);
+	put_le(header + 22, channels, 2);
+	put_le(header + 24, rate, 4);
+	put_le(header + 28, rate * channels * 2, 4);
+	put_le(header + 32, channels * 2, 2);
+	put_le(header + 34, 16, 2);
+	memcpy(header + 36, "data", 4);
+	put_le(header + 40, data_size, 4);
+
+	int ok = (f = fopen(path, "wb")) && fwrite(header, sizeof(header), 1, f) == 1
+		&& fwrite(pcm, data_size, 1, f) == 1;
+	if (f && fclose(f))
+		ok = 0;
+
+	return ok ? 0 : -1;
+}
+
+// 16 bit WAV with a 1 kHz tone on the left channel and 1.5 kHz on the
+// right, at half scale
+static int write_wav(char *path, int rate, int channels, int seconds)
+{
+	long frames = (long)rate * seconds;
+	int16_t *pcm = malloc(frames * channels * sizeof(int16_t));
+	int ret;
+
+	if (!pcm)
+		return -1;
+
+	for (long i = 0; i < frames; i++) {
+		for (int c = 0; c < channels; c++)
+			pcm[i * channels + c] = lrint(16384 * sin(2 * M_PI * (1000 + 500 * c) * i / rate));
+	}
+
+	ret = write_pcm(path, rate, channels, pcm, frames);
+	free(pcm);
+
+	return ret;
+}
+
+// The whole path from 16 bit PCM to PLLA_FRAC words, as the DSP and refill
+// threads run it: mapped WAV input, polyphase resampler, multiplex and RDS,
+// deviation scaling, for BENCH_SECONDS of baseband at rate. Purity is
+// measured on a mono tone after turning the words back into frequency
+// offsets, so it includes the final rounding to whole PLL steps.
+static int run_pipeline(char *path, int channels, int rds, int rate, double *seconds, long *produced, double *quality)
+{
+	long len = (long)rate * BENCH_SECONDS;
+	sample_t *data = malloc(DATA_SIZE * 16 * sizeof(sample_t));
+	float *offsets = malloc((len + DATA_SIZE * 16) * sizeof(float));
+	uint32_t *words = malloc(DATA_SIZE * 16 * sizeof(uint32_t));
+	scale_t scale = deviation_scale(BENCH_DEVIATION, BENCH_STEPS_PER_KHZ);
+	uint32_t base = 0x5A << 24;
+	int ret = -1;
+
+	*produced = 0;
+	if (!data || !offsets || !words || fm_mpx_open(path, NULL, 0, RESAMPLER_POLY, rds, PROC_OFF, 0, 1, 0, rate, 0, 0, NULL, COMPOSITE_OFF) < 0)
+		goto exit;
+
+	double start = cpu_time();
+	while (*produced < len) {
+		int n = fm_mpx_get_samples(data);
+
+		if (n < 0) {
+			fm_mpx_close();
+			goto exit;
+		}
+		for (int i = 0; i < n; i++)
+			words[i] = freq_word(base, data[i], scale);
+		// Kept outside the word loop so it stays as tight as the refill
+		if (channels == 1) {
+			for (int i = 0; i < n; i++)
+				offsets[*produced + i] = (int32_t)(words[i] - base);
+		}
+		*produced += n;
+	}
+	*seconds = cpu_time() - start;
+	fm_mpx_close();
+
+	// One second after the filter start-up transient. Over longer spans
+	// the float rounding of the resampling ratio starts to show up as a
+	// frequency error.
+	*quality = channels == 1 ? purity(offsets + DATA_SIZE, rate, 1000, rate) : NAN;
+	ret = 0;
+
+exit:
+	free(data);
+	free(offsets);
+	free(words);
+	return ret;
+}
+
+#define BENCH_FIXED_RATE 48000
+#define BENCH_FIXED_MAX_HZ 8            // 3.5 Q15 steps at 75 kHz, 79 dB below it
+
+// The path from 16 bit stereo input to the carrier offset, with processing
+// off and no RDS, against the same arithmetic in double precision: the
+// resampler's coefficient phases blended the same way, the multiplex from
+// exact subcarriers and the PLLA_FRAC steps truncated as the float build
+// does. In a
+// FIXED_POINT build this is the Q15 path against the float one, and fails
+// if they are more than BENCH_FIXED_MAX_HZ apart anywhere.
+static int bench_fixed()
+{
+	static double coefs[RESAMPLER_PHASES + 1][RESAMPLER_TAPS];
+	long frames = BENCH_FIXED_RATE, room = frames * MPX_SAMPLE_RATE / BENCH_FIXED_RATE + 1;
+	int16_t *pcm = malloc(frames * 2 * sizeof(int16_t));
+	sample_t *in = malloc(frames * 2 * sizeof(sample_t));
+	sample_t *lr = malloc(room * 2 * sizeof(sample_t));
+	sample_t *mpx = malloc(room * sizeof(sample_t));
+	struct resampler *r = resampler_new(2, BENCH_FIXED_RATE, MPX_SAMPLE_RATE, (double)MPX_SAMPLE_RATE / BENCH_FIXED_RATE);
+	struct mpx_osc osc = { 0 };
+	scale_t scale = deviation_scale(BENCH_DEVIATION, BENCH_STEPS_PER_KHZ);
+	uint32_t base = 0x5A << 24;
+#ifdef FIXED_POINT
+	char *variant = "q15";
+#else
+	char *variant = "float";
+#endif
+	int ret = -1;
+
+	if (!pcm || !in || !lr || !mpx || !r || mpx_osc_init(&osc, MPX_SAMPLE_RATE, 0) < 0)
+		goto exit;
+
+	printf("Sample path: %s against double precision, %d Hz stereo 16 bit to %d Hz, %d kHz deviation\n",
+		SAMPLE_FORMAT, BENCH_FIXED_RATE, MPX_SAMPLE_RATE, BENCH_DEVIATION);
+
+	// 1 kHz left and 3.1 kHz right, close to full deviation together
+	for (long i = 0; i < frames; i++) {
+		pcm[2 * i] = lrint(29000 * sin(2 * M_PI * 1000 * i / BENCH_FIXED_RATE));
+		pcm[2 * i + 1] = lrint(29000 * sin(2 * M_PI * 3100 * i / BENCH_FIXED_RATE));
+	}
+	for (long i = 0; i < frames * 2; i++)
+		in[i] = sample_from_s16(pcm[i]);
+
+	// Coefficient phases as resampler_new() makes them
+	double fc = r->cutoff / BENCH_FIXED_RATE;
+
+	for (int p = 0; p <= RESAMPLER_PHASES; p++) {
+		double sum = 0;
+
+		for (int k = 0; k < RESAMPLER_TAPS; k++)
+			sum += coefs[p][k] = resampler_prototype((double)p / RESAMPLER_PHASES + RESAMPLER_TAPS / 2 - 1 - k, fc);
+		for (int k = 0; k < RESAMPLER_TAPS; k++)
+			coefs[p][k] /= sum;
+	}
+
+	int64_t pos = r->pos;
+	uint64_t step = r->step;
+	long len = resampler_process(r, in, frames, lr, room);
+
+	mpx_stereo(&osc, lr, NULL, mpx, len);
+
+	double pilot_level = 1 - 2 * osc.stereo_level - osc.rds_level;
+	double worst = 0, power = 0;
+
+	for (long n = 0; n < len; n++, pos += step) {
+		long first = (pos >> 32) - RESAMPLER_TAPS / 2 + 1;
+		uint64_t phases = (uint64_t)(uint32_t)pos * RESAMPLER_PHASES;
+		int p = phases >> 32;
+		double w = (uint32_t)phases / 4294967296.0;
+		double y[2] = { 0, 0 };
+
+		// The history before the first frame is silence
+		for (int k = 0; k < RESAMPLER_TAPS; k++) {
+			double c = coefs[p][k] + w * (coefs[p + 1][k] - coefs[p][k]);
+
+			for (int ch = 0; ch < 2 && first + k >= 0; ch++)
+				y[ch] += pcm[2 * (first + k) + ch] / 32768.0 * c;
+		}
+
+		double t = 2 * M_PI * 19000.0 * n / MPX_SAMPLE_RATE;
+		double ref = osc.stereo_level * ((y[0] + y[1]) + (y[0] - y[1]) * sin(2 * t)) + pilot_level * sin(t);
+		int32_t steps = freq_word(base, mpx[n], scale) - base;
+		double err = (steps - (int32_t)(ref * BENCH_DEVIATION * BENCH_STEPS_PER_KHZ)) * 1000 / BENCH_STEPS_PER_KHZ;
+
+		worst = fmax(worst, fabs(err));
+		power += err * err;
+	}
+
+	int ok = len > 0 && worst <= BENCH_FIXED_MAX_HZ;
+	printf("  %-12s %-10s %ld samples, error max %.2f Hz (%.1f dB), RMS %.2f Hz (%.1f dB): %s\n",
+		"fixed", variant, len, worst, 20 * log10(worst / (BENCH_DEVIATION * 1000.0)), sqrt(power / len),
+		10 * log10(power / len) - 20 * log10(BENCH_DEVIATION * 1000.0), ok ? "ok" : "FAILED");
+	ret = ok ? 0 : -1;
+
+exit:
+	mpx_osc_free(&osc);
+	resampler_free(r);
+	free(pcm);
+	free(in);
+	free(lr);
+	free(mpx);
+	return ret;
+}
+
+// The pipeline at the default baseband rate. Build with and without
+// FIXED_POINT to compare the two sample formats.
+static int bench_pipeline()
+{
+	char path[] = "/tmp/pifmadv-bench-XXXXXX";
+	int rate = 44100;
+	int fd = mkstemp(path), ret = -1;
+
+	if (fd < 0)
+		return -1;
+	close(fd);
+
+	printf("Pipeline: %s, %d Hz 16 bit WAV to PLLA_FRAC words, %d s\n", SAMPLE_FORMAT, rate, BENCH_SECONDS);
+
+	for (int channels = 1; channels <= 2; channels++) {
+		double seconds, quality;
+		long produced;
+
+		if (write_wav(path, rate, channels, BENCH_SECONDS) < 0 ||
+			run_pipeline(path, channels, channels == 2, MPX_SAMPLE_RATE, &seconds, &produced, &quality) < 0)
+			goto exit;
+
+		report("pipeline", channels == 1 ? "mono" : "stereo+rds", seconds, produced, quality);
+	}
+	ret = 0;
+
+exit:
+	unlink(path);
+	return ret;
+}
+
+// CPU load of the pipeline at each baseband rate, with the period of the
+// subcarrier tables: stereo with RDS at 192 kHz and at 228 kHz (12 x
+// 19 kHz, where the pilot table is 12 samples and an RDS bit exactly 192),
+// and mono without RDS down to 32 kHz
+static int bench_rate()
+{
+	static const struct { int rate; int channels; } configs[] = {
+		{ 228000, 2 }, { 192000, 2 }, { 128000, 2 },
+		{ 192000, 1 }, { 96000, 1 }, { 64000, 1 }, { 32000, 1 },
+	};
+	char path[] = "/tmp/pifmadv-bench-XXXXXX";
+	int rate = 44100;
+	int fd = mkstemp(path), ret = -1;
+
+	if (fd < 0)
+		return -1;
+	close(fd);
+
+	printf("Baseband rate: %s, %d Hz 16 bit WAV to PLLA_FRAC words, %d s\n", SAMPLE_FORMAT, rate, BENCH_SECONDS);
+
+	for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		int channels = configs[c].channels;
+		struct mpx_osc osc = { 0 };
+		double seconds, quality;
+		long produced;
+		char variant[16];
+
+		if (write_wav(path, rate, channels, BENCH_SECONDS) < 0 ||
+			run_pipeline(path, channels, channels == 2, configs[c].rate, &seconds, &produced, &quality) < 0)
+			goto exit;
+
+		snprintf(variant, sizeof(variant), "%d %s", configs[c].rate / 1000, channels == 2 ? "st+rds" : "mono");
+		report_at("rate", variant, seconds, produced, quality, configs[c].rate);
+		if (channels == 2 && mpx_osc_init(&osc, configs[c].rate, 1) == 0) {
+			printf("  %-12s %-10s subcarrier tables of %d samples\n", "", "", osc.period);
+			mpx_osc_free(&osc);
+		}
+	}
+	ret = 0;
+
+exit:
+	unlink(path);
+	return ret;
+}
+
+#define BENCH_RING 65536
+#define BENCH_BATCH 19200
+#define BENCH_STAGING 2048              // STAGING_SIZE of the refill thread
+
+// The DMA ring refill: the word at a time loop, converting and storing
+// every sample with a wrap check, against the block kernel into a cached
+// staging buffer followed by burst copies split at the wrap. The ring here
+// is ordinary cached memory; on the Pi it is uncached, where the bursts
+// gain more. Both must leave the same words in the ring.
+static int bench_refill()
+{
+	long len = (long)MPX_SAMPLE_RATE * BENCH_SECONDS;
+	sample_t *in = malloc(BENCH_BATCH * sizeof(sample_t));
+	uint32_t *ring[2] = { malloc(BENCH_RING * sizeof(uint32_t)), malloc(BENCH_RING * sizeof(uint32_t)) };
+	uint32_t staging[BENCH_STAGING];
+	scale_t scale = deviation_scale(BENCH_DEVIATION, BENCH_STEPS_PER_KHZ);
+	uint32_t base = 0x5A << 24 | 0x80000;
+	double hz = cpu_hz(), ns[2];
+	int ret = -1;
+
+	if (!in || !ring[0] || !ring[1])
+		goto exit;
+
+	sine(in, BENCH_BATCH, 1, 1000, MPX_SAMPLE_RATE, 0.9);
+	printf("Refill: %d sample batches into a %d word ring, %d s\n", BENCH_BATCH, BENCH_RING, BENCH_SECONDS);
+
+	for (int m = 0; m < 2; m++) {
+		int pos = 0;
+		double start = cpu_time();
+
+		for (long done = 0; done < len; done += BENCH_BATCH) {
+			if (m == 0) {
+				for (int i = 0; i < BENCH_BATCH; i++) {
+					ring[0][pos++] = freq_word(base, in[i], scale);
+					if (pos == BENCH_RING)
+						pos = 0;
+				}
+				continue;
+			}
+
+			for (int i = 0; i < BENCH_BATCH; i += BENCH_STAGING) {
+				int n = (BENCH_BATCH - i < BENCH_STAGING) ? BENCH_BATCH - i : BENCH_STAGING;
+				int first = (BENCH_RING - pos < n) ? BENCH_RING - pos : n;
+
+				freq_words(staging, in + i, n, base, scale);
+				memcpy(ring[1] + pos, staging, first * sizeof(uint32_t));
+				memcpy(ring[1], staging + first, (n - first) * sizeof(uint32_t));
+				pos = (pos + n) & (BENCH_RING - 1);
+			}
+		}
+		ns[m] = (cpu_time() - start) * 1e9 / len;
+
+		report("refill", m == 0 ? "per word" : "burst", ns[m] * len / 1e9, len, NAN);
+		if (hz)
+			printf("  %-12s %-10s %8.2f cycles/sample at %.0f MHz\n", "", "", ns[m] * hz / 1e9, hz / 1e6);
+	}
+
+	int same = memcmp(ring[0], ring[1], BENCH_RING * sizeof(uint32_t)) == 0;
+	printf("  %-12s %-10s %.1fx faster, words %s\n", "refill", "burst", ns[0] / ns[1], same ? "identical" : "DIFFER");
+	ret = same ? 0 : -1;
+
+exit:
+	free(in);
+	free(ring[0]);
+	free(ring[1]);
+	return ret;
+}
+
+// Remainder of a 26 bit RDS block divided by the generator polynomial. For
+// an intact block this is the offset word.
+static uint16_t rds_syndrome(const uint8_t *bits)
+{
+	uint32_t reg = 0;
+
+	for (int i = 0; i < RDS_BLOCK_BITS; i++) {
+		reg = reg << 1 | bits[i];
+		if (reg & 0x400)
+			reg ^= 0x5B9;
+	}
+
+	return reg;
+}
+
+static uint16_t rds_data(const uint8_t *bits)
+{
+	uint16_t data = 0;
+
+	for (int i = 0; i < 16; i++)
+		data = data << 1 | bits[i];
+
+	return data;
+}
+
+// Encode RDS on its own, then demodulate it coherently, integrate over the
+// two halves of each biphase symbol, undo the differential coding, find
+// block sync from the syndromes and check that PI, PTY, TP, PS and RT come
+// back as sent, at the baseband rate given. Halfway, two texts are set in
+// quick succession, which has to flip the A/B flag once.
+static int rds_round_trip(int rate)
+{
+	char *ps = "BENCH-PS";
+	char *rt = "Round trip through the PiFmAdv RDS decoder";
+	uint16_t pi = 0xC0DE;
+	int pty = 10;
+	long len = (long)rate * BENCH_SECONDS;
+	double spb = rate / RDS_BITRATE;
+	long nbits = len / spb - RDS_DELAY_BITS - 1;
+	sample_t *mpx = malloc(len * sizeof(sample_t));
+	sample_t *env = malloc(DATA_SIZE * 16 * sizeof(sample_t));
+	uint8_t *bits = malloc(nbits);
+	struct mpx_osc osc = { 0 };
+	char ps_rx[9] = { 0 }, rt_rx[65] = { 0 };
+	int groups = 0, errors = 0, bad = 0, ret = -1;
+	uint16_t pi_rx = 0;
+	int pty_rx = -1, tp_rx = -1, ab_rx = -1, flips = 0, updated = 0;
+
+	if (!mpx || !env || !bits || mpx_osc_init(&osc, rate, 1) < 0 || rds_init(rate) < 0)
+		goto exit;
+
+	set_rds_pi(pi);
+	set_rds_ps(ps);
+	set_rds_rt(rt);
+	set_rds_pty(pty);
+	set_rds_tp(1);
+	set_rds_ct(0);
+
+	printf("RDS: %d s of groups at %d Hz, encoded and decoded again\n", BENCH_SECONDS, rate);
+
+	double start = cpu_time();
+	for (long i = 0; i < len; i += DATA_SIZE * 16) {
+		int n = (len - i < DATA_SIZE * 16) ? len - i : DATA_SIZE * 16;
+
+		if (!updated && i >= len / 2) {
+			set_rds_rt("Replaced before it went out");
+			set_rds_rt(rt);
+			updated = 1;
+		}
+		memset(mpx + i, 0, n * sizeof(sample_t));
+		rds_get_samples(env, n);
+		mpx_mono(&osc, env, mpx + i, n);
+	}
+	report_at("rds", "encode", cpu_time() - start, len, NAN, rate);
+
+	// Symbol halves follow the bit start by one and one and a half bits
+	// of shaping delay
+	int prev = 0;
+	for (long k = 0; k < nbits; k++) {
+		double t = (k + RDS_DELAY_BITS) * spb;
+		double first = 0, second = 0;
+
+		for (long i = ceil(t); i < t + spb / 2; i++)
+			first += sample_to_float(mpx[i]) * sin(2 * M_PI * 57000.0 * i / rate);
+		for (long i = ceil(t + spb / 2); i < t + spb; i++)
+			second += sample_to_float(mpx[i]) * sin(2 * M_PI * 57000.0 * i / rate);
+
+		int cur = first > second;
+		bits[k] = cur ^ prev;
+		prev = cur;
+	}
+
+	const uint16_t offsets[RDS_GROUP_LENGTH] = { RDS_OFFSET_A, RDS_OFFSET_B, RDS_OFFSET_C, RDS_OFFSET_D };
+	long pos;
+	for (pos = 0; pos + RDS_GROUP_BITS <= nbits; pos++) {
+		int b;
+
+		for (b = 0; b < RDS_GROUP_LENGTH; b++)
+			if (rds_syndrome(bits + pos + b * RDS_BLOCK_BITS) != offsets[b]) break;
+		if (b == RDS_GROUP_LENGTH) break;
+	}
+
+	for (; pos + RDS_GROUP_BITS <= nbits; pos += RDS_GROUP_BITS) {
+		uint16_t blocks[RDS_GROUP_LENGTH];
+		int ok = 1;
+
+		for (int b = 0; b < RDS_GROUP_LENGTH; b++) {
+			blocks[b] = rds_data(bits + pos + b * RDS_BLOCK_BITS);
+			if (rds_syndrome(bits + pos + b * RDS_BLOCK_BITS) != offsets[b]) {
+				errors++;
+				ok = 0;
+			}
+		}
+		groups++;
+		if (!ok) continue;
+
+		int seg = blocks[1] & 0xF;
+
+		pi_rx = blocks[0];
+		pty_rx = (blocks[1] >> 5) & 31;
+		tp_rx = (blocks[1] >> 10) & 1;
+		switch (blocks[1] >> 11) {
+		case 0: // 0A
+			seg &= 3;
+			ps_rx[2 * seg] = blocks[3] >> 8;
+			ps_rx[2 * seg + 1] = blocks[3] & 0xFF;
+			break;
+		case 4: // 2A
+			flips += ab_rx >= 0 && (blocks[1] >> 4 & 1) != ab_rx;
+			ab_rx = blocks[1] >> 4 & 1;
+			rt_rx[4 * seg] = blocks[2] >> 8;
+			rt_rx[4 * seg + 1] = blocks[2] & 0xFF;
+			rt_rx[4 * seg + 2] = blocks[3] >> 8;
+			rt_rx[4 * seg + 3] = blocks[3] & 0xFF;
+			break;
+		}
+	}
+
+	char *cr = strchr(rt_rx, '\r');
+	if (cr)
+		*cr = 0;
+
+	bad = groups == 0 || errors || pi_rx != pi || pty_rx != pty || tp_rx != 1
+		|| strcmp(ps_rx, ps) || strcmp(rt_rx, rt) || flips != 1;
+	printf("  %-12s %-10s %d groups, %d block errors, PI %04X PTY %d TP %d PS \"%s\" RT \"%s\", A/B flipped %d "
+		"times: %s\n", "rds", "decode", groups, errors, pi_rx, pty_rx, tp_rx, ps_rx, rt_rx, flips,
+		bad ? "FAILED" : "ok");
+	ret = bad ? -1 : 0;
+
+exit:
+	rds_free();
+	mpx_osc_free(&osc);
+	free(mpx);
+	free(env);
+	free(bits);
+	return ret;
+}
+
+// At the default rate and at 228 kHz, where an RDS bit is exactly 192
+// samples
+static int bench_rds()
+{
+	if (rds_round_trip(MPX_SAMPLE_RATE) < 0)
+		return -1;
+
+	return rds_round_trip(228000);
+}
+
+#define NET_BENCH_RATE 48000
+#define NET_BENCH_PACKET 240            // 5 ms
+#define NET_BENCH_BLOCK 480             // read as fm_mpx does, 10 ms at a time
+#define NET_BENCH_RTP_PORT 47004
+#define NET_BENCH_HTTP_PORT 47080
+
+struct net_sender {
+	int fd;
+	long frames;
+	int lost;
+	int swapped;
+};
+
+// Frame idx carries its index in 15 + 2 bits and a 12 bit check, so that
+// concealed and crossfaded frames are told apart from real ones
+static int net_check(long idx)
+{
+	return 1 << 14 | ((idx * 40503) >> 5 & 0xfff) << 2 | idx >> 15;
+}
+
+static void net_frame(uint8_t *p, long idx, int big_endian)
+{
+	int v[2] = { idx & 0x7fff, net_check(idx) };
+
+	for (int c = 0; c < 2; c++) {
+		p[2 * c] = big_endian ? v[c] >> 8 : v[c];
+		p[2 * c + 1] = big_endian ? v[c] : v[c] >> 8;
+	}
+}
+
+static long net_index(const sample_t *frame)
+{
+	long lo = lrintf(sample_to_float(frame[0]) * 32768);
+	long hi = lrintf(sample_to_float(frame[1]) * 32768);
+	long idx = (hi & 3) << 15 | lo;
+
+	return lo >= 0 && hi >= 0 && net_check(idx) == hi ? idx : -1;
+}
+
+static void add_ns(struct timespec *ts, long ns)
+{
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+// 5 ms RTP packets on schedule plus up to 3 ms of random delay, starting
+// just before the sequence number and timestamp wrap. Every 97th packet
+// is lost and every 89th swapped with the one after it.
+static void *rtp_sender(void *arg)
+{
+	struct net_sender *s = arg;
+	uint8_t pkt[12 + NET_BENCH_PACKET * 4], held[sizeof(pkt)];
+	struct sockaddr_in to;
+	struct timespec start;
+	int holding = 0;
+
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(NET_BENCH_RTP_PORT);
+	to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	srand(1);
+
+	for (long n = 0; n * NET_BENCH_PACKET < s->frames; n++) {
+		uint16_t seq = n + 65400;
+		uint32_t ts = n * NET_BENCH_PACKET + 0xfffe0000;
+		struct timespec at = start;
+
+		pkt[0] = 0x80;
+		pkt[1] = 96;
+		pkt[2] = seq >> 8;
+		pkt[3] = seq;
+		for (int b = 0; b < 4; b++)
+			pkt[4 + b] = ts >> (24 - 8 * b);
+		memset(pkt + 8, 0x5a, 4);
+		for (int i = 0; i < NET_BENCH_PACKET; i++)
+			net_frame(pkt + 12 + 4 * i, n * NET_BENCH_PACKET + i, 1);
+
+		add_ns(&at, n * NET_BENCH_PACKET * (1000000000L / NET_BENCH_RATE) + rand() % 3000000);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL);
+
+		if (n % 97 == 50) {
+			s->lost++;
+			continue;
+		}
+		if (n % 89 == 40) {
+			memcpy(held, pkt, sizeof(pkt));
+			holding = 1;
+			continue;
+		}
+		sendto(s->fd, pkt, sizeof(pkt), 0, (struct sockaddr *)&to, sizeof(to));
+		if (holding) {
+			sendto(s->fd, held, sizeof(held), 0, (struct sockaddr *)&to, sizeof(to));
+			holding = 0;
+			s->swapped++;
+		}
+	}
+
+	return NULL;
+}
+
+// A WAV served as fast as TCP takes it, in chunks that split frames
+static void *http_server(void *arg)
+{
+	struct net_sender *s = arg;
+	char request[1024];
+	long data_size = s->frames * 4;
+	uint8_t *body = malloc(44 + data_size);
+	int fd = accept(s->fd, NULL, NULL);
+	const char *reply = "HTTP/1.0 200 OK\r\nContent-Type: audio/wav\r\n\r\n";
+
+	if (fd < 0 || !body)
+		goto exit;
+	if (recv(fd, request, sizeof(request), 0) <= 0)
+		goto exit;
+
+	memcpy(body, "RIFF", 4);
+	put_le(body + 4, 36 + data_size, 4);
+	memcpy(body + 8, "WAVEfmt ", 8);
+	put_le(body + 16, 16, 4);
+	put_le(body + 20, 1, 2);
+	put_le(body + 22, 2, 2);
+	put_le(body + 24, NET_BENCH_RATE, 4);
+	put_le(body + 28, NET_BENCH_RATE * 4, 4);
+	put_le(body + 32, 4, 2);
+	put_le(body + 34, 16, 2);
+	memcpy(body + 36, "data", 4);
+	put_le(body + 40, data_size, 4);
+	for (long i = 0; i < s->frames; i++)
+		net_frame(body + 44 + 4 * i, i, 0);
+
+	if (send(fd, reply, strlen(reply), MSG_NOSIGNAL) < 0)
+		goto exit;
+	for (long sent = 0; sent < 44 + data_size; sent += 999) {
+		long n = 44 + data_size - sent < 999 ? 44 + data_size - sent : 999;
+
+		if (send(fd, body + sent, n, MSG_NOSIGNAL) != n)
+			break;
+	}
+
+exit:
+	if (fd >= 0)
+		close(fd);
+	free(body);
+	return NULL;
+}
+
+// Play the stream out in real time until the frames up to until have gone
+// by. Returns the newest index seen, with the frames that never came out
+// intact in missing.
+static long net_receive(struct net_audio *net, long until, long *missing)
+{
+	sample_t block[NET_BENCH_BLOCK * 2];
+	struct timespec at;
+	long last = -1, seen = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &at);
+	for (int blocks = 0; last < until; blocks++) {
+		// Give up when nothing arrives
+		if (blocks > 10 * 100 + until / NET_BENCH_BLOCK)
+			return -1;
+
+		add_ns(&at, NET_BENCH_BLOCK * (1000000000L / NET_BENCH_RATE));
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL);
+		net_read(net, block, NET_BENCH_BLOCK);
+
+		for (int i = 0; i < NET_BENCH_BLOCK; i++) {
+			long idx = net_index(block + 2 * i);
+
+			if (idx > last) {
+				last = idx;
+				seen++;
+			}
+		}
+	}
+
+	*missing = last + 1 - seen;
+	return last;
+}
+
+// Network input over loopback, read out in real time as the DSP thread
+// would. RTP with jitter, loss and reordering has to account for every
+// frame: those that do not come out are exactly the lost packets, the
+// delay trimmed back to the target and the crossfades around either.
+// HTTP sent faster than real time has to be held back by TCP without
+// losing or dropping anything.
+static int bench_net()
+{
+	struct net_audio net;
+	struct net_stats stats;
+	struct net_sender sender = { -1, 2 * NET_BENCH_RATE, 0, 0 };
+	struct sockaddr_in addr;
+	pthread_t thread;
+	char url[64];
+	long missing = 0, last;
+	int one = 1, ok;
+
+	printf("Network input: %d Hz stereo 16 bit over loopback, read in %d frame blocks\n", NET_BENCH_RATE, NET_BENCH_BLOCK);
+
+	snprintf(url, sizeof(url), "rtp://127.0.0.1:%d", NET_BENCH_RTP_PORT);
+	if (net_open(&net, url, "48000:2:s16") < 0)
+		return -1;
+	if ((sender.fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || pthread_create(&thread, NULL, rtp_sender, &sender)) {
+		net_close(&net);
+		return -1;
+	}
+	last = net_receive(&net, sender.frames - NET_BENCH_RATE / 5, &missing);
+	pthread_join(thread, NULL);
+	net_get_stats(&net, &stats);
+	close(sender.fd);
+	net_close(&net);
+
+	// Each loss and each slip costs at most two crossfades on top
+	long expected = stats.lost * NET_BENCH_PACKET + stats.dropped;
+	long slack = 2 * 64 * (stats.lost + stats.dropped / 64 + 1);
+
+	ok = last >= 0 && stats.lost == (uint64_t)sender.lost && stats.reordered == (uint64_t)sender.swapped &&
+		stats.late == 0 && stats.duplicates == 0 && stats.underruns == 0 &&
+		missing >= expected && missing <= expected + slack;
+	printf("  %-12s %-10s %llu lost, %llu reordered, %llu late, jitter %.1f ms, delay %.1f ms (target %.1f)\n",
+		"net", "rtp", (unsigned long long)stats.lost, (unsigned long long)stats.reordered,
+		(unsigned long long)stats.late, stats.jitter_ms, stats.delay_ms, stats.target_ms);
+	printf("  %-12s %-10s %ld frames missing, %ld lost or trimmed, %llu concealed, %llu underruns: %s\n",
+		"net", "rtp", missing, expected, (unsigned long long)stats.concealed,
+		(unsigned long long)stats.underruns, ok ? "ok" : "FAILED");
+	if (!ok)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(NET_BENCH_HTTP_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sender.frames = NET_BENCH_RATE;
+	if ((sender.fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+			setsockopt(sender.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+			bind(sender.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sender.fd, 1) < 0 ||
+			pthread_create(&thread, NULL, http_server, &sender)) {
+		fprintf(stderr, "Error: could not listen on port %d\n", NET_BENCH_HTTP_PORT);
+		if (sender.fd >= 0)
+			close(sender.fd);
+		return -1;
+	}
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/stream.wav", NET_BENCH_HTTP_PORT);
+	ok = net_open(&net, url, NULL) == 0;
+	if (ok) {
+		last = net_receive(&net, sender.frames - NET_BENCH_RATE / 5, &missing);
+		net_get_stats(&net, &stats);
+		net_close(&net);
+	}
+	pthread_join(thread, NULL);
+	close(sender.fd);
+	if (!ok)
+		return -1;
+
+	ok = last >= 0 && missing == 0 && stats.dropped == 0 && stats.concealed == 0 && stats.underruns == 0;
+	printf("  %-12s %-10s %ld frames missing, %llu dropped, %llu underruns, delay %.1f ms (target %.1f, max %.1f): %s\n",
+		"net", "http", missing, (unsigned long long)stats.dropped, (unsigned long long)stats.underruns,
+		stats.delay_ms, stats.target_ms, stats.max_delay_ms, ok ? "ok" : "FAILED");
+
+	return ok ? 0 : -1;
+}
+
+#define PL_BENCH_RATE 48000
+#define PL_BENCH_FADE 4800              // 100 ms
+#define PL_BENCH_LOW_RATE 32000         // tracks resampled to the playlist rate
+
+// Three tracks splitting one stereo tone at odd places, played from a
+// directory without crossfade, have to come out as the tone itself, down
+// to the sample, also across the wrap back to the first track. Read in
+// real time, with the decoder going through track changes all the while,
+// the reader must never be kept waiting. Two DC tracks from an M3U with a
+// crossfade have to overlap by exactly the crossfade. A tone split over
+// two tracks at a lower rate, between two at the playlist rate, has to
+// come out as the whole tone resampled in one go, with the end of the
+// filter flushed before the next track.
+static int bench_playlist()
+{
+	static const char *names[] = { "a.wav", "b.wav", "c.wav", "x.wav", "y.wav", "list.m3u", "l1.wav", "l2.wav", "rate.m3u" };
+	char dir[] = "/tmp/pifmadv-playlist-XXXXXX";
+	char path[9][64];
+	long split[] = { 12345, 20000, 7777 }, total = 12345 + 20000 + 7777;
+	long fade_a = PL_BENCH_RATE, fade_b = PL_BENCH_RATE / 2;
+	long low[] = { 10000, 6543 }, low_total = 10000 + 6543;
+	int16_t *pcm = malloc(fade_a * 2 * sizeof(int16_t));
+	sample_t *out = malloc(2 * total * 2 * sizeof(sample_t));
+	sample_t *ref = malloc(2 * total * 2 * sizeof(sample_t));
+	sample_t *whole = malloc((low_total + RESAMPLER_TAPS / 2) * 2 * sizeof(sample_t));
+	struct resampler *r = resampler_new(2, PL_BENCH_LOW_RATE, PL_BENCH_RATE, (double)PL_BENCH_RATE / PL_BENCH_LOW_RATE);
+	struct playlist pl;
+	FILE *f;
+	int ret = -1, made = 0;
+
+	if (!pcm || !out || !ref || !whole || !r || !mkdtemp(dir))
+		goto exit;
+	for (int i = 0; i < 9; i++)
+		snprintf(path[i], sizeof(path[i]), "%s/%s", dir, names[i]);
+
+	printf("Playlist: %d Hz stereo 16 bit tracks\n", PL_BENCH_RATE);
+
+	for (long i = 0; i < total; i++) {
+		pcm[2 * i] = lrint(12000 * sin(2 * M_PI * 997 * i / PL_BENCH_RATE));
+		pcm[2 * i + 1] = lrint(12000 * sin(2 * M_PI * 1499 * i / PL_BENCH_RATE));
+	}
+	for (long i = 0, start = 0; i < 3; start += split[i++]) {
+		if (write_pcm(path[i], PL_BENCH_RATE, 2, pcm + 2 * start, split[i]) < 0)
+			goto exit;
+		made++;
+	}
+
+	if (playlist_open(&pl, dir, 0) < 0)
+		goto exit;
+
+	long differ = 0;
+	playlist_read(&pl, out, 2 * total);
+	for (long i = 0; i < 2 * total * 2; i++)
+		differ += out[i] != sample_from_s16(pcm[i % (total * 2)]);
+
+	// One second in 10 ms blocks, as the DSP thread takes them. The long
+	// read above may have had to wait, this must not.
+	struct timespec at, before, after;
+	uint64_t starved = pl.starved;
+	double max_wait = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &at);
+	for (int b = 0; b < 100; b++) {
+		add_ns(&at, 10000000L);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		playlist_read(&pl, out, PL_BENCH_RATE / 100);
+		clock_gettime(CLOCK_MONOTONIC, &after);
+
+		double wait = (after.tv_sec - before.tv_sec) * 1e3 + (after.tv_nsec - before.tv_nsec) / 1e6;
+		if (wait > max_wait)
+			max_wait = wait;
+	}
+	uint64_t started = pl.tracks_started;
+
+	starved = pl.starved - starved;
+	double slowest = pl.max_open_ms;
+	playlist_close(&pl);
+
+	int ok = differ == 0 && starved == 0;
+	printf("  %-12s %-10s %ld of %ld samples differ over two passes, %llu tracks started, slowest start %.2f ms\n",
+		"playlist", "gapless", differ, 2 * total * 2, (unsigned long long)started, slowest);
+	printf("  %-12s %-10s longest read %.3f ms, decoder fell behind %llu times: %s\n",
+		"playlist", "real time", max_wait, (unsigned long long)starved, ok ? "ok" : "FAILED");
+	if (!ok)
+		goto exit;
+
+	// +0.5 for a second, then -0.25 for half a second
+	for (long i = 0; i < fade_a * 2; i++)
+		pcm[i] = 16384;
+	if (write_pcm(path[3], PL_BENCH_RATE, 2, pcm, fade_a) < 0)
+		goto exit;
+	made++;
+	for (long i = 0; i < fade_b * 2; i++)
+		pcm[i] = -8192;
+	if (write_pcm(path[4], PL_BENCH_RATE, 2, pcm, fade_b) < 0)
+		goto exit;
+	made++;
+	if (!(f = fopen(path[5], "w")))
+		goto exit;
+	made++;
+	fprintf(f, "#EXTM3U\nx.wav\ny.wav\n");
+	fclose(f);
+
+	if (playlist_open(&pl, path[5], (float)PL_BENCH_FADE / PL_BENCH_RATE) < 0)
+		goto exit;
+	playlist_read(&pl, out, fade_a + fade_b);
+	playlist_close(&pl);
+
+	// The fade starts PL_BENCH_FADE before the end of the first track and
+	// falls steadily, the second track is on its own from the end of the
+	// first up to the next fade
+	sample_t a = sample_from_s16(16384), b = sample_from_s16(-8192);
+	long fall = fade_a - PL_BENCH_FADE, rise = fade_a + fade_b - 2 * PL_BENCH_FADE;
+	int monotonic = 1;
+
+	for (long i = fall; i < fade_a; i++)
+		monotonic &= out[2 * i] <= out[2 * (i - 1)] && out[2 * i] == out[2 * i + 1];
+	ok = out[2 * (fall - 1)] == a && out[2 * fall] != a && monotonic &&
+		out[2 * fade_a] == b && out[2 * (rise - 1)] == b && out[2 * rise] != b;
+	printf("  %-12s %-10s %d frame fade from frame %ld, second track alone from %ld to %ld: %s\n",
+		"playlist", "crossfade", PL_BENCH_FADE, fall, fade_a, rise, ok ? "ok" : "FAILED");
+	if (!ok)
+		goto exit;
+
+	// The first track again, then the tone at the lower rate in two parts
+	long ref_len = 0, resampled;
+
+	for (long i = 0; i < split[0]; i++) {
+		pcm[2 * i] = lrint(12000 * sin(2 * M_PI * 997 * i / PL_BENCH_RATE));
+		pcm[2 * i + 1] = lrint(12000 * sin(2 * M_PI * 1499 * i / PL_BENCH_RATE));
+	}
+	if (write_pcm(path[0], PL_BENCH_RATE, 2, pcm, split[0]) < 0)
+		goto exit;
+	for (long i = 0; i < split[0] * 2; i++)
+		ref[ref_len++] = sample_from_s16(pcm[i]);
+
+	for (long i = 0; i < low_total; i++) {
+		pcm[2 * i] = lrint(12000 * sin(2 * M_PI * 997 * i / PL_BENCH_LOW_RATE));
+		pcm[2 * i + 1] = lrint(12000 * sin(2 * M_PI * 1499 * i / PL_BENCH_LOW_RATE));
+	}
+	for (long i = 0, start = 0; i < 2; start += low[i++]) {
+		if (write_pcm(path[6 + i], PL_BENCH_LOW_RATE, 2, pcm + 2 * start, low[i]) < 0)
+			goto exit;
+		made++;
+	}
+	if (!(f = fopen(path[8], "w")))
+		goto exit;
+	made++;
+	fprintf(f, "a.wav\nl1.wav\nl2.wav\n");
+	fclose(f);
+
+	// The whole tone and the filter's delay of silence in one block
+	for (long i = 0; i < low_total * 2; i++)
+		whole[i] = sample_from_s16(pcm[i]);
+	memset(whole + low_total * 2, 0, RESAMPLER_TAPS / 2 * 2 * sizeof(sample_t));
+	resampled = resampler_process(r, whole, low_total + RESAMPLER_TAPS / 2, ref + ref_len, 2 * total - ref_len / 2);
+	ref_len += resampled * 2;
+
+	if (playlist_open(&pl, path[8], 0) < 0)
+		goto exit;
+	playlist_read(&pl, out, ref_len / 2 + split[0]);
+	playlist_close(&pl);
+
+	differ = 0;
+	for (long i = 0; i < ref_len + split[0] * 2; i++)
+		differ += out[i] != ref[i % ref_len];
+
+	ok = differ == 0;
+	printf("  %-12s %-10s %ld frames at %d Hz resampled to %ld, %ld samples differ: %s\n",
+		"playlist", "rate", low_total, PL_BENCH_LOW_RATE, resampled, differ, ok ? "ok" : "FAILED");
+	ret = ok ? 0 : -1;
+
+exit:
+	for (int i = 0; i < made && i < 9; i++)
+		unlink(path[i]);
+	rmdir(dir);
+	free(pcm);
+	free(out);
+	free(ref);
+	free(whole);
+	resampler_free(r);
+	return ret;
+}
+
+// Every channel from 76 to 108 MHz on a 10 kHz raster, for the 19.2 MHz
+// oscillator of the older boards and the 54 MHz one of the Pi 4. Each
+// solution must be within half a PLLA_FRAC step, with room for the
+// deviation, and the table built with the program has to give the same
+// solutions as solving directly. Channels where every VCO lands too close
+// to a whole multiple of the oscillator (96 MHz with 19.2 MHz, for one)
+// have no solution with an integer divider and are only counted. The
+// carrier error the old truncated and masked multiplier gave at the same
+// divider is shown for comparison.
+static int bench_tune()
+{
+	static const uint32_t clocks[] = { 19200000, 54000000 };
+	int ret = 0;
+
+	printf("Tuning: %d channels from %.0f to %.0f MHz, %d kHz deviation\n", TUNE_TABLE_SIZE, TUNE_TABLE_MIN / 1e6,
+		TUNE_TABLE_MAX / 1e6, TUNE_TABLE_DEVIATION);
+
+	for (int c = 0; c < 2; c++) {
+		struct tune t, cached;
+		double max_error = 0, max_old = 0, max_step = 0, solve_ns, lookup_ns;
+		int missing = 0, bad = 0;
+
+		double start = cpu_time();
+		for (int i = 0; i < TUNE_TABLE_SIZE; i++) {
+			uint32_t carrier = TUNE_TABLE_MIN + i * TUNE_TABLE_STEP;
+
+			if (tune_solve(&t, clocks[c], carrier, TUNE_TABLE_DEVIATION) < 0) {
+				missing++;
+				continue;
+			}
+
+			uint64_t swing = ((TUNE_TABLE_DEVIATION * 1000ULL + TUNE_GUARD_HZ) * t.divider << 20) / clocks[c];
+			uint32_t old = (uint32_t)((double)carrier * t.divider / clocks[c] * (1 << 20)) & ~3U;
+			double old_error = (double)clocks[c] * old / (1 << 20) / t.divider - carrier;
+
+			bad += fabs(t.error) > t.step_hz / 2 || t.headroom < swing;
+			max_error = fmax(max_error, fabs(t.error));
+			max_old = fmax(max_old, fabs(old_error));
+			max_step = fmax(max_step, t.step_hz);
+		}
+		solve_ns = (cpu_time() - start) * 1e9 / TUNE_TABLE_SIZE;
+
+		start = cpu_time();
+		for (int i = 0; i < TUNE_TABLE_SIZE; i++)
+			tune_lookup(&cached, clocks[c], TUNE_TABLE_MIN + i * TUNE_TABLE_STEP, TUNE_TABLE_DEVIATION);
+		lookup_ns = (cpu_time() - start) * 1e9 / TUNE_TABLE_SIZE;
+
+		for (int i = 0; i < TUNE_TABLE_SIZE; i++) {
+			uint32_t carrier = TUNE_TABLE_MIN + i * TUNE_TABLE_STEP;
+			int found = tune_lookup(&cached, clocks[c], carrier, TUNE_TABLE_DEVIATION) == 0;
+
+			if (found != (tune_solve(&t, clocks[c], carrier, TUNE_TABLE_DEVIATION) == 0) ||
+					(found && (cached.divider != t.divider || cached.multiplier != t.multiplier)))
+				bad++;
+		}
+
+		printf("  %-12s %-10s %d without solution, error max %.3f Hz (was %.1f Hz), step max %.3f Hz: %s\n",
+			"tune", c == 0 ? "19.2 MHz" : "54 MHz", missing, max_error, max_old, max_step,
+			bad ? "FAILED" : "ok");
+		printf("  %-12s %-10s %.0f ns per solve, %.0f ns per table lookup\n", "", "", solve_ns, lookup_ns);
+		if (bad)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+static double wall_time()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The DMA ring at several depths on the simulated backend: GPU memory and
+// control blocks needed, time to build, then the control blocks run at
+// 192 kHz for a few laps, reading the position back every millisecond the
+// way the refill thread does. Fails if a sample the DMA is on did not reach
+// PLLA_FRAC, or if the samples counted from laps and positions drift from
+// the pacing rate.
+static int bench_dma()
+{
+	static const float depths[] = { 10, 50, 100, DMA_RING_DEFAULT_MS, DMA_RING_MAX_MS };
+	int ret = 0;
+
+	printf("DMA ring: simulated backend, paced at %d Hz\n", MPX_SAMPLE_RATE);
+
+	for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+		volatile uint32_t *dma_base = hal_sim.map_peripheral(DMA_VIRT_BASE, DMA_CHANNEL_SIZE * (DMA_CHANNEL_MAX + 1));
+		volatile uint32_t *clk = hal_sim.map_peripheral(CLK_VIRT_BASE, CLK_LEN);
+		volatile uint32_t *pwm = hal_sim.map_peripheral(PWM_VIRT_BASE, PWM_LEN);
+		volatile uint32_t *dma = dma_base + (DMA_CHANNEL_SIZE / sizeof(int)) * DMA_CHANNEL;
+		uint32_t samples = dma_ring_samples(depths[d], MPX_SAMPLE_RATE);
+		uint32_t size = dma_ring_size(samples);
+		int mbox = hal_sim.mbox_open();
+		unsigned handle = hal_sim.mem_alloc(mbox, size, PAGE_SIZE, MEM_FLAG);
+		unsigned bus = hal_sim.mem_lock(mbox, handle);
+		uint8_t *virt = hal_sim.mapmem(BUS_TO_PHYS(bus), size);
+		struct dma_ring ring;
+
+		if (!dma_base || !clk || !pwm || !virt) {
+			fprintf(stderr, "Could not set up the simulated backend\n");
+			return -1;
+		}
+
+		double start = wall_time();
+		dma_ring_layout(&ring, samples, virt, bus);
+		dma_ring_build(&ring, 0x5A << 24);
+		double build_ms = (wall_time() - start) * 1e3;
+
+		for (uint32_t i = 0; i < samples; i++)
+			ring.sample[i] = 0x5A << 24 | i;
+
+		// 998.4 MHz VCO, PWM clock divided down to 384 kHz, two clocks a word
+		clk[PLLA_CTRL] = 52;
+		clk[PLLA_FRAC] = 0;
+		clk[PLLA_PER] = 1;
+		clk[PWMCLK_DIV] = 2600 << 12;
+		pwm[PWM_RNG1] = 2;
+		dma[DMA_CONBLK_AD] = ring.bus;
+		dma[DMA_CS] = BCM2708_DMA_ACTIVE;
+
+		uint32_t lap = dma_ring_lap(&ring), last_lap = lap;
+		int pos = dma_ring_position(&ring, hal_sim.dma_conblk_ad(dma)), last_pos = pos;
+		double run = fmax(2.5 * depths[d] / 1000, 0.1), first = wall_time(), now;
+		uint64_t counted = 0;
+		int wrong = 0;
+
+		do {
+			usleep(1000);
+			pos = dma_ring_position(&ring, hal_sim.dma_conblk_ad(dma));
+			lap = dma_ring_lap(&ring);
+			now = wall_time();
+			counted += (uint64_t)((lap - last_lap) & (DMA_RING_LAPS - 1)) * samples + pos - last_pos;
+			wrong += clk[PLLA_FRAC] != ring.sample[pos];
+			last_lap = lap;
+			last_pos = pos;
+		} while (now - first < run);
+
+		double expected = (now - first) * MPX_SAMPLE_RATE;
+		int ok = !wrong && fabs(counted - expected) < MPX_SAMPLE_RATE / 500;
+
+		printf("  %-12s %4.0f ms     %6u samples, %6u control blocks, %5u kB, built in %6.2f ms, %.1f laps %s\n",
+			"dma", depths[d], samples, samples * 2 + 1, size / 1024, build_ms, counted / (double)samples,
+			ok ? "ok" : "FAILED");
+		if (!ok) {
+			printf("  %-12s %-10s %llu samples counted, %.0f expected, %d positions off\n", "", "",
+				(unsigned long long)counted, expected, wrong);
+			ret = -1;
+		}
+
+		dma[DMA_CS] = 0;
+		hal_sim.dma_conblk_ad(dma);
+		hal_sim.unmapmem(virt, size);
+		hal_sim.mem_unlock(mbox, handle);
+		hal_sim.mem_free(mbox, handle);
+		hal_sim.mbox_close(mbox);
+		hal_sim.unmap_peripheral((void *)pwm, PWM_LEN);
+		hal_sim.unmap_peripheral((void *)clk, CLK_LEN);
+		hal_sim.unmap_peripheral((void *)dma_base, DMA_CHANNEL_SIZE * (DMA_CHANNEL_MAX + 1));
+	}
+
+	return ret;
+}
+
+#define BENCH_TRACE_ROUNDS 8
+#define BENCH_TRACE_STAGES 10000000
+
+// Cost of the tracing: a stage with tracing compiled in but off, against
+// the same loop without it, then recording with --trace on. Events go in
+// half a ring at a time, leaving the dumper time to write them out, and
+// the file has to end up with every one of them.
+static int bench_trace()
+{
+	char path[] = "/tmp/pifmadv-bench-XXXXXX";
+	uint32_t words = TRACE_RING_SIZE / 2;
+	volatile uint32_t sink = 0;
+	int fd = mkstemp(path), ret = -1;
+	double start, base_ns, off_ns, on_ns = 0;
+
+	if (fd < 0)
+		return -1;
+	close(fd);
+
+	printf("Trace: %d stages off, %d x %u events on\n", BENCH_TRACE_STAGES, BENCH_TRACE_ROUNDS, words);
+
+	start = cpu_time();
+	for (int i = 0; i < BENCH_TRACE_STAGES; i++)
+		sink += (uint32_t)i * 40503;
+	base_ns = (cpu_time() - start) * 1e9 / BENCH_TRACE_STAGES;
+
+	start = cpu_time();
+	for (int i = 0; i < BENCH_TRACE_STAGES; i++) {
+		uint64_t t = trace_now();
+
+		sink += (uint32_t)i * 40503;
+		if (t)
+			trace_record(TRACE_MPX, t, i);
+	}
+	off_ns = (cpu_time() - start) * 1e9 / BENCH_TRACE_STAGES - base_ns;
+
+	if (trace_open(path) < 0)
+		goto exit;
+	for (int r = 0; r < BENCH_TRACE_ROUNDS; r++) {
+		start = cpu_time();
+		for (uint32_t i = 0; i < words; i++) {
+			uint64_t t = trace_now();
+
+			sink += (uint32_t)i * 40503;
+			if (t)
+				trace_record(TRACE_MPX, t, i);
+		}
+		on_ns += cpu_time() - start;
+		usleep(250000);
+	}
+	trace_close();
+	on_ns = on_ns * 1e9 / ((double)BENCH_TRACE_ROUNDS * words) - base_ns;
+
+	FILE *f = fopen(path, "r");
+	char line[256];
+	long events = 0;
+
+	while (f && fgets(line, sizeof(line), f))
+		events += strstr(line, "\"ph\":\"X\"") != NULL;
+	if (f)
+		fclose(f);
+
+	int ok = events == (long)BENCH_TRACE_ROUNDS * words;
+
+	printf("  %-12s %-10s %8.2f ns per stage\n", "trace", "off", off_ns);
+	printf("  %-12s %-10s %8.2f ns per event, %ld of %ld events in the file: %s\n", "trace", "on", on_ns,
+		events, (long)BENCH_TRACE_ROUNDS * words, ok ? "ok" : "FAILED");
+	ret = ok ? 0 : -1;
+
+exit:
+	unlink(path);
+	return ret;
+}
+
+#define BENCH_DRIFT_SECONDS 1200
+#define BENCH_DRIFT_RATE 48000
+#define BENCH_DRIFT_BLOCK 480           // frames read at a time, 10 ms
+#define BENCH_DRIFT_NET_SECONDS 8       // read in real time, settling and then steering
+
+// The drift servo against an input whose clock is off by up to 500 ppm,
+// read 10 ms at a time at the baseband pace: once arriving in 20 ms
+// packets up to 5 ms late, as from the network, and once in 441 frame
+// writes, as from a pipe. Fails if the input ever runs dry, if the
+// smoothed fill strays more than 10 ms from where it settled, or if the
+// estimate is not within 1 ppm of the offset at the end.
+static int bench_drift()
+{
+	static const double offsets[] = { -500, -100, 0, 50, 300 };
+	static const struct { const char *name; int frames; double jitter; } inputs[] = {
+		{ "network", 960, 0.005 }, { "pipe", 441, 0 },
+	};
+	double ratio = (double)MPX_SAMPLE_RATE / BENCH_DRIFT_RATE;
+	double update_ns = 0;
+	long updates = 0;
+	int ret = 0;
+
+	printf("Drift: %d Hz input, %d s simulated\n", BENCH_DRIFT_RATE, BENCH_DRIFT_SECONDS);
+
+	for (int k = 0; k < (int)(sizeof(offsets) / sizeof(offsets[0])); k++) {
+		for (int n = 0; n < 2; n++) {
+			struct drift d;
+			double now = 0, worst = 0;
+			double period = inputs[n].frames / (BENCH_DRIFT_RATE * (1 + offsets[k] / 1e6));
+			int64_t delivered = BENCH_DRIFT_RATE / 10, consumed = 0, writes = 0;
+			uint32_t lcg = 1;
+			int dry = 0;
+
+			drift_init(&d, ratio, ratio);
+			double start = cpu_time();
+			while (now < BENCH_DRIFT_SECONDS) {
+				// Sent on the input clock, all in by now
+				for (;;) {
+					double arrival = writes * period + (lcg >> 8) / 16777216.0 * inputs[n].jitter;
+
+					if (arrival > now)
+						break;
+					delivered += inputs[n].frames;
+					writes++;
+					lcg = lcg * 1664525 + 1013904223;
+				}
+
+				consumed += BENCH_DRIFT_BLOCK;
+				dry += consumed > delivered;
+				drift_update(&d, (double)(delivered - consumed) / BENCH_DRIFT_RATE,
+					(double)BENCH_DRIFT_BLOCK / BENCH_DRIFT_RATE);
+				now += BENCH_DRIFT_BLOCK * drift_ratio(&d) / MPX_SAMPLE_RATE;
+				if (d.stats.settled)
+					worst = fmax(worst, fabs(d.stats.fill_ms - d.stats.target_ms));
+				updates++;
+			}
+			update_ns += cpu_time() - start;
+
+			int ok = !dry && worst < 10 && fabs(d.stats.ppm - offsets[k]) < 1;
+
+			printf("  %-12s %-10s %+6.0f ppm: estimate %+8.2f ppm, fill %.1f to %.1f ms (target %.1f), "
+				"%d dry: %s\n", "drift", inputs[n].name, offsets[k], d.stats.ppm,
+				d.stats.min_fill_ms, d.stats.max_fill_ms, d.stats.target_ms, dry, ok ? "ok" : "FAILED");
+			if (!ok)
+				ret = -1;
+		}
+	}
+
+	// The RTP stream of the network bench, lost packets and all, through
+	// a real jitter buffer read on the sender's clock: there is no drift,
+	// so the fill the servo sees has to hold still across the losses
+	struct net_audio net;
+	struct net_stats stats;
+	struct net_sender sender = { -1, (long)BENCH_DRIFT_NET_SECONDS * NET_BENCH_RATE + NET_BENCH_RATE / 2, 0, 0 };
+	struct drift d;
+	struct timespec at;
+	pthread_t thread;
+	sample_t block[NET_BENCH_BLOCK * 2];
+	char url[64];
+
+	snprintf(url, sizeof(url), "rtp://127.0.0.1:%d", NET_BENCH_RTP_PORT);
+	if (net_open(&net, url, "48000:2:s16") < 0)
+		return -1;
+	if ((sender.fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || pthread_create(&thread, NULL, rtp_sender, &sender)) {
+		fprintf(stderr, "Error: could not start the RTP sender\n");
+		if (sender.fd >= 0)
+			close(sender.fd);
+		net_close(&net);
+		return -1;
+	}
+
+	drift_init(&d, 1, 1);
+	clock_gettime(CLOCK_MONOTONIC, &at);
+	for (int blocks = 0; blocks < BENCH_DRIFT_NET_SECONDS * NET_BENCH_RATE / NET_BENCH_BLOCK; blocks++) {
+		add_ns(&at, NET_BENCH_BLOCK * (1000000000L / NET_BENCH_RATE));
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL);
+		net_read(&net, block, NET_BENCH_BLOCK);
+		drift_update(&d, net_fill(&net), (double)NET_BENCH_BLOCK / NET_BENCH_RATE);
+	}
+	pthread_join(thread, NULL);
+	net_get_stats(&net, &stats);
+	close(sender.fd);
+	net_close(&net);
+
+	int ok = d.stats.settled && stats.lost > 0 && fabs(d.stats.correction_ppm) < 100 &&
+		d.stats.max_fill_ms - d.stats.min_fill_ms < 5;
+
+	printf("  %-12s %-10s %llu lost, %llu concealed: correction %+8.2f ppm, fill %.1f to %.1f ms (target %.1f): %s\n",
+		"drift", "rtp", (unsigned long long)stats.lost, (unsigned long long)stats.concealed, d.stats.correction_ppm,
+		d.stats.min_fill_ms, d.stats.max_fill_ms, d.stats.target_ms, ok ? "ok" : "FAILED");
+	if (!ok)
+		ret = -1;
+
+	printf("  %-12s %-10s %.1f ns per update\n", "drift", "", update_ns * 1e9 / updates);
+
+	return ret;
+}
+
+// Low-water mark of the low-latency profile, LOW_LATENCY_LOW_WATER_MS
+#define BENCH_LATENCY_LOW_WATER_MS 6
+
+// The DSP thread's work per block with the low-latency profile's 2 ms
+// input blocks and with the usual ones, stereo with RDS at 192 kHz: the
+// CPU load, and the worst block, which has to take well under the
+// low-water mark or the refill pads with carrier. Then the latency
+// accounting, on blocks captured a known time before the DMA sends their
+// last sample: fails unless the percentiles come out at those times.
+static int bench_latency()
+{
+	static struct latency l;
+	struct latency_stats stats;
+	char path[] = "/tmp/pifmadv-bench-XXXXXX";
+	sample_t *data = malloc(DATA_SIZE * 16 * sizeof(sample_t));
+	int rate = 44100;
+	int fd = mkstemp(path), ret = -1;
+
+	if (fd < 0 || !data)
+		goto exit;
+	close(fd);
+
+	printf("Latency: %d Hz stereo WAV, %d s, and %d made-up blocks\n", rate, BENCH_SECONDS, 1000);
+	if (write_wav(path, rate, 2, BENCH_SECONDS) < 0)
+		goto exit;
+
+	for (int low = 1; low >= 0; low--) {
+		long produced = 0, blocks = 0;
+		double worst = 0, total = 0;
+
+		if (fm_mpx_open(path, NULL, 0, RESAMPLER_POLY, 1, PROC_OFF, 0, 1, 0, MPX_SAMPLE_RATE, 0, low, NULL, COMPOSITE_OFF) < 0)
+			goto exit;
+		while (produced < (long)MPX_SAMPLE_RATE * BENCH_SECONDS) {
+			double start = cpu_time();
+			int n = fm_mpx_get_samples(data);
+			double took = cpu_time() - start;
+
+			if (n < 0) {
+				fm_mpx_close();
+				goto exit;
+			}
+			total += took;
+			worst = fmax(worst, took);
+			produced += n;
+			blocks++;
+		}
+		fm_mpx_close();
+
+		printf("  %-12s %-10s %5.1f%% CPU, %6.1f us per block, worst %6.1f us%s\n", "latency",
+			low ? "low" : "normal", total / BENCH_SECONDS * 100, total / blocks * 1e6, worst * 1e6,
+			low && worst * 1000 > BENCH_LATENCY_LOW_WATER_MS / 2.0 ? ", over half the low-water mark" : "");
+	}
+
+	// Block i of 384 samples has its last sample go out (1 + i % 100) / 10
+	// ms after it was captured; resolved in chunks of 1000 samples
+	uint64_t base = 1000000000;
+
+	latency_init(&l);
+	for (int i = 0; i < 1000; i++) {
+		uint64_t sample = i * 384 + 383;
+
+		latency_mark(&l, sample, base + sample * 1e9 / MPX_SAMPLE_RATE - (1 + i % 100) * 100000);
+	}
+	for (uint64_t first = 0; first < 384000; first += 1000)
+		latency_resolve(&l, first, 1000, base + first * 1e9 / MPX_SAMPLE_RATE, MPX_SAMPLE_RATE);
+	latency_read(&l, &stats);
+
+	// Every latency ten times, so the median is the 501st, 5.1 ms, in the
+	// bin from 5.1 to 5.2; a latency right on a bin edge may land below it
+	int ok = stats.count == 1000 && fabs(stats.min_ms - 0.1) < 0.1 && fabs(stats.p50_ms - 5.15) < 0.1 &&
+		fabs(stats.p90_ms - 9.15) < 0.1 && fabs(stats.p99_ms - 10.05) < 0.1 && fabs(stats.max_ms - 10) < 0.1;
+
+	printf("  %-12s %-10s %llu blocks, %.1f ms min, %.2f median, %.2f p90, %.2f p99, %.1f max: %s\n",
+		"latency", "accounting", (unsigned long long)stats.count, stats.min_ms, stats.p50_ms, stats.p90_ms,
+		stats.p99_ms, stats.max_ms, ok ? "ok" : "FAILED");
+	ret = ok ? 0 : -1;
+
+exit:
+	unlink(path);
+	free(data);
+	return ret;
+}
+
+#define BENCH_CACHE_RATE 48000          // a whole ratio to 192 kHz
+
+// Baseband from the live path, mono without RDS, so it is the resampled
+// audio itself
+static long run_mono(char *path, char *insert, sample_t *out, long len)
+{
+	long produced = 0;
+
+	if (fm_mpx_open(path, NULL, 0, RESAMPLER_POLY, 0, PROC_OFF, 0, 0, 0, MPX_SAMPLE_RATE, 0, 0, NULL, COMPOSITE_OFF) < 0)
+		return -1;
+	if (insert && fm_mpx_insert(insert) < 0) {
+		fm_mpx_close();
+		return -1;
+	}
+	while (produced < len) {
+		int n = fm_mpx_get_samples(out + produced);
+
+		if (n < 0) {
+			fm_mpx_close();
+			return -1;
+		}
+		produced += n;
+	}
+	fm_mpx_close();
+
+	return produced;
+}
+
+// The baseband cache: rendering a stereo WAV into it and mapping it back,
+// then the DSP thread's work per block decoding the WAV and replaying it
+// from the cache, stereo with RDS at 192 kHz. Fails unless the mapped file
+// holds what was rendered, the cache equals the live path's second loop
+// over a file sample for sample, and a clip inserted over silence plays
+// for exactly its length.
+static int bench_cache()
+{
+	char dir[] = "/tmp/pifmadv-cache-XXXXXX";
+	char wav[64], mono[64], quiet[64], stored[96] = "";
+	struct cache_params p = { MPX_SAMPLE_RATE, 0, RESAMPLER_POLY, PROC_OFF, 0, DATA_SIZE };
+	struct cache a = { 0 }, b = { 0 }, c = { 0 };
+	long len = 3L * MPX_SAMPLE_RATE;
+	sample_t *data = malloc(DATA_SIZE * 16 * sizeof(sample_t));
+	sample_t *out = malloc((len + DATA_SIZE * 16) * sizeof(sample_t));
+	int16_t *silence = calloc(2 * BENCH_CACHE_RATE, sizeof(int16_t));
+	int rate = 44100, ret = -1, made = 0;
+
+	if (!data || !out || !silence || !mkdtemp(dir))
+		goto exit;
+	snprintf(wav, sizeof(wav), "%s/stereo.wav", dir);
+	snprintf(mono, sizeof(mono), "%s/mono.wav", dir);
+	snprintf(quiet, sizeof(quiet), "%s/quiet.wav", dir);
+	made = 1;
+
+	printf("Cache: %d Hz stereo WAV, %d s, and %d Hz mono\n", rate, BENCH_SECONDS, BENCH_CACHE_RATE);
+	if (write_wav(wav, rate, 2, BENCH_SECONDS) < 0 || write_wav(mono, BENCH_CACHE_RATE, 1, 1) < 0 ||
+		write_pcm(quiet, BENCH_CACHE_RATE, 1, silence, 2 * BENCH_CACHE_RATE) < 0)
+		goto exit;
+
+	double start = cpu_time();
+	if (cache_open(&a, dir, wav, NULL, &p) != 0)
+		goto exit;
+	double render = cpu_time() - start;
+	snprintf(stored, sizeof(stored), "%s/%016llx.mpx", dir, (unsigned long long)a.key);
+	start = cpu_time();
+	if (cache_open(&b, dir, wav, NULL, &p) != 0)
+		goto exit;
+	double load = cpu_time() - start;
+
+	int ok = a.frames == b.frames && a.channels == b.channels &&
+		memcmp(a.data, b.data, a.frames * a.channels * sizeof(sample_t)) == 0;
+	printf("  %-12s %-10s %.1f MB, rendered in %.0f ms, mapped in %.2f ms: %s\n", "cache", "store",
+		a.frames * a.channels * sizeof(sample_t) / 1e6, render * 1e3, load * 1e3, ok ? "ok" : "FAILED");
+	if (!ok)
+		goto exit;
+
+	for (int cached = 0; cached <= 1; cached++) {
+		long produced = 0;
+
+		if (fm_mpx_open(wav, NULL, 0, RESAMPLER_POLY, 1, PROC_OFF, 0, 1, 0, MPX_SAMPLE_RATE, 0, 0,
+			cached ? dir : NULL, COMPOSITE_OFF) < 0)
+			goto exit;
+		start = cpu_time();
+		while (produced < (long)MPX_SAMPLE_RATE * BENCH_SECONDS) {
+			int n = fm_mpx_get_samples(data);
+
+			if (n < 0) {
+				fm_mpx_close();
+				goto exit;
+			}
+			produced += n;
+		}
+		double seconds = cpu_time() - start;
+		fm_mpx_close();
+		report("cache", cached ? "replay" : "decode", seconds, produced, NAN);
+	}
+
+	// The live path starts the second loop a handful of samples after a
+	// whole loop, depending on the resampler's delay
+	long loop = (long)MPX_SAMPLE_RATE, found = -1;
+
+	if (run_mono(mono, NULL, out, len) < 0 || cache_open(&c, NULL, mono, NULL, &p) != 0)
+		goto exit;
+	for (long at = loop - RESAMPLER_TAPS; found < 0 && at <= loop + RESAMPLER_TAPS; at++) {
+		if (c.frames == loop && memcmp(out + at, c.data, loop * sizeof(sample_t)) == 0)
+			found = at;
+	}
+	printf("  %-12s %-10s %ld samples a loop, second loop from sample %ld: %s\n", "cache", "loop",
+		c.frames, found, found >= 0 ? "ok" : "FAILED");
+	if (found < 0)
+		goto exit;
+
+	// A 1 s clip over 2 s of silence
+	long first = -1, last = -1;
+
+	if (run_mono(quiet, mono, out, 2 * loop) < 0)
+		goto exit;
+	for (long i = 0; i < 2 * loop; i++) {
+		if (out[i] != 0) {
+			if (first < 0)
+				first = i;
+			last = i;
+		}
+	}
+	ok = first == 0 && last + 1 == loop;
+	printf("  %-12s %-10s clip from sample %ld to %ld of %ld: %s\n", "cache", "insert", first, last + 1, loop,
+		ok ? "ok" : "FAILED");
+	ret = ok ? 0 : -1;
+
+exit:
+	cache_close(&a);
+	cache_close(&b);
+	cache_close(&c);
+	if (made) {
+		unlink(wav);
+		unlink(mono);
+		unlink(quiet);
+		if (stored[0])
+			unlink(stored);
+		rmdir(dir);
+	}
+	free(data);
+	free(out);
+	free(silence);
+	return ret;
+}
+
+#define BENCH_COMPOSITE_PPM 100
+
+// Composite passthrough: a finished multiplex of a 1 kHz tone, the pilot
+// and a 57 kHz subcarrier in raw float, s16 and s32 files, and the float
+// file again with a --ppm correction, which puts it through the resampler.
+// The float file is played once as plain audio first, so passthrough
+// follows an open that set up a resampler. Reports the DSP thread's work
+// for each. Fails unless the passthrough comes out within a 16 bit step of
+// the original, and unless the resampler keeps all three tones within
+// 0.1 dB.
+static int bench_composite()
+{
+	static const int formats[] = { COMPOSITE_FLOAT, COMPOSITE_S16, COMPOSITE_S32, COMPOSITE_FLOAT };
+	static const char *names[] = { "float", "s16", "s32", "ppm" };
+	static const double tones[][2] = { { 1000, 0.5 }, { 19000, 0.1 }, { 57000, 0.05 } };
+	char path[] = "/tmp/pifmadv-bench-XXXXXX";
+	long len = MPX_SAMPLE_RATE;
+	float *comp = malloc(len * sizeof(float));
+	int32_t *raw = malloc(len * sizeof(int32_t));
+	sample_t *data = malloc(DATA_SIZE * 16 * sizeof(sample_t));
+	sample_t *out = malloc((len + DATA_SIZE * 16) * sizeof(sample_t));
+	float *y = malloc(len * sizeof(float));
+	int fd = mkstemp(path), ret = -1;
+
+	if (fd < 0 || !comp || !raw || !data || !out || !y)
+		goto exit;
+	close(fd);
+
+	for (long i = 0; i < len; i++) {
+		comp[i] = 0;
+		for (int t = 0; t < 3; t++)
+			comp[i] += tones[t][1] * sin(2 * M_PI * tones[t][0] * i / MPX_SAMPLE_RATE);
+	}
+
+	printf("Composite: 1 kHz, pilot and 57 kHz at %d Hz, raw float, s16 and s32, %d s\n", MPX_SAMPLE_RATE, BENCH_SECONDS);
+
+	for (int f = 0; f < 4; f++) {
+		float ppm = f == 3 ? BENCH_COMPOSITE_PPM : 0;
+		int size = formats[f] == COMPOSITE_S16 ? 2 : 4;
+		long produced = 0;
+		FILE *file;
+
+		for (long i = 0; i < len; i++) {
+			if (formats[f] == COMPOSITE_S16)
+				((int16_t *)raw)[i] = lrint(comp[i] * 32767);
+			else if (formats[f] == COMPOSITE_S32)
+				raw[i] = lrint(comp[i] * 2147483647.0);
+			else
+				((float *)raw)[i] = comp[i];
+		}
+		if (!(file = fopen(path, "wb")) || fwrite(raw, size, len, file) != (size_t)len || fclose(file))
+			goto exit;
+
+		// Passthrough must not pick up the resampler of an earlier input, so
+		// the first file is played once as plain raw audio before
+		if (f == 0) {
+			char spec[32];
+
+			snprintf(spec, sizeof(spec), "%d:1:float", MPX_SAMPLE_RATE);
+			if (fm_mpx_open(path, spec, 0, RESAMPLER_POLY, 0, PROC_OFF, 0, 0, 0, MPX_SAMPLE_RATE, 0, 0, NULL, COMPOSITE_OFF) < 0)
+				goto exit;
+			int n = fm_mpx_get_samples(data);
+			fm_mpx_close();
+			if (n < 0)
+				goto exit;
+		}
+
+		if (fm_mpx_open(path, NULL, ppm, RESAMPLER_POLY, 1, PROC_OFF, 0, 1, 0, MPX_SAMPLE_RATE, 0, 0, NULL, formats[f]) < 0)
+			goto exit;
+		double start = cpu_time();
+		while (produced < (long)MPX_SAMPLE_RATE * BENCH_SECONDS) {
+			int n = fm_mpx_get_samples(data);
+
+			if (n < 0) {
+				fm_mpx_close();
+				goto exit;
+			}
+			if (produced < len)
+				memcpy(out + produced, data, n * sizeof(sample_t));
+			produced += n;
+		}
+		double seconds = cpu_time() - start;
+		fm_mpx_close();
+		report("composite", (char *)names[f], seconds, produced, NAN);
+
+		to_float(y, out, len);
+		if (ppm == 0) {
+			double err = 0;
+
+			for (long i = 0; i < len; i++)
+				err = fmax(err, fabs(y[i] - comp[i]));
+			printf("  %-12s %-10s max error %.2f of a 16 bit step: %s\n", "composite", names[f], err * 32768,
+				err * 32768 <= 1.5 ? "ok" : "FAILED");
+			if (err * 32768 > 1.5)
+				goto exit;
+			continue;
+		}
+
+		// Past the resampler's start-up, with the tones moved down by the
+		// correction
+		int ok = 1;
+
+		printf("  %-12s %-10s", "composite", names[f]);
+		for (int t = 0; t < 3; t++) {
+			double a = amplitude(y + RESAMPLER_TAPS, len - 2 * RESAMPLER_TAPS, 1,
+				tones[t][0] / (1 + ppm / 1e6), MPX_SAMPLE_RATE);
+			double db = 20 * log10(a / tones[t][1]);
+
+			printf("%s %.0f Hz %+.3f dB", t ? "," : "", tones[t][0], db);
+			ok &= fabs(db) < 0.1;
+		}
+		printf(": %s\n", ok ? "ok" : "FAILED");
+		if (!ok)
+			goto exit;
+	}
+	ret = 0;
+
+exit:
+	unlink(path);
+	free(comp);
+	free(raw);
+	free(data);
+	free(out);
+	free(y);
+	return ret;
+}
+
+// Mean power of the signal at count frequencies step Hz apart from freq,
+// a smoothed spectrum of noise
+static double band_power(const float *y, int len, double freq, double step, int count, double rate)
+{
+	double sum = 0;
+
+	for (int i = 0; i < count; i++) {
+		double a = amplitude(y, len, 1, freq + i * step, rate);
+
+		sum += a * a / 2;
+	}
+
+	return sum / count;
+}
+
+// Frequency of the signal around sample at, from the first and the last
+// upward zero crossing within span samples either side
+static double crossing_freq(const float *y, long at, long span, double rate)
+{
+	double first = -1, last = -1;
+	int crossings = 0;
+
+	for (long i = at - span; i < at + span; i++) {
+		float a = y[i], b = y[i + 1];
+
+		if (a < 0 && b >= 0) {
+			last = i + a / (a - b);
+			if (first < 0)
+				first = last;
+			crossings++;
+		}
+	}
+
+	return crossings > 1 ? (crossings - 1) * rate / (last - first) : 0;
+}
+
+// Test signal generators at 48 kHz stereo: the time to make each, and one
+// property of each that a measurement depends on. Fails unless the sine is
+// 90 dB pure (80 in fixed point), the multitone's tones are level within
+// 0.1 dB, a 100 Hz to 10 kHz sweep passes 1 kHz at its midpoint within 1%,
+// white noise has the RMS of a uniform distribution within 0.1 dB, pink
+// noise falls 12 dB over the four octaves from 200 Hz within 1.5 dB, and
+// the calibration tone is 1 kHz at full scale within 0.01 dB and repeats
+// exactly every 48 samples.
+static int bench_siggen()
+{
+	static const char *specs[] = {
+		"test:sine", "test:multitone", "test:sweep,from=100,to=10000,time=1", "test:white", "test:pink", "test:cal"
+	};
+	long len = 4 * SIGGEN_RATE;
+	sample_t *out = malloc(len * SIGGEN_CHANNELS * sizeof(sample_t));
+	float *y = malloc(len * SIGGEN_CHANNELS * sizeof(float));
+	struct siggen g;
+	int ret = -1;
+
+	if (!out || !y)
+		goto exit;
+
+	printf("Test signals: %d s at %d Hz, %d channels\n", BENCH_SECONDS, SIGGEN_RATE, SIGGEN_CHANNELS);
+
+	for (size_t k = 0; k < sizeof(specs) / sizeof(specs[0]); k++) {
+		long produced = 0;
+		int ok = 0;
+
+		if (siggen_open(&g, specs[k], NULL) < 0)
+			goto exit;
+		double start = cpu_time();
+		while (produced < (long)SIGGEN_RATE * BENCH_SECONDS)
+			produced += siggen_read(&g, out, DATA_SIZE);
+		double seconds = cpu_time() - start;
+		siggen_close(&g);
+		report_at("siggen", (char *)siggen_name(k), seconds, produced, NAN, SIGGEN_RATE);
+
+		if (siggen_open(&g, specs[k], NULL) < 0)
+			goto exit;
+		// The noise is checked from a second before a 32 bit sample count
+		// would wrap, about a day into a soak run
+		g.counter = (1ULL << 32) - SIGGEN_RATE;
+		siggen_read(&g, out, len);
+		to_float(y, out, len * SIGGEN_CHANNELS);
+		// The channels are the same, the checks take the first
+		for (long i = 0; i < len; i++)
+			y[i] = y[i * SIGGEN_CHANNELS];
+
+		switch (g.kind) {
+		case SIGGEN_SINE: {
+			double db = purity(y, SIGGEN_RATE, g.freq, SIGGEN_RATE);
+
+			printf("  %-12s %-10s purity %.1f dB: ", "siggen", siggen_name(g.kind), db);
+#ifdef FIXED_POINT
+			ok = db >= 80;
+#else
+			ok = db >= 90;
+#endif
+			break;
+		}
+		case SIGGEN_MULTITONE: {
+			static const double tones[] = { 31.5, 63, 125, 250, 500, 1000, 2000, 4000, 8000, 12500 };
+			double worst = 0;
+
+			// Two seconds hold a whole number of cycles of every tone
+			for (int t = 0; t < g.tones; t++) {
+				double db = 20 * log10(amplitude(y, 2 * SIGGEN_RATE, 1, tones[t], SIGGEN_RATE) / g.amp[0]);
+
+				if (fabs(db) > fabs(worst))
+					worst = db;
+			}
+			printf("  %-12s %-10s worst tone %+.3f dB: ", "siggen", siggen_name(g.kind), worst);
+			ok = fabs(worst) < 0.1;
+			break;
+		}
+		case SIGGEN_SWEEP: {
+			double f = crossing_freq(y, SIGGEN_RATE / 2, SIGGEN_RATE / 100, SIGGEN_RATE);
+
+			printf("  %-12s %-10s %.1f Hz at the midpoint: ", "siggen", siggen_name(g.kind), f);
+			ok = fabs(f / sqrt(g.freq * g.to) - 1) < 0.01;
+			break;
+		}
+		case SIGGEN_WHITE: {
+			double power = 0, db;
+
+			for (long i = 0; i < len; i++)
+				power += (double)y[i] * y[i];
+			db = 10 * log10(power / len / (g.level * g.level / 3));
+			printf("  %-12s %-10s RMS %+.3f dB from uniform: ", "siggen", siggen_name(g.kind), db);
+			ok = fabs(db) < 0.1;
+			break;
+		}
+		case SIGGEN_PINK: {
+			double low = band_power(y, len, 180, 0.25, 160, SIGGEN_RATE);
+			double high = band_power(y, len, 3180, 0.25, 160, SIGGEN_RATE);
+			double db = 10 * log10(low / high);
+
+			printf("  %-12s %-10s %.2f dB from 200 Hz to 3.2 kHz: ", "siggen", siggen_name(g.kind), db);
+			ok = fabs(db - 10 * log10(16)) < 1.5;
+			break;
+		}
+		case SIGGEN_CAL: {
+			double db = 20 * log10(amplitude(y, SIGGEN_RATE, 1, 1000, SIGGEN_RATE));
+			int period = SIGGEN_RATE / 1000;
+			int periodic = 1;
+
+			for (long i = 0; i + period < len; i++)
+				periodic &= out[(i + period) * SIGGEN_CHANNELS] == out[i * SIGGEN_CHANNELS];
+			printf("  %-12s %-10s %+.4f dBFS, %s: ", "siggen", siggen_name(g.kind), db,
+				periodic ? "periodic" : "not periodic");
+			ok = fabs(db) < 0.01 && periodic;
+			break;
+		}
+		}
+		siggen_close(&g);
+
+		printf("%s\n", ok ? "ok" : "FAILED");
+		if (!ok)
+			goto exit;
+	}
+	ret = 0;
+
+exit:
+	free(out);
+	free(y);
+	return ret;
+}
+
+int bench_run(char *name) {
+	int all = strcmp(name, "all") == 0;
+	int found = 0;
+
+	printf("Baseband samples are %s.\n", SAMPLE_FORMAT);
+
+	if (all || strcmp(name, "resampler") == 0) {
+		found = 1;
+		if (bench_resampler() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "mpx") == 0) {
+		found = 1;
+		if (bench_mpx() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "rds") == 0) {
+		found = 1;
+		if (bench_rds() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "refill") == 0) {
+		found = 1;
+		if (bench_refill() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "process") == 0) {
+		found = 1;
+		if (bench_process() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "clip") == 0) {
+		found = 1;
+		if (bench_clip() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "net") == 0) {
+		found = 1;
+		if (bench_net() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "playlist") == 0) {
+		found = 1;
+		if (bench_playlist() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "tune") == 0) {
+		found = 1;
+		if (bench_tune() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "dma") == 0) {
+		found = 1;
+		if (bench_dma() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "rate") == 0) {
+		found = 1;
+		if (bench_rate() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "trace") == 0) {
+		found = 1;
+		if (bench_trace() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "drift") == 0) {
+		found = 1;
+		if (bench_drift() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "latency") == 0) {
+		found = 1;
+		if (bench_latency() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "cache") == 0) {
+		found = 1;
+		if (bench_cache() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "composite") == 0) {
+		found = 1;
+		if (bench_composite() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "siggen") == 0) {
+		found = 1;
+		if (bench_siggen() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "fixed") == 0) {
+		found = 1;
+		if (bench_fixed() < 0) return 1;
+	}
+
+	if (all || strcmp(name, "pipeline") == 0) {
+		found = 1;
+		if (bench_pipeline() < 0) return 1;
+	}
+
+	if (!found) {
+		fprintf(stderr, "Unknown benchmark: %s\n", name);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,13 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+extern int bench_run(char *name);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <math.h>
+#include "biquad.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+void biquad4_set(struct biquad4 *bq, int lane, double b0, double b1, double b2, double a0, double a1, double a2)
+{
+	bq->b0[lane] = b0 / a0;
+	bq->b1[lane] = b1 / a0;
+	bq->b2[lane] = b2 / a0;
+	bq->a1[lane] = a1 / a0;
+	bq->a2[lane] = a2 / a0;
+}
+
+// Second order sections from the RBJ cookbook
+void biquad4_design(struct biquad4 *bq, int lane, int type, double freq, double q, double rate)
+{
+	double w = 2 * M_PI * freq / rate;
+	double alpha = sin(w) / (2 * q), c = cos(w);
+
+	switch (type) {
+	case BQ_LOWPASS:
+		biquad4_set(bq, lane, (1 - c) / 2, 1 - c, (1 - c) / 2, 1 + alpha, -2 * c, 1 - alpha);
+		break;
+	case BQ_HIGHPASS:
+		biquad4_set(bq, lane, (1 + c) / 2, -(1 + c), (1 + c) / 2, 1 + alpha, -2 * c, 1 - alpha);
+		break;
+	case BQ_ALLPASS:
+		biquad4_set(bq, lane, 1 - alpha, -2 * c, 1 + alpha, 1 + alpha, -2 * c, 1 - alpha);
+		break;
+	case BQ_BANDPASS:
+		biquad4_set(bq, lane, alpha, 0, -alpha, 1 + alpha, -2 * c, 1 - alpha);
+		break;
+	}
+}
+
+// Run the four lanes over len frames of four floats each; in and out may
+// be the same buffer. The lanes are independent, so each frame is a single
+// vector operation and only the recursion runs serially.
+void biquad4_run(struct biquad4 *bq, const float *in, float *out, int len)
+{
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	float32x4_t b0 = vld1q_f32(bq->b0), b1 = vld1q_f32(bq->b1), b2 = vld1q_f32(bq->b2);
+	float32x4_t a1 = vld1q_f32(bq->a1), a2 = vld1q_f32(bq->a2);
+	float32x4_t z1 = vld1q_f32(bq->z1), z2 = vld1q_f32(bq->z2);
+
+	for (int i = 0; i < len; i++) {
+		float32x4_t x = vld1q_f32(in + 4 * i);
+		float32x4_t y = vmlaq_f32(z1, b0, x);
+
+		z1 = vmlsq_f32(vmlaq_f32(z2, b1, x), a1, y);
+		z2 = vmlsq_f32(vmulq_f32(b2, x), a2, y);
+		vst1q_f32(out + 4 * i, y);
+	}
+	vst1q_f32(bq->z1, z1);
+	vst1q_f32(bq->z2, z2);
+#elif defined(__SSE__)
+	__m128 b0 = _mm_loadu_ps(bq->b0), b1 = _mm_loadu_ps(bq->b1), b2 = _mm_loadu_ps(bq->b2);
+	__m128 a1 = _mm_loadu_ps(bq->a1), a2 = _mm_loadu_ps(bq->a2);
+	__m128 z1 = _mm_loadu_ps(bq->z1), z2 = _mm_loadu_ps(bq->z2);
+
+	for (int i = 0; i < len; i++) {
+		__m128 x = _mm_loadu_ps(in + 4 * i);
+		__m128 y = _mm_add_ps(z1, _mm_mul_ps(b0, x));
+
+		z1 = _mm_sub_ps(_mm_add_ps(z2, _mm_mul_ps(b1, x)), _mm_mul_ps(a1, y));
+		z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+		_mm_storeu_ps(out + 4 * i, y);
+	}
+	_mm_storeu_ps(bq->z1, z1);
+	_mm_storeu_ps(bq->z2, z2);
+#else
+	for (int i = 0; i < len; i++) {
+		for (int l = 0; l < 4; l++) {
+			float x = in[4 * i + l];
+			float y = bq->b0[l] * x + bq->z1[l];
+
+			bq->z1[l] = bq->b1[l] * x - bq->a1[l] * y + bq->z2[l];
+			bq->z2[l] = bq->b2[l] * x - bq->a2[l] * y;
+			out[4 * i + l] = y;
+		}
+	}
+#endif
+}
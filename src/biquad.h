@@ -0,0 +1,27 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef BIQUAD_H
+#define BIQUAD_H
+
+// Second order section types for biquad4_design()
+#define BQ_LOWPASS 0
+#define BQ_HIGHPASS 1
+#define BQ_ALLPASS 2
+#define BQ_BANDPASS 3                   // 0 dB at the centre
+
+// Four independent biquads, one per vector lane, transposed direct form II
+struct biquad4 {
+	float b0[4], b1[4], b2[4], a1[4], a2[4];
+	float z1[4], z2[4];
+};
+
+extern void biquad4_set(struct biquad4 *bq, int lane, double b0, double b1, double b2, double a0, double a1, double a2);
+extern void biquad4_design(struct biquad4 *bq, int lane, int type, double freq, double q, double rate);
+extern void biquad4_run(struct biquad4 *bq, const float *in, float *out, int len);
+
+#endif
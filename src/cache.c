@@ -0,0 +1,328 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sndfile.h>
+#include "cache.h"
+#include "fm_mpx.h"
+#include "decoder.h"
+#include "pcm_map.h"
+
+#define CACHE_MAGIC                     "PIFMMPX"
+
+// At the start of the file, padded so the samples after it stay aligned
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t sample_size;           // 4 for float, 2 for Q15
+	uint32_t rate;
+	uint32_t channels;
+	uint64_t frames;
+	uint64_t key;
+	uint8_t pad[24];
+};
+
+// FNV-1a, 64 bit
+static uint64_t fnv(uint64_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+// The input bytes, then every setting that changes what is rendered from
+// them. A file edited in place gets a new key, and the old render is
+// simply never looked up again.
+static int cache_key(char *filename, char *raw, const struct cache_params *p, uint64_t *key)
+{
+	struct stat st;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int32_t fields[] = { CACHE_VERSION, sizeof(sample_t), p->mpx_rate, p->resampler_type, p->processing, p->preemph };
+	void *base;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return -1;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -1;
+
+	madvise(base, st.st_size, MADV_SEQUENTIAL);
+	h = fnv(h, base, st.st_size);
+	munmap(base, st.st_size);
+
+	h = fnv(h, fields, sizeof(fields));
+	h = fnv(h, &p->ppm, sizeof(p->ppm));
+	if (raw)
+		h = fnv(h, raw, strlen(raw));
+	*key = h;
+
+	return 0;
+}
+
+static size_t cache_length(long frames, int channels)
+{
+	return sizeof(struct cache_header) + (size_t)frames * channels * sizeof(sample_t);
+}
+
+// 0 with a valid file for key mapped, 1 without one
+static int cache_load(struct cache *c, const char *path, int rate)
+{
+	const struct cache_header *h;
+	struct stat st;
+	void *base;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 1;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct cache_header)) {
+		close(fd);
+		return 1;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return 1;
+
+	h = base;
+	if (memcmp(h->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) || h->version != CACHE_VERSION ||
+		h->sample_size != sizeof(sample_t) || h->rate != (uint32_t)rate || h->key != c->key ||
+		(h->channels != 1 && h->channels != 2) || h->frames == 0 ||
+		(size_t)st.st_size != cache_length(h->frames, h->channels)) {
+		munmap(base, st.st_size);
+		return 1;
+	}
+
+	c->base = base;
+	c->length = st.st_size;
+	c->frames = h->frames;
+	c->channels = h->channels;
+	c->data = (const sample_t *)(h + 1);
+	madvise(base, st.st_size, MADV_WILLNEED);
+
+	return 0;
+}
+
+// Opens the input and checks that it can be cached at all, before a byte
+// of it is hashed. 1 if it cannot: not seekable, or longer than
+// CACHE_MAX_S.
+static int cache_check(char *filename, char *raw, SNDFILE **inf, SF_INFO *sfinfo)
+{
+	memset(sfinfo, 0, sizeof(SF_INFO));
+	if (raw) {
+		int format;
+
+		if (pcm_parse_raw(raw, &sfinfo->samplerate, &sfinfo->channels, &format) < 0)
+			return -1;
+		sfinfo->format = SF_FORMAT_RAW | (format == PCM_FLOAT ? SF_FORMAT_FLOAT : SF_FORMAT_PCM_16);
+	}
+	if (!(*inf = sf_open(filename, SFM_READ, sfinfo))) {
+		fprintf(stderr, "Error: could not open %s to cache it.\n", filename);
+		return -1;
+	}
+	if (!sfinfo->seekable || sfinfo->frames <= 0 || sfinfo->frames > (sf_count_t)CACHE_MAX_S * sfinfo->samplerate ||
+		(sfinfo->channels != 1 && sfinfo->channels != 2)) {
+		sf_close(*inf);
+		*inf = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+// Renders the input through the same decoder as fm_mpx_get_samples(), block
+// by block, into an anonymous mapping laid out like the file
+static int cache_render(struct cache *c, SNDFILE *inf, const SF_INFO *sfinfo, const struct cache_params *p)
+{
+	struct decoder dec;
+	int channels = sfinfo->channels;
+	double ratio = (float)p->mpx_rate / sfinfo->samplerate + (p->ppm / 1e6);
+	int ret = -1;
+#ifdef FIXED_POINT
+	float *in = NULL;
+#endif
+
+	if (decoder_open(&dec, sfinfo->samplerate, channels, p->mpx_rate, ratio, ratio, p->resampler_type,
+		p->processing, p->preemph, p->block) < 0)
+		return -1;
+
+	long max_frames = sfinfo->frames * ratio + 2 * (sfinfo->frames / dec.block + 2) + dec.room;
+
+#ifdef FIXED_POINT
+	if (!(in = malloc(dec.block * channels * sizeof(float))))
+		goto exit;
+#endif
+	c->length = cache_length(max_frames, channels);
+	c->base = mmap(NULL, c->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (c->base == MAP_FAILED) {
+		c->base = NULL;
+		goto exit;
+	}
+
+	sample_t *dst = (sample_t *)((struct cache_header *)c->base + 1);
+	long written = 0;
+
+	// The first pass only brings the processing and the resampler round to
+	// the end of the input, as a looping file would. Blocks are resampled
+	// straight into the mapping, which keeps room for a whole one at the
+	// end.
+	for (int pass = 0; pass < 2; pass++) {
+		int n;
+
+		if (sf_seek(inf, 0, SEEK_SET) < 0)
+			goto exit;
+		for (;;) {
+			int len;
+
+#ifdef FIXED_POINT
+			// Converted the way mapped files are
+			if ((n = sf_readf_float(inf, in, dec.block)) <= 0)
+				break;
+			for (int i = 0; i < n * channels; i++)
+				dec.input[i] = sample_from_float(in[i]);
+#else
+			if ((n = sf_readf_float(inf, dec.input, dec.block)) <= 0)
+				break;
+#endif
+			if (written + dec.room > max_frames)
+				goto exit;
+			len = decoder_resample(&dec, decoder_process(&dec, dec.input, n), n, dst + written * channels);
+			if (len < 0)
+				goto exit;
+			if (pass == 1)
+				written += len;
+		}
+		if (n < 0)
+			goto exit;
+	}
+
+	struct cache_header *h = c->base;
+
+	memcpy(h->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	h->version = CACHE_VERSION;
+	h->sample_size = sizeof(sample_t);
+	h->rate = p->mpx_rate;
+	h->channels = channels;
+	h->frames = written;
+	h->key = c->key;
+
+	c->frames = written;
+	c->channels = channels;
+	c->data = dst;
+	ret = written ? 0 : -1;
+
+exit:
+	decoder_close(&dec);
+#ifdef FIXED_POINT
+	free(in);
+#endif
+	if (ret < 0)
+		cache_close(c);
+	return ret;
+}
+
+// Written to a temporary file and renamed, so another instance never maps
+// half a file
+static int cache_store(struct cache *c, const char *path)
+{
+	char tmp[4096 + 16];
+	size_t length = cache_length(c->frames, c->channels);
+	int fd, ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return -1;
+
+	ok = 1;
+	for (size_t done = 0; ok && done < length; ) {
+		ssize_t n = write(fd, (const uint8_t *)c->base + done, length - done);
+
+		if (n <= 0)
+			ok = 0;
+		else
+			done += n;
+	}
+	if (close(fd) || !ok || rename(tmp, path)) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+// The input rendered with the settings in p, mapped from <dir>/<key>.mpx if
+// it is there and rendered and stored otherwise. Without a directory the
+// render is kept in memory only. 1 if the input cannot be cached: not a
+// regular seekable file, or longer than CACHE_MAX_S.
+int cache_open(struct cache *c, const char *dir, char *filename, char *raw, const struct cache_params *p) {
+	char path[4096];
+	SF_INFO sfinfo;
+	SNDFILE *inf;
+	int ret;
+
+	memset(c, 0, sizeof(struct cache));
+	if ((ret = cache_check(filename, raw, &inf, &sfinfo)) != 0)
+		return ret;
+	if (cache_key(filename, raw, p, &c->key) < 0) {
+		sf_close(inf);
+		return 1;
+	}
+
+	if (dir) {
+		snprintf(path, sizeof(path), "%s/%016llx.mpx", dir, (unsigned long long)c->key);
+		if (cache_load(c, path, p->mpx_rate) == 0) {
+			sf_close(inf);
+			return 0;
+		}
+	}
+
+	ret = cache_render(c, inf, &sfinfo, p);
+	sf_close(inf);
+	if (ret != 0)
+		return ret;
+
+	if (dir && ((mkdir(dir, 0755) < 0 && errno != EEXIST) || cache_store(c, path) < 0))
+		fprintf(stderr, "Warning: could not write the baseband cache to %s, playing from memory.\n", path);
+	mprotect(c->base, c->length, PROT_READ);
+
+	return 0;
+}
+
+// Up to max_frames frames from the current position, 0 at the end.
+// *frames points into the mapping.
+int cache_read(struct cache *c, const sample_t **frames, int max_frames) {
+	int len = (c->frames - c->pos < max_frames) ? c->frames - c->pos : max_frames;
+
+	*frames = c->data + c->pos * c->channels;
+	c->pos += len;
+
+	return len;
+}
+
+void cache_rewind(struct cache *c) {
+	c->pos = 0;
+}
+
+void cache_close(struct cache *c) {
+	if (c->base)
+		munmap(c->base, c->length);
+	memset(c, 0, sizeof(struct cache));
+}
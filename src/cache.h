@@ -0,0 +1,52 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sample.h"
+
+// Longest input rendered into the cache. Stereo float at 192 kHz takes
+// 1.5 MB per second, so this is meant for jingles and loops, not shows.
+#define CACHE_MAX_S                     600
+
+#define CACHE_VERSION                   1
+
+// Everything besides the input that goes into the rendered audio. A cache
+// file is only used when all of it matches, along with the input bytes.
+struct cache_params {
+	int mpx_rate;
+	float ppm;
+	int resampler_type;
+	int processing;
+	int preemph;
+	int block;                      // input frames per block, as fm_mpx reads them
+};
+
+// Input audio processed and resampled to the baseband rate, before the
+// volume and the multiplex, read in place from a memory-mapped file in
+// <dir>/<key>.mpx. The rendering is the second of two passes over the
+// input, so the filters and the AGC start where a looping file leaves
+// them and the loop has no seam.
+struct cache {
+	void *base;
+	size_t length;
+	const sample_t *data;           // first frame
+	long frames;
+	long pos;
+	int channels;
+	uint64_t key;
+};
+
+extern int cache_open(struct cache *c, const char *dir, char *filename, char *raw, const struct cache_params *p);
+extern int cache_read(struct cache *c, const sample_t **frames, int max_frames);
+extern void cache_rewind(struct cache *c);
+extern void cache_close(struct cache *c);
+
+#endif
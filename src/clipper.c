@@ -0,0 +1,211 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <string.h>
+#include <math.h>
+#include "clipper.h"
+
+// Half width of the soft knee, relative to the limit
+#define CLIP_KNEE 0.05f
+
+// Bands kept free of clip distortion, centre and width in Hz
+#define PROTECT_PILOT 19000.0
+#define PROTECT_PILOT_WIDTH 2000.0
+#define PROTECT_RDS 57000.0
+#define PROTECT_RDS_WIDTH 5000.0
+
+// The protect filter is stopped once its state has decayed below this
+#define IDLE_LEVEL 1e-7f
+
+void mpx_clipper_init(struct mpx_clipper *clip, int rate, float limit, float scale, int pilot, int rds) {
+	memset(clip, 0, sizeof(struct mpx_clipper));
+	clip->limit = limit;
+	clip->scale = scale;
+	clip->knee = CLIP_KNEE * limit;
+	clip->window = rate / 1000;
+	clip->idle = 1;
+
+	// Lane 0 for the pilot, lane 1 for RDS; lanes left at zero output zero
+	for (int p = 0; p < CLIP_PASSES; p++) {
+		if (pilot)
+			biquad4_design(&clip->protect[p], 0, BQ_BANDPASS, PROTECT_PILOT, PROTECT_PILOT / PROTECT_PILOT_WIDTH, rate);
+		if (rds)
+			biquad4_design(&clip->protect[p], 1, BQ_BANDPASS, PROTECT_RDS, PROTECT_RDS / PROTECT_RDS_WIDTH, rate);
+	}
+	clip->filtered = pilot || rds;
+}
+
+// Largest magnitude in a run of samples. Written as compares rather than
+// fmaxf() so it vectorizes without -ffast-math.
+static float peak(const sample_t *x, int len)
+{
+#ifdef FIXED_POINT
+	int32_t p = 0;
+
+	for (int i = 0; i < len; i++) {
+		int32_t a = x[i] < 0 ? -x[i] : x[i];
+
+		p = a > p ? a : p;
+	}
+
+	return p * (1.0f / 32768);
+#else
+	float p = 0;
+
+	for (int i = 0; i < len; i++) {
+		float a = fabsf(x[i]);
+
+		p = a > p ? a : p;
+	}
+
+	return p;
+#endif
+}
+
+static void histogram(struct mpx_clipper *clip, float peak)
+{
+	float deviation = 1 - (clip->limit - peak) * clip->scale;
+	int bin = 0;
+
+	while (bin < CLIP_HIST_BINS - 1 && deviation * 100 >= clip_hist_edges[bin])
+		bin++;
+	clip->stats.peaks[bin]++;
+	if (deviation > clip->stats.max_peak)
+		clip->stats.max_peak = deviation;
+}
+
+static void clip_chunk(struct mpx_clipper *clip, sample_t *audio, int len)
+{
+	float limit = clip->limit;
+	float threshold = limit - clip->knee;
+	float span = 2 * clip->knee;
+	float curve = 1 / (4 * clip->knee);
+	float *err = clip->error;
+	float *lanes = clip->lanes;
+	float worst = 0;
+	int clipped = 0, overshoots = 0;
+#ifdef FIXED_POINT
+	float *x = clip->buffer;
+
+	for (int i = 0; i < len; i++)
+		x[i] = sample_to_float(audio[i]);
+#else
+	float *x = audio;
+#endif
+
+	for (int pass = 0; pass < CLIP_PASSES; pass++) {
+		// A parabola from the threshold, where it leaves the signal alone,
+		// to limit + knee, where it meets the limit with zero slope
+		for (int i = 0; i < len; i++) {
+			float a = fabsf(x[i]);
+			float u = a - threshold;
+
+			u = u < 0 ? 0 : u;
+			u = u > span ? span : u;
+
+			float y = threshold + u - u * u * curve;
+
+			y = a < y ? a : y;
+			err[i] = copysignf(y, x[i]) - x[i];
+			if (pass == 0)
+				clipped += a > threshold;
+		}
+
+		// Take out what the clipping added around the pilot and RDS
+		if (clip->filtered) {
+			for (int i = 0; i < len; i++) {
+				lanes[4 * i] = err[i];
+				lanes[4 * i + 1] = err[i];
+				lanes[4 * i + 2] = 0;
+				lanes[4 * i + 3] = 0;
+			}
+			biquad4_run(&clip->protect[pass], lanes, lanes, len);
+			for (int i = 0; i < len; i++)
+				err[i] -= lanes[4 * i] + lanes[4 * i + 1];
+		}
+
+		if (pass < CLIP_PASSES - 1) {
+			for (int i = 0; i < len; i++)
+				x[i] += err[i];
+		}
+	}
+
+	for (int i = 0; i < len; i++) {
+		float y = x[i] + err[i];
+		float over = fabsf(y) - limit;
+
+		overshoots += over > 0;
+		worst = over > worst ? over : worst;
+		y = y > limit ? limit : y;
+		y = y < -limit ? -limit : y;
+#ifdef FIXED_POINT
+		audio[i] = sample_from_float(y);
+#else
+		audio[i] = y;
+#endif
+	}
+
+	clip->stats.clipped += clipped;
+	clip->stats.overshoots += overshoots;
+	if (worst * clip->scale > clip->stats.max_overshoot)
+		clip->stats.max_overshoot = worst * clip->scale;
+}
+
+void mpx_clipper_run(struct mpx_clipper *clip, sample_t *audio, int len) {
+	float threshold = clip->limit - clip->knee;
+	float block_peak = 0;
+
+	clip->stats.samples += len;
+
+	// The histogram scan also tells whether there is anything to clip
+	for (int done = 0; done < len;) {
+		int run = clip->window - clip->window_fill;
+
+		if (run > len - done)
+			run = len - done;
+
+		float p = peak(audio + done, run);
+
+		if (p > clip->window_peak)
+			clip->window_peak = p;
+		if (p > block_peak)
+			block_peak = p;
+
+		done += run;
+		clip->window_fill += run;
+		if (clip->window_fill == clip->window) {
+			histogram(clip, clip->window_peak);
+			clip->window_fill = 0;
+			clip->window_peak = 0;
+		}
+	}
+
+	if (block_peak <= threshold && clip->idle)
+		return;
+	if (block_peak > threshold)
+		clip->idle = !clip->filtered;
+
+	for (int i = 0; i < len; i += CLIP_CHUNK)
+		clip_chunk(clip, audio + i, (len - i < CLIP_CHUNK) ? len - i : CLIP_CHUNK);
+
+	// Nothing clipped and the filter has rung out: back to only scanning
+	if (block_peak <= threshold) {
+		int quiet = 1;
+
+		for (int p = 0; p < CLIP_PASSES; p++) {
+			for (int l = 0; l < 4; l++)
+				quiet &= fabsf(clip->protect[p].z1[l]) < IDLE_LEVEL && fabsf(clip->protect[p].z2[l]) < IDLE_LEVEL;
+		}
+		if (quiet) {
+			for (int p = 0; p < CLIP_PASSES; p++) {
+				memset(clip->protect[p].z1, 0, sizeof(clip->protect[p].z1));
+				memset(clip->protect[p].z2, 0, sizeof(clip->protect[p].z2));
+			}
+			clip->idle = 1;
+		}
+	}
+}
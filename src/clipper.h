@@ -0,0 +1,51 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef CLIPPER_H
+#define CLIPPER_H
+
+#include "sample.h"
+#include "biquad.h"
+#include "stats.h"
+
+// Frames the float stages work on at a time
+#define CLIP_CHUNK 256
+
+// Clip and clean up this many times before the final hard clip. The first
+// pass alone leaves about a third of the clipped samples over the limit
+// again; after the second, next to none are.
+#define CLIP_PASSES 2
+
+// Composite clipper. It runs on the audio part of the multiplex, before
+// the pilot and RDS are added, and holds it to the share of the peak
+// deviation that is left for audio: a soft knee clipper, then the clip
+// error is stripped of anything near 19 and 57 kHz so the distortion does
+// not land on the pilot or RDS, then whatever that pushed back over the
+// limit is hard clipped and counted as overshoot.
+struct mpx_clipper {
+	float limit;                    // audio peak, fraction of full scale
+	float scale;                    // to the fraction of the peak deviation
+	float knee;                     // soft from limit - knee to limit + knee
+	struct biquad4 protect[CLIP_PASSES]; // bandpass at 19 and 57 kHz on the clip error
+	int filtered;                   // any protect lane in use
+	int idle;                       // protect filter decayed to nothing
+	int window;                     // 1 ms histogram window
+	int window_fill;
+	float window_peak;
+	struct clip_stats stats;
+
+	float error[CLIP_CHUNK];
+	float lanes[CLIP_CHUNK * 4];
+#ifdef FIXED_POINT
+	float buffer[CLIP_CHUNK];
+#endif
+};
+
+extern void mpx_clipper_init(struct mpx_clipper *clip, int rate, float limit, float scale, int pilot, int rds);
+extern void mpx_clipper_run(struct mpx_clipper *clip, sample_t *audio, int len);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include "control.h"
+#include "fm_mpx.h"
+#include "rds.h"
+
+#define CTL_BUFFER_SIZE 256
+
+// How often the control thread checks whether it should stop
+#define CTL_POLL_MS 100
+
+static int fd = -1;
+static pthread_t thread;
+static volatile int stop;
+static struct control_params *params;
+
+static void handle_command(char *cmd)
+{
+	char *arg = strchr(cmd, ' ');
+
+	if (arg == NULL)
+		return;
+	*arg++ = 0;
+
+	if (strcmp(cmd, "PS") == 0) {
+		set_rds_ps(arg);
+		printf("PS set to: \"%s\"\n", arg);
+	} else if (strcmp(cmd, "RT") == 0) {
+		set_rds_rt(arg);
+		printf("RT set to: \"%s\"\n", arg);
+	} else if (strcmp(cmd, "TA") == 0) {
+		set_rds_ta(strcmp(arg, "ON") == 0);
+		printf("Set TA to %s\n", strcmp(arg, "ON") == 0 ? "ON" : "OFF");
+	} else if (strcmp(cmd, "PTY") == 0) {
+		int pty = atoi(arg);
+
+		if (pty >= 0 && pty <= 31) {
+			set_rds_pty(pty);
+			printf("PTY set to: %d\n", pty);
+		}
+	} else if (strcmp(cmd, "DEV") == 0) {
+		float deviation = atof(arg);
+
+		if (deviation > 0 && deviation <= params->max_deviation) {
+			atomic_store_explicit(&params->deviation, deviation, memory_order_relaxed);
+			printf("Deviation set to: %.1f kHz\n", deviation);
+		} else {
+			fprintf(stderr, "Deviation has to be between 0 and %.1f kHz\n", params->max_deviation);
+		}
+	} else if (strcmp(cmd, "VOL") == 0) {
+		float volume = atof(arg);
+
+		if (volume >= 0 && volume <= 200) {
+			fm_mpx_set_volume(volume / 100);
+			printf("Volume set to: %.0f%%\n", volume);
+		}
+	} else if (strcmp(cmd, "INSERT") == 0) {
+		if (fm_mpx_insert(arg) == 0)
+			printf("Inserted: %s\n", arg);
+	}
+}
+
+// Blocks in poll() on its own thread, so neither the DSP nor the refill
+// ever waits for the pipe
+static void *control_thread(void *arg)
+{
+	char buf[CTL_BUFFER_SIZE];
+	int len = 0;
+
+	while (!stop) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+
+		if (poll(&pfd, 1, CTL_POLL_MS) <= 0)
+			continue;
+
+		int n = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (n <= 0)
+			continue;
+		len += n;
+		buf[len] = 0;
+
+		char *line = buf, *end;
+		while ((end = strchr(line, '\n'))) {
+			*end = 0;
+			if (end > line && end[-1] == '\r')
+				end[-1] = 0;
+			handle_command(line);
+			line = end + 1;
+		}
+
+		len -= line - buf;
+		// Drop lines too long to ever fit
+		if (len == sizeof(buf) - 1)
+			len = 0;
+		memmove(buf, line, len);
+	}
+
+	return NULL;
+}
+
+int control_open(char *path, struct control_params *ctl_params) {
+	// Opened read-write so there is always a writer, and poll() does not
+	// report a hangup every time a client closes its end
+	if ((fd = open(path, O_RDWR | O_NONBLOCK)) < 0) {
+		fprintf(stderr, "Error: could not open control pipe %s.\n", path);
+		return -1;
+	}
+
+	params = ctl_params;
+	stop = 0;
+	if (pthread_create(&thread, NULL, control_thread, NULL)) {
+		fprintf(stderr, "Error: could not start the control thread.\n");
+		close(fd);
+		fd = -1;
+		return -1;
+	}
+
+	printf("Reading control commands on %s.\n", path);
+
+	return 0;
+}
+
+void control_close() {
+	if (fd < 0)
+		return;
+
+	stop = 1;
+	pthread_join(thread, NULL);
+	close(fd);
+	fd = -1;
+}
@@ -0,0 +1,24 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdatomic.h>
+
+// Parameters that can change while transmitting. The control thread
+// stores them; the TX loop loads them once per block, so a change never
+// lands in the middle of one and the hot path makes no system calls.
+struct control_params {
+	_Atomic float deviation;        // kHz
+	float max_deviation;            // kHz, keeps PLLA_FRAC in range
+};
+
+extern int control_open(char *path, struct control_params *params);
+extern void control_close();
+
+#endif
@@ -0,0 +1,145 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decoder.h"
+#include "fm_mpx.h"
+
+// Sets up the processing and the resampler for input at in_rate, and cuts
+// block down to what they take at once. Blocks are sized for max_ratio,
+// the largest ratio the drift servo may ask for.
+int decoder_open(struct decoder *d, int in_rate, int channels, int mpx_rate, double ratio, double max_ratio, int resampler_type, int processing, int preemph, int block) {
+	memset(d, 0, sizeof(struct decoder));
+	d->channels = channels;
+	d->room = DATA_SIZE * 16;
+
+	if (audio_proc_init(&d->proc, in_rate, channels, processing, preemph) < 0) {
+		fprintf(stderr, "Error: could not set up the audio processing\n");
+		goto fail;
+	}
+	if (block > PROC_MAX_FRAMES)
+		block = PROC_MAX_FRAMES;
+
+	if (resampler_type == RESAMPLER_POLY) {
+		if ((d->poly = resampler_new(channels, in_rate, mpx_rate, ratio)) == NULL) {
+			fprintf(stderr, "Error: could not create the resampler\n");
+			goto fail;
+		}
+		// Never hand the resampler more input than fits into the output
+		resampler_set_ratio(d->poly, max_ratio);
+		if (block > resampler_max_input(d->poly, d->room))
+			block = resampler_max_input(d->poly, d->room);
+		resampler_set_ratio(d->poly, ratio);
+	} else {
+		int src_error;
+		int converter = (resampler_type == RESAMPLER_SINC) ? SRC_SINC_FASTEST : SRC_ZERO_ORDER_HOLD;
+
+		if ((d->src = src_new(converter, channels, &src_error)) == NULL) {
+			fprintf(stderr, "Error: src_new failed: %s\n", src_strerror(src_error));
+			goto fail;
+		}
+		d->src_data.src_ratio = ratio;
+		d->src_data.output_frames = d->room;
+		// Input libsamplerate has no room for is dropped
+		if (block >= d->room / max_ratio)
+			block = d->room / max_ratio - 1;
+	}
+	d->block = block;
+
+	d->input = malloc(block * channels * sizeof(sample_t));
+	int ok = d->input != NULL;
+#ifdef FIXED_POINT
+	d->src_in = malloc(block * channels * sizeof(float));
+	d->src_out = malloc(d->room * channels * sizeof(float));
+	d->proc_buffer = malloc(block * channels * sizeof(float));
+	ok = ok && d->src_in && d->src_out && d->proc_buffer;
+#endif
+	if (!ok) {
+		fprintf(stderr, "Error: could not allocate the decoder buffers\n");
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	decoder_close(d);
+	return -1;
+}
+
+// Runs the processing over frames of in, returning where the result is.
+// The processing runs in place, in d->input, as in may be read-only.
+const sample_t *decoder_process(struct decoder *d, const sample_t *in, int frames) {
+	int len = frames * d->channels;
+
+	if (!d->proc.delay)
+		return in;
+
+#ifdef FIXED_POINT
+	for (int i = 0; i < len; i++)
+		d->proc_buffer[i] = sample_to_float(in[i]);
+	audio_proc_run(&d->proc, d->proc_buffer, frames);
+	for (int i = 0; i < len; i++)
+		d->input[i] = sample_from_float(d->proc_buffer[i]);
+#else
+	if (in != d->input)
+		memcpy(d->input, in, len * sizeof(sample_t));
+	audio_proc_run(&d->proc, d->input, frames);
+#endif
+
+	return d->input;
+}
+
+// Resamples frames of in into out, which has room for d->room frames,
+// returning the frames made
+int decoder_resample(struct decoder *d, const sample_t *in, int frames, sample_t *out) {
+	if (d->poly)
+		return resampler_process(d->poly, in, frames, out, d->room);
+
+#ifdef FIXED_POINT
+	src_short_to_float_array(in, d->src_in, frames * d->channels);
+	d->src_data.data_in = d->src_in;
+	d->src_data.data_out = d->src_out;
+#else
+	d->src_data.data_in = in;
+	d->src_data.data_out = out;
+#endif
+	d->src_data.input_frames = frames;
+
+	int src_error;
+	if ((src_error = src_process(d->src, &d->src_data))) {
+		fprintf(stderr, "Error: src_process failed: %s\n", src_strerror(src_error));
+		return -1;
+	}
+
+#ifdef FIXED_POINT
+	src_float_to_short_array(d->src_out, out, d->src_data.output_frames_gen * d->channels);
+#endif
+	return d->src_data.output_frames_gen;
+}
+
+void decoder_set_ratio(struct decoder *d, double ratio) {
+	if (d->poly)
+		resampler_set_ratio(d->poly, ratio);
+	else
+		d->src_data.src_ratio = ratio;
+}
+
+void decoder_close(struct decoder *d) {
+	audio_proc_free(&d->proc);
+	resampler_free(d->poly);
+	if (d->src)
+		src_delete(d->src);
+	free(d->input);
+#ifdef FIXED_POINT
+	free(d->src_in);
+	free(d->src_out);
+	free(d->proc_buffer);
+#endif
+	memset(d, 0, sizeof(struct decoder));
+}
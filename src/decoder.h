@@ -0,0 +1,43 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <samplerate.h>
+#include "sample.h"
+#include "audio_proc.h"
+#include "resampler.h"
+
+// Input audio processed and resampled to the baseband rate a block at a
+// time. The live input and the baseband cache both go through it, so a
+// cached render comes out as the live one would.
+struct decoder {
+	int channels;
+	int block;                      // input frames per block, at most
+	int room;                       // baseband frames per block, at most
+	sample_t *input;                // block frames, for the caller to read into
+
+	struct audio_proc proc;
+	struct resampler *poly;
+	SRC_STATE *src;
+	SRC_DATA src_data;
+#ifdef FIXED_POINT
+	// libsamplerate and the audio processing only work in float
+	float *src_in;
+	float *src_out;
+	float *proc_buffer;
+#endif
+};
+
+extern int decoder_open(struct decoder *d, int in_rate, int channels, int mpx_rate, double ratio, double max_ratio, int resampler_type, int processing, int preemph, int block);
+extern const sample_t *decoder_process(struct decoder *d, const sample_t *in, int frames);
+extern int decoder_resample(struct decoder *d, const sample_t *in, int frames, sample_t *out);
+extern void decoder_set_ratio(struct decoder *d, double ratio);
+extern void decoder_close(struct decoder *d);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <string.h>
+#include "dma_ring.h"
+
+// Samples whose control blocks are built at a time, 8 kB stays in L1
+#define BUILD_SAMPLES                   128
+
+uint32_t dma_ring_samples(float ms, int rate) {
+	return ms * rate / 1000 + 0.5;
+}
+
+uint32_t dma_ring_size(uint32_t samples) {
+	uint32_t size = (samples * 2 + 1) * sizeof(dma_cb_t) + (samples + DMA_RING_LAPS) * sizeof(uint32_t);
+
+	return (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+void dma_ring_layout(struct dma_ring *ring, uint32_t samples, uint8_t *virt, uint32_t bus) {
+	ring->samples = samples;
+	ring->size = dma_ring_size(samples);
+	ring->virt = virt;
+	ring->bus = bus;
+	ring->cb = (dma_cb_t *)virt;
+	ring->lap_cb = ring->cb + samples * 2;
+	ring->sample = (uint32_t *)(ring->lap_cb + 1);
+	ring->lap = ring->sample + samples;
+}
+
+uint32_t dma_ring_bus(struct dma_ring *ring, void *virt) {
+	return ring->bus + ((uint8_t *)virt - ring->virt);
+}
+
+// Fill the ring with word and chain the control blocks into a loop. GPU
+// memory is uncached, so everything is built in cached memory first and
+// copied over in bursts, rather than written a field at a time.
+void dma_ring_build(struct dma_ring *ring, uint32_t word) {
+	static dma_cb_t cbs[BUILD_SAMPLES * 2];
+	static uint32_t words[BUILD_SAMPLES];
+	uint32_t frac = PERIPH_PHYS_BASE + (PLLA_FRAC<<2) + CLK_BASE_OFFSET;
+	uint32_t fifo = PERIPH_PHYS_BASE + (PWM_FIFO<<2) + PWM_BASE_OFFSET;
+
+	for (int i = 0; i < BUILD_SAMPLES; i++)
+		words[i] = word;
+
+	for (uint32_t first = 0; first < ring->samples; first += BUILD_SAMPLES) {
+		uint32_t len = ring->samples - first < BUILD_SAMPLES ? ring->samples - first : BUILD_SAMPLES;
+		dma_cb_t *cbp = cbs;
+
+		for (uint32_t i = first; i < first + len; i++) {
+			// Write a frequency sample
+			cbp->info = BCM2708_DMA_NO_WIDE_BURSTS | BCM2708_DMA_WAIT_RESP;
+			cbp->src = dma_ring_bus(ring, ring->sample + i);
+			cbp->dst = frac;
+			cbp->length = 4;
+			cbp->stride = 0;
+			cbp->next = dma_ring_bus(ring, ring->cb + i * 2 + 1);
+			cbp++;
+			// Delay
+			cbp->info = BCM2708_DMA_NO_WIDE_BURSTS | BCM2708_DMA_WAIT_RESP | BCM2708_DMA_D_DREQ | BCM2708_DMA_PER_MAP(DREQ_PWM);
+			cbp->src = ring->bus;
+			cbp->dst = fifo;
+			cbp->length = 4;
+			cbp->stride = 0;
+			cbp->next = dma_ring_bus(ring, ring->cb + i * 2 + 2);
+			cbp++;
+		}
+		memcpy(ring->cb + first * 2, cbs, len * 2 * sizeof(dma_cb_t));
+		memcpy(ring->sample + first, words, len * sizeof(uint32_t));
+	}
+
+	// Lap counter, run once per pass over the ring on the way back to the start
+	static uint32_t lap[DMA_RING_LAPS];
+	dma_cb_t *cbp = cbs;
+
+	for (int i = 0; i < DMA_RING_LAPS; i++)
+		lap[i] = dma_ring_bus(ring, ring->lap + (i + 1) % DMA_RING_LAPS);
+	memcpy(ring->lap, lap, sizeof(lap));
+
+	memset(cbp, 0, sizeof(dma_cb_t));
+	cbp->info = BCM2708_DMA_NO_WIDE_BURSTS | BCM2708_DMA_WAIT_RESP;
+	cbp->src = dma_ring_bus(ring, ring->lap);
+	cbp->dst = dma_ring_bus(ring, &ring->lap_cb->src);
+	cbp->length = 4;
+	cbp->stride = 0;
+	cbp->next = ring->bus;
+	memcpy(ring->lap_cb, cbp, sizeof(dma_cb_t));
+}
+
+// Laps completed by the DMA, modulo DMA_RING_LAPS. The lap control block
+// reads the entry its own source address points to, which holds the
+// address of the next entry, and writes it back over that source address.
+uint32_t dma_ring_lap(struct dma_ring *ring) {
+	volatile uint32_t *src = &ring->lap_cb->src;
+
+	return (*src - dma_ring_bus(ring, ring->lap)) / sizeof(uint32_t);
+}
+
+// Sample the DMA is on, given the control block it is processing. The lap
+// control block counts as the start of the ring it leads back to.
+int dma_ring_position(struct dma_ring *ring, uint32_t conblk) {
+	uint32_t sample = (conblk - ring->bus) / (sizeof(dma_cb_t) * 2);
+
+	return sample < ring->samples ? sample : 0;
+}
@@ -0,0 +1,49 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef DMA_RING_H
+#define DMA_RING_H
+
+#include <stdint.h>
+#include "hal.h"
+
+// Ring depth, in milliseconds of baseband
+#define DMA_RING_DEFAULT_MS             341.333 // 65536 samples
+#define DMA_RING_MIN_MS                 10
+#define DMA_RING_MAX_MS                 1000
+
+// Entries in the table the lap control block steps through
+#define DMA_RING_LAPS                   1024
+
+// The DMA ring in GPU memory. Every sample takes two control blocks: one
+// writes its word to PLLA_FRAC, the next writes to the PWM FIFO with DREQ
+// pacing and so holds the channel until the PWM wants another word. Both
+// are needed per sample, since a control block has a single destination
+// and a fixed successor. The control blocks come first, so the one the
+// DMA is on gives the sample directly, then the lap control block, the
+// sample words and the lap table.
+struct dma_ring {
+	uint32_t samples;
+	uint32_t size;                  // bytes, whole pages
+	uint8_t *virt;
+	uint32_t bus;
+
+	dma_cb_t *cb;                   // 2 * samples
+	dma_cb_t *lap_cb;               // counts laps, see dma_ring_lap()
+	uint32_t *sample;
+	uint32_t *lap;
+};
+
+extern uint32_t dma_ring_samples(float ms, int rate);
+extern uint32_t dma_ring_size(uint32_t samples);
+extern void dma_ring_layout(struct dma_ring *ring, uint32_t samples, uint8_t *virt, uint32_t bus);
+extern void dma_ring_build(struct dma_ring *ring, uint32_t word);
+extern uint32_t dma_ring_bus(struct dma_ring *ring, void *virt);
+extern uint32_t dma_ring_lap(struct dma_ring *ring);
+extern int dma_ring_position(struct dma_ring *ring, uint32_t conblk);
+
+#endif
@@ -0,0 +1,79 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <string.h>
+#include "drift.h"
+
+void drift_init(struct drift *d, double ratio, double nominal) {
+	memset(d, 0, sizeof(struct drift));
+	d->ratio = ratio;
+	d->nominal = nominal;
+	d->fill = -1;
+}
+
+// One block of dt seconds of input has been taken, leaving fill seconds
+// between the input and the DMA. Returns the correction for the next
+// block.
+double drift_update(struct drift *d, double fill, double dt) {
+	struct drift_stats *s = &d->stats;
+
+	if (d->fill < 0)
+		d->fill = fill;
+	else
+		d->fill += dt / (DRIFT_SMOOTH_S + dt) * (fill - d->fill);
+	d->elapsed += dt;
+	s->updates++;
+	s->fill_ms = d->fill * 1000;
+
+	if (d->elapsed < DRIFT_SETTLE_S) {
+		d->learned += fill * dt;
+		d->learned_time += dt;
+		return 0;
+	}
+	if (!s->settled) {
+		s->settled = 1;
+		s->min_fill_ms = s->max_fill_ms = s->fill_ms;
+		d->learned = d->learned_time > 0 ? d->learned / d->learned_time : d->fill;
+	}
+
+	double error = d->fill - d->learned;
+	double max = DRIFT_MAX_PPM / 1e6;
+	double integral = d->integral + DRIFT_KI * error * dt;
+
+	// The integrator holds still while the correction is at its limit
+	if (integral > max)
+		integral = max;
+	else if (integral < -max)
+		integral = -max;
+
+	double correction = DRIFT_KP * error + integral;
+
+	if (correction > max || correction < -max) {
+		correction = correction > 0 ? max : -max;
+		if ((integral > d->integral) == (correction > 0))
+			integral = d->integral;
+	}
+	d->integral = integral;
+	d->correction = correction;
+	d->estimate += dt / (DRIFT_ESTIMATE_S + dt) * (integral - d->estimate);
+
+	s->ppm = d->estimate * 1e6;
+	s->correction_ppm = correction * 1e6;
+	s->static_ppm = (d->ratio / (1 + d->estimate) - d->nominal) * 1e6;
+	s->target_ms = d->learned * 1000;
+	if (s->fill_ms < s->min_fill_ms)
+		s->min_fill_ms = s->fill_ms;
+	if (s->fill_ms > s->max_fill_ms)
+		s->max_fill_ms = s->fill_ms;
+
+	return correction;
+}
+
+// Output frames per input frame with the correction applied
+double drift_ratio(const struct drift *d) {
+	return d->ratio / (1 + d->correction);
+}
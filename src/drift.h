@@ -0,0 +1,58 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef DRIFT_H
+#define DRIFT_H
+
+#include "stats.h"
+
+// Largest correction the servo applies, either way
+#define DRIFT_MAX_PPM                   1000
+
+// Time constant of the fill average, long enough to ride out packets and
+// pipe writes arriving in bursts
+#define DRIFT_SMOOTH_S                  1.0
+
+// Input played before the servo starts steering, so the average has
+// settled and a network input is done prebuffering. The average fill
+// over this time becomes the target.
+#define DRIFT_SETTLE_S                  5.0
+
+// Time constant of the drift estimate. The integrator follows the beat
+// between packet and block sizes too; the estimate is its long average.
+#define DRIFT_ESTIMATE_S                60.0
+
+// PI gains on the fill error in seconds, for a loop with a natural
+// frequency of 0.05 rad/s and a damping of 0.7: a 200 ppm drift moves the
+// fill by about 4 ms before the integrator has taken it over, in about
+// a minute and a half.
+#define DRIFT_KP                        0.07    // per second of error
+#define DRIFT_KI                        0.0025  // per second of error, per second
+
+// Steers the resampling ratio so the fill between the input and the DMA,
+// what is waiting in the input buffer plus the baseband queued ahead of
+// the DMA, stays where it settled. That fill follows the input clock
+// against the clock pacing the DMA, so a correction that holds it also
+// cancels the drift between them, and keeps the latency from creeping.
+struct drift {
+	double ratio;                   // resampling ratio without the correction
+	double nominal;                 // output rate over input rate
+	double fill;                    // smoothed, seconds
+	double learned;                 // fill times time while settling, then the target
+	double learned_time;
+	double elapsed;                 // seconds of input seen
+	double integral;
+	double estimate;                // long average of the integral
+	double correction;              // fraction, positive plays the input faster
+	struct drift_stats stats;
+};
+
+extern void drift_init(struct drift *d, double ratio, double nominal);
+extern double drift_update(struct drift *d, double fill, double dt);
+extern double drift_ratio(const struct drift *d);
+
+#endif
@@ -8,29 +8,257 @@
 #include <sndfile.h>
 #include <stdlib.h>
 #include <string.h>
-#include <samplerate.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include "fm_mpx.h"
+#include "decoder.h"
+#include "resampler.h"
+#include "mpx_gen.h"
+#include "rds.h"
+#include "pcm_map.h"
+#include "clipper.h"
+#include "net_audio.h"
+#include "playlist.h"
+#include "drift.h"
+#include "cache.h"
+#include "siggen.h"
+#include "trace.h"
 
-static float input_buffer[DATA_SIZE];
+static sample_t input_buffer[DATA_SIZE * 2];
+static sample_t resampled[DATA_SIZE * 16 * 2];
+static sample_t rds_buffer[DATA_SIZE * 16];
 
 static SNDFILE *inf;
+static struct pcm_map map;
+static struct net_audio net;
+static struct playlist playlist;
+static struct siggen gen;
 
-// SRC
-static SRC_STATE *resampler;
-static SRC_DATA resampler_data;
+static struct decoder dec;
+static double ratio;                    // input to baseband rate, before any drift
+static int frames_per_block;
+static int channels;
+static int rds_on;
 
-int fm_mpx_open(char *filename, float ppm) {
+static struct mpx_osc osc;
+static struct mpx_clipper clipper;
+static struct clip_shared clip_shared;
+static int clip_on;
+
+// Clock drift servo, for live input only
+static struct drift drift;
+static struct drift_shared drift_shared;
+static int drift_on;
+static int in_rate;
+static int pipe_frame_bytes;            // stdin read from a pipe or socket
+static double queued;                   // seconds of baseband ahead of the DMA
+
+// Baseband cache: the input rendered once and replayed from the mapping
+static struct cache replay;
+static struct cache_params cache_params;
+static char *cache_path;
+static int replay_block;                // baseband frames per block
+
+// Clip inserted from the control thread. It hands one over in insert_next;
+// the DSP thread plays it over the program, then hands it back in
+// insert_done and clears inserting, and the control thread frees it.
+static _Atomic(struct cache *) insert_next;
+static _Atomic(struct cache *) insert_done;
+static _Atomic int inserting;
+static struct cache *insert;
+
+// Finished composite at the baseband rate, read straight into the
+// caller's buffer when it is in the pipeline's own sample format
+#ifdef FIXED_POINT
+#define COMPOSITE_NATIVE COMPOSITE_S16
+#else
+#define COMPOSITE_NATIVE COMPOSITE_FLOAT
+#endif
+static int comp_fd = -1;
+static int comp_format;
+static int comp_regular;                // a file, rewound at its end
+static struct resampler *comp_poly;     // only for a clock correction
+static int32_t comp_raw[DATA_SIZE * 2];
+
+// Set from the control thread, picked up at the next block
+static _Atomic float volume = 1;
+
+// Bytes per sample of a libsndfile format, for the fill of a pipe
+static int sample_bytes(int format)
+{
+	switch (format & SF_FORMAT_SUBMASK) {
+	case SF_FORMAT_PCM_S8:
+	case SF_FORMAT_PCM_U8:
+		return 1;
+	case SF_FORMAT_PCM_24:
+		return 3;
+	case SF_FORMAT_PCM_32:
+	case SF_FORMAT_FLOAT:
+		return 4;
+	case SF_FORMAT_DOUBLE:
+		return 8;
+	default:
+		return 2;
+	}
+}
+
+static int composite_bytes(int format)
+{
+	return format == COMPOSITE_S16 ? 2 : 4;
+}
+
+static const char *composite_name(int format)
+{
+	return format == COMPOSITE_S16 ? "s16" : format == COMPOSITE_S32 ? "s32" : "float";
+}
+
+// A finished multiplex, pilot and RDS included, from a file or stdin at the
+// baseband rate. It skips the resampler, the multiplex and the clipper,
+// unless --ppm or the drift servo need the rate changed; the resampler is
+// then opened up to pass the subcarriers.
+static int open_composite(char *filename, int format, float ppm, int mpx_rate, int drift_comp, int low_latency)
+{
+	struct stat st;
+
+	comp_fd = strcmp(filename, "-") == 0 ? fileno(stdin) : open(filename, O_RDONLY);
+	if (comp_fd < 0 || fstat(comp_fd, &st) < 0) {
+		fprintf(stderr, "Error: could not open composite input %s.\n", filename);
+		return -1;
+	}
+	comp_format = format;
+	comp_regular = S_ISREG(st.st_mode);
+	if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))
+		pipe_frame_bytes = composite_bytes(format);
+
+	channels = 1;
+	rds_on = 0;
+	clip_on = 0;
+	in_rate = mpx_rate;
+	ratio = 1 + ppm / 1e6;
+
+	frames_per_block = low_latency ? mpx_rate * LOW_LATENCY_BLOCK_MS / 1000 : DATA_SIZE * 2;
+
+	drift_on = drift_comp && pipe_frame_bytes;
+	if (drift_on) {
+		drift_init(&drift, ratio, 1);
+		printf("Clock drift compensation on, up to %d ppm.\n", DRIFT_MAX_PPM);
+	}
+
+	printf("Using composite input: %s, %s at %d Hz, ", strcmp(filename, "-") == 0 ? "stdin" : filename,
+		composite_name(format), mpx_rate);
+	if (ppm == 0 && !drift_on) {
+		comp_poly = NULL;
+		printf("passed straight through.\n");
+		return 0;
+	}
+	printf("resampled for the clock correction.\n");
+
+	// Half the rate, which the resampler brings down to just below Nyquist
+	if ((comp_poly = resampler_new_band(1, mpx_rate, mpx_rate, ratio, mpx_rate / 2)) == NULL) {
+		fprintf(stderr, "Error: could not create the resampler\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// Settings for clips, and the cache in place of a plain input file, which
+// is not decoded any further once it is cached
+static int open_cache(char *filename, char *raw, char *cache_dir)
+{
+	cache_params.block = frames_per_block;
+	cache_path = cache_dir;
+	replay_block = frames_per_block * ratio;
+	if (replay_block > dec.room)
+		replay_block = dec.room;
+
+	if (!cache_dir || net.frames || playlist.count || gen.rate || strcmp(filename, "-") == 0)
+		return 0;
+
+	int ret = cache_open(&replay, cache_dir, filename, raw, &cache_params);
+
+	if (ret < 0) {
+		fprintf(stderr, "Error: could not render %s into the baseband cache.\n", filename);
+		return -1;
+	}
+	if (ret > 0) {
+		printf("Not caching %s: too long or not seekable, decoding it live.\n", filename);
+		return 0;
+	}
+	printf("Using baseband cache: %s/%016llx.mpx (%.1f s)\n", cache_dir,
+		(unsigned long long)replay.key, (double)replay.frames / cache_params.mpx_rate);
+	pcm_map_close(&map);
+	if (inf)
+		sf_close(inf);
+	inf = NULL;
+
+	return 0;
+}
+
+int fm_mpx_open(char *filename, char *raw, float ppm, int resampler_type, int rds, int processing, int preemph, int clip, float crossfade, int mpx_rate, int drift_comp, int low_latency, char *cache_dir, int composite) {
 	// Open the input file
 	SF_INFO sfinfo;
+	int mapped = 1;
 
-	// stdin or file on the filesystem?
-	if(strcmp(filename, "-") == 0) {
+	// Only one of them is set up below, and a leftover of an earlier open
+	// would otherwise be taken for it
+	comp_poly = NULL;
+	memset(&dec, 0, sizeof(dec));
+	if (composite)
+		return open_composite(filename, composite, ppm, mpx_rate, drift_comp, low_latency);
+
+	memset(&sfinfo, 0, sizeof(sfinfo));
+	if (raw) {
+		int format;
+
+		if (pcm_parse_raw(raw, &sfinfo.samplerate, &sfinfo.channels, &format) < 0) {
+			fprintf(stderr, "Error: raw format has to be rate:channels:s16|float\n");
+			return -1;
+		}
+		sfinfo.format = SF_FORMAT_RAW | (format == PCM_FLOAT ? SF_FORMAT_FLOAT : SF_FORMAT_PCM_16);
+	}
+
+	// Raw and plain WAV files are mapped and read in place
+	if (net_is_url(filename)) {
+		if (net_open(&net, filename, raw) < 0)
+			return -1;
+		printf("Using network audio: %s (%d Hz, %d channels)\n", filename, net.rate, net.channels);
+		sfinfo.samplerate = net.rate;
+		sfinfo.channels = net.channels;
+	} else if (siggen_is_spec(filename)) {
+		if (siggen_open(&gen, filename, raw) < 0)
+			return -1;
+		sfinfo.samplerate = gen.rate;
+		sfinfo.channels = gen.channels;
+	} else if (playlist_is_playlist(filename)) {
+		if (playlist_open(&playlist, filename, crossfade) < 0)
+			return -1;
+		sfinfo.samplerate = playlist.rate;
+		sfinfo.channels = playlist.channels;
+	} else if (strcmp(filename, "-") != 0 && (mapped = pcm_map_open(&map, filename, raw)) == 0) {
+		printf("Using audio file: %s (memory mapped)\n", filename);
+		sfinfo.samplerate = map.rate;
+		sfinfo.channels = map.channels;
+	} else if (mapped < 0) {
+		fprintf(stderr, "Error: could not map input file %s.\n", filename);
+		return -1;
+	} else if(strcmp(filename, "-") == 0) {
 		if(!(inf = sf_open_fd(fileno(stdin), SFM_READ, &sfinfo, 0))) {
 			fprintf(stderr, "Error: could not open stdin for audio input.\n");
 			return -1;
 		} else {
 			printf("Using stdin for audio input.\n");
 		}
+
+		// Only a pipe or socket says how much is waiting in it
+		struct stat st;
+
+		if (fstat(fileno(stdin), &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+			pipe_frame_bytes = sfinfo.channels * sample_bytes(sfinfo.format);
 	} else {
 		if(!(inf = sf_open(filename, SFM_READ, &sfinfo))) {
 			fprintf(stderr, "Error: could not open input file %s.\n", filename);
@@ -40,31 +268,120 @@ int fm_mpx_open(char *filename, float ppm) {
 		}
 	}
 
-	if (sfinfo.channels != 1) {
-		fprintf(stderr, "Input must have only one channel\n");
+	channels = sfinfo.channels;
+	if (channels == 2) {
+		printf("Stereo input, generating a stereo multiplex.\n");
+	} else if (channels != 1) {
+		fprintf(stderr, "Input must have one or two channels\n");
 		return -1;
 	}
 
-	resampler_data.data_in = input_buffer;
-	resampler_data.output_frames = DATA_SIZE * 16;
-	resampler_data.src_ratio = (float)192000 / sfinfo.samplerate + (ppm / 1e6);
-
-	int src_error;
-	if ((resampler = src_new(SRC_ZERO_ORDER_HOLD, 1, &src_error)) == NULL) {
-		fprintf(stderr, "Error: src_new failed: %s\n", src_strerror(src_error));
+	rds_on = rds;
+	if ((channels == 2 || rds_on) && mpx_rate < MPX_RATE_MIN_STEREO) {
+		fprintf(stderr, "Error: stereo and RDS need a baseband rate of at least %d Hz, use a mono input with --rds 0\n", MPX_RATE_MIN_STEREO);
 		return -1;
 	}
+	if ((channels == 2 || rds_on) && mpx_osc_init(&osc, mpx_rate, rds_on) < 0) {
+		fprintf(stderr, "Error: could not set up the subcarrier oscillators\n");
+		return -1;
+	}
+	if (rds_on) {
+		if (rds_init(mpx_rate) < 0) {
+			fprintf(stderr, "Error: could not set up the RDS encoder\n");
+			return -1;
+		}
+		set_rds_stereo(channels == 2);
+	}
 
-	return 0;
+	// Stereo is clipped after the matrix, mono before mpx_mono() makes
+	// room for RDS
+	clip_on = clip;
+	if (clip_on && channels == 2)
+		mpx_clipper_init(&clipper, mpx_rate, 2 * osc.stereo_level, 1, 1, rds_on);
+	else if (clip_on)
+		mpx_clipper_init(&clipper, mpx_rate, 1, rds_on ? osc.mono_level : 1, 0, rds_on);
+
+	cache_params = (struct cache_params){ mpx_rate, ppm, resampler_type, processing, preemph, 0 };
+
+	ratio = (float)mpx_rate / sfinfo.samplerate + (ppm / 1e6);
+	in_rate = sfinfo.samplerate;
+
+	// Blocks are sized for the largest ratio the servo can ask for
+	double max_ratio = ratio;
+
+	drift_on = drift_comp && (net.frames || pipe_frame_bytes);
+	if (drift_on) {
+		drift_init(&drift, ratio, (double)mpx_rate / sfinfo.samplerate);
+		max_ratio /= 1 - DRIFT_MAX_PPM / 1e6;
+		printf("Clock drift compensation on, up to %d ppm.\n", DRIFT_MAX_PPM);
+	}
+
+	// Live input is taken 10 ms at a time, so the jitter buffer is not
+	// drained in big gulps. For low latency, every input is taken a few
+	// ms at a time, so no block waits long for its last frame.
+	frames_per_block = net.frames ? sfinfo.samplerate / 100 : DATA_SIZE;
+	if (low_latency)
+		frames_per_block = sfinfo.samplerate * LOW_LATENCY_BLOCK_MS / 1000;
+
+	if (decoder_open(&dec, sfinfo.samplerate, channels, mpx_rate, ratio, max_ratio, resampler_type, processing, preemph, frames_per_block) < 0)
+		return -1;
+	frames_per_block = dec.block;
+
+	return open_cache(filename, raw, cache_dir);
+}
+
+// Feed the servo what is left between the input and the DMA after a block
+// of frames and take the corrected ratio for the next one. The baseband
+// queue soaks up the drift until it is full or empty, so it is counted
+// along with the input buffer.
+static void steer(int frames)
+{
+	double fill = queued + (net.frames ? net_fill(&net) : fm_mpx_input_age());
+
+	drift_update(&drift, fill, (double)frames / in_rate);
+	if (comp_poly)
+		resampler_set_ratio(comp_poly, drift_ratio(&drift));
+	else
+		decoder_set_ratio(&dec, drift_ratio(&drift));
+	drift_stats_publish(&drift_shared, &drift.stats);
 }
 
-int fm_mpx_get_samples(float *mpx_buffer) {
+// Reads, processes and resamples a block of input into out, returning the
+// frames made
+static int decode(sample_t *out)
+{
 	int audio_len;
-	int frames_to_read = DATA_SIZE;
+	int frames_to_read = frames_per_block;
 	int buffer_offset = 0;
+	const sample_t *in = dec.input;
+
+	TRACE_BEGIN(t_read);
+	if (map.base) {
+		// A block that runs into the end of a mapped file is cut short there
+		while ((buffer_offset = pcm_map_read(&map, &in, dec.input, frames_per_block)) == 0)
+			pcm_map_rewind(&map);
+		frames_to_read = 0;
+	} else if (net.frames) {
+		buffer_offset = net_read(&net, dec.input, frames_per_block);
+		frames_to_read = 0;
+	} else if (playlist.count) {
+		if ((buffer_offset = playlist_read(&playlist, dec.input, frames_per_block)) < 0) {
+			fprintf(stderr, "Error: none of the playlist tracks can be played, terminating\n");
+			return -1;
+		}
+		frames_to_read = 0;
+	} else if (gen.rate) {
+		buffer_offset = siggen_read(&gen, dec.input, frames_per_block);
+		frames_to_read = 0;
+	}
 
 	while (frames_to_read) {
-		if ((audio_len = sf_readf_float(inf, input_buffer + buffer_offset, frames_to_read)) < 0) {
+#ifdef FIXED_POINT
+		audio_len = sf_readf_short(inf, dec.input + buffer_offset * channels, frames_to_read);
+#else
+		audio_len = sf_readf_float(inf, dec.input + buffer_offset * channels, frames_to_read);
+#endif
+		if (audio_len < 0) {
 			fprintf(stderr, "Error reading audio\n");
 			return -1;
 		}
@@ -77,23 +394,336 @@ int fm_mpx_get_samples(float *mpx_buffer) {
 			return -1;
 		}
 	}
+	TRACE_END(t_read, TRACE_READ, buffer_offset);
+
+	if (drift_on)
+		steer(buffer_offset);
+
+	// Mapped input is read-only, and is copied to be processed
+	if (dec.proc.delay) {
+		TRACE_BEGIN(t_process);
+		in = decoder_process(&dec, in, buffer_offset);
+		TRACE_END(t_process, TRACE_PROCESS, buffer_offset);
+	}
+
+	TRACE_BEGIN(t_resample);
+	audio_len = decoder_resample(&dec, in, buffer_offset, out);
+	if (audio_len < 0)
+		return -1;
+	TRACE_END(t_resample, TRACE_RESAMPLE, audio_len);
+
+	return audio_len;
+}
+
+// Up to len samples of composite into buf, converted on the way unless
+// they are in the native format already. A file starts over at its end.
+static int composite_fill(sample_t *buf, int len)
+{
+	int size = composite_bytes(comp_format);
+	uint8_t *raw = comp_format == COMPOSITE_NATIVE ? (uint8_t *)buf : (uint8_t *)comp_raw;
+	size_t want = (size_t)len * size, got = 0;
+	int rewound = 0;
+
+	while (got < want) {
+		ssize_t n = read(comp_fd, raw + got, want - got);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			fprintf(stderr, "Error reading composite input\n");
+			return -1;
+		}
+		if (n == 0) {
+			// A sample cut short at the end of a file is dropped
+			got -= got % size;
+			if (!comp_regular || rewound || lseek(comp_fd, 0, SEEK_SET) < 0)
+				break;
+			rewound = 1;
+			continue;
+		}
+		got += n;
+		rewound = 0;
+	}
+
+	if ((len = got / size) == 0) {
+		fprintf(stderr, "Composite input ended, terminating\n");
+		return -1;
+	}
+
+	if (raw == (uint8_t *)buf)
+		return len;
+
+	if (comp_format == COMPOSITE_S16) {
+		const int16_t *in = (const int16_t *)comp_raw;
+
+		for (int i = 0; i < len; i++)
+			buf[i] = sample_from_s16(in[i]);
+	} else if (comp_format == COMPOSITE_S32) {
+#ifdef FIXED_POINT
+		// Rounded to the top 16 bits
+		for (int i = 0; i < len; i++)
+			buf[i] = sat16((comp_raw[i] >> 16) + ((comp_raw[i] >> 15) & 1));
+#else
+		for (int i = 0; i < len; i++)
+			buf[i] = comp_raw[i] * (1.0f / 2147483648.0f);
+#endif
+	} else {
+		const float *in = (const float *)comp_raw;
+
+		for (int i = 0; i < len; i++)
+			buf[i] = sample_from_float(in[i]);
+	}
+
+	return len;
+}
+
+// A block of composite into out, resampled only for a clock correction
+static int composite_read(sample_t *out)
+{
+	int len;
+
+	TRACE_BEGIN(t_read);
+	if ((len = composite_fill(comp_poly ? input_buffer : out, frames_per_block)) < 0)
+		return -1;
+	TRACE_END(t_read, TRACE_READ, len);
+
+	if (drift_on)
+		steer(len);
+
+	if (comp_poly) {
+		TRACE_BEGIN(t_resample);
+		len = resampler_process(comp_poly, input_buffer, len, out, DATA_SIZE * 16);
+		TRACE_END(t_resample, TRACE_RESAMPLE, len);
+	}
+
+	return len;
+}
+
+// Plays the inserted clip over len frames of the program, converting mono
+// to stereo and back. The program is read underneath all the same, so a
+// live input stays in time.
+static void overlay(sample_t *out, int len)
+{
+	const sample_t *clip;
+	int n = cache_read(insert, &clip, len);
+
+	if (insert->channels == channels) {
+		memcpy(out, clip, n * channels * sizeof(sample_t));
+	} else if (channels == 2) {
+		for (int i = 0; i < n; i++)
+			out[2 * i] = out[2 * i + 1] = clip[i];
+	} else {
+		for (int i = 0; i < n; i++)
+			out[i] = (clip[2 * i] + clip[2 * i + 1]) / 2;
+	}
 
-	resampler_data.input_frames = audio_len;
-	resampler_data.data_out = mpx_buffer;
+	if (insert->pos == insert->frames) {
+		atomic_store(&insert_done, insert);
+		atomic_store(&inserting, 0);
+		insert = NULL;
+	}
+}
 
-	int src_error;
-	if ((src_error = src_process(resampler, &resampler_data))) {
-		fprintf(stderr, "Error: src_process failed: %s\n", src_strerror(src_error));
+int fm_mpx_get_samples(sample_t *mpx_buffer) {
+	int audio_len;
+	float gain = atomic_load_explicit(&volume, memory_order_relaxed);
+
+	if (!insert && (insert = atomic_exchange(&insert_next, NULL)))
+		cache_rewind(insert);
+
+	// Mono goes straight to the caller, stereo needs mixing first
+	sample_t *out = (channels == 2) ? resampled : mpx_buffer;
+	const sample_t *audio = out;
+
+	if (replay.data) {
+		TRACE_BEGIN(t_read);
+		while ((audio_len = cache_read(&replay, &audio, replay_block)) == 0)
+			cache_rewind(&replay);
+		// The mapping is read-only, and mono is worked on in the caller's
+		// buffer
+		if (channels == 1 || gain != 1 || insert) {
+			memcpy(out, audio, audio_len * channels * sizeof(sample_t));
+			audio = out;
+		}
+		TRACE_END(t_read, TRACE_READ, audio_len);
+	} else if (comp_fd >= 0) {
+		if ((audio_len = composite_read(out)) < 0)
+			return -1;
+	} else if ((audio_len = decode(out)) < 0) {
 		return -1;
 	}
 
-	audio_len = resampler_data.output_frames_gen;
+	if (insert)
+		overlay(out, audio_len);
+
+	// Applied after resampling as the input may be read-only
+	if (gain != 1) {
+#ifdef FIXED_POINT
+		// Q14, as the volume goes up to 200%
+		int32_t gain_q14 = lrintf(gain * 16384);
+
+		for (int i = 0; i < audio_len * channels; i++)
+			out[i] = sat16((out[i] * gain_q14 + (1 << 13)) >> 14);
+#else
+		for (int i = 0; i < audio_len * channels; i++)
+			out[i] *= gain;
+#endif
+	}
+
+	if (rds_on) {
+		TRACE_BEGIN(t_rds);
+		rds_get_samples(rds_buffer, audio_len);
+		TRACE_END(t_rds, TRACE_RDS, audio_len);
+	}
+
+	TRACE_BEGIN(t_mpx);
+
+	if (channels == 2 && clip_on) {
+		mpx_stereo_audio(&osc, audio, mpx_buffer, audio_len);
+		mpx_clipper_run(&clipper, mpx_buffer, audio_len);
+		mpx_stereo_subcarriers(&osc, rds_on ? rds_buffer : NULL, mpx_buffer, audio_len);
+	} else if (channels == 2) {
+		mpx_stereo(&osc, audio, rds_on ? rds_buffer : NULL, mpx_buffer, audio_len);
+	} else {
+		if (clip_on)
+			mpx_clipper_run(&clipper, mpx_buffer, audio_len);
+		if (rds_on)
+			mpx_mono(&osc, rds_buffer, mpx_buffer, audio_len);
+	}
+
+	if (clip_on)
+		clip_stats_publish(&clip_shared, &clipper.stats);
+	TRACE_END(t_mpx, TRACE_MPX, audio_len);
 
 	return audio_len;
 }
 
+static void free_clip(struct cache *c)
+{
+	if (c) {
+		cache_close(c);
+		free(c);
+	}
+}
+
+// Renders or maps filename with the program's settings, from the cache
+// directory when there is one, and plays it over the program from the next
+// block. From the control thread; fails while another clip is playing.
+int fm_mpx_insert(char *filename) {
+	struct cache *c;
+
+	free_clip(atomic_exchange(&insert_done, NULL));
+	if (comp_fd >= 0) {
+		fprintf(stderr, "Error: clips cannot be inserted into a composite input\n");
+		return -1;
+	}
+	if (!cache_params.mpx_rate)
+		return -1;
+	if (atomic_load(&inserting)) {
+		fprintf(stderr, "Error: another clip is still playing\n");
+		return -1;
+	}
+	if (!(c = malloc(sizeof(struct cache))))
+		return -1;
+	if (cache_open(c, cache_path, filename, NULL, &cache_params) != 0) {
+		fprintf(stderr, "Error: could not render %s for insertion\n", filename);
+		free(c);
+		return -1;
+	}
+
+	atomic_store(&inserting, 1);
+	atomic_store(&insert_next, c);
+	return 0;
+}
+
+void fm_mpx_set_volume(float gain) {
+	atomic_store_explicit(&volume, gain, memory_order_relaxed);
+}
+
+// Clipper telemetry from any thread, -1 with the clipper off
+int fm_mpx_clip_stats(struct clip_stats *stats) {
+	if (!clip_on)
+		return -1;
+
+	clip_stats_read(&clip_shared, stats);
+	return 0;
+}
+
+// Network input telemetry from any thread, -1 without network input
+int fm_mpx_net_stats(struct net_stats *stats) {
+	if (!net.frames)
+		return -1;
+
+	net_get_stats(&net, stats);
+	return 0;
+}
+
+// Seconds of input waiting behind the last block read: newer frames, so
+// about how long ago its newest frame was captured. 0 for files.
+double fm_mpx_input_age() {
+	if (net.frames)
+		return net_delay(&net);
+	if (pipe_frame_bytes) {
+		int bytes = 0;
+
+		ioctl(fileno(stdin), FIONREAD, &bytes);
+		return (double)bytes / pipe_frame_bytes / in_rate;
+	}
+
+	return 0;
+}
+
+// Baseband queued ahead of the DMA, from the DSP thread before each block
+void fm_mpx_set_queued(double seconds) {
+	queued = seconds;
+}
+
+// Clock drift telemetry from any thread, -1 with the servo off
+int fm_mpx_drift_stats(struct drift_stats *stats) {
+	if (!drift_on)
+		return -1;
+
+	drift_stats_read(&drift_shared, stats);
+	return 0;
+}
 
 void fm_mpx_close() {
-	if (sf_close(inf)) fprintf(stderr, "Error closing audio file");
-	src_delete(resampler);
+	if (inf && sf_close(inf)) fprintf(stderr, "Error closing audio file");
+	inf = NULL;
+	pcm_map_close(&map);
+	siggen_close(&gen);
+	if (net.frames) {
+		struct net_stats stats;
+
+		net_get_stats(&net, &stats);
+		net_stats_print(&stats);
+		net_close(&net);
+	}
+	if (drift_on) {
+		drift_stats_print(&drift.stats);
+		drift_on = 0;
+	}
+	pipe_frame_bytes = 0;
+	if (comp_fd >= 0 && comp_fd != fileno(stdin))
+		close(comp_fd);
+	comp_fd = -1;
+	if (playlist.count) {
+		playlist_report(&playlist);
+		playlist_close(&playlist);
+	}
+	cache_close(&replay);
+	cache_params.mpx_rate = 0;
+	free_clip(insert);
+	free_clip(atomic_exchange(&insert_next, NULL));
+	free_clip(atomic_exchange(&insert_done, NULL));
+	insert = NULL;
+	atomic_store(&inserting, 0);
+	resampler_free(comp_poly);
+	comp_poly = NULL;
+	mpx_osc_free(&osc);
+	rds_free();
+	if (clip_on && clipper.stats.samples)
+		clip_stats_print(&clipper.stats);
+	audio_proc_report(&dec.proc);
+	decoder_close(&dec);
 }
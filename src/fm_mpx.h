@@ -5,8 +5,43 @@
     See https://github.com/Miegl/PiFmAdv
 */
 
+#include "sample.h"
+
 #define DATA_SIZE 4096
+#define MPX_SAMPLE_RATE 192000          // Default baseband rate
+
+// Baseband rates accepted, in whole kHz. Stereo and RDS need room for the
+// 57 kHz subcarrier and its images; mono alone gets by with much less.
+#define MPX_RATE_MIN 32000
+#define MPX_RATE_MIN_STEREO 128000
+#define MPX_RATE_MAX 384000
+
+// Input block of the low-latency profile
+#define LOW_LATENCY_BLOCK_MS 2
+
+// Resampler used to bring the input up to the baseband rate
+#define RESAMPLER_POLY 0
+#define RESAMPLER_ZOH 1
+#define RESAMPLER_SINC 2
+
+// Sample formats of a finished composite taken at the baseband rate,
+// little-endian
+#define COMPOSITE_OFF 0
+#define COMPOSITE_S16 1
+#define COMPOSITE_S32 2
+#define COMPOSITE_FLOAT 3
+
+struct clip_stats;
+struct net_stats;
+struct drift_stats;
 
-extern int fm_mpx_open(char *filename, float ppm);
-extern int fm_mpx_get_samples(float *mpx_buffer);
+extern int fm_mpx_open(char *filename, char *raw, float ppm, int resampler_type, int rds, int processing, int preemph, int clip, float crossfade, int mpx_rate, int drift_comp, int low_latency, char *cache_dir, int composite);
+extern int fm_mpx_insert(char *filename);
+extern int fm_mpx_get_samples(sample_t *mpx_buffer);
+extern void fm_mpx_set_volume(float gain);
+extern int fm_mpx_clip_stats(struct clip_stats *stats);
+extern int fm_mpx_net_stats(struct net_stats *stats);
+extern double fm_mpx_input_age();
+extern void fm_mpx_set_queued(double seconds);
+extern int fm_mpx_drift_stats(struct drift_stats *stats);
 extern void fm_mpx_close();
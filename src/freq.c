@@ -0,0 +1,76 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include "freq.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Baseband to PLLA_FRAC words, a block at a time into ordinary cached
+// memory. Gives the same words as freq_word() on every sample: the float
+// conversions truncate towards zero like the C cast, and in fixed point
+// vqdmulh of the sample moved up to Q31 is exactly (x * scale) >> 15.
+void freq_words(uint32_t *restrict out, const sample_t *restrict in, int len, uint32_t base, scale_t scale) {
+	int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint32x4_t b = vdupq_n_u32(base);
+#ifdef FIXED_POINT
+	int32x4_t s = vdupq_n_s32(scale);
+
+	for (; i + 8 <= len; i += 8) {
+		int16x8_t x = vld1q_s16(in + i);
+		int32x4_t lo = vqdmulhq_s32(vshll_n_s16(vget_low_s16(x), 16), s);
+		int32x4_t hi = vqdmulhq_s32(vshll_n_s16(vget_high_s16(x), 16), s);
+
+		vst1q_u32(out + i, vaddq_u32(b, vreinterpretq_u32_s32(lo)));
+		vst1q_u32(out + i + 4, vaddq_u32(b, vreinterpretq_u32_s32(hi)));
+	}
+#else
+	float32x4_t s = vdupq_n_f32(scale);
+
+	for (; i + 4 <= len; i += 4) {
+		int32x4_t x = vcvtq_s32_f32(vmulq_f32(vld1q_f32(in + i), s));
+
+		vst1q_u32(out + i, vaddq_u32(b, vreinterpretq_u32_s32(x)));
+	}
+#endif
+#elif defined(__SSE2__)
+	__m128i b = _mm_set1_epi32(base);
+#ifdef FIXED_POINT
+	// SSE2 has no signed 32 bit multiply. With scale = hi * 2^15 + lo,
+	// (x * scale) >> 15 is x * hi + ((x * lo) >> 15), and both products
+	// are 16 by 16 bits as long as the scale stays below 2^30.
+	__m128i hi = _mm_set1_epi16(scale >> 15), lo = _mm_set1_epi16(scale & 0x7FFF);
+
+	for (; i + 8 <= len; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i h_lo = _mm_mullo_epi16(x, hi), h_hi = _mm_mulhi_epi16(x, hi);
+		__m128i l_lo = _mm_mullo_epi16(x, lo), l_hi = _mm_mulhi_epi16(x, lo);
+		__m128i y0 = _mm_add_epi32(_mm_unpacklo_epi16(h_lo, h_hi), _mm_srai_epi32(_mm_unpacklo_epi16(l_lo, l_hi), 15));
+		__m128i y1 = _mm_add_epi32(_mm_unpackhi_epi16(h_lo, h_hi), _mm_srai_epi32(_mm_unpackhi_epi16(l_lo, l_hi), 15));
+
+		_mm_storeu_si128((__m128i *)(out + i), _mm_add_epi32(b, y0));
+		_mm_storeu_si128((__m128i *)(out + i + 4), _mm_add_epi32(b, y1));
+	}
+#else
+	__m128 s = _mm_set1_ps(scale);
+
+	for (; i + 4 <= len; i += 4) {
+		__m128i x = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), s));
+
+		_mm_storeu_si128((__m128i *)(out + i), _mm_add_epi32(b, x));
+	}
+#endif
+#endif
+
+	for (; i < len; i++)
+		out[i] = freq_word(base, in[i], scale);
+}
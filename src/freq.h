@@ -0,0 +1,16 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef FREQ_H
+#define FREQ_H
+
+#include <stdint.h>
+#include "sample.h"
+
+extern void freq_words(uint32_t *out, const sample_t *in, int len, uint32_t base, scale_t scale);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "hal.h"
+#include "mailbox.h"
+
+static void *hw_map_peripheral(uint32_t base, uint32_t len)
+{
+	int fd = open("/dev/mem", O_RDWR | O_SYNC);
+	void *vaddr;
+
+	if (fd < 0)
+		return NULL;
+	vaddr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, base);
+	close(fd);
+	if (vaddr == MAP_FAILED)
+		return NULL;
+
+	return vaddr;
+}
+
+static void hw_unmap_peripheral(void *addr, uint32_t len)
+{
+	munmap(addr, len);
+}
+
+static uint32_t hw_dma_conblk_ad(volatile uint32_t *dma_reg)
+{
+	return dma_reg[DMA_CONBLK_AD];
+}
+
+const struct hal_backend hal_hw = {
+	.name = "hw",
+	.map_peripheral = hw_map_peripheral,
+	.unmap_peripheral = hw_unmap_peripheral,
+	.mbox_open = mbox_open,
+	.mbox_close = mbox_close,
+	.mem_alloc = mem_alloc,
+	.mem_free = mem_free,
+	.mem_lock = mem_lock,
+	.mem_unlock = mem_unlock,
+	.mapmem = mapmem,
+	.unmapmem = unmapmem,
+	.dma_conblk_ad = hw_dma_conblk_ad,
+};
+
+const struct hal_backend *hal_get(char *name) {
+	if (strcmp(name, "sim") == 0)
+		return &hal_sim;
+
+#if (RASPI) != 0
+	if (strcmp(name, "hw") == 0)
+		return &hal_hw;
+#endif
+
+	return NULL;
+}
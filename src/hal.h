@@ -0,0 +1,273 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+#ifndef RASPI
+#define RASPI                           0 // Not a Raspberry Pi, only the simulated backend is usable
+#endif
+
+#if (RASPI) == 1                        // Original Raspberry Pi 1
+#define PERIPH_VIRT_BASE                0x20000000
+#define PERIPH_PHYS_BASE                0x7e000000
+#define DRAM_PHYS_BASE                  0x40000000
+#define MEM_FLAG                        0x0c
+#define CLOCK_BASE			19.2e6
+#define DMA_CHANNEL			14
+#elif (RASPI) == 2 || (RASPI) == 0      // Raspberry Pi 2 & 3, also used for host builds
+#define PERIPH_VIRT_BASE                0x3f000000
+#define PERIPH_PHYS_BASE                0x7e000000
+#define DRAM_PHYS_BASE                  0xc0000000
+#define MEM_FLAG                        0x04
+#define CLOCK_BASE			19.2e6
+#define DMA_CHANNEL			14
+#elif (RASPI) == 4                      // Raspberry Pi 4
+#define PERIPH_VIRT_BASE                0xfe000000
+#define PERIPH_PHYS_BASE                0x7e000000
+#define DRAM_PHYS_BASE                  0xc0000000
+#define MEM_FLAG                        0x04
+#define CLOCK_BASE			54.0e6
+#define DMA_CHANNEL			6
+#else
+#error Unknown Raspberry Pi version (variable RASPI)
+#endif
+
+#define DMA_BASE_OFFSET                 0x00007000
+#define PWM_BASE_OFFSET                 0x0020C000
+#define PWM_LEN                         0x28
+#define CLK_BASE_OFFSET                 0x00101000
+#define CLK_LEN                         0x1300
+#define GPIO_BASE_OFFSET                0x00200000
+#define GPIO_LEN                        0x100
+#define PCM_BASE_OFFSET                 0x00203000
+#define PCM_LEN                         0x24
+#define PAD_BASE_OFFSET                 0x00100000
+#define PAD_LEN                         (0x40/4) //0x64
+
+#define DMA_VIRT_BASE                   (PERIPH_VIRT_BASE + DMA_BASE_OFFSET)
+#define PWM_VIRT_BASE                   (PERIPH_VIRT_BASE + PWM_BASE_OFFSET)
+#define CLK_VIRT_BASE                   (PERIPH_VIRT_BASE + CLK_BASE_OFFSET)
+#define GPIO_VIRT_BASE                  (PERIPH_VIRT_BASE + GPIO_BASE_OFFSET)
+#define PAD_VIRT_BASE                   (PERIPH_VIRT_BASE + PAD_BASE_OFFSET)
+#define PCM_VIRT_BASE                   (PERIPH_VIRT_BASE + PCM_BASE_OFFSET)
+
+#define PWM_PHYS_BASE                   (PERIPH_PHYS_BASE + PWM_BASE_OFFSET)
+#define PCM_PHYS_BASE                   (PERIPH_PHYS_BASE + PCM_BASE_OFFSET)
+#define GPIO_PHYS_BASE                  (PERIPH_PHYS_BASE + GPIO_BASE_OFFSET)
+
+// GPIO
+#define GPFSEL0                         (0x00/4)
+#define GPFSEL1                         (0x04/4)
+#define GPFSEL2                         (0x08/4)
+#define GPPUD                           (0x94/4)
+#define GPPUDCLK0                       (0x98/4)
+#define GPPUDCLK1                       (0x9C/4)
+
+#define CORECLK_CNTL                    (0x08/4)
+#define CORECLK_DIV                     (0x0c/4)
+#define GPCLK_CNTL                      (0x70/4)
+#define GPCLK_DIV                       (0x74/4)
+#define EMMCCLK_CNTL                    (0x1C0/4)
+#define EMMCCLK_DIV                     (0x1C4/4)
+
+#define CM_LOCK                         (0x114/4)
+#define CM_LOCK_FLOCKA                  (1<<8)
+#define CM_LOCK_FLOCKB                  (1<<9)
+#define CM_LOCK_FLOCKC                  (1<<10)
+#define CM_LOCK_FLOCKD                  (1<<11)
+#define CM_LOCK_FLOCKH                  (1<<12)
+
+#define CM_PLLA                         (0x104/4)
+#define CM_PLLC                         (0x108/4)
+#define CM_PLLD                         (0x10c/4)
+#define CM_PLLH                         (0x110/4)
+#define CM_PLLB                         (0x170/4)
+
+#define A2W_PLLA_ANA0                   (0x1010/4)
+#define A2W_PLLC_ANA0                   (0x1030/4)
+#define A2W_PLLD_ANA0                   (0x1050/4)
+#define A2W_PLLH_ANA0                   (0x1070/4)
+#define A2W_PLLB_ANA0                   (0x10f0/4)
+#define A2W_PLL_KA_SHIFT                7
+#define A2W_PLL_KI_SHIFT                19
+#define A2W_PLL_KP_SHIFT                15
+
+#define PLLA_CTRL                       (0x1100/4)
+#define PLLA_FRAC                       (0x1200/4)
+#define PLLA_DSI0                       (0x1300/4)
+#define PLLA_CORE                       (0x1400/4)
+#define PLLA_PER                        (0x1500/4)
+#define PLLA_CCP2                       (0x1600/4)
+
+#define PLLB_CTRL                       (0x11e0/4)
+#define PLLB_FRAC                       (0x12e0/4)
+#define PLLB_ARM                        (0x13e0/4)
+#define PLLB_SP0                        (0x14e0/4)
+#define PLLB_SP1                        (0x15e0/4)
+#define PLLB_SP2                        (0x16e0/4)
+
+#define PLLC_CTRL                       (0x1120/4)
+#define PLLC_FRAC                       (0x1220/4)
+#define PLLC_CORE2                      (0x1320/4)
+#define PLLC_CORE1                      (0x1420/4)
+#define PLLC_PER                        (0x1520/4)
+#define PLLC_CORE0                      (0x1620/4)
+
+#define PLLD_CTRL                       (0x1140/4)
+#define PLLD_FRAC                       (0x1240/4)
+#define PLLD_DSI0                       (0x1340/4)
+#define PLLD_CORE                       (0x1440/4)
+#define PLLD_PER                        (0x1540/4)
+#define PLLD_DSI1                       (0x1640/4)
+
+#define PLLH_CTRL                       (0x1160/4)
+#define PLLH_FRAC                       (0x1260/4)
+#define PLLH_AUX                        (0x1360/4)
+#define PLLH_RCAL                       (0x1460/4)
+#define PLLH_PIX                        (0x1560/4)
+#define PLLH_STS                        (0x1660/4)
+
+// PWM
+#define PWM_CTL                         (0x00/4)
+#define PWM_DMAC                        (0x08/4)
+#define PWM_RNG1                        (0x10/4)
+#define PWM_RNG2                        (0x20/4)
+#define PWM_FIFO                        (0x18/4)
+
+#define PWMCLK_CNTL                     40
+#define PWMCLK_DIV                      41
+
+#define PWMCTL_PWEN1                    (1<<0)
+#define PWMCTL_MODE1                    (1<<1)
+#define PWMCTL_RPTL1                    (1<<2)
+#define PWMCTL_POLA1                    (1<<4)
+#define PWMCTL_USEF1                    (1<<5)
+#define PWMCTL_CLRF                     (1<<6)
+#define PWMCTL_MSEN1                    (1<<7)
+#define PWMCTL_PWEN2                    (1<<8)
+#define PWMCTL_MODE2                    (1<<9)
+#define PWMCTL_RPTL2                    (1<<10)
+#define PWMCTL_USEF2                    (1<<13)
+#define PWMCTL_MSEN2                    (1<<15)
+
+#define PWMDMAC_ENAB                    (1<<31)
+#define PWMDMAC_THRSHLD                 ((15<<8)|(15<<0))
+
+// PCM
+#define PCM_CS_A                        (0x00/4)
+#define PCM_FIFO_A                      (0x04/4)
+#define PCM_MODE_A                      (0x08/4)
+#define PCM_RXC_A                       (0x0c/4)
+#define PCM_TXC_A                       (0x10/4)
+#define PCM_DREQ_A                      (0x14/4)
+#define PCM_INTEN_A                     (0x18/4)
+#define PCM_INT_STC_A                   (0x1c/4)
+#define PCM_GRAY                        (0x20/4)
+
+#define PCMCLK_CNTL                     38
+#define PCMCLK_DIV                      39
+
+// PAD
+#define GPIO_PAD_0_27                   (0x2C/4)
+#define GPIO_PAD_28_45                  (0x30/4)
+#define GPIO_PAD_46_52                  (0x34/4)
+
+// DMA
+#define DMA_CHANNEL_MAX                 14
+#define DMA_CHANNEL_SIZE                0x100
+
+#define BCM2708_DMA_ACTIVE              (1<<0)
+#define BCM2708_DMA_END                 (1<<1)
+#define BCM2708_DMA_INT                 (1<<2)
+#define BCM2708_DMA_WAIT_RESP           (1<<3)
+#define BCM2708_DMA_D_DREQ              (1<<6)
+#define BCM2708_DMA_DST_IGNOR           (1<<7)
+#define BCM2708_DMA_SRC_INC             (1<<8)
+#define BCM2708_DMA_SRC_IGNOR           (1<<11)
+#define BCM2708_DMA_NO_WIDE_BURSTS      (1<<26)
+#define BCM2708_DMA_DISDEBUG            (1<<28)
+#define BCM2708_DMA_ABORT               (1<<30)
+#define BCM2708_DMA_RESET               (1<<31)
+#define BCM2708_DMA_PER_MAP(x)          ((x)<<16)
+#define BCM2708_DMA_PRIORITY(x)         ((x)&0xf << 16)
+#define BCM2708_DMA_PANIC_PRIORITY(x)   ((x)&0xf << 20)
+
+#define DMA_CS                          (0x00/4)
+#define DMA_CONBLK_AD                   (0x04/4)
+#define DMA_DEBUG                       (0x20/4)
+
+#define DMA_CS_RESET			(1<<31)
+#define DMA_CS_ABORT			(1<<30)
+#define DMA_CS_DISDEBUG			(1<<29)
+#define DMA_CS_WAIT_FOR_OUTSTANDING_WRITES (1<<28)
+#define DMA_CS_INT			(1<<2)
+#define DMA_CS_END			(1<<1)
+#define DMA_CS_ACTIVE			(1<<0)
+#define DMA_CS_PRIORITY(x)		((x)&0xf << 16)
+#define DMA_CS_PANIC_PRIORITY(x)	((x)&0xf << 20)
+
+#define DREQ_PCM_TX                     2
+#define DREQ_PCM_RX                     3
+#define DREQ_SMI                        4
+#define DREQ_PWM                        5
+#define DREQ_SPI_TX                     6
+#define DREQ_SPI_RX                     7
+#define DREQ_SPI_SLAVE_TX               8
+#define DREQ_SPI_SLAVE_RX               9
+
+#define MEM_FLAG_DISCARDABLE            (1 << 0) /* can be resized to 0 at any time. Use for cached data */
+#define MEM_FLAG_NORMAL                 (0 << 2) /* normal allocating alias. Don't use from ARM */
+#define MEM_FLAG_DIRECT                 (1 << 2) /* 0xC alias uncached */
+#define MEM_FLAG_COHERENT               (2 << 2) /* 0x8 alias. Non-allocating in L2 but coherent */
+#define MEM_FLAG_L1_NONALLOCATING       (MEM_FLAG_DIRECT | MEM_FLAG_COHERENT) /* Allocating in L2 */
+#define MEM_FLAG_ZERO                   (1 << 4)  /* initialise buffer to all zeros */
+#define MEM_FLAG_NO_INIT                (1 << 5) /* don't initialise (default is initialise to all ones */
+#define MEM_FLAG_HINT_PERMALOCK         (1 << 6) /* Likely to be locked for long periods of time. */
+
+#define BUS_TO_PHYS(x)                  ((x)&~0xC0000000)
+
+#define PAGE_SIZE                       4096
+#define PAGE_SHIFT                      12
+
+typedef struct {
+    uint32_t info, src, dst, length, stride, next, pad[2];
+} dma_cb_t;
+
+// Hardware backend: everything tx() needs from the peripherals and the VideoCore mailbox.
+// The real backend talks to /dev/mem and /dev/vcio, the simulated one keeps the registers
+// and GPU memory in RAM and executes the DMA control blocks in software at the rate the
+// PWM clock registers describe.
+struct hal_backend {
+	const char *name;
+
+	// Peripheral mapping; base is the ARM physical address (*_VIRT_BASE).
+	void *(*map_peripheral)(uint32_t base, uint32_t len);
+	void (*unmap_peripheral)(void *addr, uint32_t len);
+
+	// Mailbox GPU memory allocation, same contract as mailbox.c
+	int (*mbox_open)();
+	void (*mbox_close)(int file_desc);
+	unsigned (*mem_alloc)(int file_desc, unsigned size, unsigned align, unsigned flags);
+	unsigned (*mem_free)(int file_desc, unsigned handle);
+	unsigned (*mem_lock)(int file_desc, unsigned handle);
+	unsigned (*mem_unlock)(int file_desc, unsigned handle);
+	void *(*mapmem)(unsigned base, unsigned size);
+	void (*unmapmem)(void *addr, unsigned size);
+
+	// Bus address of the control block the DMA channel is currently processing.
+	uint32_t (*dma_conblk_ad)(volatile uint32_t *dma_reg);
+};
+
+extern const struct hal_backend hal_hw;
+extern const struct hal_backend hal_sim;
+
+extern const struct hal_backend *hal_get(char *name);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hal.h"
+
+// Simulated backend. Peripheral registers and mailbox memory are plain heap
+// allocations, and the DMA engine is emulated lazily: every position readback
+// executes the control blocks that real hardware would have processed since
+// the channel was activated. Control blocks with D_DREQ set are paced at the
+// rate the PLLA, PWM clock divider and PWM range registers work out to.
+
+#define SIM_MAX_MAPS                    8
+#define SIM_MAX_BLOCKS                  4
+#define SIM_BLOCK_SPAN                  0x04000000
+#define SIM_MAX_STEPS                   (1 << 24)
+
+static struct {
+	uint32_t base;
+	uint32_t len;
+	uint32_t *mem;
+} sim_map[SIM_MAX_MAPS];
+
+static struct {
+	uint32_t phys;
+	uint32_t size;
+	uint8_t *mem;
+} sim_block[SIM_MAX_BLOCKS];
+
+static struct {
+	int running;
+	struct timespec start;
+	double rate;
+	uint64_t paced;
+} sim_dma;
+
+static uint32_t page_align(uint32_t len)
+{
+	return (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+static volatile uint32_t *sim_find_map(uint32_t base)
+{
+	for (int i = 0; i < SIM_MAX_MAPS; i++) {
+		if (sim_map[i].mem && sim_map[i].base == base)
+			return sim_map[i].mem;
+	}
+
+	return NULL;
+}
+
+static void *sim_bus_to_virt(uint32_t bus, uint32_t len)
+{
+	if ((bus & 0xff000000) == PERIPH_PHYS_BASE) {
+		uint32_t addr = bus - PERIPH_PHYS_BASE + PERIPH_VIRT_BASE;
+
+		for (int i = 0; i < SIM_MAX_MAPS; i++) {
+			if (sim_map[i].mem && addr >= sim_map[i].base && addr + len <= sim_map[i].base + sim_map[i].len)
+				return (uint8_t *)sim_map[i].mem + (addr - sim_map[i].base);
+		}
+		return NULL;
+	}
+
+	uint32_t phys = BUS_TO_PHYS(bus);
+
+	for (int i = 0; i < SIM_MAX_BLOCKS; i++) {
+		if (sim_block[i].mem && phys >= sim_block[i].phys && phys + len <= sim_block[i].phys + sim_block[i].size)
+			return sim_block[i].mem + (phys - sim_block[i].phys);
+	}
+
+	return NULL;
+}
+
+static void *sim_map_peripheral(uint32_t base, uint32_t len)
+{
+	for (int i = 0; i < SIM_MAX_MAPS; i++) {
+		if (sim_map[i].mem)
+			continue;
+
+		// Real mappings are whole pages, and some register offsets rely on that
+		sim_map[i].len = page_align(len);
+		if (!(sim_map[i].mem = calloc(1, sim_map[i].len)))
+			return NULL;
+		sim_map[i].base = base;
+
+		// The PLLs lock instantly
+		if (base == CLK_VIRT_BASE)
+			sim_map[i].mem[CM_LOCK] = CM_LOCK_FLOCKA;
+
+		return sim_map[i].mem;
+	}
+
+	return NULL;
+}
+
+static void sim_unmap_peripheral(void *addr, uint32_t len)
+{
+	for (int i = 0; i < SIM_MAX_MAPS; i++) {
+		if (sim_map[i].mem == addr) {
+			free(sim_map[i].mem);
+			sim_map[i].mem = NULL;
+		}
+	}
+}
+
+static int sim_mbox_open()
+{
+	return 0;
+}
+
+static void sim_mbox_close(int file_desc)
+{
+}
+
+static unsigned sim_mem_alloc(int file_desc, unsigned size, unsigned align, unsigned flags)
+{
+	size = page_align(size);
+	if (size > SIM_BLOCK_SPAN)
+		return 0;
+
+	for (int i = 0; i < SIM_MAX_BLOCKS; i++) {
+		if (sim_block[i].mem)
+			continue;
+
+		if (!(sim_block[i].mem = aligned_alloc(PAGE_SIZE, size)))
+			return 0;
+		// Same initialisation rules as the firmware
+		if (flags & MEM_FLAG_ZERO)
+			memset(sim_block[i].mem, 0, size);
+		else if (!(flags & MEM_FLAG_NO_INIT))
+			memset(sim_block[i].mem, 0xff, size);
+		sim_block[i].size = size;
+		sim_block[i].phys = (i + 1) * SIM_BLOCK_SPAN;
+
+		return i + 1;
+	}
+
+	return 0;
+}
+
+static unsigned sim_mem_free(int file_desc, unsigned handle)
+{
+	if (handle < 1 || handle > SIM_MAX_BLOCKS)
+		return 1;
+
+	free(sim_block[handle - 1].mem);
+	sim_block[handle - 1].mem = NULL;
+
+	return 0;
+}
+
+static unsigned sim_mem_lock(int file_desc, unsigned handle)
+{
+	if (handle < 1 || handle > SIM_MAX_BLOCKS || !sim_block[handle - 1].mem)
+		return 0;
+
+	return sim_block[handle - 1].phys | DRAM_PHYS_BASE;
+}
+
+static unsigned sim_mem_unlock(int file_desc, unsigned handle)
+{
+	return 0;
+}
+
+static void *sim_mapmem(unsigned base, unsigned size)
+{
+	return sim_bus_to_virt(base, size);
+}
+
+static void sim_unmapmem(void *addr, unsigned size)
+{
+}
+
+// Rate at which the PWM raises DREQ, derived from the registers tx() programmed
+static double sim_pacing_rate()
+{
+	volatile uint32_t *clk = sim_find_map(CLK_VIRT_BASE);
+	volatile uint32_t *pwm = sim_find_map(PWM_VIRT_BASE);
+
+	if (!clk || !pwm)
+		return 0;
+
+	double vco = CLOCK_BASE * ((clk[PLLA_CTRL] & 0x3ff) + (clk[PLLA_FRAC] & 0xfffff) / (double)(1 << 20));
+	double per = clk[PLLA_PER] & 0xff;
+	double div = ((clk[PWMCLK_DIV] >> 12) & 0xfff) + (clk[PWMCLK_DIV] & 0xfff) / 4096.0;
+	uint32_t range = pwm[PWM_RNG1];
+
+	if (per == 0 || div == 0 || range == 0)
+		return 0;
+
+	return vco / per / div / range;
+}
+
+static uint32_t sim_dma_conblk_ad(volatile uint32_t *dma_reg)
+{
+	struct timespec now;
+	uint32_t conblk = dma_reg[DMA_CONBLK_AD];
+
+	if (!(dma_reg[DMA_CS] & BCM2708_DMA_ACTIVE)) {
+		sim_dma.running = 0;
+		return conblk;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (!sim_dma.running) {
+		sim_dma.running = 1;
+		sim_dma.start = now;
+		sim_dma.paced = 0;
+		sim_dma.rate = sim_pacing_rate();
+		printf("Simulated DMA paced at %.1f Hz.\n", sim_dma.rate);
+	}
+
+	double elapsed = (now.tv_sec - sim_dma.start.tv_sec) + (now.tv_nsec - sim_dma.start.tv_nsec) / 1e9;
+	uint64_t due = elapsed * sim_dma.rate;
+
+	for (int steps = 0; conblk && steps < SIM_MAX_STEPS; steps++) {
+		dma_cb_t *cb = sim_bus_to_virt(conblk, sizeof(dma_cb_t));
+
+		if (cb == NULL) {
+			fprintf(stderr, "Simulated DMA: bad control block address 0x%08x\n", conblk);
+			dma_reg[DMA_CS] &= ~BCM2708_DMA_ACTIVE;
+			break;
+		}
+
+		if (cb->info & BCM2708_DMA_D_DREQ) {
+			if (sim_dma.paced >= due)
+				break;
+			sim_dma.paced++;
+		}
+
+		void *src = sim_bus_to_virt(cb->src, cb->length);
+		void *dst = sim_bus_to_virt(cb->dst, cb->length);
+		if (src && dst)
+			memmove(dst, src, cb->length);
+
+		conblk = cb->next;
+	}
+
+	if (!conblk)
+		dma_reg[DMA_CS] &= ~BCM2708_DMA_ACTIVE;
+	dma_reg[DMA_CONBLK_AD] = conblk;
+
+	return conblk;
+}
+
+const struct hal_backend hal_sim = {
+	.name = "sim",
+	.map_peripheral = sim_map_peripheral,
+	.unmap_peripheral = sim_unmap_peripheral,
+	.mbox_open = sim_mbox_open,
+	.mbox_close = sim_mbox_close,
+	.mem_alloc = sim_mem_alloc,
+	.mem_free = sim_mem_free,
+	.mem_lock = sim_mem_lock,
+	.mem_unlock = sim_mem_unlock,
+	.mapmem = sim_mapmem,
+	.unmapmem = sim_unmapmem,
+	.dma_conblk_ad = sim_dma_conblk_ad,
+};
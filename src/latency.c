@@ -0,0 +1,111 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <string.h>
+#include "latency.h"
+
+void latency_init(struct latency *l) {
+	atomic_init(&l->head, 0);
+	atomic_init(&l->tail, 0);
+	for (int i = 0; i < LATENCY_BINS; i++)
+		atomic_init(&l->bins[i], 0);
+	atomic_init(&l->count, 0);
+	atomic_init(&l->dropped, 0);
+	atomic_init(&l->min_us, UINT32_MAX);
+	atomic_init(&l->max_us, 0);
+}
+
+// From the DSP thread
+void latency_mark(struct latency *l, uint64_t sample, uint64_t ns) {
+	uint32_t head = atomic_load_explicit(&l->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&l->tail, memory_order_acquire);
+
+	if (head - tail >= LATENCY_MARKS) {
+		atomic_fetch_add_explicit(&l->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	l->marks[head % LATENCY_MARKS].sample = sample;
+	l->marks[head % LATENCY_MARKS].ns = ns;
+	atomic_store_explicit(&l->head, head + 1, memory_order_release);
+}
+
+// From the refill thread, the only writer of the histogram
+void latency_record(struct latency *l, int64_t ns) {
+	uint32_t us = ns > 0 ? ns / 1000 : 0;
+	uint32_t bin = us / LATENCY_BIN_US;
+
+	if (bin >= LATENCY_BINS)
+		bin = LATENCY_BINS - 1;
+	atomic_store_explicit(&l->bins[bin], atomic_load_explicit(&l->bins[bin], memory_order_relaxed) + 1,
+		memory_order_relaxed);
+	if (us < atomic_load_explicit(&l->min_us, memory_order_relaxed))
+		atomic_store_explicit(&l->min_us, us, memory_order_relaxed);
+	if (us > atomic_load_explicit(&l->max_us, memory_order_relaxed))
+		atomic_store_explicit(&l->max_us, us, memory_order_relaxed);
+	atomic_store_explicit(&l->count, atomic_load_explicit(&l->count, memory_order_relaxed) + 1,
+		memory_order_release);
+}
+
+// Baseband samples first to first + len have just been written into the
+// DMA ring, where the first goes out at start_ns and the rest follow at
+// rate. Marks for samples before first were never written, the DMA
+// ring having been restarted past them.
+void latency_resolve(struct latency *l, uint64_t first, uint32_t len, uint64_t start_ns, double rate) {
+	uint32_t tail = atomic_load_explicit(&l->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&l->head, memory_order_acquire);
+
+	for (; tail != head; tail++) {
+		struct latency_mark *m = &l->marks[tail % LATENCY_MARKS];
+
+		if (m->sample >= first + len)
+			break;
+		if (m->sample >= first)
+			latency_record(l, (int64_t)(start_ns + (m->sample - first) / rate * 1e9) - (int64_t)m->ns);
+	}
+
+	atomic_store_explicit(&l->tail, tail, memory_order_release);
+}
+
+static float percentile(const uint32_t *bins, uint64_t count, double p)
+{
+	uint64_t rank = count * p, seen = 0;
+
+	for (int i = 0; i < LATENCY_BINS; i++) {
+		seen += bins[i];
+		if (seen > rank)
+			return (i + 0.5f) * LATENCY_BIN_US / 1000.0f;
+	}
+
+	return LATENCY_BINS * LATENCY_BIN_US / 1000.0f;
+}
+
+// Percentiles from any thread, to the middle of their bin
+void latency_read(struct latency *l, struct latency_stats *stats) {
+	uint32_t bins[LATENCY_BINS];
+	uint64_t count = 0;
+
+	memset(stats, 0, sizeof(struct latency_stats));
+	atomic_load_explicit(&l->count, memory_order_acquire);
+	for (int i = 0; i < LATENCY_BINS; i++) {
+		bins[i] = atomic_load_explicit(&l->bins[i], memory_order_relaxed);
+		count += bins[i];
+	}
+
+	stats->count = count;
+	stats->dropped = atomic_load_explicit(&l->dropped, memory_order_relaxed);
+	if (!count)
+		return;
+	stats->min_ms = atomic_load_explicit(&l->min_us, memory_order_relaxed) / 1000.0f;
+	stats->max_ms = atomic_load_explicit(&l->max_us, memory_order_relaxed) / 1000.0f;
+	stats->p50_ms = percentile(bins, count, 0.5);
+	stats->p90_ms = percentile(bins, count, 0.9);
+	stats->p99_ms = percentile(bins, count, 0.99);
+	stats->p999_ms = percentile(bins, count, 0.999);
+	stats->p999_ms = stats->p999_ms < stats->max_ms ? stats->p999_ms : stats->max_ms;
+	stats->p99_ms = stats->p99_ms < stats->max_ms ? stats->p99_ms : stats->max_ms;
+}
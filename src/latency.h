@@ -0,0 +1,51 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "stats.h"
+
+// Histogram of latencies, 100 us bins up to 2 s; longer ones go in the last
+#define LATENCY_BIN_US                  100
+#define LATENCY_BINS                    20000
+
+// Blocks on their way from the DSP thread to the DMA ring
+#define LATENCY_MARKS                   1024
+
+// When the newest input frame of a block was captured, and the baseband
+// sample it ended up in, counted since the start of the baseband ring
+struct latency_mark {
+	uint64_t sample;
+	uint64_t ns;                    // CLOCK_MONOTONIC_RAW
+};
+
+// Capture to DMA slot latency. The DSP thread marks each block, the refill
+// thread takes the marks in the same SPSC fashion as struct mpx_ring when
+// it writes their samples into the DMA ring, where the time they go out is
+// known, and keeps the histogram. Other threads read the histogram as it
+// is; a bin a report misses shows up in the next.
+struct latency {
+	struct latency_mark marks[LATENCY_MARKS];
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+	_Atomic uint32_t bins[LATENCY_BINS];
+	_Atomic uint64_t count;
+	_Atomic uint64_t dropped;       // marks that found the queue full
+	_Atomic uint32_t min_us;
+	_Atomic uint32_t max_us;
+};
+
+extern void latency_init(struct latency *l);
+extern void latency_mark(struct latency *l, uint64_t sample, uint64_t ns);
+extern void latency_resolve(struct latency *l, uint64_t first, uint32_t len, uint64_t start_ns, double rate);
+extern void latency_record(struct latency *l, int64_t ns);
+extern void latency_read(struct latency *l, struct latency_stats *stats);
+
+#endif
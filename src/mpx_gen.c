@@ -0,0 +1,258 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdlib.h>
+#include <math.h>
+#include "mpx_gen.h"
+#include "rds.h"
+
+#define PILOT_FREQ 19000
+
+// Share of the peak deviation for the pilot and RDS. Audio gets the rest.
+#define MPX_PILOT_LEVEL 0.09f
+#define MPX_RDS_LEVEL 0.04f
+
+static int gcd(int a, int b)
+{
+	while (b) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+int mpx_osc_init(struct mpx_osc *osc, int rate, int rds) {
+	osc->period = rate / gcd(rate, PILOT_FREQ);
+	osc->phase = 0;
+	osc->pilot = malloc(osc->period * sizeof(sample_t));
+	osc->sub = malloc(osc->period * sizeof(sample_t));
+	osc->rds = malloc(osc->period * sizeof(sample_t));
+	if (!osc->pilot || !osc->sub || !osc->rds) {
+		mpx_osc_free(osc);
+		return -1;
+	}
+
+	for (int i = 0; i < osc->period; i++) {
+		osc->pilot[i] = sample_from_float(sin(2 * M_PI * PILOT_FREQ * i / rate));
+		osc->sub[i] = sample_from_float(sin(2 * M_PI * 2 * PILOT_FREQ * i / rate));
+		osc->rds[i] = sample_from_float(sin(2 * M_PI * 3 * PILOT_FREQ * i / rate));
+	}
+
+	osc->rds_level = rds ? MPX_RDS_LEVEL : 0;
+	osc->stereo_level = (1 - MPX_PILOT_LEVEL - osc->rds_level) / 2;
+	osc->mono_level = 1 - osc->rds_level;
+
+	return 0;
+}
+
+void mpx_osc_free(struct mpx_osc *osc) {
+	free(osc->pilot);
+	free(osc->sub);
+	free(osc->rds);
+	osc->pilot = NULL;
+	osc->sub = NULL;
+	osc->rds = NULL;
+}
+
+// Mix interleaved L/R, and the shaped RDS data if there is any, into the
+// stereo multiplex. The inner loops run up to the next table wrap and have
+// no dependencies between iterations, so the compiler turns them into
+// NEON/SSE code. In fixed point the terms are summed in Q30; with full
+// scale audio the levels add up to just under 2^31.
+void mpx_stereo(struct mpx_osc *osc, const sample_t *restrict lr, const sample_t *restrict rds, sample_t *restrict mpx, int len) {
+#ifdef FIXED_POINT
+	int32_t audio_level = lrintf(osc->stereo_level * 32768);
+	int32_t pilot_level = lrintf(MPX_PILOT_LEVEL * 32768);
+	int32_t rds_level = lrintf(osc->rds_level / RDS_PEAK * 32768);
+#else
+	float audio_level = osc->stereo_level;
+	float pilot_level = MPX_PILOT_LEVEL;
+	float rds_level = osc->rds_level;
+#endif
+	int phase = osc->phase;
+
+	while (len) {
+		int run = osc->period - phase;
+		const sample_t *restrict pilot = osc->pilot + phase;
+		const sample_t *restrict sub = osc->sub + phase;
+		const sample_t *restrict carrier = osc->rds + phase;
+
+		if (run > len)
+			run = len;
+
+		if (rds) {
+			for (int i = 0; i < run; i++) {
+#ifdef FIXED_POINT
+				int32_t l = lr[2 * i], r = lr[2 * i + 1];
+				int32_t acc = audio_level * ((l + r) + mul_q15(l - r, sub[i])) + pilot_level * pilot[i]
+					+ rds_level * mul_q15(rds[i], carrier[i]);
+
+				mpx[i] = sat16((acc + (1 << 14)) >> 15);
+#else
+				float l = lr[2 * i], r = lr[2 * i + 1];
+
+				mpx[i] = audio_level * ((l + r) + (l - r) * sub[i]) + pilot_level * pilot[i]
+					+ rds_level * rds[i] * carrier[i];
+#endif
+			}
+			rds += run;
+		} else {
+			for (int i = 0; i < run; i++) {
+#ifdef FIXED_POINT
+				int32_t l = lr[2 * i], r = lr[2 * i + 1];
+				int32_t acc = audio_level * ((l + r) + mul_q15(l - r, sub[i])) + pilot_level * pilot[i];
+
+				mpx[i] = sat16((acc + (1 << 14)) >> 15);
+#else
+				float l = lr[2 * i], r = lr[2 * i + 1];
+
+				mpx[i] = audio_level * ((l + r) + (l - r) * sub[i]) + pilot_level * pilot[i];
+#endif
+			}
+		}
+
+		lr += 2 * run;
+		mpx += run;
+		len -= run;
+		phase += run;
+		if (phase == osc->period)
+			phase = 0;
+	}
+
+	osc->phase = phase;
+}
+
+// The stereo multiplex in two passes, for the composite clipper to work on
+// the audio in between: L+R and L-R on the subcarrier from the current
+// phase, leaving the phase where it is...
+void mpx_stereo_audio(struct mpx_osc *osc, const sample_t *restrict lr, sample_t *restrict mpx, int len) {
+#ifdef FIXED_POINT
+	int32_t audio_level = lrintf(osc->stereo_level * 32768);
+#else
+	float audio_level = osc->stereo_level;
+#endif
+	int phase = osc->phase;
+
+	while (len) {
+		int run = osc->period - phase;
+		const sample_t *restrict sub = osc->sub + phase;
+
+		if (run > len)
+			run = len;
+
+		for (int i = 0; i < run; i++) {
+#ifdef FIXED_POINT
+			int32_t l = lr[2 * i], r = lr[2 * i + 1];
+			int32_t acc = audio_level * ((l + r) + mul_q15(l - r, sub[i]));
+
+			mpx[i] = sat16((acc + (1 << 14)) >> 15);
+#else
+			float l = lr[2 * i], r = lr[2 * i + 1];
+
+			mpx[i] = audio_level * ((l + r) + (l - r) * sub[i]);
+#endif
+		}
+
+		lr += 2 * run;
+		mpx += run;
+		len -= run;
+		phase = 0;
+	}
+}
+
+// ...then the pilot and RDS on top, in place, moving the phase on
+void mpx_stereo_subcarriers(struct mpx_osc *osc, const sample_t *restrict rds, sample_t *restrict mpx, int len) {
+#ifdef FIXED_POINT
+	int32_t pilot_level = lrintf(MPX_PILOT_LEVEL * 32768);
+	int32_t rds_level = lrintf(osc->rds_level / RDS_PEAK * 32768);
+#else
+	float pilot_level = MPX_PILOT_LEVEL;
+	float rds_level = osc->rds_level;
+#endif
+	int phase = osc->phase;
+
+	while (len) {
+		int run = osc->period - phase;
+		const sample_t *restrict pilot = osc->pilot + phase;
+		const sample_t *restrict carrier = osc->rds + phase;
+
+		if (run > len)
+			run = len;
+
+		if (rds) {
+			for (int i = 0; i < run; i++) {
+#ifdef FIXED_POINT
+				int32_t acc = mpx[i] * 32768 + pilot_level * pilot[i] + rds_level * mul_q15(rds[i], carrier[i]);
+
+				mpx[i] = sat16((acc + (1 << 14)) >> 15);
+#else
+				mpx[i] += pilot_level * pilot[i] + rds_level * rds[i] * carrier[i];
+#endif
+			}
+			rds += run;
+		} else {
+			for (int i = 0; i < run; i++) {
+#ifdef FIXED_POINT
+				int32_t acc = mpx[i] * 32768 + pilot_level * pilot[i];
+
+				mpx[i] = sat16((acc + (1 << 14)) >> 15);
+#else
+				mpx[i] += pilot_level * pilot[i];
+#endif
+			}
+		}
+
+		mpx += run;
+		len -= run;
+		phase += run;
+		if (phase == osc->period)
+			phase = 0;
+	}
+
+	osc->phase = phase;
+}
+
+// Make room for RDS in mono audio, in place, and add it
+void mpx_mono(struct mpx_osc *osc, const sample_t *restrict rds, sample_t *restrict mpx, int len) {
+#ifdef FIXED_POINT
+	int32_t audio_level = lrintf(osc->mono_level * 32768);
+	int32_t rds_level = lrintf(osc->rds_level / RDS_PEAK * 32768);
+#else
+	float audio_level = osc->mono_level;
+	float rds_level = osc->rds_level;
+#endif
+	int phase = osc->phase;
+
+	while (len) {
+		int run = osc->period - phase;
+		const sample_t *restrict carrier = osc->rds + phase;
+
+		if (run > len)
+			run = len;
+
+		for (int i = 0; i < run; i++) {
+#ifdef FIXED_POINT
+			int32_t acc = audio_level * mpx[i] + rds_level * mul_q15(rds[i], carrier[i]);
+
+			mpx[i] = sat16((acc + (1 << 14)) >> 15);
+#else
+			mpx[i] = audio_level * mpx[i] + rds_level * rds[i] * carrier[i];
+#endif
+		}
+
+		rds += run;
+		mpx += run;
+		len -= run;
+		phase += run;
+		if (phase == osc->period)
+			phase = 0;
+	}
+
+	osc->phase = phase;
+}
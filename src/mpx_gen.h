@@ -0,0 +1,36 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef MPX_GEN_H
+#define MPX_GEN_H
+
+#include "sample.h"
+
+// Subcarrier oscillators for the multiplex. All of them are harmonics of the
+// 19 kHz pilot, so at the baseband rate they repeat exactly every period
+// samples (192 at 192 kHz) and are read from tables sharing one phase
+// counter, which keeps them phase locked by construction.
+struct mpx_osc {
+	sample_t *pilot;                // sin(19 kHz)
+	sample_t *sub;                  // sin(38 kHz)
+	sample_t *rds;                  // sin(57 kHz)
+	int period;
+	int phase;
+
+	float stereo_level;             // L+R, and L-R on the subcarrier
+	float mono_level;
+	float rds_level;                // 0 without RDS
+};
+
+extern int mpx_osc_init(struct mpx_osc *osc, int rate, int rds);
+extern void mpx_osc_free(struct mpx_osc *osc);
+extern void mpx_stereo(struct mpx_osc *osc, const sample_t *lr, const sample_t *rds, sample_t *mpx, int len);
+extern void mpx_stereo_audio(struct mpx_osc *osc, const sample_t *lr, sample_t *mpx, int len);
+extern void mpx_stereo_subcarriers(struct mpx_osc *osc, const sample_t *rds, sample_t *mpx, int len);
+extern void mpx_mono(struct mpx_osc *osc, const sample_t *rds, sample_t *mpx, int len);
+
+#endif
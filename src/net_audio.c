@@ -0,0 +1,812 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "net_audio.h"
+#include "pcm_map.h"
+
+// Delay limits. UDP and RTP start out at NET_START_DELAY and then follow
+// the jitter; HTTP starts at NET_HTTP_DELAY and grows on underruns.
+#define NET_MIN_DELAY_MS 20
+#define NET_MAX_DELAY_MS 1000
+#define NET_START_DELAY_MS 100
+#define NET_HTTP_DELAY_MS 200
+#define NET_BUFFER_MS 2000
+
+// Target delay in multiples of the smoothed jitter, on top of two packets
+// and the block the reader takes at a time
+#define JITTER_FACTOR 4
+
+// Concealment replays the last CONCEAL_MS of audio, fading it out over
+// CONCEAL_FADE_MS; real audio and skips are crossfaded over CROSSFADE frames
+#define CONCEAL_MS 10
+#define CONCEAL_FADE_MS 20
+#define CROSSFADE 64
+
+// How often blocked calls look at the stop flag
+#define NET_POLL_MS 100
+// An HTTP stream that sends nothing for this long is reconnected
+#define HTTP_TIMEOUT_MS 5000
+#define HTTP_RETRY_MS 1000
+#define HTTP_HEADER_MAX 8192
+
+static double now_s()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int net_is_url(const char *name) {
+	return strncmp(name, "udp://", 6) == 0 || strncmp(name, "rtp://", 6) == 0 || strncmp(name, "http://", 7) == 0;
+}
+
+// udp://[host]:port, rtp://[host]:port or http://host[:port][/path], with
+// IPv6 addresses in brackets
+static int parse_url(struct net_audio *net, const char *url)
+{
+	char hostport[256], *host, *port;
+	const char *rest, *slash;
+	size_t len;
+
+	if (strncmp(url, "udp://", 6) == 0) {
+		net->kind = NET_UDP;
+		rest = url + 6;
+	} else if (strncmp(url, "rtp://", 6) == 0) {
+		net->kind = NET_RTP;
+		rest = url + 6;
+	} else {
+		net->kind = NET_HTTP;
+		rest = url + 7;
+	}
+
+	slash = net->kind == NET_HTTP ? strchr(rest, '/') : NULL;
+	len = slash ? (size_t)(slash - rest) : strlen(rest);
+	if (len >= sizeof(hostport))
+		return -1;
+	memcpy(hostport, rest, len);
+	hostport[len] = 0;
+	snprintf(net->path, sizeof(net->path), "%s", slash ? slash : "/");
+
+	if (hostport[0] == '[') {
+		char *close = strchr(hostport, ']');
+
+		if (!close)
+			return -1;
+		*close = 0;
+		host = hostport + 1;
+		port = close[1] == ':' ? close + 2 : NULL;
+	} else {
+		host = hostport;
+		port = strrchr(hostport, ':');
+		if (port)
+			*port++ = 0;
+	}
+
+	if (!port || !*port) {
+		if (net->kind != NET_HTTP)
+			return -1;
+		port = "80";
+	}
+	if ((net->kind == NET_HTTP && !*host) || strlen(port) >= sizeof(net->port))
+		return -1;
+
+	snprintf(net->host, sizeof(net->host), "%s", host);
+	snprintf(net->port, sizeof(net->port), "%s", port);
+	return 0;
+}
+
+static int udp_open(struct net_audio *net)
+{
+	struct addrinfo hints, *res;
+	int err, one = 1, rcvbuf = 1 << 20;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ((err = getaddrinfo(net->host[0] ? net->host : NULL, net->port, &hints, &res))) {
+		fprintf(stderr, "Error: could not resolve %s: %s\n", net->host, gai_strerror(err));
+		return -1;
+	}
+
+	if ((net->fd = socket(res->ai_family, SOCK_DGRAM, 0)) < 0 ||
+			setsockopt(net->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+			bind(net->fd, res->ai_addr, res->ai_addrlen) < 0) {
+		fprintf(stderr, "Error: could not listen on port %s: %s\n", net->port, strerror(errno));
+		freeaddrinfo(res);
+		return -1;
+	}
+
+	// Room for the packets that come in while the reader is busy
+	setsockopt(net->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	// Studio feeds are often multicast
+	if (res->ai_family == AF_INET) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)res->ai_addr;
+
+		if (IN_MULTICAST(ntohl(sin->sin_addr.s_addr))) {
+			struct ip_mreq mreq;
+
+			mreq.imr_multiaddr = sin->sin_addr;
+			mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+			if (setsockopt(net->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+				fprintf(stderr, "Error: could not join multicast group %s: %s\n", net->host, strerror(errno));
+				freeaddrinfo(res);
+				return -1;
+			}
+		}
+	}
+
+	freeaddrinfo(res);
+	return 0;
+}
+
+// recv() that gives up after timeout_ms, or as soon as the receiver is
+// asked to stop, with errno set to ETIMEDOUT
+static int recv_some(struct net_audio *net, void *buf, int len, int timeout_ms)
+{
+	for (int waited = 0; waited < timeout_ms && !atomic_load(&net->stop); waited += NET_POLL_MS) {
+		struct pollfd pfd = { net->fd, POLLIN, 0 };
+		int ready = poll(&pfd, 1, NET_POLL_MS);
+
+		if (ready < 0 && errno != EINTR)
+			return -1;
+		if (ready > 0)
+			return recv(net->fd, buf, len, 0);
+	}
+
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+static void http_close(struct net_audio *net)
+{
+	if (net->fd >= 0)
+		close(net->fd);
+	net->fd = -1;
+}
+
+// Connect, send the request and read up to the start of the audio, taking
+// the format from a WAV header if there is one. Whatever audio came in
+// with the headers is left in body. The first connection has to give the
+// format, later ones have to stick to it.
+static int http_connect(struct net_audio *net, uint8_t *body, int *body_len, int verbose)
+{
+	struct addrinfo hints, *res, *ai;
+	char buf[HTTP_HEADER_MAX + 1], *end;
+	int len = 0, status, err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((err = getaddrinfo(net->host, net->port, &hints, &res))) {
+		if (verbose)
+			fprintf(stderr, "Error: could not resolve %s: %s\n", net->host, gai_strerror(err));
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((net->fd = socket(ai->ai_family, SOCK_STREAM, 0)) < 0)
+			continue;
+		if (connect(net->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		http_close(net);
+	}
+	freeaddrinfo(res);
+	if (net->fd < 0) {
+		if (verbose)
+			fprintf(stderr, "Error: could not connect to %s:%s\n", net->host, net->port);
+		return -1;
+	}
+
+	// HTTP/1.0, so the body comes without chunked encoding
+	len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.0\r\nHost: %s\r\nUser-Agent: PiFmAdv\r\n\r\n", net->path, net->host);
+	if (send(net->fd, buf, len, MSG_NOSIGNAL) != len) {
+		http_close(net);
+		return -1;
+	}
+
+	len = 0;
+	buf[0] = 0;
+	while (!(end = strstr(buf, "\r\n\r\n"))) {
+		int n = len < HTTP_HEADER_MAX ? recv_some(net, buf + len, HTTP_HEADER_MAX - len, HTTP_TIMEOUT_MS) : -1;
+
+		if (n <= 0) {
+			if (verbose)
+				fprintf(stderr, "Error: no HTTP response from %s:%s\n", net->host, net->port);
+			http_close(net);
+			return -1;
+		}
+		len += n;
+		buf[len] = 0;
+	}
+	if (sscanf(buf, "HTTP/%*d.%*d %d", &status) != 1 || status != 200) {
+		if (verbose)
+			fprintf(stderr, "Error: HTTP request for %s failed: %.*s\n", net->path, (int)strcspn(buf, "\r\n"), buf);
+		http_close(net);
+		return -1;
+	}
+
+	*body_len = len - (end + 4 - buf);
+	memcpy(body, end + 4, *body_len);
+
+	// A WAV header has to be read whole before it says anything
+	if (*body_len < 4 || memcmp(body, "RIFF", 4) == 0) {
+		int rate, channels, format;
+		size_t offset, size;
+
+		while (pcm_parse_wav(body, *body_len, &rate, &channels, &format, &offset, &size) &&
+				*body_len < HTTP_HEADER_MAX && (*body_len < 4 || memcmp(body, "RIFF", 4) == 0)) {
+			int n = recv_some(net, body + *body_len, HTTP_HEADER_MAX - *body_len, HTTP_TIMEOUT_MS);
+
+			if (n <= 0) {
+				http_close(net);
+				return -1;
+			}
+			*body_len += n;
+		}
+
+		if (memcmp(body, "RIFF", 4) == 0) {
+			if (pcm_parse_wav(body, *body_len, &rate, &channels, &format, &offset, &size)) {
+				if (verbose)
+					fprintf(stderr, "Error: the HTTP stream is not 16 bit or float WAV\n");
+				http_close(net);
+				return -1;
+			}
+			if (net->channels && (rate != net->rate || channels != net->channels || format != net->format)) {
+				fprintf(stderr, "Warning: the HTTP stream came back in a different format\n");
+				http_close(net);
+				return -1;
+			}
+			net->rate = rate;
+			net->channels = channels;
+			net->format = format;
+			*body_len -= offset;
+			memmove(body, body + offset, *body_len);
+		}
+	}
+
+	if (net->channels == 0) {
+		fprintf(stderr, "Error: the HTTP stream has no WAV header, give its format with --raw\n");
+		http_close(net);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void convert(struct net_audio *net, sample_t *dst, const uint8_t *src, int frames)
+{
+	int samples = frames * net->channels;
+
+	if (net->format == PCM_S16) {
+		for (int i = 0; i < samples; i++, src += 2) {
+			uint16_t v = net->big_endian ? src[0] << 8 | src[1] : src[0] | src[1] << 8;
+
+			dst[i] = sample_from_s16((int16_t)v);
+		}
+	} else {
+		for (int i = 0; i < samples; i++, src += 4) {
+			uint32_t v = net->big_endian ?
+				(uint32_t)src[0] << 24 | src[1] << 16 | src[2] << 8 | src[3] :
+				(uint32_t)src[3] << 24 | src[2] << 16 | src[1] << 8 | src[0];
+			float f;
+
+			memcpy(&f, &v, sizeof(f));
+			dst[i] = sample_from_float(f);
+		}
+	}
+}
+
+// Store frames at their place in the buffer. Called with the lock held.
+static void put_frames(struct net_audio *net, int64_t pos, const uint8_t *data, int frames)
+{
+	int64_t first = pos > net->play ? pos : net->play;
+
+	if (pos + frames <= net->play) {
+		net->stats.late++;
+		return;
+	}
+	if (net->filled[first % net->size]) {
+		net->stats.duplicates++;
+		return;
+	}
+
+	// Further ahead than the buffer reaches: the oldest frames have to go
+	if (pos + frames - net->play > net->size) {
+		int64_t skip = pos + frames - net->play - net->size;
+
+		for (int64_t p = net->play; p < net->play + skip; p++)
+			net->filled[p % net->size] = 0;
+		net->play += skip;
+		net->stats.dropped += skip;
+		if (net->end < net->play)
+			net->end = net->play;
+	}
+
+	for (int64_t p = pos < net->play ? net->play : pos; p < pos + frames; p++) {
+		int slot = p % net->size;
+
+		convert(net, net->frames + slot * net->channels, data + (p - pos) * net->frame_bytes, 1);
+		net->filled[slot] = 1;
+	}
+
+	if (pos + frames > net->end)
+		net->end = pos + frames;
+	net->packet = frames;
+	pthread_cond_broadcast(&net->cond);
+}
+
+// RFC 3550 interarrival jitter, which sets the target delay for UDP and RTP
+static void arrival(struct net_audio *net, int64_t pos)
+{
+	double transit = now_s() * net->rate - pos;
+
+	if (net->stats.packets > 1)
+		net->jitter += (fabs(transit - net->transit) - net->jitter) / 16;
+	net->transit = transit;
+
+	if (net->kind != NET_HTTP) {
+		int target = JITTER_FACTOR * net->jitter + 2 * net->packet + net->block;
+
+		if (target < net->rate * NET_MIN_DELAY_MS / 1000)
+			target = net->rate * NET_MIN_DELAY_MS / 1000;
+		if (target > net->rate * NET_MAX_DELAY_MS / 1000)
+			target = net->rate * NET_MAX_DELAY_MS / 1000;
+		net->target = target;
+	}
+	net->stats.jitter_ms = net->jitter * 1000 / net->rate;
+	net->stats.target_ms = net->target * 1000.0 / net->rate;
+}
+
+static void rtp_packet(struct net_audio *net, const uint8_t *p, int len)
+{
+	int header, payload;
+
+	if (len < 12 || (p[0] >> 6) != 2)
+		return;
+	header = 12 + 4 * (p[0] & 0x0f);
+	if (p[0] & 0x10) {
+		if (len < header + 4)
+			return;
+		header += 4 + 4 * (p[header + 2] << 8 | p[header + 3]);
+	}
+	payload = len - header;
+	if ((p[0] & 0x20) && payload > 0)
+		payload -= p[len - 1];
+	if (payload < net->frame_bytes)
+		return;
+
+	uint16_t seq = p[2] << 8 | p[3];
+	uint32_t ts = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+
+	pthread_mutex_lock(&net->lock);
+	net->stats.packets++;
+
+	int16_t delta = seq - net->max_seq;
+	int64_t pos = net->ref_pos + (int32_t)(ts - net->ref_ts);
+
+	// A new stream, or a jump further than the buffer reaches: start over
+	// from the newest frame received
+	if (!net->synced || pos < net->play - net->size || pos > net->end + net->size) {
+		if (net->synced)
+			net->stats.restarts++;
+		net->synced = 1;
+		net->base_seq = seq;
+		net->max_seq = seq;
+		net->cycles = 0;
+		net->lost_base = net->stats.lost;
+		net->received = 0;
+		net->ref_ts = ts;
+		net->ref_pos = net->end;
+		pos = net->end;
+		delta = 1;
+	} else if (delta > 0) {
+		if (seq < net->max_seq)
+			net->cycles += 65536;
+		net->max_seq = seq;
+	} else if (delta < 0) {
+		net->stats.reordered++;
+	}
+	net->received++;
+
+	put_frames(net, pos, p + header, payload / net->frame_bytes);
+	if (delta > 0) {
+		net->ref_ts = ts;
+		net->ref_pos = pos;
+		arrival(net, pos);
+	}
+
+	int64_t expected = (int64_t)net->cycles + net->max_seq - net->base_seq + 1;
+
+	if (expected > (int64_t)net->received)
+		net->stats.lost = net->lost_base + expected - net->received;
+	pthread_mutex_unlock(&net->lock);
+}
+
+// Datagrams and HTTP reads without timestamps simply follow each other;
+// for HTTP a frame may be split between two reads
+static void append(struct net_audio *net, const uint8_t *data, int len)
+{
+	pthread_mutex_lock(&net->lock);
+	net->stats.packets++;
+
+	if (net->partial_len) {
+		int take = net->frame_bytes - net->partial_len;
+
+		if (take > len)
+			take = len;
+		memcpy(net->partial + net->partial_len, data, take);
+		net->partial_len += take;
+		data += take;
+		len -= take;
+		if (net->partial_len == net->frame_bytes) {
+			put_frames(net, net->end, net->partial, 1);
+			net->partial_len = 0;
+		}
+	}
+
+	int frames = len / net->frame_bytes;
+
+	if (frames) {
+		int64_t pos = net->end;
+
+		put_frames(net, pos, data, frames);
+		arrival(net, pos);
+	}
+	if (net->kind == NET_HTTP) {
+		net->partial_len = len - frames * net->frame_bytes;
+		memcpy(net->partial, data + frames * net->frame_bytes, net->partial_len);
+	}
+	pthread_mutex_unlock(&net->lock);
+}
+
+static void *receive_thread(void *arg)
+{
+	struct net_audio *net = arg;
+	uint8_t buf[65536];
+
+	while (!atomic_load(&net->stop)) {
+		int n;
+
+		if (net->kind != NET_HTTP) {
+			if ((n = recv_some(net, buf, sizeof(buf), NET_POLL_MS)) <= 0)
+				continue;
+			if (net->kind == NET_RTP)
+				rtp_packet(net, buf, n);
+			else
+				append(net, buf, n);
+			continue;
+		}
+
+		if (net->fd < 0) {
+			for (int waited = 0; waited < HTTP_RETRY_MS && !atomic_load(&net->stop); waited += NET_POLL_MS)
+				usleep(NET_POLL_MS * 1000);
+			if (atomic_load(&net->stop) || http_connect(net, buf, &n, 0) < 0)
+				continue;
+
+			pthread_mutex_lock(&net->lock);
+			net->stats.restarts++;
+			net->partial_len = 0;
+			pthread_mutex_unlock(&net->lock);
+			if (n)
+				append(net, buf, n);
+		}
+
+		// TCP can be held back, so the buffer never holds more than the
+		// target and the delay stays put
+		int room;
+
+		pthread_mutex_lock(&net->lock);
+		while (!atomic_load(&net->stop) && net->end - net->play >= net->target) {
+			struct timespec deadline;
+
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			deadline.tv_nsec += NET_POLL_MS * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&net->cond, &net->lock, &deadline);
+		}
+		room = (net->target - (net->end - net->play)) * net->frame_bytes;
+		pthread_mutex_unlock(&net->lock);
+		if (room < net->frame_bytes || room > (int)sizeof(buf))
+			room = room < net->frame_bytes ? net->frame_bytes : (int)sizeof(buf);
+
+		if ((n = recv_some(net, buf, room, HTTP_TIMEOUT_MS)) <= 0) {
+			if (!atomic_load(&net->stop))
+				fprintf(stderr, "Warning: lost the HTTP stream, reconnecting\n");
+			http_close(net);
+			continue;
+		}
+		append(net, buf, n);
+	}
+
+	return NULL;
+}
+
+int net_open(struct net_audio *net, char *url, char *raw) {
+	uint8_t body[HTTP_HEADER_MAX];
+	int body_len = 0;
+	pthread_condattr_t attr;
+
+	memset(net, 0, sizeof(struct net_audio));
+	net->fd = -1;
+
+	if (parse_url(net, url) < 0) {
+		fprintf(stderr, "Error: could not parse %s, expected udp://[host]:port, rtp://[host]:port or http://host[:port]/path\n", url);
+		return -1;
+	}
+	if (raw && pcm_parse_raw(raw, &net->rate, &net->channels, &net->format) < 0) {
+		fprintf(stderr, "Error: raw format has to be rate:channels:s16|float\n");
+		return -1;
+	}
+	// RTP payloads are in network byte order (RFC 3551)
+	net->big_endian = net->kind == NET_RTP;
+
+	if (net->kind == NET_HTTP) {
+		if (http_connect(net, body, &body_len, 1) < 0)
+			return -1;
+	} else {
+		if (!raw) {
+			fprintf(stderr, "Error: network input needs its format, e.g. --raw 48000:2:s16\n");
+			return -1;
+		}
+		if (udp_open(net) < 0) {
+			http_close(net);
+			return -1;
+		}
+	}
+
+	if (net->channels > 2) {
+		fprintf(stderr, "Input must have one or two channels\n");
+		http_close(net);
+		return -1;
+	}
+
+	net->frame_bytes = net->channels * (net->format == PCM_FLOAT ? 4 : 2);
+	net->size = net->rate * NET_BUFFER_MS / 1000;
+	net->history_len = net->rate * CONCEAL_MS / 1000;
+	net->frames = malloc(net->size * net->channels * sizeof(sample_t));
+	net->filled = calloc(net->size, 1);
+	net->history = calloc(net->history_len * net->channels, sizeof(sample_t));
+	if (!net->frames || !net->filled || !net->history) {
+		net_close(net);
+		return -1;
+	}
+	net->target = net->rate * (net->kind == NET_HTTP ? NET_HTTP_DELAY_MS : NET_START_DELAY_MS) / 1000;
+	net->stats.target_ms = net->target * 1000.0 / net->rate;
+
+	pthread_mutex_init(&net->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&net->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (body_len)
+		append(net, body, body_len);
+
+	if (pthread_create(&net->thread, NULL, receive_thread, net)) {
+		fprintf(stderr, "Error: could not start the network receiver\n");
+		net_close(net);
+		return -1;
+	}
+	net->running = 1;
+
+	return 0;
+}
+
+static inline sample_t mix(sample_t a, sample_t b, float w)
+{
+	return sample_from_float(sample_to_float(a) * (1 - w) + sample_to_float(b) * w);
+}
+
+// Replay the last frames played, fading out, then silence
+static void conceal(struct net_audio *net, sample_t *dst)
+{
+	int fade_len = net->rate * CONCEAL_FADE_MS / 1000;
+	const sample_t *src = net->history + (net->history_pos + net->conceal_run) % net->history_len * net->channels;
+	float gain = 1 - (float)net->conceal_run / fade_len;
+
+	for (int c = 0; c < net->channels; c++)
+		dst[c] = gain > 0 ? sample_from_float(sample_to_float(src[c]) * gain) : 0;
+	net->conceal_run++;
+}
+
+static void play_frame(struct net_audio *net, const sample_t *src, sample_t *dst)
+{
+	if (net->conceal_run && !net->fade)
+		net->fade = CROSSFADE;
+
+	if (net->fade) {
+		sample_t hidden[2];
+
+		// Fade from where the concealment would have gone
+		conceal(net, hidden);
+		for (int c = 0; c < net->channels; c++)
+			dst[c] = mix(hidden[c], src[c], 1 - (float)net->fade / (CROSSFADE + 1));
+		if (--net->fade == 0)
+			net->conceal_run = 0;
+		return;
+	}
+
+	memcpy(dst, src, net->channels * sizeof(sample_t));
+	memcpy(net->history + net->history_pos * net->channels, src, net->channels * sizeof(sample_t));
+	if (++net->history_pos == net->history_len)
+		net->history_pos = 0;
+}
+
+// Bring the delay back down to the target by skipping what is too much,
+// crossfading the end of the block into the audio after the skip. Only
+// for UDP and RTP: an HTTP sender is held back instead.
+static void slip(struct net_audio *net, sample_t *out, int frames)
+{
+	int64_t level = net->end - net->play;
+	int64_t drop = level - net->target;
+
+	if (net->kind == NET_HTTP || level <= net->target + net->target / 2 + net->packet || frames < CROSSFADE)
+		return;
+	if (drop > frames)
+		drop = frames;
+	if (drop < CROSSFADE)
+		return;
+
+	for (int k = 0; k < CROSSFADE; k++) {
+		if (!net->filled[(net->play + drop - CROSSFADE + k) % net->size])
+			return;
+	}
+
+	for (int k = 0; k < CROSSFADE; k++) {
+		sample_t *dst = out + (frames - CROSSFADE + k) * net->channels;
+		const sample_t *src = net->frames + (net->play + drop - CROSSFADE + k) % net->size * net->channels;
+
+		for (int c = 0; c < net->channels; c++)
+			dst[c] = mix(dst[c], src[c], (k + 1.0f) / (CROSSFADE + 1));
+	}
+
+	for (int64_t p = net->play; p < net->play + drop; p++)
+		net->filled[p % net->size] = 0;
+	net->play += drop;
+	net->stats.dropped += drop;
+}
+
+// Always returns frames frames. Waits for them for as long as they take to
+// play, then makes up what is missing.
+int net_read(struct net_audio *net, sample_t *out, int frames) {
+	struct timespec deadline;
+	long ns = (long)((double)frames / net->rate * 1e9);
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += ns / 1000000000L;
+	deadline.tv_nsec += ns % 1000000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&net->lock);
+	net->block = frames;
+	for (;;) {
+		if (!net->started && net->end - net->play >= net->target)
+			net->started = 1;
+		if (net->started && net->end - net->play >= frames)
+			break;
+		if (pthread_cond_timedwait(&net->cond, &net->lock, &deadline) == ETIMEDOUT)
+			break;
+	}
+
+	for (int i = 0; i < frames; i++) {
+		sample_t *dst = out + i * net->channels;
+
+		if (!net->started) {
+			memset(dst, 0, net->channels * sizeof(sample_t));
+			continue;
+		}
+
+		// Nothing newer has come in: conceal, and play the late frames
+		// when they arrive, which makes the delay that much longer
+		if (net->play >= net->end) {
+			if (!net->underrun) {
+				net->stats.underruns++;
+				net->underrun = 1;
+				if (net->kind == NET_HTTP && net->target < net->rate * NET_MAX_DELAY_MS / 1000) {
+					net->target += net->target / 2;
+					net->stats.target_ms = net->target * 1000.0 / net->rate;
+				}
+			}
+			conceal(net, dst);
+			net->stats.concealed++;
+			net->stalled++;
+			continue;
+		}
+		net->underrun = 0;
+
+		int slot = net->play % net->size;
+
+		if (net->filled[slot]) {
+			play_frame(net, net->frames + slot * net->channels, dst);
+			net->filled[slot] = 0;
+		} else {
+			conceal(net, dst);
+			net->stats.concealed++;
+		}
+		net->play++;
+	}
+
+	if (net->started)
+		slip(net, out, frames);
+
+	net->stats.delay_ms = (net->end - net->play) * 1000.0 / net->rate;
+	if (net->stats.delay_ms > net->stats.max_delay_ms)
+		net->stats.max_delay_ms = net->stats.delay_ms;
+
+	// Room for an HTTP sender that was held back
+	pthread_cond_broadcast(&net->cond);
+	pthread_mutex_unlock(&net->lock);
+
+	return frames;
+}
+
+// Seconds buffered ahead of the reader
+double net_delay(struct net_audio *net) {
+	int64_t fill;
+
+	pthread_mutex_lock(&net->lock);
+	fill = net->end - net->play;
+	pthread_mutex_unlock(&net->lock);
+
+	return (double)fill / net->rate;
+}
+
+// The same, less what underruns have added to the delay and trimming has
+// taken away since the start. A lost packet is concealed in its place and
+// leaves the delay as it was. What is left only moves when the sender's
+// clock and the reader's pace part ways.
+double net_fill(struct net_audio *net) {
+	int64_t fill;
+
+	pthread_mutex_lock(&net->lock);
+	fill = net->end - net->play - net->stalled + (int64_t)net->stats.dropped;
+	pthread_mutex_unlock(&net->lock);
+
+	return (double)fill / net->rate;
+}
+
+void net_get_stats(struct net_audio *net, struct net_stats *stats) {
+	pthread_mutex_lock(&net->lock);
+	memcpy(stats, &net->stats, sizeof(struct net_stats));
+	pthread_mutex_unlock(&net->lock);
+}
+
+void net_close(struct net_audio *net) {
+	if (net->running) {
+		atomic_store(&net->stop, 1);
+		pthread_join(net->thread, NULL);
+		pthread_mutex_destroy(&net->lock);
+		pthread_cond_destroy(&net->cond);
+		net->running = 0;
+	}
+	http_close(net);
+	free(net->frames);
+	free(net->filled);
+	free(net->history);
+	net->frames = NULL;
+	net->filled = NULL;
+	net->history = NULL;
+}
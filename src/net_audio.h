@@ -0,0 +1,91 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef NET_AUDIO_H
+#define NET_AUDIO_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "sample.h"
+#include "stats.h"
+
+// Network sources, given to --audio as a URL
+#define NET_UDP 1                       // udp://[address]:port, raw PCM datagrams
+#define NET_RTP 2                       // rtp://[address]:port, L16 or float in network order
+#define NET_HTTP 3                      // http://host[:port]/path, a WAV or raw PCM body
+
+// Live audio from the network. A receiver thread places what arrives in a
+// jitter buffer by its position on the sender's timeline; the reader plays
+// it out after a delay that follows the measured jitter, conceals holes
+// and underruns, and drops frames when the delay has grown too long.
+struct net_audio {
+	int kind;
+	int fd;
+	int rate;
+	int channels;
+	int format;                     // PCM_S16 or PCM_FLOAT
+	int big_endian;
+	int frame_bytes;
+	char host[256];
+	char port[16];
+	char path[1024];
+
+	pthread_t thread;
+	int running;
+	_Atomic int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	// Jitter buffer, frame n at n modulo size
+	sample_t *frames;
+	uint8_t *filled;
+	int size;
+	int64_t play;                   // next frame to play
+	int64_t end;                    // one past the newest frame received
+	int started;                    // prebuffered up to the target
+	int target;                     // frames
+	int packet;                     // frames in the last packet
+	int block;                      // frames in the last read
+	int underrun;                   // the reader has caught up with end
+	int64_t stalled;                // frames concealed waiting at end, which the delay grew by
+
+	// RTP sequence and timestamp tracking, RFC 3550 style
+	int synced;
+	uint16_t max_seq;
+	uint32_t cycles;
+	uint32_t base_seq;
+	uint64_t received;
+	uint64_t lost_base;             // lost before the last restart
+	uint32_t ref_ts;                // timestamp of the newest packet...
+	int64_t ref_pos;                // ...and its place in the buffer
+	double transit;
+	double jitter;                  // frames
+
+	// Bytes of a frame split across HTTP reads
+	uint8_t partial[16];
+	int partial_len;
+
+	// Concealment replays the last frames played, fading out
+	sample_t *history;
+	int history_len;
+	int history_pos;
+	int conceal_run;                // frames concealed since the last real one
+	int fade;                       // frames left of the crossfade back to real audio
+
+	struct net_stats stats;
+};
+
+extern int net_is_url(const char *name);
+extern int net_open(struct net_audio *net, char *url, char *raw);
+extern int net_read(struct net_audio *net, sample_t *out, int frames);
+extern double net_delay(struct net_audio *net);
+extern double net_fill(struct net_audio *net);
+extern void net_get_stats(struct net_audio *net, struct net_stats *stats);
+extern void net_close(struct net_audio *net);
+
+#endif
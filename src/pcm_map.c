@@ -0,0 +1,194 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pcm_map.h"
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+// rate:channels:s16|float, e.g. 44100:2:s16
+int pcm_parse_raw(char *spec, int *rate, int *channels, int *format) {
+	char fmt[8];
+
+	if (sscanf(spec, "%d:%d:%7s", rate, channels, fmt) != 3 || *rate <= 0 || *channels < 1)
+		return -1;
+
+	if (strcmp(fmt, "s16") == 0)
+		*format = PCM_S16;
+	else if (strcmp(fmt, "float") == 0)
+		*format = PCM_FLOAT;
+	else
+		return -1;
+
+	return 0;
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+// Find the format and the sample data of a WAV file in a buffer holding
+// at least its header. Returns 1 for anything other than 16 bit integer
+// or 32 bit float PCM, or if the data chunk is not in the buffer.
+int pcm_parse_wav(const uint8_t *buf, size_t length, int *rate, int *channels, int *pcm_format, size_t *offset, size_t *size) {
+	const uint8_t *p = buf, *end = buf + length;
+	int format = -1, bits = 0;
+
+	*channels = 0;
+	if (length < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4))
+		return 1;
+
+	for (p += 12; p + 8 <= end; p += 8 + ((le32(p + 4) + 1) & ~1u)) {
+		uint32_t chunk = le32(p + 4);
+
+		if (memcmp(p, "fmt ", 4) == 0 && chunk >= 16 && p + 8 + chunk <= end) {
+			format = le16(p + 8);
+			*channels = le16(p + 10);
+			*rate = le32(p + 12);
+			bits = le16(p + 22);
+			// The real format code is at the start of the subformat GUID
+			if (format == WAVE_FORMAT_EXTENSIBLE && chunk >= 26)
+				format = le16(p + 32);
+		} else if (memcmp(p, "data", 4) == 0) {
+			if (*channels == 0)
+				return 1;
+			if (format == WAVE_FORMAT_PCM && bits == 16)
+				*pcm_format = PCM_S16;
+			else if (format == WAVE_FORMAT_IEEE_FLOAT && bits == 32)
+				*pcm_format = PCM_FLOAT;
+			else
+				return 1;
+
+			// Streamed WAVs leave the size at 0 or 0xFFFFFFFF
+			if (chunk == 0 || chunk > end - (p + 8))
+				chunk = end - (p + 8);
+			*offset = p + 8 - buf;
+			*size = chunk;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int parse_wav(struct pcm_map *map)
+{
+	size_t offset, size;
+
+	if (pcm_parse_wav(map->base, map->length, &map->rate, &map->channels, &map->format, &offset, &size))
+		return 1;
+
+	map->data = (const uint8_t *)map->base + offset;
+	map->frames = size / (map->channels * (map->format == PCM_FLOAT ? 4 : 2));
+	return 0;
+}
+
+// Map a raw or WAV file. Returns 1 if it is in a format that has to go
+// through libsndfile instead.
+int pcm_map_open(struct pcm_map *map, char *filename, char *raw) {
+	struct stat st;
+	int fd;
+
+	memset(map, 0, sizeof(struct pcm_map));
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+	return 1;
+#endif
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return 1;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return 1;
+	}
+
+	map->length = st.st_size;
+	map->base = mmap(NULL, map->length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map->base == MAP_FAILED) {
+		map->base = NULL;
+		return 1;
+	}
+
+	if (raw) {
+		if (pcm_parse_raw(raw, &map->rate, &map->channels, &map->format) < 0) {
+			pcm_map_close(map);
+			return -1;
+		}
+		map->data = map->base;
+		map->frames = map->length / (map->channels * (map->format == PCM_FLOAT ? 4 : 2));
+	} else if (parse_wav(map)) {
+		pcm_map_close(map);
+		return 1;
+	}
+
+	// Floats are only used in place if they are aligned
+	if (map->frames == 0 || (map->format == PCM_FLOAT && ((uintptr_t)map->data & 3))) {
+		pcm_map_close(map);
+		return 1;
+	}
+
+	madvise(map->base, map->length, MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+// Up to max_frames frames from the current position, 0 at the end of
+// the file. Data in the native sample format is not copied; *frames
+// points into the mapping.
+int pcm_map_read(struct pcm_map *map, const sample_t **frames, sample_t *scratch, int max_frames) {
+	int len = (map->frames - map->pos < max_frames) ? map->frames - map->pos : max_frames;
+
+	if (map->format == PCM_FLOAT) {
+		const float *in = (const float *)map->data + map->pos * map->channels;
+
+#ifdef FIXED_POINT
+		for (int i = 0; i < len * map->channels; i++)
+			scratch[i] = sample_from_float(in[i]);
+		*frames = scratch;
+#else
+		*frames = in;
+#endif
+	} else {
+		const int16_t *in = (const int16_t *)map->data + map->pos * map->channels;
+
+#ifdef FIXED_POINT
+		*frames = in;
+#else
+		for (int i = 0; i < len * map->channels; i++)
+			scratch[i] = sample_from_s16(in[i]);
+		*frames = scratch;
+#endif
+	}
+	map->pos += len;
+
+	return len;
+}
+
+void pcm_map_rewind(struct pcm_map *map) {
+	map->pos = 0;
+}
+
+void pcm_map_close(struct pcm_map *map) {
+	if (map->base)
+		munmap(map->base, map->length);
+	map->base = NULL;
+}
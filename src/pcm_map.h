@@ -0,0 +1,39 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef PCM_MAP_H
+#define PCM_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sample.h"
+
+#define PCM_S16 0
+#define PCM_FLOAT 1
+
+// Audio file mapped into memory. Samples already in the pipeline's format
+// (float, or 16 bit in fixed point builds) are handed out as pointers into
+// the mapping; anything else is converted straight from it.
+struct pcm_map {
+	void *base;
+	size_t length;
+	const void *data;               // first frame
+	long frames;
+	long pos;
+	int rate;
+	int channels;
+	int format;
+};
+
+extern int pcm_parse_raw(char *spec, int *rate, int *channels, int *format);
+extern int pcm_parse_wav(const uint8_t *buf, size_t length, int *rate, int *channels, int *format, size_t *offset, size_t *size);
+extern int pcm_map_open(struct pcm_map *map, char *filename, char *raw);
+extern int pcm_map_read(struct pcm_map *map, const sample_t **frames, sample_t *scratch, int max_frames);
+extern void pcm_map_rewind(struct pcm_map *map);
+extern void pcm_map_close(struct pcm_map *map);
+
+#endif
@@ -5,6 +5,8 @@
     See https://github.com/Miegl/PiFmAdv
 */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -21,243 +23,38 @@
 #include <sys/mman.h>
 #include <sndfile.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "fm_mpx.h"
-#include "mailbox.h"
-
-#define MBFILE                          DEVICE_FILE_NAME // From mailbox.h
-
-#if (RASPI) == 1                        // Original Raspberry Pi 1
-#define PERIPH_VIRT_BASE                0x20000000
-#define PERIPH_PHYS_BASE                0x7e000000
-#define DRAM_PHYS_BASE                  0x40000000
-#define MEM_FLAG                        0x0c
-#define CLOCK_BASE			19.2e6
-#define DMA_CHANNEL			14
-#elif (RASPI) == 2                      // Raspberry Pi 2 & 3
-#define PERIPH_VIRT_BASE                0x3f000000
-#define PERIPH_PHYS_BASE                0x7e000000
-#define DRAM_PHYS_BASE                  0xc0000000
-#define MEM_FLAG                        0x04
-#define CLOCK_BASE			19.2e6
-#define DMA_CHANNEL			14
-#elif (RASPI) == 4                      // Raspberry Pi 4
-#define PERIPH_VIRT_BASE                0xfe000000
-#define PERIPH_PHYS_BASE                0x7e000000
-#define DRAM_PHYS_BASE                  0xc0000000
-#define MEM_FLAG                        0x04
-#define CLOCK_BASE			54.0e6
-#define DMA_CHANNEL			6
-#else
-#error Unknown Raspberry Pi version (variable RASPI)
-#endif
-
-#define DMA_BASE_OFFSET                 0x00007000
-#define PWM_BASE_OFFSET                 0x0020C000
-#define PWM_LEN                         0x28
-#define CLK_BASE_OFFSET                 0x00101000
-#define CLK_LEN                         0x1300
-#define GPIO_BASE_OFFSET                0x00200000
-#define GPIO_LEN                        0x100
-#define PCM_BASE_OFFSET                 0x00203000
-#define PCM_LEN                         0x24
-#define PAD_BASE_OFFSET                 0x00100000
-#define PAD_LEN                         (0x40/4) //0x64
-
-#define DMA_VIRT_BASE                   (PERIPH_VIRT_BASE + DMA_BASE_OFFSET)
-#define PWM_VIRT_BASE                   (PERIPH_VIRT_BASE + PWM_BASE_OFFSET)
-#define CLK_VIRT_BASE                   (PERIPH_VIRT_BASE + CLK_BASE_OFFSET)
-#define GPIO_VIRT_BASE                  (PERIPH_VIRT_BASE + GPIO_BASE_OFFSET)
-#define PAD_VIRT_BASE                   (PERIPH_VIRT_BASE + PAD_BASE_OFFSET)
-#define PCM_VIRT_BASE                   (PERIPH_VIRT_BASE + PCM_BASE_OFFSET)
-
-#define PWM_PHYS_BASE                   (PERIPH_PHYS_BASE + PWM_BASE_OFFSET)
-#define PCM_PHYS_BASE                   (PERIPH_PHYS_BASE + PCM_BASE_OFFSET)
-#define GPIO_PHYS_BASE                  (PERIPH_PHYS_BASE + GPIO_BASE_OFFSET)
-
-// GPIO
-#define GPFSEL0                         (0x00/4)
-#define GPFSEL1                         (0x04/4)
-#define GPFSEL2                         (0x08/4)
-#define GPPUD                           (0x94/4)
-#define GPPUDCLK0                       (0x98/4)
-#define GPPUDCLK1                       (0x9C/4)
-
-#define CORECLK_CNTL                    (0x08/4)
-#define CORECLK_DIV                     (0x0c/4)
-#define GPCLK_CNTL                      (0x70/4)
-#define GPCLK_DIV                       (0x74/4)
-#define EMMCCLK_CNTL                    (0x1C0/4)
-#define EMMCCLK_DIV                     (0x1C4/4)
-
-#define CM_LOCK                         (0x114/4)
-#define CM_LOCK_FLOCKA                  (1<<8)
-#define CM_LOCK_FLOCKB                  (1<<9)
-#define CM_LOCK_FLOCKC                  (1<<10)
-#define CM_LOCK_FLOCKD                  (1<<11)
-#define CM_LOCK_FLOCKH                  (1<<12)
-
-#define CM_PLLA                         (0x104/4)
-#define CM_PLLC                         (0x108/4)
-#define CM_PLLD                         (0x10c/4)
-#define CM_PLLH                         (0x110/4)
-#define CM_PLLB                         (0x170/4)
-
-#define A2W_PLLA_ANA0                   (0x1010/4)
-#define A2W_PLLC_ANA0                   (0x1030/4)
-#define A2W_PLLD_ANA0                   (0x1050/4)
-#define A2W_PLLH_ANA0                   (0x1070/4)
-#define A2W_PLLB_ANA0                   (0x10f0/4)
-#define A2W_PLL_KA_SHIFT                7
-#define A2W_PLL_KI_SHIFT                19
-#define A2W_PLL_KP_SHIFT                15
-
-#define PLLA_CTRL                       (0x1100/4)
-#define PLLA_FRAC                       (0x1200/4)
-#define PLLA_DSI0                       (0x1300/4)
-#define PLLA_CORE                       (0x1400/4)
-#define PLLA_PER                        (0x1500/4)
-#define PLLA_CCP2                       (0x1600/4)
-
-#define PLLB_CTRL                       (0x11e0/4)
-#define PLLB_FRAC                       (0x12e0/4)
-#define PLLB_ARM                        (0x13e0/4)
-#define PLLB_SP0                        (0x14e0/4)
-#define PLLB_SP1                        (0x15e0/4)
-#define PLLB_SP2                        (0x16e0/4)
-
-#define PLLC_CTRL                       (0x1120/4)
-#define PLLC_FRAC                       (0x1220/4)
-#define PLLC_CORE2                      (0x1320/4)
-#define PLLC_CORE1                      (0x1420/4)
-#define PLLC_PER                        (0x1520/4)
-#define PLLC_CORE0                      (0x1620/4)
-
-#define PLLD_CTRL                       (0x1140/4)
-#define PLLD_FRAC                       (0x1240/4)
-#define PLLD_DSI0                       (0x1340/4)
-#define PLLD_CORE                       (0x1440/4)
-#define PLLD_PER                        (0x1540/4)
-#define PLLD_DSI1                       (0x1640/4)
-
-#define PLLH_CTRL                       (0x1160/4)
-#define PLLH_FRAC                       (0x1260/4)
-#define PLLH_AUX                        (0x1360/4)
-#define PLLH_RCAL                       (0x1460/4)
-#define PLLH_PIX                        (0x1560/4)
-#define PLLH_STS                        (0x1660/4)
-
-// PWM
-#define PWM_CTL                         (0x00/4)
-#define PWM_DMAC                        (0x08/4)
-#define PWM_RNG1                        (0x10/4)
-#define PWM_RNG2                        (0x20/4)
-#define PWM_FIFO                        (0x18/4)
-
-#define PWMCLK_CNTL                     40
-#define PWMCLK_DIV                      41
-
-#define PWMCTL_PWEN1                    (1<<0)
-#define PWMCTL_MODE1                    (1<<1)
-#define PWMCTL_RPTL1                    (1<<2)
-#define PWMCTL_POLA1                    (1<<4)
-#define PWMCTL_USEF1                    (1<<5)
-#define PWMCTL_CLRF                     (1<<6)
-#define PWMCTL_MSEN1                    (1<<7)
-#define PWMCTL_PWEN2                    (1<<8)
-#define PWMCTL_MODE2                    (1<<9)
-#define PWMCTL_RPTL2                    (1<<10)
-#define PWMCTL_USEF2                    (1<<13)
-#define PWMCTL_MSEN2                    (1<<15)
-
-#define PWMDMAC_ENAB                    (1<<31)
-#define PWMDMAC_THRSHLD                 ((15<<8)|(15<<0))
-
-// PCM
-#define PCM_CS_A                        (0x00/4)
-#define PCM_FIFO_A                      (0x04/4)
-#define PCM_MODE_A                      (0x08/4)
-#define PCM_RXC_A                       (0x0c/4)
-#define PCM_TXC_A                       (0x10/4)
-#define PCM_DREQ_A                      (0x14/4)
-#define PCM_INTEN_A                     (0x18/4)
-#define PCM_INT_STC_A                   (0x1c/4)
-#define PCM_GRAY                        (0x20/4)
-
-#define PCMCLK_CNTL                     38
-#define PCMCLK_DIV                      39
-
-// PAD
-#define GPIO_PAD_0_27                   (0x2C/4)
-#define GPIO_PAD_28_45                  (0x30/4)
-#define GPIO_PAD_46_52                  (0x34/4)
-
-// DMA
-#define DMA_CHANNEL_MAX                 14
-#define DMA_CHANNEL_SIZE                0x100
-
-#define BCM2708_DMA_ACTIVE              (1<<0)
-#define BCM2708_DMA_END                 (1<<1)
-#define BCM2708_DMA_INT                 (1<<2)
-#define BCM2708_DMA_WAIT_RESP           (1<<3)
-#define BCM2708_DMA_D_DREQ              (1<<6)
-#define BCM2708_DMA_DST_IGNOR           (1<<7)
-#define BCM2708_DMA_SRC_INC             (1<<8)
-#define BCM2708_DMA_SRC_IGNOR           (1<<11)
-#define BCM2708_DMA_NO_WIDE_BURSTS      (1<<26)
-#define BCM2708_DMA_DISDEBUG            (1<<28)
-#define BCM2708_DMA_ABORT               (1<<30)
-#define BCM2708_DMA_RESET               (1<<31)
-#define BCM2708_DMA_PER_MAP(x)          ((x)<<16)
-#define BCM2708_DMA_PRIORITY(x)         ((x)&0xf << 16)
-#define BCM2708_DMA_PANIC_PRIORITY(x)   ((x)&0xf << 20)
-
-#define DMA_CS                          (0x00/4)
-#define DMA_CONBLK_AD                   (0x04/4)
-#define DMA_DEBUG                       (0x20/4)
-
-#define DMA_CS_RESET			(1<<31)
-#define DMA_CS_ABORT			(1<<30)
-#define DMA_CS_DISDEBUG			(1<<29)
-#define DMA_CS_WAIT_FOR_OUTSTANDING_WRITES (1<<28)
-#define DMA_CS_INT			(1<<2)
-#define DMA_CS_END			(1<<1)
-#define DMA_CS_ACTIVE			(1<<0)
-#define DMA_CS_PRIORITY(x)		((x)&0xf << 16)
-#define DMA_CS_PANIC_PRIORITY(x)	((x)&0xf << 20)
-
-#define DREQ_PCM_TX                     2
-#define DREQ_PCM_RX                     3
-#define DREQ_SMI                        4
-#define DREQ_PWM                        5
-#define DREQ_SPI_TX                     6
-#define DREQ_SPI_RX                     7
-#define DREQ_SPI_SLAVE_TX               8
-#define DREQ_SPI_SLAVE_RX               9
-
-#define MEM_FLAG_DISCARDABLE            (1 << 0) /* can be resized to 0 at any time. Use for cached data */
-#define MEM_FLAG_NORMAL                 (0 << 2) /* normal allocating alias. Don't use from ARM */
-#define MEM_FLAG_DIRECT                 (1 << 2) /* 0xC alias uncached */
-#define MEM_FLAG_COHERENT               (2 << 2) /* 0x8 alias. Non-allocating in L2 but coherent */
-#define MEM_FLAG_L1_NONALLOCATING       (MEM_FLAG_DIRECT | MEM_FLAG_COHERENT) /* Allocating in L2 */
-#define MEM_FLAG_ZERO                   (1 << 4)  /* initialise buffer to all zeros */
-#define MEM_FLAG_NO_INIT                (1 << 5) /* don't initialise (default is initialise to all ones */
-#define MEM_FLAG_HINT_PERMALOCK         (1 << 6) /* Likely to be locked for long periods of time. */
-
-#define BUS_TO_PHYS(x)                  ((x)&~0xC0000000)
-
-#define PAGE_SIZE                       4096
-#define PAGE_SHIFT                      12
-#define NUM_PAGES                       ((sizeof(struct control_data_s) + PAGE_SIZE - 1) >> PAGE_SHIFT)
-
-#define NUM_SAMPLES			65536
-#define NUM_CBS				(NUM_SAMPLES * 2)
-
-#define SUBSIZE                         1
-
-typedef struct {
-    uint32_t info, src, dst, length, stride, next, pad[2];
-} dma_cb_t;
+#include "hal.h"
+#include "refill_sched.h"
+#include "ring.h"
+#include "bench.h"
+#include "rds.h"
+#include "control.h"
+#include "stats.h"
+#include "freq.h"
+#include "tune.h"
+#include "audio_proc.h"
+#include "dma_ring.h"
+#include "latency.h"
+#include "trace.h"
+
+#define STAGING_SIZE			2048 // Words converted per burst, 8 kB stays in L1
+
+// Baseband samples buffered between the DSP and the refill thread
+#define MPX_RING_SIZE                   (1 << 17)
+
+// The low-latency profile: a short DMA ring topped up often, and little
+// baseband waiting for it, 21 ms at 192 kHz. --dma-ring and --low-water
+// still override the profile.
+#define LOW_LATENCY_RING_MS             20
+#define LOW_LATENCY_LOW_WATER_MS        6
+#define LOW_LATENCY_MPX_RING            (1 << 12)
+
+#define OUTPUT_WORDS                    0
+#define OUTPUT_FLOAT                    1
 
 static struct {
     int handle;                     /* From mbox_open() */
@@ -266,12 +63,9 @@ static struct {
     uint8_t *virt_addr;             /* From mapmem() */
 } mbox;
 
-struct control_data_s {
-    dma_cb_t cb[NUM_CBS];
-    uint32_t sample[NUM_SAMPLES];
-};
+static struct dma_ring ctl;
 
-static struct control_data_s *ctl;
+static const struct hal_backend *hal;
 
 static volatile uint32_t *pwm_reg;
 static volatile uint32_t *clk_reg;
@@ -286,7 +80,7 @@ static void udelay(int us)
     nanosleep(&ts, NULL);
 }
 
-static int stop_tx;
+static volatile int stop_tx;
 
 static void shutdown() {
 	stop_tx = 1;
@@ -315,9 +109,9 @@ static void cleanup() {
     }
 
     if (mbox.virt_addr != NULL) {
-        unmapmem(mbox.virt_addr, NUM_PAGES * PAGE_SIZE);
-        mem_unlock(mbox.handle, mbox.mem_ref);
-        mem_free(mbox.handle, mbox.mem_ref);
+        hal->unmapmem(mbox.virt_addr, ctl.size);
+        hal->mem_unlock(mbox.handle, mbox.mem_ref);
+        hal->mem_free(mbox.handle, mbox.mem_ref);
     }
 }
 
@@ -338,41 +132,418 @@ static void fatal(char *fmt, ...)
     exit(0);
 }
 
-static uint32_t mem_virt_to_phys(void *virt)
+static struct control_params control;
+
+// Seed the run-time parameters and start listening on the control pipe,
+// if there is one. The deviation may only be raised as far as PLLA_FRAC
+// can swing without carrying into the integer part.
+static int start_control(char *ctl_path, int deviation, uint32_t freq_ctl, float steps_per_khz)
 {
-    uint32_t offset = (uint8_t *)virt - mbox.virt_addr;
+	uint32_t frac = freq_ctl & 0xFFFFF;
+	uint32_t headroom = (frac < 0xFFFFF - frac) ? frac : 0xFFFFF - frac;
 
-    return mbox.bus_addr + offset;
-}
+	atomic_init(&control.deviation, deviation);
+	control.max_deviation = headroom / steps_per_khz;
 
-static uint32_t mem_phys_to_virt(uint32_t phys)
-{
-    return phys - (uint32_t)mbox.bus_addr + (uint32_t)mbox.virt_addr;
+	return ctl_path ? control_open(ctl_path, &control) : 0;
 }
 
 static void *map_peripheral(uint32_t base, uint32_t len)
 {
-    int fd = open("/dev/mem", O_RDWR | O_SYNC);
-    void * vaddr;
+    void *vaddr = hal->map_peripheral(base, len);
 
-    if (fd < 0)
-        fatal("Failed to open /dev/mem: %m.\n");
-    vaddr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, base);
-    if (vaddr == MAP_FAILED)
+    if (vaddr == NULL)
         fatal("Failed to map peripheral at 0x%08x: %m.\n", base);
-    close(fd);
 
     return vaddr;
 }
 
 
 
-static int tx(uint32_t carrier_freq, int divider, char *audio_file, float ppm, int deviation, int power, int gpio) {
-	// Catch only important signals
-	for (int i = 0; i < 25; i++) {
-		signal(i, shutdown);
+// Run the baseband pipeline without touching any hardware and write the
+// resulting PLLA_FRAC words (or the frequency offset they produce, in Hz)
+// to a file, as fast as the CPU allows.
+static int render(const struct tune *tune, char *audio_file, char *raw, float ppm, int resampler, int processing, int preemph, int clip, float crossfade, int mpx_rate, char *cache_dir, int composite, int rds, int deviation, char *ctl_path, char *output_file, int output_format, long samples) {
+	static sample_t data[DATA_SIZE*16];
+	static uint32_t words[DATA_SIZE*16];
+	static float offsets[DATA_SIZE*16];
+	FILE *out;
+
+	if (strcmp(output_file, "-") == 0) {
+		// Keep stdout for the samples only, status messages go to stderr
+		out = fdopen(dup(fileno(stdout)), "wb");
+		dup2(fileno(stderr), fileno(stdout));
+	} else {
+		out = fopen(output_file, "wb");
+	}
+	if (out == NULL) {
+		fprintf(stderr, "Error: could not open output file %s.\n", output_file);
+		return 1;
+	}
+
+	if (fm_mpx_open(audio_file, raw, ppm, resampler, rds, processing, preemph, clip, crossfade, mpx_rate, 0, 0, cache_dir, composite) < 0) {
+		fclose(out);
+		return 1;
+	}
+
+	int divider = tune->divider;
+	uint32_t freq_ctl = tune->multiplier;
+	uint32_t base = 0x5A << 24 | (freq_ctl & 0xFFFFF);
+	float steps_per_khz = divider*1000/(CLOCK_BASE/(1<<20));
+	float hz_per_step = CLOCK_BASE/(1<<20)/divider;
+	long written = 0;
+	int data_len;
+	struct timespec start, end;
+
+	if (start_control(ctl_path, deviation, freq_ctl, steps_per_khz) < 0) {
+		fm_mpx_close();
+		fclose(out);
+		return 1;
+	}
+
+	printf("Rendering %s to %s.\n", output_format == OUTPUT_FLOAT ? "frequency offsets" : "PLLA_FRAC words", output_file);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (!stop_tx && (samples == 0 || written < samples)) {
+		if ((data_len = fm_mpx_get_samples(data)) < 0) break;
+		if (samples && data_len > samples - written)
+			data_len = samples - written;
+
+		scale_t scale = deviation_scale(atomic_load_explicit(&control.deviation, memory_order_relaxed), steps_per_khz);
+		freq_words(words, data, data_len, base, scale);
+
+		if (output_format == OUTPUT_FLOAT) {
+			for (int i = 0; i < data_len; i++)
+				offsets[i] = (int32_t)(words[i] - base) * hz_per_step;
+			if (fwrite(offsets, sizeof(float), data_len, out) != (size_t)data_len) break;
+		} else {
+			if (fwrite(words, sizeof(uint32_t), data_len, out) != (size_t)data_len) break;
+		}
+		written += data_len;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("Rendered %ld samples in %.3f s: %.0f samples/s (%.1fx real time).\n",
+		written, elapsed, written / elapsed, written / elapsed / mpx_rate);
+
+	control_close();
+	fm_mpx_close();
+	fclose(out);
+
+	return 0;
+}
+
+static struct mpx_ring mpx_ring;
+
+struct refill_params {
+	uint32_t base;                  // PLLA_FRAC word of the unmodulated carrier
+	float steps_per_khz;            // PLLA_FRAC steps per kHz of deviation
+	float low_water;
+	int rate;                       // baseband, samples/s
+	uint32_t lap;                   // DMA position when the refill starts
+	int sample;
+};
+
+static struct stats_shared stats;
+static struct latency latency;
+
+static uint64_t monotonic_raw_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Producer: runs the whole baseband pipeline, decoding and resampling
+// included, and queues the result for the refill thread
+static void *dsp_thread(void *arg)
+{
+	static sample_t data[DATA_SIZE*16];
+	struct refill_params *params = arg;
+	struct tx_stats snapshot;
+	uint64_t produced = 0;
+	int data_len;
+
+	trace_thread("dsp");
+	while (!stop_tx) {
+		// Baseband written but not yet sent, for the clock drift servo.
+		// The carrier the ring starts out with, padding and replayed
+		// samples did not come from here. The DMA position is only read
+		// back at each refill, so what it consumed since is worked out
+		// from the time.
+		stats_read(&stats, &snapshot);
+		if (snapshot.position_ns) {
+			double consumed = (double)snapshot.dma_samples - ctl.samples - snapshot.starved - snapshot.underrun_samples +
+				(monotonic_raw_ns() - snapshot.position_ns) / 1e9 * params->rate;
+
+			fm_mpx_set_queued((produced - consumed) / params->rate);
+		}
+
+		if ((data_len = fm_mpx_get_samples(data)) < 0) {
+			stop_tx = 1;
+			break;
+		}
+		if (data_len)
+			latency_mark(&latency, produced + data_len - 1, monotonic_raw_ns() - fm_mpx_input_age() * 1e9);
+
+		sample_t *p = data;
+		while (data_len && !stop_tx) {
+			uint32_t written = ring_write(&mpx_ring, p, data_len);
+			p += written;
+			data_len -= written;
+			produced += written;
+			if (data_len) {
+				TRACE_BEGIN(t_wait);
+				udelay(1000);
+				TRACE_END(t_wait, TRACE_RING_WAIT, data_len);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// Read lap and control block until they agree, so a wrap between the two
+// readbacks is not counted twice or missed
+static void dma_position(uint32_t *lap, int *sample)
+{
+	uint32_t lap_cb = dma_ring_bus(&ctl, ctl.lap_cb);
+	uint32_t cb;
+
+	for (int tries = 0; tries < 100; tries++) {
+		uint32_t before = dma_ring_lap(&ctl);
+
+		cb = hal->dma_conblk_ad(dma_reg);
+		*lap = dma_ring_lap(&ctl);
+		if (*lap == before && cb != lap_cb)
+			break;
 	}
 
+	*sample = dma_ring_position(&ctl, cb);
+}
+
+// Copy words into the DMA ring at *pos. The ring is uncached, so it is
+// written in at most two contiguous bursts, split at the wrap, rather than
+// a word at a time.
+static void write_burst(const uint32_t *words, uint32_t len, int *pos)
+{
+	uint32_t first = ctl.samples - *pos;
+
+	if (first > len)
+		first = len;
+	memcpy(&ctl.sample[*pos], words, first * sizeof(uint32_t));
+	memcpy(&ctl.sample[0], words + first, (len - first) * sizeof(uint32_t));
+
+	*pos += len;
+	if ((uint32_t)*pos >= ctl.samples)
+		*pos -= ctl.samples;
+}
+
+// Consumer: keeps the DMA ring topped up from the baseband ring. It never
+// blocks on the DSP thread; if that falls behind, the carrier is held
+// unmodulated rather than letting the DMA replay stale samples.
+static void *refill_thread(void *arg)
+{
+	struct refill_params *params = arg;
+	uint32_t last_lap = params->lap, lap;
+	int dma_sample = params->sample, this_sample;
+	int write_sample = dma_sample;
+	// The ring starts out full of carrier
+	uint32_t queued = ctl.samples;
+	struct refill_sched sched;
+	struct tx_stats tx_stats;
+	struct timespec done;
+	uint64_t taken = 0;             // from the baseband ring since the start
+	// Words are built here, in cached memory, before going out in bursts
+	static uint32_t staging[STAGING_SIZE];
+
+	sched_init(&sched, params->rate, ctl.samples, params->low_water);
+	stats_init(&tx_stats, ctl.samples);
+	trace_thread("refill");
+
+	for (;;) {
+		TRACE_BEGIN(t_position);
+		dma_position(&lap, &this_sample);
+		tx_stats.position_ns = monotonic_raw_ns();
+
+		uint64_t consumed = (uint64_t)((lap - last_lap) & (DMA_RING_LAPS - 1)) * ctl.samples + this_sample - dma_sample;
+		TRACE_END(t_position, TRACE_POSITION, consumed);
+		last_lap = lap;
+		dma_sample = this_sample;
+		tx_stats.dma_samples += consumed;
+
+		if (consumed > queued) {
+			// The DMA went past everything we had written and replayed
+			// old samples. Start writing again right where it is now.
+			tx_stats.underruns++;
+			tx_stats.underrun_samples += consumed - queued;
+			queued = 0;
+			write_sample = this_sample;
+		} else {
+			queued -= consumed;
+		}
+		if (queued < tx_stats.min_headroom)
+			tx_stats.min_headroom = queued;
+
+		sched_wake(&sched, consumed < ctl.samples ? consumed : ctl.samples);
+
+		scale_t scale = deviation_scale(atomic_load_explicit(&control.deviation, memory_order_relaxed), params->steps_per_khz);
+		uint32_t free_slots = ctl.samples - queued;
+		uint32_t batch = 0;
+
+		TRACE_BEGIN(t_refill);
+		while (free_slots) {
+			sample_t *data;
+			uint32_t len = ring_peek(&mpx_ring, &data);
+
+			if (len == 0) break;
+			if (len > free_slots)
+				len = free_slots;
+			if (len > STAGING_SIZE)
+				len = STAGING_SIZE;
+
+			// The first of them goes out once what is queued ahead has
+			// drained, (ctl.samples - free_slots) slots after position_ns
+			latency_resolve(&latency, taken, len, tx_stats.position_ns +
+				(uint64_t)((ctl.samples - free_slots) / sched.rate * 1e9), sched.rate);
+			taken += len;
+			freq_words(staging, data, len, params->base, scale);
+			ring_consume(&mpx_ring, len);
+			write_burst(staging, len, &write_sample);
+			free_slots -= len;
+			batch += len;
+		}
+		TRACE_END(t_refill, TRACE_REFILL, batch);
+
+		// Out of baseband: pad with carrier, but only up to the low-water mark
+		uint32_t pad = 0;
+		if (ctl.samples - free_slots < sched.low_water)
+			pad = sched.low_water - (ctl.samples - free_slots);
+		if (pad > free_slots)
+			pad = free_slots;
+		TRACE_BEGIN(t_pad);
+		for (uint32_t left = pad; left; ) {
+			uint32_t len = left < STAGING_SIZE ? left : STAGING_SIZE;
+
+			for (uint32_t i = 0; i < len; i++)
+				staging[i] = params->base;
+			write_burst(staging, len, &write_sample);
+			left -= len;
+			free_slots -= len;
+			batch += len;
+			tx_stats.starved += len;
+		}
+		if (pad)
+			TRACE_END(t_pad, TRACE_PAD, pad);
+		queued = ctl.samples - free_slots;
+
+		clock_gettime(CLOCK_MONOTONIC, &done);
+		uint32_t busy_ns = (done.tv_sec - sched.wake_time.tv_sec) * 1000000000L + done.tv_nsec - sched.wake_time.tv_nsec;
+
+		if (batch) {
+			tx_stats.refills++;
+			tx_stats.refill_samples += batch;
+			if (batch < tx_stats.min_batch)
+				tx_stats.min_batch = batch;
+			if (batch > tx_stats.max_batch)
+				tx_stats.max_batch = batch;
+			tx_stats.busy_ns += busy_ns;
+			if (busy_ns > tx_stats.max_busy_ns)
+				tx_stats.max_busy_ns = busy_ns;
+		}
+		stats_publish(&stats, &tx_stats);
+
+		if (stop_tx) break;
+
+		sched_sleep(&sched, queued);
+	}
+
+	sched_report(&sched);
+	if (tx_stats.starved)
+		printf("Baseband ran late: %llu samples of unmodulated carrier inserted\n", (unsigned long long)tx_stats.starved);
+	if (tx_stats.underruns)
+		printf("DMA underran %llu times, replaying %llu stale samples\n",
+			(unsigned long long)tx_stats.underruns, (unsigned long long)tx_stats.underrun_samples);
+
+	return NULL;
+}
+
+// Print the stats line every interval seconds and keep the stats file
+// current, until transmission stops
+static void report_stats(float interval, char *stats_file, int rate)
+{
+	struct timespec start, now;
+	struct tx_stats snapshot;
+	struct clip_stats clip;
+	struct net_stats net;
+	struct drift_stats drift;
+	struct latency_stats lat;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (!stop_tx) {
+		struct timespec ts = { (time_t)interval, (interval - (time_t)interval) * 1e9 };
+
+		nanosleep(&ts, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		stats_read(&stats, &snapshot);
+		int clip_on = fm_mpx_clip_stats(&clip) == 0;
+		int net_on = fm_mpx_net_stats(&net) == 0;
+		int drift_on = fm_mpx_drift_stats(&drift) == 0;
+
+		latency_read(&latency, &lat);
+
+		stats_print(&snapshot, rate);
+		if (clip_on)
+			clip_stats_print(&clip);
+		if (net_on)
+			net_stats_print(&net);
+		if (drift_on)
+			drift_stats_print(&drift);
+		latency_stats_print(&lat);
+		if (stats_file && stats_write(stats_file, &snapshot, clip_on ? &clip : NULL, net_on ? &net : NULL,
+			drift_on ? &drift : NULL, &lat,
+				(now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9, rate) < 0)
+			fprintf(stderr, "Warning: could not write stats file %s\n", stats_file);
+	}
+}
+
+static int start_thread(pthread_t *thread, void *(*fn)(void *), void *arg, int rt_prio, int cpu)
+{
+	pthread_attr_t attr;
+	int err;
+
+	pthread_attr_init(&attr);
+	if (rt_prio > 0) {
+		struct sched_param param = { .sched_priority = rt_prio };
+
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	if (cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	err = pthread_create(thread, &attr, fn, arg);
+	if (err == EPERM && rt_prio > 0) {
+		fprintf(stderr, "Warning: not allowed to use SCHED_FIFO, falling back to normal scheduling\n");
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		err = pthread_create(thread, &attr, fn, arg);
+	}
+	pthread_attr_destroy(&attr);
+
+	return err;
+}
+
+static int tx(const struct tune *tune, char *audio_file, char *raw, float ppm, int resampler, int processing, int preemph, int clip, float crossfade, int mpx_rate, int drift_comp, int low_latency, char *cache_dir, int composite, int rds, int deviation, char *ctl_path, int power, int gpio, float low_water, float ring_ms, int rt_prio, int cpu, float stats_interval, char *stats_file) {
 	dma_reg = map_peripheral(DMA_VIRT_BASE, (DMA_CHANNEL_SIZE * (DMA_CHANNEL_MAX + 1)));
 	dma_reg = dma_reg + ((DMA_CHANNEL_SIZE / sizeof(int)) * (DMA_CHANNEL));
 	pwm_reg = map_peripheral(PWM_VIRT_BASE, PWM_LEN);
@@ -380,22 +551,28 @@ static int tx(uint32_t carrier_freq, int divider, char *audio_file, float ppm, i
 	gpio_reg = map_peripheral(GPIO_VIRT_BASE, GPIO_LEN);
 	pcm_reg = map_peripheral(PCM_VIRT_BASE, PCM_LEN);
 	pad_reg = map_peripheral(PAD_VIRT_BASE, PAD_LEN);
+	uint32_t carrier_freq = tune->carrier;
+	int divider = tune->divider;
 	uint32_t freq_ctl;
+	uint32_t ring_samples = dma_ring_samples(ring_ms, mpx_rate);
+	struct timespec build_start, build_end;
+
+	ctl.size = dma_ring_size(ring_samples);
 
 	// Use the mailbox interface to the VC to ask for physical memory.
-	mbox.handle = mbox_open();
+	mbox.handle = hal->mbox_open();
 	if (mbox.handle < 0)
 		fatal("Failed to open mailbox. Check kernel support for vcio / BCM2708 mailbox.\n");
-	printf("Allocating physical memory: size = %d, ", NUM_PAGES * PAGE_SIZE);
-	if(!(mbox.mem_ref = mem_alloc(mbox.handle, NUM_PAGES * PAGE_SIZE, PAGE_SIZE, MEM_FLAG))) {
+	printf("Allocating physical memory: size = %d, ", (int)ctl.size);
+	if(!(mbox.mem_ref = hal->mem_alloc(mbox.handle, ctl.size, PAGE_SIZE, MEM_FLAG))) {
 		fatal("\nCould not allocate memory.\n");
 	}
 	printf("mem_ref = %u, ", mbox.mem_ref);
-	if(!(mbox.bus_addr = mem_lock(mbox.handle, mbox.mem_ref))) {
+	if(!(mbox.bus_addr = hal->mem_lock(mbox.handle, mbox.mem_ref))) {
 		fatal("\nCould not lock memory.\n");
 	}
 	printf("bus_addr = %x, ", mbox.bus_addr);
-	if(!(mbox.virt_addr = mapmem(BUS_TO_PHYS(mbox.bus_addr), NUM_PAGES * PAGE_SIZE))) {
+	if(!(mbox.virt_addr = hal->mapmem(BUS_TO_PHYS(mbox.bus_addr), ctl.size))) {
 		fatal("\nCould not map memory.\n");
 	}
 	printf("virt_addr = %p\n", mbox.virt_addr);
@@ -424,10 +601,10 @@ static int tx(uint32_t carrier_freq, int divider, char *audio_file, float ppm, i
 	udelay(100);
 
 	// Adjust PLLA frequency
-	freq_ctl = (carrier_freq*divider)/CLOCK_BASE*(1<<20);
+	freq_ctl = tune->multiplier;
 	clk_reg[PLLA_CTRL] = (0x5a<<24) | (0x21<<12) | (freq_ctl>>20); // Integer part
 	freq_ctl&=0xFFFFF;
-	clk_reg[PLLA_FRAC] = (0x5a<<24) | (freq_ctl&0xFFFFC); // Fractional part
+	clk_reg[PLLA_FRAC] = (0x5a<<24) | freq_ctl; // Fractional part
 	udelay(100);
 
 	if ((clk_reg[CM_LOCK] & CM_LOCK_FLOCKA) > 0)
@@ -460,37 +637,32 @@ static int tx(uint32_t carrier_freq, int divider, char *audio_file, float ppm, i
 	gpio_reg[reg] = (gpio_reg[reg] & ~(7 << shift)) | (mode << shift);
 	udelay(100);
 
-	ctl = (struct control_data_s *) mbox.virt_addr;
-	dma_cb_t *cbp = ctl->cb;
-
-	for (int i = 0; i < NUM_SAMPLES; i++) {
-		ctl->sample[i] = 0x5a << 24 | freq_ctl; // Silence
-		// Write a frequency sample
-		cbp->info = BCM2708_DMA_NO_WIDE_BURSTS | BCM2708_DMA_WAIT_RESP;
-		cbp->src = mem_virt_to_phys(ctl->sample + i);
-		cbp->dst = PERIPH_PHYS_BASE + (PLLA_FRAC<<2) + CLK_BASE_OFFSET;
-		cbp->length = 4;
-		cbp->stride = 0;
-		cbp->next = mem_virt_to_phys(cbp + 1);
-		cbp++;
-		// Delay
-		cbp->info = BCM2708_DMA_NO_WIDE_BURSTS | BCM2708_DMA_WAIT_RESP | BCM2708_DMA_D_DREQ | BCM2708_DMA_PER_MAP(5);
-		cbp->src = mem_virt_to_phys(mbox.virt_addr);
-		cbp->dst = PERIPH_PHYS_BASE + (PWM_FIFO<<2) + PWM_BASE_OFFSET;
-		cbp->length = 4;
-		cbp->stride = 0;
-		cbp->next = mem_virt_to_phys(cbp + 1);
-		cbp++;
-	}
-	cbp--;
-	cbp->next = mem_virt_to_phys(mbox.virt_addr);
-
-	// Here we define the rate at which we want to update the GPCLK control register
-	uint32_t srdivider = (carrier_freq*divider/1e3)/(2*192);
+	clock_gettime(CLOCK_MONOTONIC, &build_start);
+	dma_ring_layout(&ctl, ring_samples, mbox.virt_addr, mbox.bus_addr);
+	dma_ring_build(&ctl, 0x5a << 24 | freq_ctl); // Silence
+	clock_gettime(CLOCK_MONOTONIC, &build_end);
+
+	printf("DMA ring: %u samples (%.1f ms), %u control blocks, %u kB, built in %.1f ms.\n",
+		ctl.samples, ctl.samples * 1000.0 / mpx_rate, ctl.samples * 2 + 1, ctl.size / 1024,
+		(build_end.tv_sec - build_start.tv_sec) * 1e3 + (build_end.tv_nsec - build_start.tv_nsec) / 1e6);
+
+	// Here we define the rate at which we want to update the GPCLK control register:
+	// the PWM takes range clocks per word, and the range grows at low rates so
+	// the divider fits its 12 integer bits
+	double vco = (double)tune->clock_base * tune->multiplier / (1 << 20);
+	uint32_t range = 2;
+	while (vco / ((double)range * mpx_rate) >= 4096)
+		range++;
+	double srdivider = vco / ((double)range * mpx_rate);
 	uint32_t idivider = srdivider;
-	uint32_t fdivider = (srdivider - idivider)*pow(2, 12);
+	uint32_t fdivider = lrint((srdivider - idivider) * (1 << 12));
+	if (fdivider == 1 << 12) {
+		idivider++;
+		fdivider = 0;
+	}
 
-	printf("PPM correction is %.4f, divider is %4d (%d + %d*2^-12).\n", ppm, srdivider, idivider, fdivider);
+	printf("PPM correction is %.4f, divider is %.4f (%d + %d*2^-12), range %d: samples at %.1f Hz.\n",
+		ppm, srdivider, idivider, fdivider, range, vco / range / (idivider + fdivider / 4096.0));
 
 	pwm_reg[PWM_CTL] = 0;
 	udelay(100);
@@ -500,7 +672,7 @@ static int tx(uint32_t carrier_freq, int divider, char *audio_file, float ppm, i
 	udelay(100);
 	clk_reg[PWMCLK_CNTL] = (0x5a<<24) | (1<<9) | (1<<4) | (4); // Source = PLLA, enable, MASH setting 1
 	udelay(100);
-	pwm_reg[PWM_RNG1] = 2;
+	pwm_reg[PWM_RNG1] = range;
 	udelay(100);
 	pwm_reg[PWM_DMAC] = PWMDMAC_ENAB | PWMDMAC_THRSHLD;
 	udelay(100);
@@ -514,63 +686,76 @@ static int tx(uint32_t carrier_freq, int divider, char *audio_file, float ppm, i
 	dma_reg[DMA_CS] = BCM2708_DMA_RESET;
 	udelay(100);
 	dma_reg[DMA_CS] = BCM2708_DMA_INT | BCM2708_DMA_END;
-	dma_reg[DMA_CONBLK_AD] = mem_virt_to_phys(ctl->cb);
+	dma_reg[DMA_CONBLK_AD] = dma_ring_bus(&ctl, ctl.cb);
 	dma_reg[DMA_DEBUG] = 7; // clear debug error flags
 	dma_reg[DMA_CS] = BCM2708_DMA_PRIORITY(15) | BCM2708_DMA_PANIC_PRIORITY(15) | BCM2708_DMA_DISDEBUG | BCM2708_DMA_ACTIVE;
 
-	uint32_t last_cb = (uint32_t)ctl->cb;
+	struct refill_params params;
+	pthread_t dsp, refill;
 
-	// Data structures for baseband data
-	float data[DATA_SIZE*16];
-	int data_len = 0;
-	int data_index = 0;
+	// Let the backend latch the start of the transfer
+	dma_position(&params.lap, &params.sample);
 
 	// Initialize the baseband generator
-	if(fm_mpx_open(audio_file, ppm) < 0) {
+	if(fm_mpx_open(audio_file, raw, ppm, resampler, rds, processing, preemph, clip, crossfade, mpx_rate, drift_comp, low_latency, cache_dir, composite) < 0) {
 		goto exit;
 	}
 
+	latency_init(&latency);
+	if (ring_init(&mpx_ring, low_latency ? LOW_LATENCY_MPX_RING : MPX_RING_SIZE) < 0) {
+		fm_mpx_close();
+		fatal("Could not allocate the baseband ring.\n");
+	}
+
 	printf("Starting to transmit on %3.1f MHz.\n", carrier_freq/1e6);
 
-	float deviation_scale_factor = (divider*(deviation*1000)/(CLOCK_BASE/(1<<20)));
-	uint32_t cur_cb;
-	int last_sample, this_sample, free_slots;
-	float dval;
+	params.base = 0x5A << 24 | freq_ctl;
+	params.steps_per_khz = divider*1000/(CLOCK_BASE/(1<<20));
+	params.low_water = low_water;
+	params.rate = mpx_rate;
 
-	for (;;) {
-		cur_cb = (int)mem_phys_to_virt(dma_reg[DMA_CONBLK_AD]);
-		last_sample = (last_cb - (int)mbox.virt_addr) / (sizeof(dma_cb_t) * 2);
-		this_sample = (cur_cb - (int)mbox.virt_addr) / (sizeof(dma_cb_t) * 2);
-		free_slots = this_sample - last_sample;
-
-		if (free_slots < 0)
-			free_slots += NUM_SAMPLES;
-
-		while (free_slots >= SUBSIZE) {
-			// Get more baseband samples if necessary
-			if(data_len == 0) {
-				if ((data_len = fm_mpx_get_samples(data)) < 0) break;
-				data_index = 0;
-			}
+	if (start_control(ctl_path, deviation, freq_ctl, params.steps_per_khz) < 0) {
+		ring_free(&mpx_ring);
+		goto exit;
+	}
 
-			dval = data[data_index]*deviation_scale_factor;
-			data_index++;
-			data_len--;
+	if (start_thread(&dsp, dsp_thread, &params, 0, -1)) {
+		fm_mpx_close();
+		fatal("Could not start the DSP thread.\n");
+	}
+	if (start_thread(&refill, refill_thread, &params, rt_prio, cpu)) {
+		stop_tx = 1;
+		pthread_join(dsp, NULL);
+		fm_mpx_close();
+		fatal("Could not start the refill thread.\n");
+	}
 
-			ctl->sample[last_sample++] = (0x5A << 24 | freq_ctl) + dval;
-			if (last_sample == NUM_SAMPLES)
-				last_sample = 0;
+	if (stats_interval > 0)
+		report_stats(stats_interval, stats_file, mpx_rate);
 
-			free_slots -= SUBSIZE;
-		}
-		last_cb = (uint32_t)mbox.virt_addr + last_sample * sizeof(dma_cb_t) * 2;
+	pthread_join(refill, NULL);
+	pthread_join(dsp, NULL);
+	control_close();
 
-		usleep(5000);
+	struct latency_stats lat;
 
-		if (stop_tx) break;
+	latency_read(&latency, &lat);
+	latency_stats_print(&lat);
+	if (stats_file) {
+		struct tx_stats snapshot;
+		struct clip_stats clip;
+		struct net_stats net;
+		struct drift_stats drift;
+
+		stats_read(&stats, &snapshot);
+		stats_write(stats_file, &snapshot, fm_mpx_clip_stats(&clip) == 0 ? &clip : NULL,
+			fm_mpx_net_stats(&net) == 0 ? &net : NULL, fm_mpx_drift_stats(&drift) == 0 ? &drift : NULL,
+			&lat, snapshot.dma_samples / (double)mpx_rate, mpx_rate);
 	}
+	ring_free(&mpx_ring);
 
 exit:
+	trace_close();
 	fm_mpx_close();
 	terminate();
 
@@ -580,28 +765,90 @@ exit:
 int main(int argc, char **argv) {
 	int opt = 0;
 	char *audio_file = NULL;
+	char *raw = NULL;
 	uint32_t carrier_freq = 87600000;
 	float ppm = 0.0;
 	int deviation = 75;
 	int divc = 0;
 	int power = 0;
 	int gpio = 4;
+	char *output_file = NULL;
+	int output_format = OUTPUT_WORDS;
+	long samples = 0;
+	float low_water = 0;
+	float ring_ms = 0;
+	int low_latency = 0;
+	int rt_prio = 0;
+	int cpu = -1;
+	float stats_interval = 0;
+	char *stats_file = NULL;
+	int resampler = RESAMPLER_POLY;
+	int processing = PROC_OFF;
+	int preemph = 0;
+	int clip = 1;
+	float crossfade = 0;
+	int mpx_rate = MPX_SAMPLE_RATE;
+	int drift_comp = 1;
+	char *cache_dir = NULL;
+	int composite = COMPOSITE_OFF;
+	char *trace_file = NULL;
+	int rds = 1;
+	int pty;
+	char *ctl_path = NULL;
+#if (RASPI) == 0
+	char *backend = "sim";
+#else
+	char *backend = "hw";
+#endif
 
-	const char    	*short_opt = "a:rf:d:p:D:w:g:h";
+	const char    	*short_opt = "a:F:r:i:s:t:y:T:C:l:f:d:p:D:w:g:B:o:O:n:L:P:c:R:b:S:j:x:e:k:X:M:m:A:Q:K:u:z:h";
 	struct option   long_opt[] =
 	{
 		{"audio", 	required_argument, NULL, 'a'},
+		{"raw", 	required_argument, NULL, 'F'},
+		{"rds", 	required_argument, NULL, 'r'},
+		{"pi", 		required_argument, NULL, 'i'},
+		{"ps", 		required_argument, NULL, 's'},
+		{"rt", 		required_argument, NULL, 't'},
+		{"pty", 	required_argument, NULL, 'y'},
+		{"tp", 		required_argument, NULL, 'T'},
+		{"ct", 		required_argument, NULL, 'C'},
+		{"ctl", 	required_argument, NULL, 'l'},
 		{"freq", 	required_argument, NULL, 'f'},
 		{"dev", 	required_argument, NULL, 'd'},
 		{"ppm", 	required_argument, NULL, 'p'},
 		{"div", 	required_argument, NULL, 'D'},
 		{"power", 	required_argument, NULL, 'w'},
 		{"gpio",	required_argument, NULL, 'g'},
+		{"backend",	required_argument, NULL, 'B'},
+		{"output",	required_argument, NULL, 'o'},
+		{"output-format", required_argument, NULL, 'O'},
+		{"samples",	required_argument, NULL, 'n'},
+		{"low-water",	required_argument, NULL, 'L'},
+		{"dma-ring",	required_argument, NULL, 'M'},
+		{"rt-prio",	required_argument, NULL, 'P'},
+		{"cpu",		required_argument, NULL, 'c'},
+		{"resampler",	required_argument, NULL, 'R'},
+		{"bench",	required_argument, NULL, 'b'},
+		{"stats",	required_argument, NULL, 'S'},
+		{"stats-file",	required_argument, NULL, 'j'},
+		{"processing",	required_argument, NULL, 'x'},
+		{"preemph",	required_argument, NULL, 'e'},
+		{"clipper",	required_argument, NULL, 'k'},
+		{"crossfade",	required_argument, NULL, 'X'},
+		{"mpx-rate",	required_argument, NULL, 'm'},
+		{"drift",	required_argument, NULL, 'A'},
+		{"latency",	required_argument, NULL, 'Q'},
+		{"cache",	required_argument, NULL, 'K'},
+		{"composite",	required_argument, NULL, 'u'},
+		{"trace",	required_argument, NULL, 'z'},
 
 		{"help",	no_argument, NULL, 'h'},
 		{ 0, 		0, 		   0,    0 }
 	};
 
+	set_rds_rt("PiFmAdv: Advanced FM transmitter for the Raspberry Pi");
+
 	while((opt = getopt_long(argc, argv, short_opt, long_opt, NULL)) != -1)
 	{
 		switch(opt)
@@ -610,6 +857,47 @@ int main(int argc, char **argv) {
 				audio_file = optarg;
 				break;
 
+			case 'F': //raw
+				raw = optarg;
+				break;
+
+			case 'r': //rds
+				rds = atoi(optarg);
+				break;
+
+			case 'i': //pi
+				set_rds_pi(strtoul(optarg, NULL, 16));
+				break;
+
+			case 's': //ps
+				set_rds_ps(optarg);
+				break;
+
+			case 't': //rt
+				set_rds_rt(optarg);
+				break;
+
+			case 'y': //pty
+				pty = atoi(optarg);
+				if (pty < 0 || pty > 31) {
+					fprintf(stderr, "Program type has to be set in range of 0 - 31\n");
+					return 1;
+				}
+				set_rds_pty(pty);
+				break;
+
+			case 'T': //tp
+				set_rds_tp(atoi(optarg));
+				break;
+
+			case 'C': //ct
+				set_rds_ct(atoi(optarg));
+				break;
+
+			case 'l': //ctl
+				ctl_path = optarg;
+				break;
+
 			case 'f': //freq
 				carrier_freq = 1e6 * atof(optarg);
 				if(carrier_freq < 76e6 || carrier_freq > 108e6)
@@ -644,14 +932,221 @@ int main(int argc, char **argv) {
 				}
 				break;
 
+			case 'B': //backend
+				backend = optarg;
+				break;
+
+			case 'o': //output
+				output_file = optarg;
+				break;
+
+			case 'O': //output-format
+				if (strcmp(optarg, "words") == 0) {
+					output_format = OUTPUT_WORDS;
+				} else if (strcmp(optarg, "float") == 0) {
+					output_format = OUTPUT_FLOAT;
+				} else {
+					fprintf(stderr, "Output format has to be words or float\n");
+					return 1;
+				}
+				break;
+
+			case 'n': //samples
+				samples = atol(optarg);
+				break;
+
+			case 'L': //low-water
+				low_water = atof(optarg);
+				if (low_water <= 0) {
+					fprintf(stderr, "Low-water mark has to be a positive number of milliseconds\n");
+					return 1;
+				}
+				break;
+
+			case 'M': //dma-ring
+				ring_ms = atof(optarg);
+				if (ring_ms < DMA_RING_MIN_MS || ring_ms > DMA_RING_MAX_MS) {
+					fprintf(stderr, "DMA ring has to be between %d and %d milliseconds\n", DMA_RING_MIN_MS, DMA_RING_MAX_MS);
+					return 1;
+				}
+				break;
+
+			case 'P': //rt-prio
+				rt_prio = atoi(optarg);
+				if (rt_prio < 0 || rt_prio > 99) {
+					fprintf(stderr, "Real-time priority has to be set in range of 0 - 99\n");
+					return 1;
+				}
+				break;
+
+			case 'c': //cpu
+				cpu = atoi(optarg);
+				break;
+
+			case 'R': //resampler
+				if (strcmp(optarg, "poly") == 0) {
+					resampler = RESAMPLER_POLY;
+				} else if (strcmp(optarg, "zoh") == 0) {
+					resampler = RESAMPLER_ZOH;
+				} else if (strcmp(optarg, "sinc") == 0) {
+					resampler = RESAMPLER_SINC;
+				} else {
+					fprintf(stderr, "Resampler has to be poly, zoh or sinc\n");
+					return 1;
+				}
+				break;
+
+			case 'x': //processing
+				if (strcmp(optarg, "off") == 0) {
+					processing = PROC_OFF;
+				} else if (strcmp(optarg, "light") == 0) {
+					processing = PROC_LIGHT;
+				} else if (strcmp(optarg, "full") == 0) {
+					processing = PROC_FULL;
+				} else {
+					fprintf(stderr, "Processing has to be off, light or full\n");
+					return 1;
+				}
+				break;
+
+			case 'e': //preemph
+				if (strcmp(optarg, "off") == 0) {
+					preemph = 0;
+				} else if (strcmp(optarg, "50") == 0 || strcmp(optarg, "eu") == 0) {
+					preemph = 50;
+				} else if (strcmp(optarg, "75") == 0 || strcmp(optarg, "us") == 0) {
+					preemph = 75;
+				} else {
+					fprintf(stderr, "Pre-emphasis has to be off, 50 (eu) or 75 (us)\n");
+					return 1;
+				}
+				break;
+
+			case 'k': //clipper
+				if (strcmp(optarg, "on") == 0 || strcmp(optarg, "1") == 0) {
+					clip = 1;
+				} else if (strcmp(optarg, "off") == 0 || strcmp(optarg, "0") == 0) {
+					clip = 0;
+				} else {
+					fprintf(stderr, "Clipper has to be on or off\n");
+					return 1;
+				}
+				break;
+
+			case 'X': //crossfade
+				crossfade = atof(optarg);
+				if (crossfade < 0 || crossfade > 30) {
+					fprintf(stderr, "Crossfade has to be between 0 and 30 seconds\n");
+					return 1;
+				}
+				break;
+
+			case 'm': //mpx-rate
+				mpx_rate = atoi(optarg);
+				if (mpx_rate < MPX_RATE_MIN || mpx_rate > MPX_RATE_MAX || mpx_rate % 1000) {
+					fprintf(stderr, "Baseband rate has to be whole kHz between %d and %d Hz\n", MPX_RATE_MIN, MPX_RATE_MAX);
+					return 1;
+				}
+				break;
+
+			case 'A': //drift
+				if (strcmp(optarg, "on") == 0 || strcmp(optarg, "1") == 0) {
+					drift_comp = 1;
+				} else if (strcmp(optarg, "off") == 0 || strcmp(optarg, "0") == 0) {
+					drift_comp = 0;
+				} else {
+					fprintf(stderr, "Drift compensation has to be on or off\n");
+					return 1;
+				}
+				break;
+
+			case 'Q': //latency
+				if (strcmp(optarg, "low") == 0) {
+					low_latency = 1;
+				} else if (strcmp(optarg, "normal") == 0) {
+					low_latency = 0;
+				} else {
+					fprintf(stderr, "Latency has to be low or normal\n");
+					return 1;
+				}
+				break;
+
+			case 'K': //cache
+				cache_dir = optarg;
+				break;
+
+			case 'u': //composite
+				if (strcmp(optarg, "s16") == 0) {
+					composite = COMPOSITE_S16;
+				} else if (strcmp(optarg, "s32") == 0) {
+					composite = COMPOSITE_S32;
+				} else if (strcmp(optarg, "float") == 0) {
+					composite = COMPOSITE_FLOAT;
+				} else {
+					fprintf(stderr, "Composite format has to be s16, s32 or float\n");
+					return 1;
+				}
+				break;
+
+			case 'S': //stats
+				stats_interval = atof(optarg);
+				break;
+
+			case 'j': //stats-file
+				stats_file = optarg;
+				break;
+
+			case 'z': //trace
+#ifdef TRACE
+				trace_file = optarg;
+				break;
+#else
+				fprintf(stderr, "Tracing is not compiled in, build with make TRACE=1\n");
+				return 1;
+#endif
+
+			case 'b': //bench
+				return bench_run(optarg);
+
 			case 'h': //help
 				fprintf(stderr, "Usage: %s --audio (-a) file\n"
+				      "	[--raw (-F) rate:channels:s16|float]\n"
+				      "	[--rds (-r) 0|1]\n"
+				      "	[--pi (-i) pi-code]\n"
+				      "	[--ps (-s) ps-text]\n"
+				      "	[--rt (-t) radiotext]\n"
+				      "	[--pty (-y) program-type]\n"
+				      "	[--tp (-T) 0|1]\n"
+				      "	[--ct (-C) 0|1]\n"
+				      "	[--ctl (-l) control-pipe]\n"
 				      "	[--freq (-f) frequency]\n"
 				      "	[--dev (-d) deviation]\n"
 				      "	[--ppm (-p) ppm-error]\n"
 				      "	[--div (-D) divider]\n"
 				      "	[--power (-w) output-power]\n"
-				      "	[--gpio (-g) gpio-pin]\n", argv[0]);
+				      "	[--gpio (-g) gpio-pin]\n"
+				      "	[--backend (-B) hw|sim]\n"
+				      "	[--output (-o) file]\n"
+				      "	[--output-format (-O) words|float]\n"
+				      "	[--samples (-n) count]\n"
+				      "	[--low-water (-L) milliseconds]\n"
+				      "	[--dma-ring (-M) milliseconds]\n"
+				      "	[--rt-prio (-P) priority]\n"
+				      "	[--cpu (-c) cpu-core]\n"
+				      "	[--resampler (-R) poly|zoh|sinc]\n"
+				      "	[--processing (-x) off|light|full]\n"
+				      "	[--preemph (-e) off|eu|us|50|75]\n"
+				      "	[--clipper (-k) on|off]\n"
+				      "	[--crossfade (-X) seconds]\n"
+				      "	[--mpx-rate (-m) rate]\n"
+				      "	[--drift (-A) on|off]\n"
+				      "	[--latency (-Q) low|normal]\n"
+				      "	[--cache (-K) directory]\n"
+				      "	[--composite (-u) s16|s32|float]\n"
+				      "	[--stats (-S) seconds]\n"
+				      "	[--stats-file (-j) file]\n"
+				      "	[--trace (-z) file]\n"
+				      "	[--bench (-b) name|all]\n", argv[0]);
 				return 1;
 				break;
 
@@ -663,55 +1158,53 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if (!ring_ms)
+		ring_ms = low_latency ? LOW_LATENCY_RING_MS : DMA_RING_DEFAULT_MS;
+	if (!low_water)
+		low_water = low_latency ? LOW_LATENCY_LOW_WATER_MS : 100;
+	if (low_latency)
+		printf("Low-latency profile: %.1f ms DMA ring, %.1f ms low-water mark, %d ms input blocks.\n",
+			ring_ms, low_water, LOW_LATENCY_BLOCK_MS);
+
 	if (audio_file == NULL) {
 		fprintf(stderr, "No audio specified.\n");
 		return 1;
 	}
 
-	float xtal_freq_recip=1.0/CLOCK_BASE;
-	int divider, best_divider = 0;
-	int min_int_multiplier, max_int_multiplier;
-	int int_multiplier;
-	float frac_multiplier;
-	int fom, best_fom = 0;
-	int solution_count = 0;
-	for(divider = 2; divider < 50; divider++)
-	{
-		if(carrier_freq * divider > 1400e6) break;
+	if (output_file == NULL && low_water >= ring_ms)
+		fprintf(stderr, "Warning: low-water mark of %.1f ms does not fit a %.1f ms DMA ring, using %.1f ms\n", low_water, ring_ms, ring_ms / 2);
 
-		max_int_multiplier=((int)((float)(carrier_freq + 10 + (deviation * 1000)) * divider * xtal_freq_recip));
-		min_int_multiplier=((int)((float)(carrier_freq - 10 - (deviation * 1000)) * divider * xtal_freq_recip));
-		if(min_int_multiplier != max_int_multiplier) continue;
+	// Catch only important signals
+	for (int i = 0; i < 25; i++) {
+		signal(i, shutdown);
+	}
 
-		solution_count++;
-		fom = 0;
+	if (output_file == NULL && (hal = hal_get(backend)) == NULL) {
+		fprintf(stderr, "Unknown or unavailable backend: %s\n", backend);
+		return 1;
+	}
 
-		if(carrier_freq * divider >  900e6) fom++; // Prefer frequencies close to 1.0 Ghz
-		if(carrier_freq * divider < 1100e6) fom++;
+	struct tune tune;
 
-		if(carrier_freq * divider >  800e6) fom++;
-		if(carrier_freq * divider < 1200e6) fom++;
+	if (divc) {
+		if (tune_divider(&tune, CLOCK_BASE, carrier_freq, deviation, divc) < 0)
+			fprintf(stderr, "Warning: divider %d puts the VCO out of range or leaves too little room for the deviation.\n", divc);
+	} else if (tune_lookup(&tune, CLOCK_BASE, carrier_freq, deviation) < 0) {
+		fprintf(stderr, "No tuning solution found. You can specify the divider manually by setting the --div parameter.\n");
+		return 1;
+	}
 
-		frac_multiplier = ((float)(carrier_freq) * divider * xtal_freq_recip);
-		int_multiplier = (int)frac_multiplier;
-		frac_multiplier = frac_multiplier - int_multiplier;
-		if((frac_multiplier > 0.2) && (frac_multiplier < 0.8)) fom++; // Prefer mulipliers away from integer boundaries
+	tune_print(&tune);
 
-		if(fom > best_fom) // Best match so far
-		{
-			best_fom = fom;
-			best_divider = divider;
-		}
-	}
+	if (trace_file && trace_open(trace_file) < 0)
+		return 1;
 
-	if(divc) {
-		best_divider = divc;
-	}
-	else if(!solution_count & !best_divider) {
-		fprintf(stderr, "No tuning solution found. You can specify the divider manually by setting the --div parameter.\n");
-	}
+	if (output_file) {
+		int ret = render(&tune, audio_file, raw, ppm, resampler, processing, preemph, clip, crossfade, mpx_rate, cache_dir, composite, rds, deviation, ctl_path, output_file, output_format, samples);
 
-	printf("Carrier: %3.2f MHz, VCO: %4.1f MHz, Multiplier: %f, Divider: %d\n", carrier_freq/1e6, (float)carrier_freq * best_divider / 1e6, carrier_freq * best_divider * xtal_freq_recip, best_divider);
+		trace_close();
+		return ret;
+	}
 
-	return tx(carrier_freq, best_divider, audio_file, ppm, deviation, power, gpio);
+	return tx(&tune, audio_file, raw, ppm, resampler, processing, preemph, clip, crossfade, mpx_rate, drift_comp, low_latency, cache_dir, composite, rds, deviation, ctl_path, power, gpio, low_water, ring_ms, rt_prio, cpu, stats_interval, stats_file);
 }
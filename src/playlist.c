@@ -0,0 +1,448 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sndfile.h>
+#include "playlist.h"
+#include "resampler.h"
+
+// Output room for one decoded block after resampling, which is enough for
+// tracks at up to eight times lower rates than the playlist
+#define PLAYLIST_RESAMPLED (PLAYLIST_BLOCK * 8)
+
+static double now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int playlist_is_playlist(const char *name) {
+	const char *ext = strrchr(name, '.');
+	struct stat st;
+
+	if (ext && (strcasecmp(ext, ".m3u") == 0 || strcasecmp(ext, ".m3u8") == 0))
+		return 1;
+	return stat(name, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Look at a file and add it if libsndfile can play it. Takes over path.
+static int add_track(struct playlist *pl, char *path, int verbose)
+{
+	SF_INFO info;
+	SNDFILE *sf;
+	struct playlist_track *tracks;
+
+	memset(&info, 0, sizeof(info));
+	if (!(sf = sf_open(path, SFM_READ, &info))) {
+		if (verbose)
+			fprintf(stderr, "Warning: skipping %s: %s\n", path, sf_strerror(NULL));
+		free(path);
+		return 0;
+	}
+	sf_close(sf);
+
+	if (info.channels < 1 || info.channels > 2 || info.frames <= 0) {
+		if (verbose)
+			fprintf(stderr, "Warning: skipping %s: not one or two channels of audio\n", path);
+		free(path);
+		return 0;
+	}
+
+	if (!(tracks = realloc(pl->tracks, (pl->count + 1) * sizeof(struct playlist_track)))) {
+		free(path);
+		return -1;
+	}
+	pl->tracks = tracks;
+	tracks[pl->count].path = path;
+	tracks[pl->count].rate = info.samplerate;
+	tracks[pl->count].channels = info.channels;
+	tracks[pl->count].frames = info.frames;
+	pl->count++;
+
+	return 0;
+}
+
+// Relative entries are relative to the M3U file. #EXT lines are ignored.
+static int load_m3u(struct playlist *pl, const char *name)
+{
+	const char *slash = strrchr(name, '/');
+	int dir_len = slash ? slash - name + 1 : 0;
+	char line[4096];
+	FILE *f;
+
+	if (!(f = fopen(name, "r"))) {
+		fprintf(stderr, "Error: could not open playlist %s\n", name);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		size_t len = strcspn(line, "\r\n");
+		char *path;
+
+		line[len] = 0;
+		if (len == 0 || line[0] == '#')
+			continue;
+		if (strstr(line, "://")) {
+			fprintf(stderr, "Warning: skipping %s: URLs are not supported in playlists\n", line);
+			continue;
+		}
+
+		if (!(path = malloc(dir_len + len + 1)))
+			break;
+		if (line[0] == '/') {
+			strcpy(path, line);
+		} else {
+			memcpy(path, name, dir_len);
+			strcpy(path + dir_len, line);
+		}
+		if (add_track(pl, path, 1) < 0)
+			break;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+// Every file libsndfile can play, in name order
+static int load_dir(struct playlist *pl, const char *name)
+{
+	struct dirent **list;
+	int n = scandir(name, &list, NULL, alphasort);
+
+	if (n < 0) {
+		fprintf(stderr, "Error: could not read directory %s\n", name);
+		return -1;
+	}
+
+	for (int i = 0; i < n; i++) {
+		size_t len = strlen(name) + strlen(list[i]->d_name) + 2;
+		char *path = list[i]->d_name[0] != '.' ? malloc(len) : NULL;
+		struct stat st;
+
+		if (path) {
+			snprintf(path, len, "%s/%s", name, list[i]->d_name);
+			if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+				add_track(pl, path, 0);
+			else
+				free(path);
+		}
+		free(list[i]);
+	}
+	free(list);
+
+	return 0;
+}
+
+// Hand the frames collected in out to the reader, waiting for room
+static void flush(struct playlist *pl)
+{
+	sample_t *p = pl->out;
+
+	while (pl->out_len && !atomic_load(&pl->stop)) {
+		uint32_t written = ring_write(&pl->ring, p, pl->out_len);
+
+		p += written;
+		pl->out_len -= written;
+		if (pl->out_len)
+			usleep(1000);
+	}
+	pl->out_len = 0;
+}
+
+// Fade the previous track out under the frame, then hold it back if it is
+// among the last hold_max of its track
+static void emit(struct playlist *pl, const sample_t *frame, int hold_max)
+{
+	sample_t mixed[2];
+	int ch = pl->channels;
+
+	if (pl->tail_pos < pl->tail_len) {
+		// Equal power, as the two tracks are unrelated
+		float w = (pl->tail_pos + 0.5f) / pl->tail_len;
+		float out_gain = cosf(w * M_PI / 2), in_gain = sinf(w * M_PI / 2);
+		const sample_t *old = pl->tail + pl->tail_pos * ch;
+
+		for (int c = 0; c < ch; c++)
+			mixed[c] = sample_from_float(sample_to_float(old[c]) * out_gain + sample_to_float(frame[c]) * in_gain);
+		frame = mixed;
+		pl->tail_pos++;
+	}
+
+	if (pl->hold_len < hold_max) {
+		memcpy(pl->hold + pl->hold_len++ * ch, frame, ch * sizeof(sample_t));
+		return;
+	}
+
+	sample_t *dst = pl->out + pl->out_len;
+
+	if (hold_max) {
+		sample_t *slot = pl->hold + pl->hold_pos * ch;
+
+		memcpy(dst, slot, ch * sizeof(sample_t));
+		memcpy(slot, frame, ch * sizeof(sample_t));
+		if (++pl->hold_pos == hold_max)
+			pl->hold_pos = 0;
+	} else {
+		memcpy(dst, frame, ch * sizeof(sample_t));
+	}
+	pl->out_len += ch;
+}
+
+static int decode_track(struct playlist *pl, int index)
+{
+	struct playlist_track *t = &pl->tracks[index];
+	struct playlist_track *next = &pl->tracks[(index + 1) % pl->count];
+	struct resampler *r;
+	double start = now_ms();
+	int first = 1, ch = pl->channels;
+	SF_INFO info;
+	SNDFILE *sf;
+
+	memset(&info, 0, sizeof(info));
+	if (!(sf = sf_open(t->path, SFM_READ, &info)))
+		return -1;
+	if (info.samplerate != t->rate || info.channels != t->channels) {
+		sf_close(sf);
+		return -1;
+	}
+
+	// The track before left its resampler for this one if they share a
+	// rate, and it goes on from that track's last frames. One kept for a
+	// track that could not be played is of no use.
+	if (pl->resampler && pl->resampler_rate != t->rate) {
+		resampler_free(pl->resampler);
+		pl->resampler = NULL;
+	}
+	r = pl->resampler;
+	pl->resampler = NULL;
+	if (t->rate != pl->rate && !r && !(r = resampler_new(ch, t->rate, pl->rate, (double)pl->rate / t->rate))) {
+		sf_close(sf);
+		return -1;
+	}
+
+	pl->tracks_started++;
+
+	// Never fade over more than half of either track
+	int hold_max = pl->crossfade;
+	if (hold_max > t->frames / 2)
+		hold_max = t->frames / 2;
+	if (hold_max > next->frames / 2)
+		hold_max = next->frames / 2;
+	pl->hold_len = 0;
+	pl->hold_pos = 0;
+
+	int block = r ? resampler_max_input(r, PLAYLIST_RESAMPLED) : PLAYLIST_BLOCK;
+	if (block > PLAYLIST_BLOCK)
+		block = PLAYLIST_BLOCK;
+
+	while (!atomic_load(&pl->stop)) {
+#ifdef FIXED_POINT
+		sf_count_t n = sf_readf_short(sf, pl->decoded, block);
+#else
+		sf_count_t n = sf_readf_float(sf, pl->decoded, block);
+#endif
+		const sample_t *frames = pl->decoded;
+
+		if (n <= 0)
+			break;
+
+		// Mono tracks in a stereo playlist, from the back so it can be
+		// done in place
+		if (t->channels < ch) {
+			for (sf_count_t i = n - 1; i >= 0; i--)
+				pl->decoded[2 * i] = pl->decoded[2 * i + 1] = pl->decoded[i];
+		}
+		if (r) {
+			n = resampler_process(r, pl->decoded, n, pl->resampled, PLAYLIST_RESAMPLED);
+			frames = pl->resampled;
+		}
+
+		for (sf_count_t i = 0; i < n; i++)
+			emit(pl, frames + i * ch, hold_max);
+
+		if (first) {
+			double ms = now_ms() - start;
+
+			if (ms > pl->max_open_ms)
+				pl->max_open_ms = ms;
+			first = 0;
+		}
+		flush(pl);
+	}
+
+	sf_close(sf);
+
+	// Unless the next track goes through the same resampler, the frames
+	// still in its filter are pushed out with silence, so none are lost
+	if (r && next->rate != t->rate) {
+		memset(pl->decoded, 0, RESAMPLER_TAPS / 2 * ch * sizeof(sample_t));
+		int n = resampler_process(r, pl->decoded, RESAMPLER_TAPS / 2, pl->resampled, PLAYLIST_RESAMPLED);
+
+		for (int i = 0; i < n; i++)
+			emit(pl, pl->resampled + i * ch, hold_max);
+		flush(pl);
+		resampler_free(r);
+		r = NULL;
+	}
+	pl->resampler = r;
+	pl->resampler_rate = t->rate;
+
+	// What was held back fades out under the start of the next track
+	for (int i = 0; i < pl->hold_len; i++)
+		memcpy(pl->tail + i * ch, pl->hold + (pl->hold_len < hold_max ? i : (pl->hold_pos + i) % hold_max) * ch,
+			ch * sizeof(sample_t));
+	pl->tail_len = pl->hold_len;
+	pl->tail_pos = 0;
+
+	return 0;
+}
+
+static void *decode_thread(void *arg)
+{
+	struct playlist *pl = arg;
+	int index = 0, failures = 0;
+
+	while (!atomic_load(&pl->stop)) {
+		if (decode_track(pl, index) < 0) {
+			fprintf(stderr, "Warning: could not play %s, skipping\n", pl->tracks[index].path);
+			pl->tracks_failed++;
+			if (++failures == pl->count) {
+				atomic_store(&pl->failed, 1);
+				break;
+			}
+		} else {
+			failures = 0;
+		}
+		index = (index + 1) % pl->count;
+	}
+
+	return NULL;
+}
+
+int playlist_open(struct playlist *pl, char *name, float crossfade) {
+	struct stat st;
+	uint32_t ring_size = 1;
+
+	memset(pl, 0, sizeof(struct playlist));
+
+	if ((stat(name, &st) == 0 && S_ISDIR(st.st_mode) ? load_dir(pl, name) : load_m3u(pl, name)) < 0)
+		return -1;
+	if (pl->count == 0) {
+		fprintf(stderr, "Error: no playable files in %s\n", name);
+		return -1;
+	}
+
+	// The first track sets the rate, any stereo track makes it stereo
+	pl->rate = pl->tracks[0].rate;
+	pl->channels = 1;
+	for (int i = 0; i < pl->count; i++) {
+		if (pl->tracks[i].channels == 2)
+			pl->channels = 2;
+		pl->tracks[i].frames = (double)pl->tracks[i].frames * pl->rate / pl->tracks[i].rate;
+	}
+	pl->crossfade = crossfade * pl->rate;
+
+	while (ring_size < (uint32_t)(pl->rate * pl->channels * PLAYLIST_PREFETCH))
+		ring_size <<= 1;
+
+	pl->decoded = malloc(PLAYLIST_BLOCK * 2 * sizeof(sample_t));
+	pl->resampled = malloc(PLAYLIST_RESAMPLED * 2 * sizeof(sample_t));
+	pl->out = malloc(PLAYLIST_RESAMPLED * 2 * sizeof(sample_t));
+	pl->hold = malloc((pl->crossfade + 1) * pl->channels * sizeof(sample_t));
+	pl->tail = malloc((pl->crossfade + 1) * pl->channels * sizeof(sample_t));
+	if (!pl->decoded || !pl->resampled || !pl->out || !pl->hold || !pl->tail || ring_init(&pl->ring, ring_size) < 0) {
+		fprintf(stderr, "Error: could not allocate the playlist buffers\n");
+		playlist_close(pl);
+		return -1;
+	}
+
+	if (pthread_create(&pl->thread, NULL, decode_thread, pl)) {
+		fprintf(stderr, "Error: could not start the playlist decoder\n");
+		playlist_close(pl);
+		return -1;
+	}
+	pl->running = 1;
+
+	// Start with the prefetch filled, so the first reads do not wait
+	while (ring_space(&pl->ring) > ring_size / 2 && !atomic_load(&pl->failed))
+		usleep(1000);
+	if (atomic_load(&pl->failed)) {
+		fprintf(stderr, "Error: none of the files in %s could be played\n", name);
+		playlist_close(pl);
+		return -1;
+	}
+
+	printf("Playlist %s: %d tracks, %d Hz, %d channels%s\n", name, pl->count, pl->rate, pl->channels,
+		pl->crossfade ? ", crossfaded" : ", gapless");
+
+	return 0;
+}
+
+// Blocks until frames frames have been decoded, which is immediate unless
+// the decoder has fallen behind
+int playlist_read(struct playlist *pl, sample_t *out, int frames) {
+	uint32_t want = frames * pl->channels;
+	int waited = 0;
+
+	while (want) {
+		sample_t *data;
+		uint32_t len = ring_peek(&pl->ring, &data);
+
+		if (!len) {
+			if (atomic_load(&pl->failed))
+				return -1;
+			if (!waited++)
+				pl->starved++;
+			usleep(1000);
+			continue;
+		}
+
+		if (len > want)
+			len = want;
+		memcpy(out, data, len * sizeof(sample_t));
+		ring_consume(&pl->ring, len);
+		out += len;
+		want -= len;
+	}
+
+	return frames;
+}
+
+void playlist_report(struct playlist *pl) {
+	printf("Playlist: %llu tracks started, %llu failed, slowest start %.1f ms, decoder fell behind %llu times\n",
+		(unsigned long long)pl->tracks_started, (unsigned long long)pl->tracks_failed, pl->max_open_ms,
+		(unsigned long long)pl->starved);
+}
+
+void playlist_close(struct playlist *pl) {
+	if (pl->running) {
+		atomic_store(&pl->stop, 1);
+		pthread_join(pl->thread, NULL);
+		pl->running = 0;
+	}
+	for (int i = 0; i < pl->count; i++)
+		free(pl->tracks[i].path);
+	free(pl->tracks);
+	ring_free(&pl->ring);
+	free(pl->decoded);
+	free(pl->resampled);
+	resampler_free(pl->resampler);
+	free(pl->out);
+	free(pl->hold);
+	free(pl->tail);
+	memset(pl, 0, sizeof(struct playlist));
+}
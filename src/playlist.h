@@ -0,0 +1,78 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "sample.h"
+#include "ring.h"
+
+// Frames decoded at a time
+#define PLAYLIST_BLOCK 4096
+// Decoded audio kept ready ahead of the reader, in seconds
+#define PLAYLIST_PREFETCH 2
+
+struct playlist_track {
+	char *path;
+	int rate;
+	int channels;
+	long frames;                    // at the playlist rate
+};
+
+// Tracks from an M3U file or a directory, played one after the other
+// and from the top again. A decoder thread opens and decodes each track
+// ahead of time into a ring, bringing it to the rate of the first track
+// and to stereo if any track is stereo, so the rest of the pipeline sees
+// one continuous stream. With a crossfade, the end of a track is held
+// back and mixed into the start of the next one.
+struct playlist {
+	struct playlist_track *tracks;
+	int count;
+	int rate;
+	int channels;
+	int crossfade;                  // frames
+
+	struct mpx_ring ring;
+	pthread_t thread;
+	int running;
+	_Atomic int stop;
+	_Atomic int failed;             // no track could be played
+
+	// Decoder state
+	sample_t *decoded;              // PLAYLIST_BLOCK frames
+	sample_t *resampled;
+	int resampled_frames;
+	struct resampler *resampler;    // kept for the next track if it has the same rate
+	int resampler_rate;             // its input rate
+	sample_t *out;                  // ready for the ring
+	int out_len;                    // samples
+	sample_t *hold;                 // end of the current track, held back
+	int hold_len;
+	int hold_pos;
+	sample_t *tail;                 // end of the previous track, fading out
+	int tail_len;
+	int tail_pos;
+
+	// Written by the decoder, read on close
+	uint64_t tracks_started;
+	uint64_t tracks_failed;
+	double max_open_ms;             // open and first block of a track
+
+	// Reader side
+	uint64_t starved;               // reads that had to wait for the decoder
+};
+
+extern int playlist_is_playlist(const char *name);
+extern int playlist_open(struct playlist *pl, char *name, float crossfade);
+extern int playlist_read(struct playlist *pl, sample_t *out, int frames);
+extern void playlist_report(struct playlist *pl);
+extern void playlist_close(struct playlist *pl);
+
+#endif
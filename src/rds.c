@@ -0,0 +1,393 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "rds.h"
+
+#define POLY 0x1B9
+#define POLY_DEG 10
+
+#define PS_LENGTH 8
+#define RT_LENGTH 64
+
+// Length of the shaped biphase symbol, in bits
+#define SYMBOL_SPAN 3
+
+// Overlapping symbols are summed with headroom in fixed point
+#ifdef FIXED_POINT
+typedef int32_t acc_t;
+#else
+typedef float acc_t;
+#endif
+
+struct rds_params {
+	uint16_t pi;
+	int ta;
+	int tp;
+	int pty;
+	int ct;
+	int stereo;
+	char ps[PS_LENGTH];
+	char rt[RT_LENGTH];
+	int rt_segments;                // 2A groups needed for the text
+	int ab;
+};
+
+// The setters may run on another thread (the control pipe) while groups
+// are being built. They write to pending under a spinlock, and the encoder
+// copies it over rds_params between groups if it can take the lock without
+// waiting, so a group never mixes old and new text.
+static struct rds_params rds_params;
+static struct rds_params pending = { 0x1234, 0, 0, 0, 1, 0, "PiFmAdv ", "", 0, 0 };
+static atomic_flag pending_lock = ATOMIC_FLAG_INIT;
+static atomic_int pending_dirty = 1;
+
+static const uint16_t offset_words[RDS_GROUP_LENGTH] = {
+	RDS_OFFSET_A, RDS_OFFSET_B, RDS_OFFSET_C, RDS_OFFSET_D
+};
+
+// The bit clock is locked to the 57 kHz subcarrier (48 cycles per bit), so
+// the bit boundaries fall on the same fractional sample positions every
+// cycle_bits bits: 19 bits in 3072 samples at 192 kHz, one bit in 192 at
+// 228 kHz. There is one precomputed symbol waveform for each of these
+// positions, and the symbols are overlap-added into acc as bits come due.
+static struct {
+	int cycle_bits;
+	int cycle_samples;
+	int span;                       // samples per waveform
+	int *bit_start;                 // first sample of each bit within the cycle
+	sample_t *waveform;             // cycle_bits waveforms of span samples
+	acc_t *acc;
+	int acc_mask;
+	int acc_pos;
+
+	int bit;                        // next bit within the cycle
+	int sample;                     // position within the cycle
+	int prev_output;                // differential encoder state
+
+	uint8_t bits[RDS_GROUP_BITS];
+	int bit_pos;
+	int group_state;
+	int ps_state;
+	int rt_state;
+} gen;
+
+uint16_t rds_crc(uint16_t block) {
+	uint16_t crc = 0;
+
+	for (int j = 0; j < 16; j++) {
+		int bit = (block >> (15 - j)) & 1;
+		int msb = (crc >> (POLY_DEG - 1)) & 1;
+
+		crc <<= 1;
+		if (msb ^ bit)
+			crc ^= POLY;
+	}
+
+	return crc & ((1 << POLY_DEG) - 1);
+}
+
+// Group 4A, sent once at the start of every minute
+static int get_rds_ct_group(uint16_t *blocks)
+{
+	static int latest_minutes = -1;
+	time_t now = time(NULL);
+	struct tm utc, local;
+
+	gmtime_r(&now, &utc);
+	if (utc.tm_min == latest_minutes)
+		return 0;
+	latest_minutes = utc.tm_min;
+
+	int mjd = now / 86400 + 40587;
+
+	blocks[1] |= 0x4000 | (mjd >> 15);
+	blocks[2] = (mjd << 1) | (utc.tm_hour >> 4);
+	blocks[3] = (utc.tm_hour & 0xF) << 12 | utc.tm_min << 6;
+
+	localtime_r(&now, &local);
+	int offset = local.tm_gmtoff / (30 * 60);
+	blocks[3] |= abs(offset);
+	if (offset < 0)
+		blocks[3] |= 0x20;
+
+	return 1;
+}
+
+// Group scheduler: a whole PS (four 0A groups), then one 2A group of
+// radiotext, with CT taking precedence once a minute
+static void get_rds_group(uint16_t *blocks)
+{
+	if (atomic_load_explicit(&pending_dirty, memory_order_relaxed) &&
+	    !atomic_flag_test_and_set_explicit(&pending_lock, memory_order_acquire)) {
+		if (pending.ab != rds_params.ab)
+			gen.rt_state = 0;
+		rds_params = pending;
+		atomic_store_explicit(&pending_dirty, 0, memory_order_relaxed);
+		atomic_flag_clear_explicit(&pending_lock, memory_order_release);
+	}
+
+	blocks[0] = rds_params.pi;
+	blocks[1] = rds_params.tp << 10 | rds_params.pty << 5;
+	blocks[2] = 0;
+	blocks[3] = 0;
+
+	if (rds_params.ct && get_rds_ct_group(blocks))
+		return;
+
+	if (gen.group_state < 4 || rds_params.rt_segments == 0) {
+		int seg = gen.ps_state;
+
+		// Music, and the stereo flag goes into the last DI segment
+		blocks[1] |= rds_params.ta << 4 | 1 << 3 | (seg == 3 && rds_params.stereo) << 2 | seg;
+		blocks[2] = 0xE0CD;     // No AF
+		blocks[3] = rds_params.ps[2 * seg] << 8 | rds_params.ps[2 * seg + 1];
+		gen.ps_state = (seg + 1) % 4;
+	} else {
+		int seg = gen.rt_state;
+
+		blocks[1] |= 0x2000 | rds_params.ab << 4 | seg;
+		blocks[2] = rds_params.rt[4 * seg] << 8 | rds_params.rt[4 * seg + 1];
+		blocks[3] = rds_params.rt[4 * seg + 2] << 8 | rds_params.rt[4 * seg + 3];
+		gen.rt_state = (seg + 1) % rds_params.rt_segments;
+	}
+
+	gen.group_state = (gen.group_state + 1) % 5;
+}
+
+static void next_group()
+{
+	uint16_t blocks[RDS_GROUP_LENGTH];
+	uint8_t *bit = gen.bits;
+
+	get_rds_group(blocks);
+	for (int i = 0; i < RDS_GROUP_LENGTH; i++) {
+		uint16_t check = rds_crc(blocks[i]) ^ offset_words[i];
+
+		for (int j = 15; j >= 0; j--)
+			*bit++ = (blocks[i] >> j) & 1;
+		for (int j = POLY_DEG - 1; j >= 0; j--)
+			*bit++ = (check >> j) & 1;
+	}
+	gen.bit_pos = 0;
+}
+
+// Impulse response of the data-shaping filter H(f) = cos(pi f td / 4),
+// 0 <= f <= 2 / td
+static double shaping(double t, double td)
+{
+	double a = M_PI * td / 4;
+	double d = a * a - 4 * M_PI * M_PI * t * t;
+
+	if (fabs(d) < 1e-9 * a * a)
+		return 2 / td;
+
+	return cos(4 * M_PI * t / td) * 2 * a / d;
+}
+
+// Biphase symbol of a bit starting at t = 0, delayed by RDS_DELAY_BITS
+static double symbol(double t, double td)
+{
+	t -= RDS_DELAY_BITS * td;
+	return shaping(t - td / 4, td) - shaping(t - 3 * td / 4, td);
+}
+
+static int gcd(int a, int b)
+{
+	while (b) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+int rds_init(int rate) {
+	// Bits and samples per cycle, from rate / 1187.5 = 2 * rate / 2375
+	int g = gcd(2 * rate, 2375);
+	double samples_per_bit = rate / RDS_BITRATE;
+	double td = 1 / RDS_BITRATE;
+	int acc_size = 1;
+
+	rds_free();
+	memset(&gen, 0, sizeof(gen));
+	gen.cycle_bits = 2375 / g;
+	gen.cycle_samples = 2 * rate / g;
+	gen.span = ceil(SYMBOL_SPAN * samples_per_bit);
+	while (acc_size < gen.span)
+		acc_size <<= 1;
+	gen.acc_mask = acc_size - 1;
+
+	gen.bit_start = malloc(gen.cycle_bits * sizeof(int));
+	double *shape = malloc(gen.cycle_bits * gen.span * sizeof(double));
+	gen.waveform = malloc(gen.cycle_bits * gen.span * sizeof(sample_t));
+	gen.acc = calloc(acc_size, sizeof(acc_t));
+	if (!shape || !gen.bit_start || !gen.waveform || !gen.acc) {
+		free(shape);
+		rds_free();
+		return -1;
+	}
+
+	double peak = 0;
+	for (int k = 0; k < gen.cycle_bits; k++) {
+		// Integer sample at or after the nominal start of bit k
+		gen.bit_start[k] = ((long)k * gen.cycle_samples + gen.cycle_bits - 1) / gen.cycle_bits;
+		double frac = gen.bit_start[k] - k * samples_per_bit;
+
+		for (int i = 0; i < gen.span; i++) {
+			shape[k * gen.span + i] = symbol((i + frac) / rate, td);
+			if (fabs(shape[k * gen.span + i]) > peak)
+				peak = fabs(shape[k * gen.span + i]);
+		}
+	}
+	for (int i = 0; i < gen.cycle_bits * gen.span; i++)
+		gen.waveform[i] = sample_from_float(RDS_PEAK * shape[i] / peak);
+	free(shape);
+
+	gen.bit_pos = RDS_GROUP_BITS;
+
+	return 0;
+}
+
+void rds_free() {
+	free(gen.bit_start);
+	free(gen.waveform);
+	free(gen.acc);
+	gen.bit_start = NULL;
+	gen.waveform = NULL;
+	gen.acc = NULL;
+}
+
+// Shaped, differentially encoded RDS data at the baseband rate, before
+// modulation onto the 57 kHz subcarrier, peaking at about RDS_PEAK.
+void rds_get_samples(sample_t *buffer, int len) {
+	while (len) {
+		if (gen.bit < gen.cycle_bits && gen.sample == gen.bit_start[gen.bit]) {
+			if (gen.bit_pos == RDS_GROUP_BITS)
+				next_group();
+
+			gen.prev_output ^= gen.bits[gen.bit_pos++];
+
+			const sample_t *w = gen.waveform + gen.bit * gen.span;
+			int sign = gen.prev_output ? 1 : -1;
+
+			for (int i = 0; i < gen.span; i++)
+				gen.acc[(gen.acc_pos + i) & gen.acc_mask] += sign * w[i];
+			gen.bit++;
+		}
+
+		int next = (gen.bit < gen.cycle_bits) ? gen.bit_start[gen.bit] : gen.cycle_samples;
+		int run = next - gen.sample;
+
+		if (run > len)
+			run = len;
+
+		for (int i = 0; i < run; i++) {
+#ifdef FIXED_POINT
+			buffer[i] = sat16(gen.acc[gen.acc_pos]);
+#else
+			buffer[i] = gen.acc[gen.acc_pos];
+#endif
+			gen.acc[gen.acc_pos] = 0;
+			gen.acc_pos = (gen.acc_pos + 1) & gen.acc_mask;
+		}
+
+		buffer += run;
+		len -= run;
+		gen.sample += run;
+		if (gen.sample == gen.cycle_samples) {
+			gen.sample = 0;
+			gen.bit = 0;
+		}
+	}
+}
+
+static void lock_pending()
+{
+	while (atomic_flag_test_and_set_explicit(&pending_lock, memory_order_acquire))
+		;
+}
+
+static void unlock_pending()
+{
+	atomic_store_explicit(&pending_dirty, 1, memory_order_relaxed);
+	atomic_flag_clear_explicit(&pending_lock, memory_order_release);
+}
+
+void set_rds_pi(uint16_t pi_code) {
+	lock_pending();
+	pending.pi = pi_code;
+	unlock_pending();
+}
+
+void set_rds_ps(char *ps) {
+	int len = strlen(ps);
+
+	lock_pending();
+	for (int i = 0; i < PS_LENGTH; i++)
+		pending.ps[i] = (i < len) ? ps[i] : ' ';
+	unlock_pending();
+}
+
+// Texts shorter than 64 characters end with a carriage return and only
+// the segments that hold them are sent
+void set_rds_rt(char *rt) {
+	int len = strlen(rt);
+
+	if (len > RT_LENGTH)
+		len = RT_LENGTH;
+
+	lock_pending();
+	for (int i = 0; i < RT_LENGTH; i++) {
+		if (i < len)
+			pending.rt[i] = rt[i];
+		else
+			pending.rt[i] = (i == len) ? '\r' : ' ';
+	}
+
+	pending.rt_segments = (len < RT_LENGTH) ? (len + 4) / 4 : RT_LENGTH / 4;
+	// Against the flag on air, so that several texts set between two
+	// groups still flip it once. The encoder only writes rds_params
+	// under the lock held here.
+	pending.ab = !rds_params.ab;
+	unlock_pending();
+}
+
+void set_rds_pty(int pty) {
+	lock_pending();
+	pending.pty = pty & 31;
+	unlock_pending();
+}
+
+void set_rds_ta(int ta) {
+	lock_pending();
+	pending.ta = ta ? 1 : 0;
+	unlock_pending();
+}
+
+void set_rds_tp(int tp) {
+	lock_pending();
+	pending.tp = tp ? 1 : 0;
+	unlock_pending();
+}
+
+void set_rds_ct(int ct) {
+	lock_pending();
+	pending.ct = ct ? 1 : 0;
+	unlock_pending();
+}
+
+void set_rds_stereo(int stereo) {
+	lock_pending();
+	pending.stereo = stereo ? 1 : 0;
+	unlock_pending();
+}
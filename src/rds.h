@@ -0,0 +1,53 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef RDS_H
+#define RDS_H
+
+#include <stdint.h>
+#include "sample.h"
+
+#define RDS_BITRATE 1187.5
+#define RDS_GROUP_LENGTH 4
+#define RDS_BLOCK_BITS 26
+#define RDS_GROUP_BITS (RDS_GROUP_LENGTH * RDS_BLOCK_BITS)
+
+// Offset words added to the checkword of blocks A, B, C and D
+#define RDS_OFFSET_A 0x0FC
+#define RDS_OFFSET_B 0x198
+#define RDS_OFFSET_C 0x168
+#define RDS_OFFSET_D 0x1B4
+
+// Offset of the RDS symbol timing: the shaped symbol of a bit extends one
+// bit period before its nominal start, so the output is delayed by one bit.
+#define RDS_DELAY_BITS 1
+
+// Peak of a single shaped symbol in the output of rds_get_samples().
+// Overlapping symbols add up to slightly more, so fixed point builds keep
+// half of the range as headroom.
+#ifdef FIXED_POINT
+#define RDS_PEAK 0.5f
+#else
+#define RDS_PEAK 1.0f
+#endif
+
+extern int rds_init(int rate);
+extern void rds_free();
+extern void rds_get_samples(sample_t *buffer, int len);
+
+extern void set_rds_pi(uint16_t pi_code);
+extern void set_rds_ps(char *ps);
+extern void set_rds_rt(char *rt);
+extern void set_rds_pty(int pty);
+extern void set_rds_ta(int ta);
+extern void set_rds_tp(int tp);
+extern void set_rds_ct(int ct);
+extern void set_rds_stereo(int stereo);
+
+extern uint16_t rds_crc(uint16_t block);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include "refill_sched.h"
+#include "trace.h"
+
+// Never sleep longer than this, so shutdown requests are noticed
+#define SCHED_MAX_SLEEP_NS              100000000L
+
+// Rate measurements over shorter intervals than this are too noisy to use
+#define SCHED_MIN_INTERVAL              0.001
+
+static double ts_diff(struct timespec *a, struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+void sched_init(struct refill_sched *sched, double rate, uint32_t ring_size, float low_water_ms) {
+	sched->ring_size = ring_size;
+	sched->rate = rate;
+	sched->low_water = low_water_ms * rate / 1000;
+	if (sched->low_water >= ring_size)
+		sched->low_water = ring_size / 2;
+
+	sched->wakeups = 0;
+	sched->min_headroom = ring_size;
+	sched->headroom_sum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &sched->wake_time);
+	sched->start_time = sched->wake_time;
+}
+
+// Called right after the DMA position has been read, with the number of
+// samples the DMA consumed since the previous readback
+void sched_wake(struct refill_sched *sched, uint32_t consumed) {
+	struct timespec now;
+	uint32_t headroom = sched->ring_size - consumed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	double interval = ts_diff(&now, &sched->wake_time);
+	if (interval >= SCHED_MIN_INTERVAL && consumed) {
+		// Smooth out readback jitter, the real rate only drifts slowly
+		sched->rate += 0.1 * (consumed / interval - sched->rate);
+	}
+	sched->wake_time = now;
+
+	sched->wakeups++;
+	sched->headroom_sum += headroom;
+	if (headroom < sched->min_headroom)
+		sched->min_headroom = headroom;
+}
+
+// Sleep until the ring, holding headroom samples at the last wakeup, is
+// predicted to be down to the low-water mark
+void sched_sleep(struct refill_sched *sched, uint32_t headroom) {
+	struct timespec deadline = sched->wake_time;
+	long sleep_ns = 0;
+
+	if (headroom > sched->low_water)
+		sleep_ns = (headroom - sched->low_water) / sched->rate * 1e9;
+	if (sleep_ns > SCHED_MAX_SLEEP_NS)
+		sleep_ns = SCHED_MAX_SLEEP_NS;
+
+	deadline.tv_nsec += sleep_ns;
+	while (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_nsec -= 1000000000L;
+		deadline.tv_sec++;
+	}
+
+	TRACE_BEGIN(t_sleep);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+	TRACE_END(t_sleep, TRACE_SLEEP, (int64_t)(trace_now() - deadline.tv_sec * 1000000000ULL - deadline.tv_nsec) / 1000);
+}
+
+void sched_report(struct refill_sched *sched) {
+	struct timespec now;
+
+	if (!sched->wakeups)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	printf("Refill: %llu wakeups (%.1f/s), headroom min %.1f ms, avg %.1f ms, low-water %.1f ms, DMA rate %.1f Hz\n",
+		(unsigned long long)sched->wakeups, sched->wakeups / ts_diff(&now, &sched->start_time),
+		sched->min_headroom * 1000.0 / sched->rate,
+		sched->headroom_sum / sched->wakeups * 1000.0 / sched->rate,
+		sched->low_water * 1000.0 / sched->rate, sched->rate);
+}
@@ -0,0 +1,34 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef REFILL_SCHED_H
+#define REFILL_SCHED_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Deadline scheduler for the DMA ring refill. The DMA consumption rate is
+// measured from successive position readbacks, and the refill loop sleeps
+// until the ring is predicted to drain down to the low-water mark.
+struct refill_sched {
+	uint32_t ring_size;
+	uint32_t low_water;             // samples of headroom left when we wake up
+	double rate;                    // measured DMA consumption, samples/s
+	struct timespec wake_time;      // when the DMA position was last read
+	struct timespec start_time;
+
+	uint64_t wakeups;
+	uint32_t min_headroom;
+	double headroom_sum;
+};
+
+extern void sched_init(struct refill_sched *sched, double rate, uint32_t ring_size, float low_water_ms);
+extern void sched_wake(struct refill_sched *sched, uint32_t consumed);
+extern void sched_sleep(struct refill_sched *sched, uint32_t headroom);
+extern void sched_report(struct refill_sched *sched);
+
+#endif
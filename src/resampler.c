@@ -0,0 +1,267 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "resampler.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define PHASE_BITS 7 // log2(RESAMPLER_PHASES)
+#define HIST_LEN (RESAMPLER_TAPS - 1)
+
+// Highest audio frequency we care to keep. Everything from the stopband edge
+// (about 6 kHz higher with 32 taps) up is suppressed, which keeps the 19 kHz
+// pilot clean for 44.1 and 48 kHz input.
+#define AUDIO_CUTOFF 16000.0
+#define KAISER_BETA 7.0
+
+static double bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+
+	return sum;
+}
+
+// Windowed sinc, fc in cycles per input sample, u in input samples
+double resampler_prototype(double u, double fc) {
+	double half = RESAMPLER_TAPS / 2.0;
+	double r = u / half;
+
+	if (r <= -1 || r >= 1)
+		return 0;
+
+	double x = 2 * fc * u;
+	double sinc = (x == 0) ? 1 : sin(M_PI * x) / (M_PI * x);
+
+	return 2 * fc * sinc * bessel_i0(KAISER_BETA * sqrt(1 - r * r)) / bessel_i0(KAISER_BETA);
+}
+
+// Kernel: one output frame from RESAMPLER_TAPS input frames, with the two
+// neighbouring coefficient phases blended by w. Coefficients are stored
+// with every tap repeated per channel, so the dot product runs over
+// n = taps * channels samples and lanes are summed per channel at the end.
+#ifdef FIXED_POINT
+// Q15 samples and taps into 32 bit accumulators. The taps of a phase add up
+// to well under 2 in absolute value, so a sum of products cannot overflow.
+static inline void dot_interp(const int16_t *x, const int16_t *c0, const int16_t *c1, int n, int32_t w, int channels, int16_t *out)
+{
+	int32_t s0[4], s1[4];
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	int32x4_t a0 = vdupq_n_s32(0), a1 = vdupq_n_s32(0);
+
+	for (int i = 0; i < n; i += 4) {
+		int16x4_t v = vld1_s16(x + i);
+		a0 = vmlal_s16(a0, v, vld1_s16(c0 + i));
+		a1 = vmlal_s16(a1, v, vld1_s16(c1 + i));
+	}
+	vst1q_s32(s0, a0);
+	vst1q_s32(s1, a1);
+#else
+	int32_t a0[4] = { 0 }, a1[4] = { 0 };
+
+	for (int i = 0; i < n; i += 4) {
+		for (int j = 0; j < 4; j++) {
+			a0[j] += x[i + j] * c0[i + j];
+			a1[j] += x[i + j] * c1[i + j];
+		}
+	}
+	for (int j = 0; j < 4; j++) {
+		s0[j] = a0[j];
+		s1[j] = a1[j];
+	}
+#endif
+
+	for (int c = 0; c < channels; c++) {
+		int32_t y0, y1;
+
+		if (channels == 1) {
+			y0 = (s0[0] + s0[1]) + (s0[2] + s0[3]);
+			y1 = (s1[0] + s1[1]) + (s1[2] + s1[3]);
+		} else {
+			y0 = s0[c] + s0[c + 2];
+			y1 = s1[c] + s1[c + 2];
+		}
+		// Q30 sums, blended with a Q15 weight
+		int32_t y = y0 + (int32_t)(((int64_t)(y1 - y0) * w) >> 15);
+		out[c] = sat16((y + (1 << 14)) >> 15);
+	}
+}
+#else
+static inline void dot_interp(const float *x, const float *c0, const float *c1, int n, float w, int channels, float *out)
+{
+	float s[4];
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	float32x4_t a0 = vdupq_n_f32(0), a1 = vdupq_n_f32(0);
+
+	for (int i = 0; i < n; i += 4) {
+		float32x4_t v = vld1q_f32(x + i);
+		a0 = vmlaq_f32(a0, v, vld1q_f32(c0 + i));
+		a1 = vmlaq_f32(a1, v, vld1q_f32(c1 + i));
+	}
+	vst1q_f32(s, vmlaq_n_f32(a0, vsubq_f32(a1, a0), w));
+#elif defined(__SSE__)
+	__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+
+	for (int i = 0; i < n; i += 4) {
+		__m128 v = _mm_loadu_ps(x + i);
+		a0 = _mm_add_ps(a0, _mm_mul_ps(v, _mm_load_ps(c0 + i)));
+		a1 = _mm_add_ps(a1, _mm_mul_ps(v, _mm_load_ps(c1 + i)));
+	}
+	_mm_storeu_ps(s, _mm_add_ps(a0, _mm_mul_ps(_mm_sub_ps(a1, a0), _mm_set1_ps(w))));
+#else
+	float a0[4] = { 0 }, a1[4] = { 0 };
+
+	for (int i = 0; i < n; i += 4) {
+		for (int j = 0; j < 4; j++) {
+			a0[j] += x[i + j] * c0[i + j];
+			a1[j] += x[i + j] * c1[i + j];
+		}
+	}
+	for (int j = 0; j < 4; j++)
+		s[j] = a0[j] + w * (a1[j] - a0[j]);
+#endif
+
+	if (channels == 1) {
+		out[0] = (s[0] + s[1]) + (s[2] + s[3]);
+	} else {
+		out[0] = s[0] + s[2];
+		out[1] = s[1] + s[3];
+	}
+}
+#endif
+
+struct resampler *resampler_new(int channels, int in_rate, int out_rate, double ratio) {
+	return resampler_new_band(channels, in_rate, out_rate, ratio, AUDIO_CUTOFF);
+}
+
+// The same with the passband up to cutoff Hz, for signals wider than audio
+struct resampler *resampler_new_band(int channels, int in_rate, int out_rate, double ratio, double cutoff) {
+	struct resampler *r;
+	int row = RESAMPLER_TAPS * channels;
+
+	if (channels != 1 && channels != 2)
+		return NULL;
+	if (!(r = calloc(1, sizeof(struct resampler))))
+		return NULL;
+
+	r->channels = channels;
+	r->coefs = aligned_alloc(16, (RESAMPLER_PHASES + 1) * row * sizeof(sample_t));
+	r->hist = calloc(2 * HIST_LEN * channels, sizeof(sample_t));
+	if (!r->coefs || !r->hist) {
+		resampler_free(r);
+		return NULL;
+	}
+
+	// Band limit to the cutoff, or below the lower Nyquist frequency with
+	// room for the transition band
+	r->cutoff = cutoff;
+	if (r->cutoff > 0.43 * in_rate)
+		r->cutoff = 0.43 * in_rate;
+	if (r->cutoff > 0.43 * out_rate)
+		r->cutoff = 0.43 * out_rate;
+
+	double fc = r->cutoff / in_rate;
+
+	for (int p = 0; p <= RESAMPLER_PHASES; p++) {
+		double taps[RESAMPLER_TAPS], sum = 0;
+
+		for (int k = 0; k < RESAMPLER_TAPS; k++) {
+			taps[k] = resampler_prototype((double)p / RESAMPLER_PHASES + RESAMPLER_TAPS / 2 - 1 - k, fc);
+			sum += taps[k];
+		}
+		// Unity DC gain for every phase, otherwise the phase steps would
+		// show up as a small amplitude ripple
+		for (int k = 0; k < RESAMPLER_TAPS; k++) {
+			for (int c = 0; c < channels; c++)
+				r->coefs[p * row + k * channels + c] = sample_from_float(taps[k] / sum);
+		}
+	}
+
+	r->pos = -((int64_t)(RESAMPLER_TAPS / 2) << 32);
+	resampler_set_ratio(r, ratio);
+
+	return r;
+}
+
+// ratio is output frames per input frame
+void resampler_set_ratio(struct resampler *r, double ratio) {
+	r->step = 4294967296.0 / ratio;
+}
+
+// Largest input block guaranteed to produce no more than out_frames
+int resampler_max_input(struct resampler *r, int out_frames) {
+	return (double)out_frames * r->step / 4294967296.0 - 2;
+}
+
+int resampler_process(struct resampler *r, const sample_t *in, int in_frames, sample_t *out, int out_frames) {
+	int channels = r->channels;
+	int row = RESAMPLER_TAPS * channels;
+	int stitch = in_frames < HIST_LEN ? in_frames : HIST_LEN;
+	int produced = 0;
+
+	// Only the frames straddling the block boundary are copied, everything
+	// else is read straight from the caller's buffer
+	memcpy(r->hist + HIST_LEN * channels, in, stitch * channels * sizeof(sample_t));
+
+	for (;;) {
+		int64_t first = (r->pos >> 32) - RESAMPLER_TAPS / 2 + 1;
+
+		if (first + RESAMPLER_TAPS > in_frames)
+			break;
+
+		if (produced == out_frames) {
+			// Out of room: skip ahead rather than lose track of the input
+			r->pos += r->step;
+			continue;
+		}
+
+		const sample_t *x = first < 0 ? r->hist + (first + HIST_LEN) * channels : in + first * channels;
+		uint32_t frac = r->pos;
+		int phase = frac >> (32 - PHASE_BITS);
+#ifdef FIXED_POINT
+		int32_t w = (uint32_t)(frac << PHASE_BITS) >> 17;
+#else
+		float w = (uint32_t)(frac << PHASE_BITS) * (1.0f / 4294967296.0f);
+#endif
+
+		dot_interp(x, r->coefs + phase * row, r->coefs + (phase + 1) * row, row, w, channels, out + produced * channels);
+		produced++;
+		r->pos += r->step;
+	}
+
+	if (in_frames >= HIST_LEN) {
+		memcpy(r->hist, in + (in_frames - HIST_LEN) * channels, HIST_LEN * channels * sizeof(sample_t));
+	} else {
+		memmove(r->hist, r->hist + in_frames * channels, (HIST_LEN - in_frames) * channels * sizeof(sample_t));
+		memcpy(r->hist + (HIST_LEN - in_frames) * channels, in, in_frames * channels * sizeof(sample_t));
+	}
+	r->pos -= (int64_t)in_frames << 32;
+
+	return produced;
+}
+
+void resampler_free(struct resampler *r) {
+	if (r == NULL)
+		return;
+
+	free(r->coefs);
+	free(r->hist);
+	free(r);
+}
@@ -0,0 +1,38 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+#include "sample.h"
+
+#define RESAMPLER_TAPS 32
+#define RESAMPLER_PHASES 128
+
+// Polyphase FIR resampler with linear interpolation between adjacent
+// phases, so any ratio (including ppm corrections) can be followed.
+// Interleaved mono or stereo input; output is interleaved the same way.
+struct resampler {
+	int channels;
+	float cutoff;
+	uint64_t step;                  // input frames per output frame, 32.32 fixed point
+	int64_t pos;                    // next output position relative to the current block, 32.32
+	sample_t *coefs;                // (RESAMPLER_PHASES + 1) rows of RESAMPLER_TAPS * channels
+	sample_t *hist;                    // last RESAMPLER_TAPS - 1 input frames, followed by the
+	                                // first RESAMPLER_TAPS - 1 frames of the current block
+};
+
+extern struct resampler *resampler_new(int channels, int in_rate, int out_rate, double ratio);
+extern struct resampler *resampler_new_band(int channels, int in_rate, int out_rate, double ratio, double cutoff);
+extern void resampler_set_ratio(struct resampler *r, double ratio);
+extern int resampler_max_input(struct resampler *r, int out_frames);
+extern int resampler_process(struct resampler *r, const sample_t *in, int in_frames, sample_t *out, int out_frames);
+extern void resampler_free(struct resampler *r);
+extern double resampler_prototype(double u, double fc);
+
+#endif
@@ -0,0 +1,79 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+
+int ring_init(struct mpx_ring *ring, uint32_t size) {
+	if (size & (size - 1))
+		return -1;
+	if (!(ring->buf = malloc(size * sizeof(sample_t))))
+		return -1;
+
+	ring->size = size;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+
+	return 0;
+}
+
+void ring_free(struct mpx_ring *ring) {
+	free(ring->buf);
+	ring->buf = NULL;
+}
+
+uint32_t ring_fill(struct mpx_ring *ring) {
+	return atomic_load_explicit(&ring->head, memory_order_acquire) -
+		atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+uint32_t ring_space(struct mpx_ring *ring) {
+	return ring->size - ring_fill(ring);
+}
+
+// Producer side: copy in as much of data as fits, returns the count written
+uint32_t ring_write(struct mpx_ring *ring, const sample_t *data, uint32_t len) {
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	uint32_t space = ring->size - (head - tail);
+	uint32_t pos = head & (ring->size - 1);
+
+	if (len > space)
+		len = space;
+
+	uint32_t first = ring->size - pos;
+	if (first > len)
+		first = len;
+	memcpy(ring->buf + pos, data, first * sizeof(sample_t));
+	memcpy(ring->buf, data + first, (len - first) * sizeof(sample_t));
+
+	atomic_store_explicit(&ring->head, head + len, memory_order_release);
+
+	return len;
+}
+
+// Consumer side: point data at the longest contiguous run of readable
+// samples and return its length. Call ring_consume() when done with them.
+uint32_t ring_peek(struct mpx_ring *ring, sample_t **data) {
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	uint32_t pos = tail & (ring->size - 1);
+	uint32_t len = head - tail;
+
+	if (len > ring->size - pos)
+		len = ring->size - pos;
+	*data = ring->buf + pos;
+
+	return len;
+}
+
+void ring_consume(struct mpx_ring *ring, uint32_t len) {
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+}
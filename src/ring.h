@@ -0,0 +1,33 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "sample.h"
+
+// Lock-free single-producer/single-consumer ring of baseband samples.
+// head is only written by the producer and tail only by the consumer;
+// both count samples since creation and wrap naturally.
+struct mpx_ring {
+	sample_t *buf;
+	uint32_t size;                  // power of two
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+};
+
+extern int ring_init(struct mpx_ring *ring, uint32_t size);
+extern void ring_free(struct mpx_ring *ring);
+extern uint32_t ring_fill(struct mpx_ring *ring);
+extern uint32_t ring_space(struct mpx_ring *ring);
+extern uint32_t ring_write(struct mpx_ring *ring, const sample_t *data, uint32_t len);
+extern uint32_t ring_peek(struct mpx_ring *ring, sample_t **data);
+extern void ring_consume(struct mpx_ring *ring, uint32_t len);
+
+#endif
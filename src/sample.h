@@ -0,0 +1,99 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Baseband sample format. The default build works in float. Building with
+// FIXED_POINT defined switches everything from the PCM decode to the
+// PLLA_FRAC word over to Q15 integers with saturating arithmetic, for
+// boards whose FPU makes the float path expensive (Pi 1, Zero).
+#ifdef FIXED_POINT
+
+typedef int16_t sample_t;
+typedef int32_t scale_t;
+
+#define SAMPLE_FORMAT "Q15 fixed point"
+
+static inline int16_t sat16(int32_t x)
+{
+	return x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : x;
+}
+
+// Q15 multiply, rounded
+static inline int32_t mul_q15(int32_t a, int32_t b)
+{
+	return (a * b + (1 << 14)) >> 15;
+}
+
+static inline sample_t sample_from_float(float x)
+{
+	return sat16(lrintf(x * 32768));
+}
+
+static inline float sample_to_float(sample_t x)
+{
+	return x * (1.0f / 32768);
+}
+
+static inline sample_t sample_from_s16(int16_t x)
+{
+	return x;
+}
+
+// PLLA_FRAC steps for a full scale sample
+static inline scale_t deviation_scale(float deviation, float steps_per_khz)
+{
+	return lrintf(deviation * steps_per_khz);
+}
+
+// The product needs more than 32 bits once the deviation exceeds 65536
+// steps, which is a single SMULL on ARM
+static inline uint32_t freq_word(uint32_t base, sample_t x, scale_t scale)
+{
+	return base + (int32_t)(((int64_t)x * scale) >> 15);
+}
+
+#else
+
+typedef float sample_t;
+typedef float scale_t;
+
+#define SAMPLE_FORMAT "float"
+
+static inline sample_t sample_from_float(float x)
+{
+	return x;
+}
+
+static inline float sample_to_float(sample_t x)
+{
+	return x;
+}
+
+static inline sample_t sample_from_s16(int16_t x)
+{
+	return x * (1.0f / 32768);
+}
+
+static inline scale_t deviation_scale(float deviation, float steps_per_khz)
+{
+	return deviation * steps_per_khz;
+}
+
+// PLLA_FRAC value for a baseband sample, scale in steps per full scale
+static inline uint32_t freq_word(uint32_t base, sample_t x, scale_t scale)
+{
+	return base + (int32_t)(x * scale);
+}
+
+#endif
+
+#endif
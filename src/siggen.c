@@ -0,0 +1,277 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "siggen.h"
+#include "pcm_map.h"
+
+#define FRAC_BITS (32 - SIGGEN_TABLE_BITS)
+
+static const char *kinds[] = { "sine", "multitone", "sweep", "white", "pink", "cal" };
+
+// Octave bands of the multitone, up to what FM carries
+static const double multitone[] = { 31.5, 63, 125, 250, 500, 1000, 2000, 4000, 8000, 12500 };
+
+// One entry past the end, so interpolation never wraps
+static float table[SIGGEN_TABLE_SIZE + 1];
+static int table_ready;
+
+static void table_init()
+{
+	if (table_ready)
+		return;
+	for (int i = 0; i <= SIGGEN_TABLE_SIZE; i++)
+		table[i] = sin(2 * M_PI * i / SIGGEN_TABLE_SIZE);
+	table_ready = 1;
+}
+
+static uint32_t phase_step(double freq, int rate)
+{
+	return lrint(freq / rate * 4294967296.0);
+}
+
+int siggen_is_spec(const char *name) {
+	return strncmp(name, "test:", 5) == 0;
+}
+
+const char *siggen_name(int kind) {
+	return kinds[kind];
+}
+
+// test:<kind>[,freq=Hz][,from=Hz][,to=Hz][,time=s][,level=dBFS], at the
+// rate and channels of --raw if given
+int siggen_open(struct siggen *g, const char *spec, char *raw) {
+	char buf[256], *save, *kind, *kv;
+	double level = NAN;
+
+	memset(g, 0, sizeof(struct siggen));
+	g->rate = SIGGEN_RATE;
+	g->channels = SIGGEN_CHANNELS;
+	if (raw) {
+		int format;
+
+		if (pcm_parse_raw(raw, &g->rate, &g->channels, &format) < 0 || g->channels > 2) {
+			fprintf(stderr, "Error: raw format has to be rate:channels:s16|float, with one or two channels\n");
+			return -1;
+		}
+	}
+
+	snprintf(buf, sizeof(buf), "%s", spec + 5);
+	if (!(kind = strtok_r(buf, ",", &save)))
+		kind = "";
+	for (g->kind = 0; g->kind <= SIGGEN_CAL && strcmp(kind, kinds[g->kind]); g->kind++)
+		;
+	if (g->kind > SIGGEN_CAL) {
+		fprintf(stderr, "Error: unknown test signal %s, has to be sine, multitone, sweep, white, pink or cal\n", kind);
+		return -1;
+	}
+
+	g->freq = g->kind == SIGGEN_SWEEP ? 20 : 1000;
+	g->to = fmin(20000, 0.45 * g->rate);
+	g->seconds = 10;
+	while ((kv = strtok_r(NULL, ",", &save))) {
+		if (sscanf(kv, "freq=%lf", &g->freq) != 1 && sscanf(kv, "from=%lf", &g->freq) != 1 &&
+			sscanf(kv, "to=%lf", &g->to) != 1 && sscanf(kv, "time=%lf", &g->seconds) != 1 &&
+			sscanf(kv, "level=%lf", &level) != 1) {
+			fprintf(stderr, "Error: unknown test signal setting %s\n", kv);
+			return -1;
+		}
+	}
+	if (g->kind == SIGGEN_CAL)
+		g->freq = 1000;
+	if (g->freq <= 0 || g->freq >= g->rate / 2 || g->to <= 0 || g->to >= g->rate / 2 || g->seconds <= 0 ||
+		level > 0) {
+		fprintf(stderr, "Error: test signal frequencies have to be below %d Hz and its level at most 0 dBFS\n",
+			g->rate / 2);
+		return -1;
+	}
+	if (isnan(level))
+		level = g->kind == SIGGEN_CAL ? 0 : SIGGEN_LEVEL_DB;
+	g->level = pow(10, level / 20);
+
+	table_init();
+	switch (g->kind) {
+	case SIGGEN_SINE:
+		g->tones = 1;
+		g->step[0] = phase_step(g->freq, g->rate);
+		g->amp[0] = g->level;
+		printf("Using test signal: sine at %.1f Hz", g->freq);
+		break;
+	case SIGGEN_MULTITONE:
+		// Schroeder phases keep the peaks of the sum down
+		for (size_t i = 0; i < sizeof(multitone) / sizeof(multitone[0]) && multitone[i] < 0.45 * g->rate; i++)
+			g->tones++;
+		for (int i = 0; i < g->tones; i++) {
+			g->step[i] = phase_step(multitone[i], g->rate);
+			g->phase[i] = (uint32_t)llrint(fmod(-0.5 * i * (i + 1) / g->tones, 1.0) * 4294967296.0);
+			g->amp[i] = g->level / g->tones;
+		}
+		printf("Using test signal: %d tones from %.1f to %.0f Hz", g->tones, multitone[0], multitone[g->tones - 1]);
+		break;
+	case SIGGEN_SWEEP:
+		g->sweep_len = lrint(g->seconds * g->rate);
+		g->sweep_growth = pow(g->to / g->freq, 1.0 / g->sweep_len);
+		g->sweep_step = g->freq / g->rate * 4294967296.0;
+		printf("Using test signal: logarithmic sweep from %.1f to %.1f Hz in %.1f s", g->freq, g->to, g->seconds);
+		break;
+	case SIGGEN_WHITE:
+	case SIGGEN_PINK:
+		printf("Using test signal: %s noise", kinds[g->kind]);
+		break;
+	case SIGGEN_CAL:
+		// Whole samples to the period where there are, exact and free of
+		// the table's interpolation error
+		if (g->rate % 1000 == 0 && g->rate / 1000 <= SIGGEN_PERIOD_MAX) {
+			g->period_len = g->rate / 1000;
+			for (int i = 0; i < g->period_len; i++)
+				g->period[i] = g->level * sin(2 * M_PI * i / g->period_len);
+		} else {
+			g->tones = 1;
+			g->step[0] = phase_step(1000, g->rate);
+			g->amp[0] = g->level;
+		}
+		printf("Using test signal: 1 kHz calibration tone");
+		break;
+	}
+	printf(" at %.1f dBFS peak, %d Hz, %d channels\n", level, g->rate, g->channels);
+
+	return 0;
+}
+
+// Adds amp times the sine at step per sample to out
+static void nco_add(float *out, int len, uint32_t *phase, uint32_t step, float amp)
+{
+	uint32_t start = *phase;
+
+	for (int i = 0; i < len; i++) {
+		uint32_t p = start + (uint32_t)i * step;
+		uint32_t idx = p >> FRAC_BITS;
+		float frac = (p & ((1 << FRAC_BITS) - 1)) * (1.0f / (1 << FRAC_BITS));
+
+		out[i] += amp * (table[idx] + frac * (table[idx + 1] - table[idx]));
+	}
+	*phase = start + (uint32_t)len * step;
+}
+
+// 32 bit integer hash with good avalanche, for noise that depends on
+// nothing but the sample number
+static inline uint32_t hash(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+// Uniform in [-1, 1)
+static inline float uniform(uint32_t x)
+{
+	return (int32_t)hash(x) * (1.0f / 2147483648.0f);
+}
+
+static void generate(struct siggen *g, float *out, int len)
+{
+	switch (g->kind) {
+	case SIGGEN_SWEEP: {
+		uint32_t p = g->phase[0];
+		double s = g->sweep_step;
+
+		// The step grows by the same factor every sample, which is the
+		// one recurrence here
+		for (int i = 0; i < len; i++) {
+			uint32_t idx = p >> FRAC_BITS;
+			float frac = (p & ((1 << FRAC_BITS) - 1)) * (1.0f / (1 << FRAC_BITS));
+
+			out[i] = g->level * (table[idx] + frac * (table[idx + 1] - table[idx]));
+			p += (uint32_t)s;
+			s *= g->sweep_growth;
+			if (++g->sweep_pos == g->sweep_len) {
+				g->sweep_pos = 0;
+				s = g->freq / g->rate * 4294967296.0;
+			}
+		}
+		g->phase[0] = p;
+		g->sweep_step = s;
+		break;
+	}
+	case SIGGEN_WHITE:
+		for (int i = 0; i < len; i++)
+			out[i] = g->level * uniform(2 * (g->counter + i));
+		g->counter += len;
+		break;
+	case SIGGEN_PINK: {
+		// Voss-McCartney: row k is drawn again every 2^(k+1) samples, so
+		// each octave down gets another row of the same power, plus a
+		// white row for the top octave. Summed again every block so float
+		// rounding does not build up.
+		float sum = 0, scale = g->level / (SIGGEN_PINK_ROWS + 1);
+
+		for (int k = 0; k < SIGGEN_PINK_ROWS; k++)
+			sum += g->rows[k];
+		for (int i = 0; i < len; i++) {
+			uint64_t n = ++g->counter;
+			int k = __builtin_ctzll(n);
+
+			if (k < SIGGEN_PINK_ROWS) {
+				float row = uniform(2 * n + 1);
+
+				sum += row - g->rows[k];
+				g->rows[k] = row;
+			}
+			out[i] = scale * (sum + uniform(2 * n));
+		}
+		break;
+	}
+	case SIGGEN_CAL:
+		if (g->period_len) {
+			for (int i = 0; i < len; i++) {
+				out[i] = g->period[g->period_pos];
+				if (++g->period_pos == g->period_len)
+					g->period_pos = 0;
+			}
+			break;
+		}
+		/* fall through */
+	default:
+		memset(out, 0, len * sizeof(float));
+		for (int t = 0; t < g->tones; t++)
+			nco_add(out, len, &g->phase[t], g->step[t], g->amp[t]);
+		break;
+	}
+}
+
+// frames interleaved frames of the signal, the same on every channel.
+// Never runs out.
+int siggen_read(struct siggen *g, sample_t *out, int frames) {
+	float block[SIGGEN_BLOCK];
+
+	for (int done = 0; done < frames; ) {
+		int len = frames - done < SIGGEN_BLOCK ? frames - done : SIGGEN_BLOCK;
+		sample_t *dst = out + done * g->channels;
+
+		generate(g, block, len);
+		if (g->channels == 2) {
+			for (int i = 0; i < len; i++)
+				dst[2 * i] = dst[2 * i + 1] = sample_from_float(block[i]);
+		} else {
+			for (int i = 0; i < len; i++)
+				dst[i] = sample_from_float(block[i]);
+		}
+		done += len;
+	}
+
+	return frames;
+}
+
+void siggen_close(struct siggen *g) {
+	memset(g, 0, sizeof(struct siggen));
+}
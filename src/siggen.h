@@ -0,0 +1,76 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef SIGGEN_H
+#define SIGGEN_H
+
+#include <stdint.h>
+#include "sample.h"
+
+// Test signals
+#define SIGGEN_SINE                     0
+#define SIGGEN_MULTITONE                1
+#define SIGGEN_SWEEP                    2       // logarithmic, repeated
+#define SIGGEN_WHITE                    3
+#define SIGGEN_PINK                     4
+#define SIGGEN_CAL                      5       // 1 kHz at full scale
+
+// Rate and channels without --raw, and the peak level without level=
+#define SIGGEN_RATE                     48000
+#define SIGGEN_CHANNELS                 2
+#define SIGGEN_LEVEL_DB                 -6.0
+
+// Sine table of 4096 steps with linear interpolation in between, which
+// keeps the error some 130 dB down
+#define SIGGEN_TABLE_BITS               12
+#define SIGGEN_TABLE_SIZE               (1 << SIGGEN_TABLE_BITS)
+
+#define SIGGEN_MAX_TONES                16
+#define SIGGEN_PINK_ROWS                16
+#define SIGGEN_BLOCK                    1024
+#define SIGGEN_PERIOD_MAX               1024    // samples, 1 ms up to 1024 kHz
+
+// Signal generator standing in for an input file: the same signal on
+// every channel, made a block at a time. Tones are NCOs, 32 bit phase
+// accumulators reading the sine table. Within a block, each sample's
+// phase comes from the block start, so the loops carry no dependency
+// from one sample to the next and vectorize. Noise is a hash of a sample
+// counter for the same reason.
+struct siggen {
+	int kind;
+	int rate;
+	int channels;
+	float level;                    // peak, full scale 1
+	double freq;                    // sine, and the start of a sweep
+	double to;                      // end of a sweep
+	double seconds;                 // length of a sweep
+
+	int tones;
+	uint32_t phase[SIGGEN_MAX_TONES];
+	uint32_t step[SIGGEN_MAX_TONES];
+	float amp[SIGGEN_MAX_TONES];
+
+	double sweep_step;              // phase step of the next sample
+	double sweep_growth;            // per sample
+	long sweep_len;
+	long sweep_pos;
+
+	uint64_t counter;               // noise, 64 bits so pink noise never takes ctz of 0
+	float rows[SIGGEN_PINK_ROWS];
+
+	float period[SIGGEN_PERIOD_MAX];        // one exact period of the calibration tone
+	int period_len;
+	int period_pos;
+};
+
+extern int siggen_is_spec(const char *name);
+extern int siggen_open(struct siggen *g, const char *spec, char *raw);
+extern int siggen_read(struct siggen *g, sample_t *out, int frames);
+extern const char *siggen_name(int kind);
+extern void siggen_close(struct siggen *g);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+
+void stats_init(struct tx_stats *stats, uint32_t ring_size) {
+	memset(stats, 0, sizeof(struct tx_stats));
+	stats->min_headroom = ring_size;
+	stats->min_batch = ring_size;
+}
+
+const float clip_hist_edges[CLIP_HIST_BINS - 1] = { 50, 70, 80, 90, 95, 100, 105 };
+
+// Writer side, only ever called from one thread
+static void seq_publish(_Atomic uint32_t *seq_ptr, void *shared, const void *stats, size_t size)
+{
+	uint32_t seq = atomic_load_explicit(seq_ptr, memory_order_relaxed);
+
+	atomic_store_explicit(seq_ptr, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(shared, stats, size);
+	atomic_store_explicit(seq_ptr, seq + 2, memory_order_release);
+}
+
+static void seq_read(_Atomic uint32_t *seq_ptr, const void *shared, void *stats, size_t size)
+{
+	uint32_t before, after;
+
+	do {
+		before = atomic_load_explicit(seq_ptr, memory_order_acquire);
+		memcpy(stats, shared, size);
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(seq_ptr, memory_order_relaxed);
+	} while ((before & 1) || before != after);
+}
+
+void stats_publish(struct stats_shared *shared, const struct tx_stats *stats) {
+	seq_publish(&shared->seq, &shared->stats, stats, sizeof(struct tx_stats));
+}
+
+void stats_read(struct stats_shared *shared, struct tx_stats *stats) {
+	seq_read(&shared->seq, &shared->stats, stats, sizeof(struct tx_stats));
+}
+
+void clip_stats_publish(struct clip_shared *shared, const struct clip_stats *stats) {
+	seq_publish(&shared->seq, &shared->stats, stats, sizeof(struct clip_stats));
+}
+
+void clip_stats_read(struct clip_shared *shared, struct clip_stats *stats) {
+	seq_read(&shared->seq, &shared->stats, stats, sizeof(struct clip_stats));
+}
+
+void drift_stats_publish(struct drift_shared *shared, const struct drift_stats *stats) {
+	seq_publish(&shared->seq, &shared->stats, stats, sizeof(struct drift_stats));
+}
+
+void drift_stats_read(struct drift_shared *shared, struct drift_stats *stats) {
+	seq_read(&shared->seq, &shared->stats, stats, sizeof(struct drift_stats));
+}
+
+void stats_print(const struct tx_stats *stats, double rate) {
+	printf("Stats: %llu underruns (%llu samples), %llu padded, headroom min %.1f ms, "
+		"batch %u/%llu/%u, refill avg %.1f us max %.1f us\n",
+		(unsigned long long)stats->underruns, (unsigned long long)stats->underrun_samples,
+		(unsigned long long)stats->starved, stats->min_headroom * 1000.0 / rate,
+		stats->refills ? stats->min_batch : 0,
+		(unsigned long long)(stats->refills ? stats->refill_samples / stats->refills : 0),
+		stats->max_batch,
+		stats->refills ? stats->busy_ns / 1e3 / stats->refills : 0, stats->max_busy_ns / 1e3);
+}
+
+void clip_stats_print(const struct clip_stats *stats) {
+	printf("Clipper: %llu clipped (%.3f%%), %llu overshoots (max %.2f%%), peak %.0f%%, 1 ms peaks",
+		(unsigned long long)stats->clipped, stats->samples ? 100.0 * stats->clipped / stats->samples : 0.0,
+		(unsigned long long)stats->overshoots, stats->max_overshoot * 100, stats->max_peak * 100);
+	for (int b = 0; b < CLIP_HIST_BINS; b++) {
+		if (b == 0)
+			printf(" <%.0f%% %llu", clip_hist_edges[0], (unsigned long long)stats->peaks[b]);
+		else
+			printf(", %.0f%% %llu", clip_hist_edges[b - 1], (unsigned long long)stats->peaks[b]);
+	}
+	printf("\n");
+}
+
+void net_stats_print(const struct net_stats *stats) {
+	printf("Network: %llu packets, %llu lost, %llu late, %llu reordered, %llu duplicate, "
+		"jitter %.1f ms, delay %.1f ms (target %.1f, max %.1f), %llu underruns, %llu frames concealed, %llu dropped",
+		(unsigned long long)stats->packets, (unsigned long long)stats->lost, (unsigned long long)stats->late,
+		(unsigned long long)stats->reordered, (unsigned long long)stats->duplicates,
+		stats->jitter_ms, stats->delay_ms, stats->target_ms, stats->max_delay_ms,
+		(unsigned long long)stats->underruns, (unsigned long long)stats->concealed, (unsigned long long)stats->dropped);
+	if (stats->restarts)
+		printf(", %llu restarts", (unsigned long long)stats->restarts);
+	printf("\n");
+}
+
+void drift_stats_print(const struct drift_stats *stats) {
+	if (!stats->settled) {
+		printf("Drift: settling, fill %.1f ms\n", stats->fill_ms);
+		return;
+	}
+	printf("Drift: input clock %+.1f ppm, correcting %+.1f ppm, fill %.1f ms (target %.1f, %.1f to %.1f), "
+		"static equivalent --ppm %.1f\n",
+		stats->ppm, stats->correction_ppm, stats->fill_ms, stats->target_ms,
+		stats->min_fill_ms, stats->max_fill_ms, stats->static_ppm);
+}
+
+void latency_stats_print(const struct latency_stats *stats) {
+	if (!stats->count)
+		return;
+	printf("Latency: capture to DMA slot %.1f ms min, %.1f median, %.1f p90, %.1f p99, %.1f p99.9, %.1f max "
+		"over %llu blocks\n", stats->min_ms, stats->p50_ms, stats->p90_ms, stats->p99_ms, stats->p999_ms,
+		stats->max_ms, (unsigned long long)stats->count);
+}
+
+// One JSON object, written to a temporary file and renamed over path so
+// readers never see it half written
+int stats_write(const char *path, const struct tx_stats *stats, const struct clip_stats *clip,
+	const struct net_stats *net, const struct drift_stats *drift, const struct latency_stats *latency,
+	double elapsed, double rate) {
+	char tmp[4096];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if (!(f = fopen(tmp, "w")))
+		return -1;
+
+	fprintf(f, "{\"elapsed_s\": %.3f, \"dma_rate_hz\": %.1f, \"dma_samples\": %llu, "
+		"\"underruns\": %llu, \"underrun_samples\": %llu, \"padded_samples\": %llu, "
+		"\"min_headroom_ms\": %.2f, \"refills\": %llu, \"min_batch\": %u, \"avg_batch\": %.1f, \"max_batch\": %u, "
+		"\"avg_refill_us\": %.2f, \"max_refill_us\": %.2f",
+		elapsed, rate, (unsigned long long)stats->dma_samples,
+		(unsigned long long)stats->underruns, (unsigned long long)stats->underrun_samples,
+		(unsigned long long)stats->starved,
+		stats->min_headroom * 1000.0 / rate, (unsigned long long)stats->refills,
+		stats->refills ? stats->min_batch : 0,
+		stats->refills ? (double)stats->refill_samples / stats->refills : 0.0,
+		stats->max_batch,
+		stats->refills ? stats->busy_ns / 1e3 / stats->refills : 0.0, stats->max_busy_ns / 1e3);
+
+	if (clip) {
+		fprintf(f, ", \"clip_samples\": %llu, \"clipped\": %llu, \"overshoots\": %llu, "
+			"\"max_overshoot_pct\": %.2f, \"max_peak_pct\": %.1f, \"peak_edges_pct\": [",
+			(unsigned long long)clip->samples, (unsigned long long)clip->clipped,
+			(unsigned long long)clip->overshoots, clip->max_overshoot * 100, clip->max_peak * 100);
+		for (int b = 0; b < CLIP_HIST_BINS - 1; b++)
+			fprintf(f, "%s%.0f", b ? ", " : "", clip_hist_edges[b]);
+		fprintf(f, "], \"peaks\": [");
+		for (int b = 0; b < CLIP_HIST_BINS; b++)
+			fprintf(f, "%s%llu", b ? ", " : "", (unsigned long long)clip->peaks[b]);
+		fprintf(f, "]");
+	}
+	if (net) {
+		fprintf(f, ", \"net_packets\": %llu, \"net_lost\": %llu, \"net_late\": %llu, \"net_reordered\": %llu, "
+			"\"net_duplicates\": %llu, \"net_underruns\": %llu, \"net_concealed\": %llu, \"net_dropped\": %llu, "
+			"\"net_restarts\": %llu, \"net_jitter_ms\": %.2f, \"net_target_ms\": %.1f, \"net_delay_ms\": %.1f, "
+			"\"net_max_delay_ms\": %.1f",
+			(unsigned long long)net->packets, (unsigned long long)net->lost, (unsigned long long)net->late,
+			(unsigned long long)net->reordered, (unsigned long long)net->duplicates,
+			(unsigned long long)net->underruns, (unsigned long long)net->concealed,
+			(unsigned long long)net->dropped, (unsigned long long)net->restarts,
+			net->jitter_ms, net->target_ms, net->delay_ms, net->max_delay_ms);
+	}
+	if (drift) {
+		fprintf(f, ", \"drift_settled\": %s, \"drift_ppm\": %.2f, \"drift_correction_ppm\": %.2f, "
+			"\"drift_static_ppm\": %.2f, \"drift_fill_ms\": %.2f, \"drift_target_ms\": %.2f, "
+			"\"drift_min_fill_ms\": %.2f, \"drift_max_fill_ms\": %.2f",
+			drift->settled ? "true" : "false", drift->ppm, drift->correction_ppm, drift->static_ppm,
+			drift->fill_ms, drift->target_ms, drift->min_fill_ms, drift->max_fill_ms);
+	}
+	if (latency && latency->count) {
+		fprintf(f, ", \"latency_blocks\": %llu, \"latency_dropped\": %llu, \"latency_min_ms\": %.2f, "
+			"\"latency_p50_ms\": %.2f, \"latency_p90_ms\": %.2f, \"latency_p99_ms\": %.2f, "
+			"\"latency_p999_ms\": %.2f, \"latency_max_ms\": %.2f",
+			(unsigned long long)latency->count, (unsigned long long)latency->dropped, latency->min_ms,
+			latency->p50_ms, latency->p90_ms, latency->p99_ms, latency->p999_ms, latency->max_ms);
+	}
+	fprintf(f, "}\n");
+
+	if (fclose(f) || rename(tmp, path))
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Refill loop telemetry. The refill thread keeps its own copy and
+// publishes it through a sequence lock once per iteration; readers on
+// other threads retry until they get a consistent snapshot.
+struct tx_stats {
+	uint64_t dma_samples;           // consumed by the DMA since the start
+	uint64_t position_ns;           // CLOCK_MONOTONIC_RAW when dma_samples was read back
+	uint64_t underruns;             // times the DMA ran past the written samples
+	uint64_t underrun_samples;      // stale samples it replayed
+	uint64_t starved;               // carrier padding inserted for a late DSP
+	uint32_t min_headroom;          // samples queued ahead of the DMA at wakeup
+	uint64_t refills;               // wakeups that wrote anything
+	uint64_t refill_samples;
+	uint32_t min_batch;
+	uint32_t max_batch;
+	uint64_t busy_ns;               // time spent refilling, wakeup to sleep
+	uint32_t max_busy_ns;
+};
+
+struct stats_shared {
+	_Atomic uint32_t seq;
+	struct tx_stats stats;
+};
+
+#define CLIP_HIST_BINS 8
+
+// Composite clipper telemetry, kept by the DSP thread and published the
+// same way. Deviations are fractions of the peak deviation.
+struct clip_stats {
+	uint64_t samples;
+	uint64_t clipped;               // touched by the soft clipper
+	uint64_t overshoots;            // over the limit again after the cleanup, hard clipped
+	float max_overshoot;
+	float max_peak;                 // before clipping
+	uint64_t peaks[CLIP_HIST_BINS]; // 1 ms windows by peak before clipping
+};
+
+struct clip_shared {
+	_Atomic uint32_t seq;
+	struct clip_stats stats;
+};
+
+// Lower edges of all but the first histogram bin, in percent
+extern const float clip_hist_edges[CLIP_HIST_BINS - 1];
+
+// Network input telemetry. Receiver and reader update it under the jitter
+// buffer lock, so readers take a copy under the same lock.
+struct net_stats {
+	uint64_t packets;               // datagrams, or reads from an HTTP stream
+	uint64_t lost;                  // RTP sequence numbers never seen
+	uint64_t late;                  // arrived after their frames were played
+	uint64_t reordered;
+	uint64_t duplicates;
+	uint64_t underruns;             // playout caught up with the newest frame
+	uint64_t concealed;             // frames made up for losses and underruns
+	uint64_t dropped;               // frames skipped to bring the delay down
+	uint64_t restarts;              // HTTP reconnects, RTP stream changes
+	float jitter_ms;                // RFC 3550 interarrival jitter
+	float target_ms;                // delay the buffer aims for
+	float delay_ms;                 // buffered at the last read
+	float max_delay_ms;
+};
+
+// Clock drift servo telemetry, kept by the DSP thread and published like
+// the clipper's. Drift is positive when the input clock runs fast against
+// the baseband.
+struct drift_stats {
+	uint64_t updates;
+	int settled;                    // target known, the servo is steering
+	float ppm;                      // estimated drift, what the integrator holds
+	float correction_ppm;           // applied at the last block
+	float static_ppm;               // --ppm that would take out the drift on its own
+	float fill_ms;                  // smoothed, input buffer and baseband ahead of the DMA
+	float target_ms;
+	float min_fill_ms;              // since settling
+	float max_fill_ms;
+};
+
+struct drift_shared {
+	_Atomic uint32_t seq;
+	struct drift_stats stats;
+};
+
+// Capture to DMA slot latency, percentiles over the whole run
+struct latency_stats {
+	uint64_t count;                 // blocks measured
+	uint64_t dropped;               // not measured, too many in flight
+	float min_ms;
+	float p50_ms;
+	float p90_ms;
+	float p99_ms;
+	float p999_ms;
+	float max_ms;
+};
+
+extern void stats_init(struct tx_stats *stats, uint32_t ring_size);
+extern void stats_publish(struct stats_shared *shared, const struct tx_stats *stats);
+extern void stats_read(struct stats_shared *shared, struct tx_stats *stats);
+extern void stats_print(const struct tx_stats *stats, double rate);
+extern void clip_stats_publish(struct clip_shared *shared, const struct clip_stats *stats);
+extern void clip_stats_read(struct clip_shared *shared, struct clip_stats *stats);
+extern void clip_stats_print(const struct clip_stats *stats);
+extern void net_stats_print(const struct net_stats *stats);
+extern void drift_stats_publish(struct drift_shared *shared, const struct drift_stats *stats);
+extern void drift_stats_read(struct drift_shared *shared, struct drift_stats *stats);
+extern void drift_stats_print(const struct drift_stats *stats);
+extern void latency_stats_print(const struct latency_stats *stats);
+extern int stats_write(const char *path, const struct tx_stats *stats, const struct clip_stats *clip,
+	const struct net_stats *net, const struct drift_stats *drift, const struct latency_stats *latency,
+	double elapsed, double rate);
+
+#endif
@@ -0,0 +1,209 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "trace.h"
+
+// How often the dumper empties the rings
+#define TRACE_DUMP_NS                   100000000
+
+// Events of one thread. Only that thread writes head and only the dumper
+// writes tail, as in struct mpx_ring; when the dumper falls behind, new
+// events are counted and dropped rather than waited for.
+struct trace_ring {
+	struct trace_event *events;
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+	_Atomic uint64_t dropped;
+	char name[24];
+	int named;                      // thread name written to the file
+};
+
+static const char *stage_names[TRACE_STAGES] = {
+	"read", "process", "resample", "rds", "mpx", "ring wait", "position", "refill", "pad", "sleep"
+};
+
+static const char *arg_names[TRACE_STAGES] = {
+	"frames", "frames", "samples", "samples", "samples", "samples", "consumed", "samples", "samples", "late_us"
+};
+
+int trace_enabled;
+
+static struct trace_ring rings[TRACE_THREADS];
+static _Atomic int ready[TRACE_THREADS];
+static _Atomic int thread_count;
+static _Atomic uint64_t unregistered;   // events from threads beyond TRACE_THREADS
+static _Thread_local struct trace_ring *self;
+static _Thread_local int self_tried;
+
+static FILE *out;
+static pthread_t dumper;
+static _Atomic int stop;
+static uint64_t origin;
+static uint64_t written;
+static int first_event;
+
+// Give the calling thread a ring of its own, named in the trace. Threads
+// that record without calling this get one the first time, named after
+// their slot.
+void trace_thread(const char *name) {
+	if (!trace_enabled || self_tried)
+		return;
+	self_tried = 1;
+
+	int slot = atomic_fetch_add(&thread_count, 1);
+
+	if (slot >= TRACE_THREADS)
+		return;
+
+	struct trace_ring *ring = &rings[slot];
+
+	if (!(ring->events = malloc(TRACE_RING_SIZE * sizeof(struct trace_event))))
+		return;
+	if (name)
+		snprintf(ring->name, sizeof(ring->name), "%s", name);
+	else
+		snprintf(ring->name, sizeof(ring->name), "thread %d", slot);
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->dropped, 0);
+	self = ring;
+	atomic_store_explicit(&ready[slot], 1, memory_order_release);
+}
+
+void trace_record(int stage, uint64_t start, int32_t arg) {
+	uint64_t end = trace_now();
+
+	if (!end)
+		return;
+	if (!self) {
+		trace_thread(NULL);
+		if (!self) {
+			atomic_fetch_add_explicit(&unregistered, 1, memory_order_relaxed);
+			return;
+		}
+	}
+
+	uint32_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&self->tail, memory_order_acquire);
+
+	if (head - tail >= TRACE_RING_SIZE) {
+		atomic_fetch_add_explicit(&self->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	struct trace_event *e = &self->events[head & (TRACE_RING_SIZE - 1)];
+
+	e->start = start;
+	e->duration = end - start;
+	e->stage = stage;
+	e->arg = arg;
+	atomic_store_explicit(&self->head, head + 1, memory_order_release);
+}
+
+// Chrome trace event format, which Perfetto and chrome://tracing open
+// directly: complete ("X") events in microseconds, one line each
+static void dump(int slot)
+{
+	struct trace_ring *ring = &rings[slot];
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (!ring->named) {
+		fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			first_event ? "" : ",\n", slot + 1, ring->name);
+		first_event = 0;
+		ring->named = 1;
+	}
+
+	for (; tail != head; tail++) {
+		struct trace_event *e = &ring->events[tail & (TRACE_RING_SIZE - 1)];
+
+		fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"%s\":%d}}",
+			stage_names[e->stage], slot + 1, (int64_t)(e->start - origin) / 1e3, e->duration / 1e3,
+			arg_names[e->stage], e->arg);
+		written++;
+	}
+
+	atomic_store_explicit(&ring->tail, tail, memory_order_release);
+}
+
+static void dump_all()
+{
+	for (int i = 0; i < TRACE_THREADS; i++) {
+		if (atomic_load_explicit(&ready[i], memory_order_acquire))
+			dump(i);
+	}
+	fflush(out);
+}
+
+static void *dumper_thread(void *arg)
+{
+	struct timespec ts = { 0, TRACE_DUMP_NS };
+
+	while (!atomic_load(&stop)) {
+		nanosleep(&ts, NULL);
+		dump_all();
+	}
+
+	return NULL;
+}
+
+// Start tracing into path. The calling thread is registered as "main".
+int trace_open(const char *path) {
+	if (!(out = fopen(path, "w"))) {
+		fprintf(stderr, "Error: could not open trace file %s\n", path);
+		return -1;
+	}
+
+	trace_enabled = 1;
+	origin = trace_now();
+	written = 0;
+	first_event = 1;
+	atomic_store(&stop, 0);
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	trace_thread("main");
+
+	if (pthread_create(&dumper, NULL, dumper_thread, NULL)) {
+		fprintf(stderr, "Error: could not start the trace dumper\n");
+		trace_enabled = 0;
+		fclose(out);
+		out = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+// Stop the dumper, write what is left and close the file. Threads still
+// recording lose their events from here on.
+void trace_close() {
+	uint64_t dropped = atomic_load(&unregistered);
+
+	if (!out)
+		return;
+
+	trace_enabled = 0;
+	atomic_store(&stop, 1);
+	pthread_join(dumper, NULL);
+	dump_all();
+	fprintf(out, "\n]}\n");
+	fclose(out);
+	out = NULL;
+
+	for (int i = 0; i < TRACE_THREADS; i++) {
+		if (!atomic_load(&ready[i]))
+			continue;
+		dropped += atomic_load(&rings[i].dropped);
+	}
+	printf("Trace: %llu events from %d threads, %llu dropped\n", (unsigned long long)written,
+		atomic_load(&thread_count) < TRACE_THREADS ? atomic_load(&thread_count) : TRACE_THREADS,
+		(unsigned long long)dropped);
+}
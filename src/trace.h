@@ -0,0 +1,70 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Pipeline stages, the event names in the trace
+#define TRACE_READ                      0 // input: file, mapped, network or playlist
+#define TRACE_PROCESS                   1 // --processing chain
+#define TRACE_RESAMPLE                  2
+#define TRACE_RDS                       3
+#define TRACE_MPX                       4 // multiplex and clipper
+#define TRACE_RING_WAIT                 5 // DSP thread waiting for room in the baseband ring
+#define TRACE_POSITION                  6 // DMA position readback
+#define TRACE_REFILL                    7 // baseband to PLLA_FRAC words into the DMA ring
+#define TRACE_PAD                       8 // carrier padding when the baseband ran late
+#define TRACE_SLEEP                     9 // refill sleep, the argument is the overshoot in us
+#define TRACE_STAGES                    10
+
+// Threads that can record, and events each can hold before the dumper
+// catches up
+#define TRACE_THREADS                   8
+#define TRACE_RING_SIZE                 (1 << 15)
+
+// One complete event: a stage, when it started and how long it took, and
+// a number that goes with it (frames, samples or microseconds)
+struct trace_event {
+	uint64_t start;                 // ns, CLOCK_MONOTONIC
+	uint32_t duration;              // ns
+	uint16_t stage;
+	int32_t arg;
+};
+
+extern int trace_enabled;
+
+extern int trace_open(const char *path);
+extern void trace_thread(const char *name);
+extern void trace_record(int stage, uint64_t start, int32_t arg);
+extern void trace_close();
+
+// 0 while tracing is off, so the end of the stage records nothing
+static inline uint64_t trace_now()
+{
+	struct timespec ts;
+
+	if (!trace_enabled)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Instrumentation points, compiled in with make TRACE=1. With tracing
+// compiled in but not enabled with --trace, a stage costs one load and a
+// branch; the argument is only worked out when the event is recorded.
+#ifdef TRACE
+#define TRACE_BEGIN(t)                  uint64_t t = trace_now()
+#define TRACE_END(t, stage, arg)        do { if (t) trace_record(stage, t, arg); } while (0)
+#else
+#define TRACE_BEGIN(t)                  do { } while (0)
+#define TRACE_END(t, stage, arg)        do { } while (0)
+#endif
+
+#endif
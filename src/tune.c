@@ -0,0 +1,98 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include "tune.h"
+#ifndef TUNE_GEN
+#include "tune_table.h"
+#endif
+
+// The multiplier for one divider, rounded to the nearest PLLA_FRAC step.
+// Returns -1 if the VCO is out of range or the deviation (kHz) would carry
+// into the integer part.
+int tune_divider(struct tune *t, uint32_t clock_base, uint32_t carrier, int deviation, int divider) {
+	uint64_t vco = (uint64_t)carrier * divider;
+	uint64_t m = ((vco << 20) + clock_base / 2) / clock_base;
+	uint32_t frac = m & 0xFFFFF;
+	uint64_t swing = (((uint64_t)deviation * 1000 + TUNE_GUARD_HZ) * divider << 20) / clock_base + 1;
+
+	t->clock_base = clock_base;
+	t->carrier = carrier;
+	t->divider = divider;
+	t->multiplier = m;
+	t->error = (double)((int64_t)(m * clock_base) - (int64_t)(vco << 20)) / ((uint64_t)divider << 20);
+	t->step_hz = (double)clock_base / ((uint64_t)divider << 20);
+	t->headroom = frac < 0xFFFFF - frac ? frac : 0xFFFFF - frac;
+
+	return vco >= TUNE_VCO_MIN && vco <= TUNE_VCO_MAX && t->headroom >= swing ? 0 : -1;
+}
+
+// The VCO is best kept near 1 GHz, where the PLL is known to lock well
+static int vco_class(const struct tune *t)
+{
+	uint64_t vco = (uint64_t)t->carrier * t->divider;
+
+	return (vco >= 900000000 && vco <= 1100000000) ? 0 : (vco >= 800000000 && vco <= 1200000000) ? 1 : 2;
+}
+
+// Every divider, preferring a VCO near 1 GHz, then the smallest error,
+// then the most headroom
+int tune_solve(struct tune *t, uint32_t clock_base, uint32_t carrier, int deviation) {
+	struct tune best, cand;
+	int found = 0;
+
+	for (int divider = TUNE_DIV_MIN; divider <= TUNE_DIV_MAX; divider++) {
+		if (tune_divider(&cand, clock_base, carrier, deviation, divider) < 0)
+			continue;
+
+		int cls = vco_class(&cand), best_cls = found ? vco_class(&best) : 3;
+		double err = cand.error < 0 ? -cand.error : cand.error;
+		double best_err = best.error < 0 ? -best.error : best.error;
+
+		if (!found || cls < best_cls || (cls == best_cls && (err < best_err ||
+				(err == best_err && cand.headroom > best.headroom)))) {
+			best = cand;
+			found = 1;
+		}
+	}
+
+	if (!found)
+		return -1;
+	*t = best;
+	return 0;
+}
+
+#ifndef TUNE_GEN
+// tune_solve() through the table tune_gen built: a channel from 76 to 108
+// MHz on a 10 kHz raster at the default deviation only takes working out
+// the multiplier for the divider stored. Anything else is solved directly.
+int tune_lookup(struct tune *t, uint32_t clock_base, uint32_t carrier, int deviation) {
+	if (carrier < TUNE_TABLE_MIN || carrier > TUNE_TABLE_MAX || (carrier - TUNE_TABLE_MIN) % TUNE_TABLE_STEP ||
+			deviation != TUNE_TABLE_DEVIATION)
+		return tune_solve(t, clock_base, carrier, deviation);
+
+	for (int c = 0; c < TUNE_TABLE_CLOCKS; c++) {
+		if (tune_table[c].clock_base != clock_base)
+			continue;
+
+		int divider = tune_table[c].divider[(carrier - TUNE_TABLE_MIN) / TUNE_TABLE_STEP];
+
+		if (!divider)
+			return -1;
+		return tune_divider(t, clock_base, carrier, deviation, divider);
+	}
+
+	return tune_solve(t, clock_base, carrier, deviation);
+}
+#endif
+
+void tune_print(const struct tune *t) {
+	printf("Carrier: %3.2f MHz (%+.3f Hz off), VCO: %4.1f MHz, Multiplier: %u + %u/2^20, Divider: %d, "
+		"deviation resolution %.3f Hz\n",
+		t->carrier / 1e6, t->error, (double)t->clock_base * t->multiplier / (1 << 20) / 1e6,
+		(unsigned)(t->multiplier >> 20), (unsigned)(t->multiplier & 0xFFFFF), t->divider, t->step_hz);
+}
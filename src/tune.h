@@ -0,0 +1,49 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdint.h>
+
+// GPCLK integer dividers and PLLA VCO range searched
+#define TUNE_DIV_MIN 2
+#define TUNE_DIV_MAX 49
+#define TUNE_VCO_MIN 600000000ULL
+#define TUNE_VCO_MAX 1400000000ULL
+
+// Kept between the deviation and the integer boundary of the multiplier
+#define TUNE_GUARD_HZ 10
+
+// Channels the solution table covers, solved at build time by tune_gen
+// for both oscillators and the default deviation (kHz)
+#define TUNE_TABLE_MIN 76000000
+#define TUNE_TABLE_MAX 108000000
+#define TUNE_TABLE_STEP 10000
+#define TUNE_TABLE_SIZE ((TUNE_TABLE_MAX - TUNE_TABLE_MIN) / TUNE_TABLE_STEP + 1)
+#define TUNE_TABLE_DEVIATION 75
+
+// carrier = clock_base * multiplier / 2^20 / divider, with the integer part
+// of the multiplier in PLLA_CTRL and the 20 fractional bits in PLLA_FRAC.
+// Everything is worked out in 64-bit integers from the requested carrier,
+// so the error is that of the PLL and not of the arithmetic.
+struct tune {
+	uint32_t clock_base;            // Hz
+	uint32_t carrier;               // requested, Hz
+	int divider;                    // GPCLK
+	uint64_t multiplier;            // PLLA_CTRL << 20 | PLLA_FRAC
+	double error;                   // achieved minus requested carrier, Hz
+	double step_hz;                 // carrier change per PLLA_FRAC step
+	uint32_t headroom;              // PLLA_FRAC steps to the nearest integer boundary
+};
+
+extern int tune_divider(struct tune *t, uint32_t clock_base, uint32_t carrier, int deviation, int divider);
+extern int tune_solve(struct tune *t, uint32_t clock_base, uint32_t carrier, int deviation);
+extern int tune_lookup(struct tune *t, uint32_t clock_base, uint32_t carrier, int deviation);
+extern void tune_print(const struct tune *t);
+
+#endif
@@ -0,0 +1,35 @@
+/*
+    PiFmAdv - Advanced FM transmitter for the Raspberry Pi
+    Copyright (C) 2017 Miegl
+
+    See https://github.com/Miegl/PiFmAdv
+*/
+
+#include <stdio.h>
+#include "tune.h"
+
+// Oscillators of the boards: 19.2 MHz up to the Pi 3, 54 MHz on the Pi 4
+static const uint32_t clocks[] = { 19200000, 54000000 };
+
+// Writes tune_table.h to stdout: the divider tune_solve() picks for every
+// channel of the table, 0 where there is none
+int main() {
+	int n = sizeof(clocks) / sizeof(clocks[0]);
+
+	printf("// Generated by tune_gen, do not edit\n\n");
+	printf("#define TUNE_TABLE_CLOCKS %d\n\n", n);
+	printf("static const struct {\n\tuint32_t clock_base;\n\tuint8_t divider[TUNE_TABLE_SIZE];\n} tune_table[TUNE_TABLE_CLOCKS] = {\n");
+	for (int c = 0; c < n; c++) {
+		printf("\t{ %u, {", clocks[c]);
+		for (int i = 0; i < TUNE_TABLE_SIZE; i++) {
+			struct tune t;
+			int divider = tune_solve(&t, clocks[c], TUNE_TABLE_MIN + i * TUNE_TABLE_STEP, TUNE_TABLE_DEVIATION) == 0 ? t.divider : 0;
+
+			printf("%s%d,", i % 20 ? " " : "\n\t\t", divider);
+		}
+		printf("\n\t} },\n");
+	}
+	printf("};\n");
+
+	return 0;
+}